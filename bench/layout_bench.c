@@ -0,0 +1,220 @@
+/**
+ * @file layout_bench.c
+ * @brief client_t/room_t 热冷字段拆分的微基准：在 64k 客户端规模下比较拆分前后的逐项开销。
+ *
+ * legacy_* 结构体按拆分前的字段顺序复制，三组循环在两种布局上完全相同，
+ * 差异只来自每次访问触及的缓存行数：
+ *   sweep  - 遍历活跃列表读取 is_alive / wsi / last_activity (超时扫描)
+ *   lookup - 按随机句柄校验 is_alive 与代数 (client_registry_get)
+ *   scan   - 在所有房间的参与者槽位中查找客户端 (原 room_registry_find_by_client 的扫描)
+ *
+ * 用法: layout_bench [客户端数量]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/client.h"
+#include "../include/room.h"
+#include "../include/utilities.h"
+
+#define BENCH_DEFAULT_CLIENTS 65536
+#define BENCH_ROUNDS 16
+#define BENCH_REPEAT 5
+
+/* 拆分前的 client_t 字段顺序 */
+typedef struct legacy_client_s {
+    id128_t id;
+    struct lws *wsi;
+    room_t *room;
+    client_state_t state;
+    client_encoding_t encoding;
+    client_deflate_t deflate;
+    uint32_t last_activity;
+    uint32_t connect_time;
+    uint64_t messages_sent;
+    uint64_t messages_received;
+    uint64_t frames_dropped;
+    client_send_queue_t sendq;
+    client_recv_buf_t recv;
+    bool ice_batch_ok;
+    void *ice_batch;
+    uint32_t generation;
+    uint32_t active_pos;
+    timer_node_t timeout_node;
+    bool is_alive;
+    void *registry;
+    atomic_uint owner_shard;
+    atomic_uint inflight;
+    uint32_t route_shard;
+    void *control_next;
+    client_control_t control_op;
+} legacy_client_t;
+
+/* 拆分前的 room_t 字段顺序 */
+typedef struct legacy_participant_s {
+    void *client;
+    uint32_t join_time;
+    bool is_owner;
+} legacy_participant_t;
+
+typedef struct legacy_room_s {
+    id128_t id;
+    char name[64];
+    legacy_participant_t participants[MAX_PARTICIPANTS];
+    uint8_t participant_count;
+    room_state_t state;
+    uint32_t created_at;
+    uint32_t last_activity;
+    void *owner;
+    uint32_t active_pos;
+} legacy_room_t;
+
+static volatile uint64_t bench_sink;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* 以 xorshift 打乱活跃列表，模拟长时间运行后槽位的随机分布 */
+static void shuffle(uint32_t *slots, size_t count, uint64_t *state) {
+    for (size_t i = count; i > 1; i--) {
+        *state ^= *state << 13;
+        *state ^= *state >> 7;
+        *state ^= *state << 17;
+        size_t j = (size_t)(*state % i);
+        uint32_t t = slots[i - 1];
+        slots[i - 1] = slots[j];
+        slots[j] = t;
+    }
+}
+
+#define BENCH_SWEEP(type, clients, slots, count, out_ns) do {                    \
+    uint64_t stale = 0, start = now_ns();                                        \
+    for (int r = 0; r < BENCH_ROUNDS; r++) {                                     \
+        for (size_t i = 0; i < (count); i++) {                                   \
+            const type *c = &(clients)[(slots)[i]];                              \
+            if (c->is_alive && c->wsi && c->last_activity < 1000u) stale++;      \
+        }                                                                        \
+    }                                                                            \
+    (out_ns) = (double)(now_ns() - start) / ((double)(count) * BENCH_ROUNDS);    \
+    bench_sink += stale;                                                         \
+} while (0)
+
+#define BENCH_LOOKUP(type, clients, slots, count, out_ns) do {                   \
+    uint64_t hits = 0, start = now_ns();                                         \
+    for (int r = 0; r < BENCH_ROUNDS; r++) {                                     \
+        for (size_t i = 0; i < (count); i++) {                                   \
+            const type *c = &(clients)[(slots)[i]];                              \
+            if (c->is_alive && c->generation == 1u) hits++;                      \
+        }                                                                        \
+    }                                                                            \
+    (out_ns) = (double)(now_ns() - start) / ((double)(count) * BENCH_ROUNDS);    \
+    bench_sink += hits;                                                          \
+} while (0)
+
+/* 每次查找扫描所有房间，per-op 按被检查的房间数归一化 */
+#define BENCH_SCAN(rooms, nrooms, slot_of, targets, ntargets, out_ns) do {       \
+    uint64_t found = 0, start = now_ns();                                        \
+    for (size_t t = 0; t < (ntargets); t++) {                                    \
+        const void *want = (targets)[t];                                         \
+        for (size_t i = 0; i < (nrooms); i++) {                                  \
+            for (int j = 0; j < MAX_PARTICIPANTS; j++) {                         \
+                if ((const void *)(rooms)[i] slot_of(j) == want) {               \
+                    found++;                                                     \
+                    goto next_##rooms;                                           \
+                }                                                                \
+            }                                                                    \
+        }                                                                        \
+    next_##rooms:;                                                               \
+    }                                                                            \
+    (out_ns) = (double)(now_ns() - start) / ((double)(ntargets) * (double)(nrooms)); \
+    bench_sink += found;                                                         \
+} while (0)
+
+/* 重复测量取最小值，减少调度和频率变化带来的噪声 */
+#define BENCH_MIN(out_ns, bench) do {                                            \
+    double best_ = 0, cur_;                                                      \
+    for (int rep_ = 0; rep_ < BENCH_REPEAT; rep_++) {                            \
+        bench;                                                                   \
+        if (rep_ == 0 || cur_ < best_) best_ = cur_;                             \
+    }                                                                            \
+    (out_ns) = best_;                                                            \
+} while (0)
+
+#define LEGACY_SLOT(j) .participants[j].client
+#define SPLIT_SLOT(j)  .slots.inline_slots[j]
+
+int main(int argc, char **argv) {
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_CLIENTS;
+    if (count < MAX_PARTICIPANTS) count = MAX_PARTICIPANTS;
+    size_t nrooms = count / MAX_PARTICIPANTS;
+    size_t ntargets = 64;
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+
+    legacy_client_t *legacy = cache_aligned_calloc(count, sizeof(legacy_client_t));
+    client_t *split = cache_aligned_calloc(count, sizeof(client_t));
+    legacy_room_t *legacy_rooms = cache_aligned_calloc(nrooms, sizeof(legacy_room_t));
+    room_t *split_rooms = cache_aligned_calloc(nrooms, sizeof(room_t));
+    uint32_t *slots = malloc(count * sizeof(uint32_t));
+    const void **legacy_targets = malloc(ntargets * sizeof(void *));
+    const void **split_targets = malloc(ntargets * sizeof(void *));
+    if (!legacy || !split || !legacy_rooms || !split_rooms || !slots ||
+        !legacy_targets || !split_targets) {
+        fprintf(stderr, "内存不足\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        legacy[i].is_alive = split[i].is_alive = true;
+        legacy[i].wsi = split[i].wsi = (struct lws *)(uintptr_t)(i + 1);
+        legacy[i].last_activity = split[i].last_activity = (uint32_t)i;
+        legacy[i].generation = split[i].generation = 1;
+        slots[i] = (uint32_t)i;
+    }
+
+    /* 房间按顺序填满，保证每个客户端最多在一个房间 */
+    for (size_t i = 0; i < nrooms * MAX_PARTICIPANTS; i++) {
+        legacy_rooms[i / MAX_PARTICIPANTS].participants[i % MAX_PARTICIPANTS].client = &legacy[i];
+        split_rooms[i / MAX_PARTICIPANTS].slots.inline_slots[i % MAX_PARTICIPANTS] = &split[i];
+    }
+
+    /* 目标取自后半部分的房间，平均扫描大约 3/4 的房间 */
+    for (size_t t = 0; t < ntargets; t++) {
+        size_t i = nrooms * MAX_PARTICIPANTS / 2 + (t * 7919) % (nrooms * MAX_PARTICIPANTS / 2);
+        legacy_targets[t] = &legacy[i];
+        split_targets[t] = &split[i];
+    }
+
+    shuffle(slots, count, &rng);
+
+    double sweep[2], lookup[2], scan[2];
+    BENCH_MIN(sweep[0], BENCH_SWEEP(legacy_client_t, legacy, slots, count, cur_));
+    BENCH_MIN(sweep[1], BENCH_SWEEP(client_t, split, slots, count, cur_));
+    BENCH_MIN(lookup[0], BENCH_LOOKUP(legacy_client_t, legacy, slots, count, cur_));
+    BENCH_MIN(lookup[1], BENCH_LOOKUP(client_t, split, slots, count, cur_));
+    BENCH_MIN(scan[0], BENCH_SCAN(legacy_rooms, nrooms, LEGACY_SLOT, legacy_targets, ntargets, cur_));
+    BENCH_MIN(scan[1], BENCH_SCAN(split_rooms, nrooms, SPLIT_SLOT, split_targets, ntargets, cur_));
+
+    printf("客户端: %zu  房间: %zu\n", count, nrooms);
+    printf("  结构体大小        拆分前  拆分后\n");
+    printf("  client_t        %6zu  %6zu 字节\n", sizeof(legacy_client_t), sizeof(client_t));
+    printf("  room_t          %6zu  %6zu 字节\n", sizeof(legacy_room_t), sizeof(room_t));
+    printf("  每次操作          拆分前  拆分后 (ns)\n");
+    printf("  超时扫描/客户端  %7.2f %7.2f\n", sweep[0], sweep[1]);
+    printf("  句柄校验/客户端  %7.2f %7.2f\n", lookup[0], lookup[1]);
+    printf("  成员查找/房间    %7.2f %7.2f\n", scan[0], scan[1]);
+
+    free(legacy);
+    free(split);
+    free(legacy_rooms);
+    free(split_rooms);
+    free(slots);
+    free(legacy_targets);
+    free(split_targets);
+    return 0;
+}
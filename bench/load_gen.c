@@ -0,0 +1,682 @@
+/**
+ * @file load_gen.c
+ * @brief 信令负载生成器：用 libwebsockets 客户端 API 打开 N 个连接，每 K 个组成一个房间，
+ * 在房间内两两重放 offer/answer/trickle-ICE 交换，报告建连速率、消息速率和转发延迟。
+ *
+ * 每一轮中，房间内每一对 (i < j) 依次进行：
+ *   i -> j  offer (SDP 约 --sdp-size 字节)
+ *   j -> i  answer + --candidates 个 ice-candidate
+ *   i -> j  --candidates 个 ice-candidate
+ * 一个房间收齐本轮所有消息后开始下一轮。发送时刻写入负载的 benchTs 字段 (单调时钟)，
+ * 服务器原样转发负载，接收端据此计算转发延迟；所有连接在同一进程内，时钟可直接相减。
+ *
+ * 全部回调在一个 lws 服务线程中执行，状态不需要加锁。
+ *
+ * 用法: load_gen [选项]，见 --help
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jansson.h>
+#include <libwebsockets.h>
+
+#include "../include/metrics.h"
+#include "../include/messages.h"
+#include "../include/utilities.h"
+
+#define LOAD_PROTOCOL "webrtc-signaling"
+#define LOAD_RX_BUFFER 4096
+#define LOAD_MAX_SDP (60 * 1024)      /* 服务器默认的最大消息长度为 64 KiB */
+
+typedef struct load_config_s {
+    const char *host;
+    int port;
+    unsigned connections;          /* 连接总数，向下取整为 room_size 的倍数 */
+    unsigned room_size;            /* 每个房间的成员数 (K) */
+    unsigned sdp_size;             /* offer/answer 中 SDP 的近似长度 */
+    unsigned candidates;           /* 每个方向每次交换的 candidate 数 */
+    unsigned rounds;               /* 每个房间的交换轮数 */
+    unsigned concurrency;          /* 同时进行中的建连数 */
+    unsigned timeout_sec;          /* 整体超时 */
+} load_config_t;
+
+typedef enum {
+    PEER_IDLE = 0,                 /* 尚未发起连接 */
+    PEER_CONNECTING,
+    PEER_OPEN,                     /* 已收到 client-id，等待房间创建后加入 */
+    PEER_JOINING,
+    PEER_JOINED,                   /* 已收到参与者列表 */
+    PEER_CLOSED
+} peer_state_t;
+
+typedef enum {
+    SEND_JOIN = 0,
+    SEND_OFFER,
+    SEND_ANSWER,
+    SEND_CANDIDATE
+} send_kind_t;
+
+/* 待发送的消息，在 WRITEABLE 时才序列化，benchTs 取实际写出的时刻 */
+typedef struct send_op_s {
+    uint16_t kind;
+    uint16_t target;               /* 目标在房间中的下标 */
+} send_op_t;
+
+struct load_room_s;
+
+typedef struct load_peer_s {
+    struct lws *wsi;
+    struct load_room_s *room;
+    unsigned index;                /* 在房间中的下标，0 为创建者 */
+    peer_state_t state;
+    char id[ID128_STR_LEN];
+    uint64_t connect_ns;
+    send_op_t *ops;                /* 发送环形队列，按需倍增 */
+    unsigned ops_head;
+    unsigned ops_count;
+    unsigned ops_cap;
+    char *rx;                      /* 分片重组 */
+    size_t rx_len;
+    size_t rx_cap;
+} load_peer_t;
+
+typedef struct load_room_s {
+    load_peer_t *peers;            /* room_size 个连续的成员 */
+    unsigned number;
+    unsigned joined;
+    bool created;
+    char id[ID128_STR_LEN];
+    unsigned round;
+    uint64_t expected;             /* 每轮应收到的转发消息数 */
+    uint64_t received;
+} load_room_t;
+
+/* 转发延迟按事件分别统计 */
+enum { LAT_OFFER = 0, LAT_ANSWER, LAT_CANDIDATE, LAT_COUNT };
+
+typedef struct load_state_s {
+    load_config_t config;
+    struct lws_context *context;
+    load_peer_t *peers;
+    load_room_t *rooms;
+    unsigned room_count;
+    char *sdp;                     /* JSON 转义后的 SDP */
+    size_t sdp_len;
+    unsigned char *tx;             /* LWS_PRE + 最长的一条消息 */
+    size_t tx_cap;
+
+    unsigned next_connect;
+    unsigned connecting;
+    unsigned established;
+    unsigned failed;
+    unsigned closed;
+    unsigned rooms_ready;
+    unsigned rooms_done;
+    uint64_t errors;
+
+    uint64_t start_ns;
+    uint64_t last_established_ns;
+    uint64_t exchange_start_ns;    /* 第一个房间开始交换的时刻 */
+    uint64_t end_ns;
+
+    uint64_t messages_sent;
+    uint64_t bytes_sent;
+    uint64_t messages_received;
+    metrics_histogram_t latency[LAT_COUNT];
+} load_state_t;
+
+static load_state_t load;
+
+static void print_usage(const char *program_name) {
+    printf("用法: %s [选项]\n\n", program_name);
+    printf("选项:\n");
+    printf("  -H, --host <地址>        服务器地址 (默认: 127.0.0.1)\n");
+    printf("  -p, --port <端口>        服务器端口 (默认: 8080)\n");
+    printf("  -n, --connections <数量> 连接总数 (默认: 200)\n");
+    printf("  -k, --room-size <数量>   每个房间的成员数 (默认: 4)\n");
+    printf("  -s, --sdp-size <字节>    offer/answer 的 SDP 长度 (默认: 2048)\n");
+    printf("  -c, --candidates <数量>  每次交换每个方向的 ICE candidate 数 (默认: 4)\n");
+    printf("  -r, --rounds <数量>      每个房间的交换轮数 (默认: 20)\n");
+    printf("  -C, --concurrency <数量> 同时进行的建连数 (默认: 64)\n");
+    printf("  -t, --timeout <秒>       整体超时 (默认: 60)\n");
+    printf("  -h, --help               显示此帮助信息\n\n");
+    printf("示例:\n");
+    printf("  %s --port 8080 --connections 1000 --room-size 6 --sdp-size 4096\n", program_name);
+}
+
+/* 按 JSON 转义后的 SDP 行填充到约 size 字节 */
+static char *make_sdp(size_t size, size_t *out_len) {
+    static const char *const lines[] = {
+        "a=rtpmap:96 VP8/90000\\r\\n",
+        "a=rtcp-fb:96 nack pli\\r\\n",
+        "a=fmtp:111 minptime=10;useinbandfec=1\\r\\n",
+        "a=ssrc:3735928559 cname:4TOk42mSjXCkVIa6\\r\\n",
+        "a=candidate:842163049 1 udp 1677729535 203.0.113.7 54321 typ srflx "
+            "raddr 10.0.0.2 rport 54321 generation 0\\r\\n",
+    };
+    char *sdp = malloc(size + 128);
+    if (!sdp) return NULL;
+
+    size_t len = (size_t)sprintf(sdp, "v=0\\r\\no=- 4611731400430051336 2 IN IP4 127.0.0.1\\r\\n");
+    for (unsigned i = 0; len < size; i++) {
+        const char *line = lines[i % (sizeof(lines) / sizeof(lines[0]))];
+        size_t n = strlen(line);
+        memcpy(sdp + len, line, n);
+        len += n;
+    }
+    sdp[len] = '\0';
+    *out_len = len;
+    return sdp;
+}
+
+static int peer_push(load_peer_t *peer, send_kind_t kind, unsigned target) {
+    if (peer->state == PEER_CLOSED || !peer->wsi) return -1;
+
+    if (peer->ops_count == peer->ops_cap) {
+        unsigned cap = peer->ops_cap ? peer->ops_cap * 2 : 16;
+        send_op_t *grown = malloc(cap * sizeof(send_op_t));
+        if (!grown) return -1;
+        for (unsigned i = 0; i < peer->ops_count; i++) {
+            grown[i] = peer->ops[(peer->ops_head + i) % peer->ops_cap];
+        }
+        free(peer->ops);
+        peer->ops = grown;
+        peer->ops_head = 0;
+        peer->ops_cap = cap;
+    }
+
+    peer->ops[(peer->ops_head + peer->ops_count++) % peer->ops_cap] =
+        (send_op_t){ (uint16_t)kind, (uint16_t)target };
+    lws_callback_on_writable(peer->wsi);
+    return 0;
+}
+
+/* 本轮：每一对 (i < j) 由 i 发起 offer */
+static void room_start_round(load_room_t *room) {
+    unsigned k = load.config.room_size;
+    room->received = 0;
+    for (unsigned i = 0; i < k; i++) {
+        for (unsigned j = i + 1; j < k; j++) {
+            peer_push(&room->peers[i], SEND_OFFER, j);
+        }
+    }
+}
+
+static void room_on_relay(load_room_t *room) {
+    if (++room->received < room->expected) return;
+
+    if (++room->round < load.config.rounds) {
+        room_start_round(room);
+    } else {
+        load.rooms_done++;
+    }
+}
+
+/* 序列化一条待发送的消息，返回负载长度 */
+static size_t peer_format(const load_peer_t *peer, const send_op_t *op, char *out, size_t cap) {
+    const load_room_t *room = peer->room;
+    const char *target = op->kind != SEND_JOIN ? room->peers[op->target].id : NULL;
+    unsigned long long ts = (unsigned long long)metrics_clock_ns();
+    int n = 0;
+
+    switch (op->kind) {
+    case SEND_JOIN:
+        if (peer->index == 0) {
+            n = snprintf(out, cap,
+                         "{\"event\":\"join-room\",\"data\":{\"roomName\":\"bench-%u\",\"capacity\":%u}}",
+                         room->number, load.config.room_size);
+        } else {
+            n = snprintf(out, cap, "{\"event\":\"join-room\",\"data\":{\"roomId\":\"%s\"}}",
+                         room->id);
+        }
+        break;
+    case SEND_OFFER:
+    case SEND_ANSWER: {
+        const char *event = op->kind == SEND_OFFER ? "offer" : "answer";
+        n = snprintf(out, cap,
+                     "{\"event\":\"%s\",\"data\":{\"targetClientId\":\"%s\",\"%s\":"
+                     "{\"type\":\"%s\",\"benchTs\":%llu,\"benchPeer\":%u,\"sdp\":\"%s\"}}}",
+                     event, target, event, event, ts, peer->index, load.sdp);
+        break;
+    }
+    case SEND_CANDIDATE:
+        n = snprintf(out, cap,
+                     "{\"event\":\"ice-candidate\",\"data\":{\"targetClientId\":\"%s\",\"candidate\":"
+                     "{\"candidate\":\"candidate:%u 1 udp 2122260223 10.0.%u.%u %u typ host "
+                     "generation 0\",\"sdpMid\":\"0\",\"sdpMLineIndex\":0,"
+                     "\"benchTs\":%llu,\"benchPeer\":%u}}}",
+                     target, 1000u + peer->index, room->number & 0xff, peer->index,
+                     50000u + op->target, ts, peer->index);
+        break;
+    default:
+        break;
+    }
+    return n > 0 && (size_t)n < cap ? (size_t)n : 0;
+}
+
+static void peer_on_writable(load_peer_t *peer) {
+    if (peer->ops_count == 0) return;
+
+    send_op_t op = peer->ops[peer->ops_head];
+    peer->ops_head = (peer->ops_head + 1) % peer->ops_cap;
+    peer->ops_count--;
+
+    char *payload = (char *)load.tx + LWS_PRE;
+    size_t len = peer_format(peer, &op, payload, load.tx_cap - LWS_PRE);
+    if (len > 0 && lws_write(peer->wsi, (unsigned char *)payload, len, LWS_WRITE_TEXT) >= (int)len) {
+        if (op.kind != SEND_JOIN) {
+            load.messages_sent++;
+            load.bytes_sent += len;
+        }
+    } else {
+        load.errors++;
+    }
+
+    if (peer->ops_count > 0) {
+        lws_callback_on_writable(peer->wsi);
+    }
+}
+
+/* 转发来的 offer/answer/candidate：记录延迟并按交换顺序回应 */
+static void peer_on_relay(load_peer_t *peer, message_event_t type, json_t *data) {
+    const char *key = type == MESSAGE_EVENT_OFFER ? "offer" :
+                      type == MESSAGE_EVENT_ANSWER ? "answer" : "candidate";
+    json_t *payload = json_object_get(data, key);
+    json_t *ts = json_object_get(payload, "benchTs");
+    json_t *from = json_object_get(payload, "benchPeer");
+    if (!json_is_integer(ts) || !json_is_integer(from) ||
+        (unsigned)json_integer_value(from) >= load.config.room_size) {
+        load.errors++;
+        return;
+    }
+
+    uint64_t sent = (uint64_t)json_integer_value(ts);
+    uint64_t now = metrics_clock_ns();
+    unsigned lat = type == MESSAGE_EVENT_OFFER ? LAT_OFFER :
+                   type == MESSAGE_EVENT_ANSWER ? LAT_ANSWER : LAT_CANDIDATE;
+    metrics_observe(&load.latency[lat], now > sent ? now - sent : 0);
+    load.messages_received++;
+
+    unsigned sender = (unsigned)json_integer_value(from);
+    if (type == MESSAGE_EVENT_OFFER) {
+        peer_push(peer, SEND_ANSWER, sender);
+    }
+    if (type == MESSAGE_EVENT_OFFER || type == MESSAGE_EVENT_ANSWER) {
+        for (unsigned i = 0; i < load.config.candidates; i++) {
+            peer_push(peer, SEND_CANDIDATE, sender);
+        }
+    }
+
+    room_on_relay(peer->room);
+}
+
+static void peer_on_message(load_peer_t *peer, const char *buf, size_t len) {
+    json_error_t error;
+    json_t *root = json_loadb(buf, len, 0, &error);
+    const char *event = root ? json_string_value(json_object_get(root, "event")) : NULL;
+    if (!event) {
+        load.errors++;
+        json_decref(root);
+        return;
+    }
+
+    /* JSON 子协议中服务器下发的 data 是 JSON 文本字符串 */
+    const char *text = json_string_value(json_object_get(root, "data"));
+    json_t *data = text ? json_loads(text, 0, &error) : NULL;
+    load_room_t *room = peer->room;
+    message_event_t type = message_event_lookup(event, strlen(event));
+
+    switch (type) {
+    case MESSAGE_EVENT_CLIENT_ID:
+        safe_strncpy(peer->id, json_string_value(json_object_get(data, "clientId")),
+                     sizeof(peer->id));
+        peer->state = PEER_OPEN;
+        if (peer->index == 0 || room->created) {
+            peer->state = PEER_JOINING;
+            peer_push(peer, SEND_JOIN, 0);
+        }
+        break;
+
+    case MESSAGE_EVENT_ROOM_CREATED:
+        safe_strncpy(room->id, json_string_value(json_object_get(data, "roomId")),
+                     sizeof(room->id));
+        room->created = true;
+        for (unsigned i = 1; i < load.config.room_size; i++) {
+            if (room->peers[i].state == PEER_OPEN) {
+                room->peers[i].state = PEER_JOINING;
+                peer_push(&room->peers[i], SEND_JOIN, 0);
+            }
+        }
+        break;
+
+    case MESSAGE_EVENT_PARTICIPANTS_LIST:
+        if (peer->state == PEER_JOINING) {
+            peer->state = PEER_JOINED;
+            if (++room->joined == load.config.room_size) {
+                if (load.rooms_ready++ == 0) {
+                    load.exchange_start_ns = metrics_clock_ns();
+                }
+                room_start_round(room);
+            }
+        }
+        break;
+
+    case MESSAGE_EVENT_OFFER:
+    case MESSAGE_EVENT_ANSWER:
+    case MESSAGE_EVENT_ICE_CANDIDATE:
+        peer_on_relay(peer, type, data);
+        break;
+
+    case MESSAGE_EVENT_ERROR:
+        if (load.errors++ < 10) {
+            fprintf(stderr, "服务器错误 (房间 %u 成员 %u): %s\n", room->number, peer->index,
+                    text ? text : "");
+        }
+        break;
+
+    default:
+        /* participant-joined / participant-left 等 */
+        break;
+    }
+
+    json_decref(data);
+    json_decref(root);
+}
+
+static int peer_on_receive(load_peer_t *peer, struct lws *wsi, const void *in, size_t len) {
+    bool complete = lws_is_final_fragment(wsi) && lws_remaining_packet_payload(wsi) == 0;
+
+    /* 单次交付的完整消息直接解析 */
+    if (complete && peer->rx_len == 0) {
+        peer_on_message(peer, in, len);
+        return 0;
+    }
+
+    if (peer->rx_len + len > peer->rx_cap) {
+        size_t cap = peer->rx_cap ? peer->rx_cap : LOAD_RX_BUFFER;
+        while (cap < peer->rx_len + len) cap *= 2;
+        char *grown = realloc(peer->rx, cap);
+        if (!grown) return -1;
+        peer->rx = grown;
+        peer->rx_cap = cap;
+    }
+    memcpy(peer->rx + peer->rx_len, in, len);
+    peer->rx_len += len;
+
+    if (complete) {
+        peer_on_message(peer, peer->rx, peer->rx_len);
+        peer->rx_len = 0;
+    }
+    return 0;
+}
+
+static void peer_closed(load_peer_t *peer, bool failed, const char *reason) {
+    if (peer->state == PEER_CLOSED) return;
+    if (peer->state == PEER_CONNECTING) {
+        load.connecting--;
+    }
+    if (failed) {
+        if (load.failed++ < 10) {
+            fprintf(stderr, "连接失败 (房间 %u 成员 %u): %s\n", peer->room->number, peer->index,
+                    reason ? reason : "未知错误");
+        }
+    } else {
+        load.closed++;
+    }
+    peer->state = PEER_CLOSED;
+    peer->wsi = NULL;
+}
+
+static int load_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user,
+                         void *in, size_t len) {
+    load_peer_t *peer = user;
+
+    switch (reason) {
+    case LWS_CALLBACK_CLIENT_ESTABLISHED:
+        load.connecting--;
+        load.established++;
+        load.last_established_ns = metrics_clock_ns();
+        peer->state = PEER_OPEN;
+        break;
+
+    case LWS_CALLBACK_CLIENT_RECEIVE:
+        if (peer && peer_on_receive(peer, wsi, in, len) != 0) return -1;
+        break;
+
+    case LWS_CALLBACK_CLIENT_WRITEABLE:
+        if (peer) peer_on_writable(peer);
+        break;
+
+    case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+        if (peer) peer_closed(peer, true, in ? (const char *)in : NULL);
+        break;
+
+    case LWS_CALLBACK_CLIENT_CLOSED:
+        if (peer) peer_closed(peer, false, NULL);
+        break;
+
+    default:
+        break;
+    }
+    return 0;
+}
+
+static const struct lws_protocols load_protocols[] = {
+    { LOAD_PROTOCOL, load_callback, 0, LOAD_RX_BUFFER, 0, NULL, 0 },
+    { NULL, NULL, 0, 0, 0, NULL, 0 } /* 终止符 */
+};
+
+/* 按并发上限发起新的连接；创建者先于同房间的其他成员连接 */
+static void load_connect_more(void) {
+    while (load.next_connect < load.config.connections &&
+           load.connecting < load.config.concurrency) {
+        load_peer_t *peer = &load.peers[load.next_connect++];
+
+        struct lws_client_connect_info info;
+        memset(&info, 0, sizeof(info));
+        info.context = load.context;
+        info.address = load.config.host;
+        info.port = load.config.port;
+        info.path = "/";
+        info.host = load.config.host;
+        info.origin = load.config.host;
+        info.protocol = LOAD_PROTOCOL;
+        info.userdata = peer;
+        info.pwsi = &peer->wsi;
+
+        peer->state = PEER_CONNECTING;
+        peer->connect_ns = metrics_clock_ns();
+        load.connecting++;
+        if (!lws_client_connect_via_info(&info)) {
+            peer_closed(peer, true, "lws_client_connect_via_info 失败");
+        }
+    }
+}
+
+static void print_latency(const char *name, const metrics_histogram_t *hists, unsigned count) {
+    metrics_snapshot_t *snap = calloc(1, sizeof(*snap));
+    if (!snap) return;
+    for (unsigned i = 0; i < count; i++) {
+        metrics_snapshot_add(snap, &hists[i]);
+    }
+    printf("  %-14s %10llu %9.1f %9.1f %9.1f\n", name, (unsigned long long)snap->count,
+           (double)metrics_snapshot_quantile(snap, 0.50) / 1e3,
+           (double)metrics_snapshot_quantile(snap, 0.99) / 1e3,
+           (double)metrics_snapshot_quantile(snap, 0.999) / 1e3);
+    free(snap);
+}
+
+static void print_report(void) {
+    const load_config_t *c = &load.config;
+    double connect_sec = (double)(load.last_established_ns - load.start_ns) / 1e9;
+    double exchange_sec = load.exchange_start_ns
+                              ? (double)(load.end_ns - load.exchange_start_ns) / 1e9 : 0;
+
+    printf("\n连接: %u/%u 成功, %u 失败, %u 中途关闭\n", load.established, c->connections,
+           load.failed, load.closed);
+    if (load.established > 0 && connect_sec > 0) {
+        printf("  建连速率: %.0f 连接/秒 (%.3f 秒)\n", load.established / connect_sec, connect_sec);
+    }
+    printf("房间: %u 个 (每个 %u 人), %u 个完成全部 %u 轮\n", load.room_count, c->room_size,
+           load.rooms_done, c->rounds);
+    printf("消息: 发送 %llu, 收到转发 %llu, 错误 %llu\n",
+           (unsigned long long)load.messages_sent, (unsigned long long)load.messages_received,
+           (unsigned long long)load.errors);
+    if (exchange_sec > 0) {
+        printf("  消息速率: %.0f 条/秒, 发送 %.2f MB/秒 (%.3f 秒)\n",
+               (double)load.messages_received / exchange_sec,
+               (double)load.bytes_sent / exchange_sec / 1e6, exchange_sec);
+    }
+
+    printf("转发延迟 (µs)\n");
+    printf("  %-14s %10s %9s %9s %9s\n", "事件", "样本", "p50", "p99", "p999");
+    print_latency("offer", &load.latency[LAT_OFFER], 1);
+    print_latency("answer", &load.latency[LAT_ANSWER], 1);
+    print_latency("ice-candidate", &load.latency[LAT_CANDIDATE], 1);
+    print_latency("全部", load.latency, LAT_COUNT);
+}
+
+static int parse_unsigned(const char *arg, unsigned min, unsigned max, unsigned *out) {
+    char *end;
+    unsigned long v = strtoul(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || v < min || v > max) return -1;
+    *out = (unsigned)v;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    load_config_t *c = &load.config;
+    *c = (load_config_t){
+        .host = "127.0.0.1",
+        .port = 8080,
+        .connections = 200,
+        .room_size = 4,
+        .sdp_size = 2048,
+        .candidates = 4,
+        .rounds = 20,
+        .concurrency = 64,
+        .timeout_sec = 60,
+    };
+
+    static const struct option long_options[] = {
+        {"host", required_argument, 0, 'H'},
+        {"port", required_argument, 0, 'p'},
+        {"connections", required_argument, 0, 'n'},
+        {"room-size", required_argument, 0, 'k'},
+        {"sdp-size", required_argument, 0, 's'},
+        {"candidates", required_argument, 0, 'c'},
+        {"rounds", required_argument, 0, 'r'},
+        {"concurrency", required_argument, 0, 'C'},
+        {"timeout", required_argument, 0, 't'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    unsigned port = (unsigned)c->port;
+    int opt, bad = 0;
+    while ((opt = getopt_long(argc, argv, "H:p:n:k:s:c:r:C:t:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'H': c->host = optarg; break;
+        case 'p': bad |= parse_unsigned(optarg, 1, 65535, &port); break;
+        case 'n': bad |= parse_unsigned(optarg, 2, 1000000, &c->connections); break;
+        case 'k': bad |= parse_unsigned(optarg, 2, 1024, &c->room_size); break;
+        case 's': bad |= parse_unsigned(optarg, 64, LOAD_MAX_SDP, &c->sdp_size); break;
+        case 'c': bad |= parse_unsigned(optarg, 0, 64, &c->candidates); break;
+        case 'r': bad |= parse_unsigned(optarg, 1, 1000000, &c->rounds); break;
+        case 'C': bad |= parse_unsigned(optarg, 1, 65535, &c->concurrency); break;
+        case 't': bad |= parse_unsigned(optarg, 1, 86400, &c->timeout_sec); break;
+        case 'h': print_usage(argv[0]); return 0;
+        default: print_usage(argv[0]); return 1;
+        }
+        if (bad) {
+            fprintf(stderr, "无效的参数: -%c %s\n", opt, optarg);
+            return 1;
+        }
+    }
+    c->port = (int)port;
+
+    if (c->connections < c->room_size) c->room_size = c->connections;
+    load.room_count = c->connections / c->room_size;
+    c->connections = load.room_count * c->room_size;
+
+    load.sdp = make_sdp(c->sdp_size, &load.sdp_len);
+    load.tx_cap = LWS_PRE + load.sdp_len + 512;
+    load.tx = malloc(load.tx_cap);
+    load.peers = calloc(c->connections, sizeof(load_peer_t));
+    load.rooms = calloc(load.room_count, sizeof(load_room_t));
+    if (!load.sdp || !load.tx || !load.peers || !load.rooms) {
+        fprintf(stderr, "内存不足\n");
+        return 1;
+    }
+
+    uint64_t pairs = (uint64_t)c->room_size * (c->room_size - 1) / 2;
+    for (unsigned r = 0; r < load.room_count; r++) {
+        load_room_t *room = &load.rooms[r];
+        room->peers = &load.peers[r * c->room_size];
+        room->number = r;
+        room->expected = pairs * (2 + 2 * (uint64_t)c->candidates);
+        for (unsigned i = 0; i < c->room_size; i++) {
+            room->peers[i].room = room;
+            room->peers[i].index = i;
+        }
+    }
+
+    lws_set_log_level(LLL_ERR, NULL);
+
+    struct lws_context_creation_info info;
+    memset(&info, 0, sizeof(info));
+    info.port = CONTEXT_PORT_NO_LISTEN;
+    info.protocols = load_protocols;
+    info.gid = -1;
+    info.uid = -1;
+    info.fd_limit_per_thread = c->connections + 64;
+
+    load.context = lws_create_context(&info);
+    if (!load.context) {
+        fprintf(stderr, "创建 libwebsockets 上下文失败\n");
+        return 1;
+    }
+
+    printf("负载: %s:%d, %u 个连接, %u 个房间 x %u 人, SDP %zu 字节, "
+           "每次交换 %u 个 candidate, %u 轮\n",
+           c->host, c->port, c->connections, load.room_count, c->room_size, load.sdp_len,
+           c->candidates, c->rounds);
+
+    load.start_ns = metrics_clock_ns();
+    uint64_t deadline = load.start_ns + (uint64_t)c->timeout_sec * 1000000000ull;
+
+    while (load.rooms_done < load.room_count) {
+        load_connect_more();
+
+        /* 所有连接都已结束 (失败或关闭)，剩余房间无法完成 */
+        if (load.next_connect == c->connections && load.connecting == 0 &&
+            load.failed + load.closed >= c->connections) {
+            break;
+        }
+        if (metrics_clock_ns() >= deadline) {
+            fprintf(stderr, "超时: %u/%u 个房间完成\n", load.rooms_done, load.room_count);
+            break;
+        }
+        if (lws_service(load.context, 0) < 0) {
+            break;
+        }
+    }
+    load.end_ns = metrics_clock_ns();
+
+    print_report();
+
+    lws_context_destroy(load.context);
+    for (unsigned i = 0; i < c->connections; i++) {
+        free(load.peers[i].ops);
+        free(load.peers[i].rx);
+    }
+    free(load.peers);
+    free(load.rooms);
+    free(load.tx);
+    free(load.sdp);
+
+    return load.rooms_done == load.room_count ? 0 : 1;
+}
@@ -0,0 +1,362 @@
+/**
+ * @file micro_bench.c
+ * @brief 热路径函数的微基准，用于发现性能回退：
+ *   deserialize - message_deserialize / message_deserialize_relay，按消息类型和 SDP 大小
+ *   codec       - 每种扫描实现下的中继解析、frame_create_relay 转义和 UTF-8 校验，
+ *                 以 jansson 的 message_deserialize / message_serialize 为基线
+ *   room        - room_registry_find_by_id，按注册表规模 (命中与未命中)
+ *   wsi         - client_registry_find_by_wsi，按注册表规模
+ *
+ * 查找按预先打乱的随机顺序进行，注册表大于缓存时测到的是真实的缺失开销。
+ * 每项重复测量取最小值。
+ *
+ * 用法: micro_bench [最大注册表规模]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/client.h"
+#include "../include/json_scan.h"
+#include "../include/logger.h"
+#include "../include/messages.h"
+#include "../include/room.h"
+#include "../include/utilities.h"
+
+#define BENCH_MAX_SIZE_DEFAULT 262144
+#define BENCH_LOOKUPS (1u << 20)
+#define BENCH_PARSE_BYTES (8u << 20) /* 每轮解析的总字节数，按消息长度决定次数 */
+#define BENCH_REPEAT 5
+
+/*
+ * 基准中的 wsi 只是保存会话句柄的结构体。client_registry_find_by_wsi 通过
+ * lws_wsi_user() 取句柄，这里提供同名定义：可执行文件中的定义优先于共享库，
+ * 查找路径与服务器中完全相同，只是不需要真实连接。
+ */
+struct lws {
+    client_handle_t session;
+};
+
+void *lws_wsi_user(struct lws *wsi) {
+    return &wsi->session;
+}
+
+static volatile uint64_t bench_sink;
+
+static const size_t bench_sizes[] = { 1024, 16384, 262144 };
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/* 查找顺序：BENCH_LOOKUPS 个在 [0, count) 内均匀分布的随机下标 */
+static uint32_t *random_order(size_t count, uint64_t *state) {
+    uint32_t *order = malloc(BENCH_LOOKUPS * sizeof(uint32_t));
+    if (!order) return NULL;
+    for (size_t i = 0; i < BENCH_LOOKUPS; i++) {
+        order[i] = (uint32_t)(xorshift(state) % count);
+    }
+    return order;
+}
+
+/* 重复测量取最小值，减少调度和频率变化带来的噪声 */
+#define BENCH_MIN(out_ns, ops, body) do {                                        \
+    double best_ = 0;                                                            \
+    for (int rep_ = 0; rep_ < BENCH_REPEAT; rep_++) {                            \
+        uint64_t start_ = now_ns();                                              \
+        body;                                                                    \
+        double cur_ = (double)(now_ns() - start_) / (double)(ops);               \
+        if (rep_ == 0 || cur_ < best_) best_ = cur_;                             \
+    }                                                                            \
+    (out_ns) = best_;                                                            \
+} while (0)
+
+/* 按 JSON 转义后的 SDP 行填充到约 size 字节 */
+static char *make_sdp(size_t size) {
+    static const char *const lines[] = {
+        "a=rtpmap:96 VP8/90000\\r\\n",
+        "a=rtcp-fb:96 nack pli\\r\\n",
+        "a=fmtp:111 minptime=10;useinbandfec=1\\r\\n",
+        "a=ssrc:3735928559 cname:4TOk42mSjXCkVIa6\\r\\n",
+        "a=candidate:842163049 1 udp 1677729535 203.0.113.7 54321 typ srflx "
+            "raddr 10.0.0.2 rport 54321 generation 0\\r\\n",
+    };
+    char *sdp = malloc(size + 128);
+    if (!sdp) return NULL;
+
+    size_t len = (size_t)sprintf(sdp, "v=0\\r\\no=- 4611731400430051336 2 IN IP4 127.0.0.1\\r\\n");
+    for (unsigned i = 0; len < size; i++) {
+        const char *line = lines[i % (sizeof(lines) / sizeof(lines[0]))];
+        size_t n = strlen(line);
+        memcpy(sdp + len, line, n);
+        len += n;
+    }
+    sdp[len] = '\0';
+    return sdp;
+}
+
+typedef struct bench_payload_s {
+    const char *name;
+    char *json;
+    size_t len;
+    bool relay;                    /* Event takes the relay fast path in the server */
+} bench_payload_t;
+
+static void bench_deserialize(void) {
+    static const char target[] = "6f1d2c3b-4a59-4e87-9c10-2b3a4c5d6e7f";
+    static const size_t sdp_sizes[] = { 1024, 4096, 16384 };
+    bench_payload_t payloads[8];
+    size_t count = 0;
+
+    char *buf = malloc(256);
+    snprintf(buf, 256, "{\"event\":\"join-room\",\"data\":{\"roomId\":\"%s\",\"roomName\":\"bench\"}}",
+             target);
+    payloads[count++] = (bench_payload_t){ "join-room", buf, strlen(buf), false };
+
+    buf = malloc(512);
+    snprintf(buf, 512,
+             "{\"event\":\"ice-candidate\",\"data\":{\"targetClientId\":\"%s\",\"candidate\":"
+             "{\"candidate\":\"candidate:842163049 1 udp 1677729535 203.0.113.7 54321 typ srflx "
+             "raddr 10.0.0.2 rport 54321 generation 0\",\"sdpMid\":\"0\",\"sdpMLineIndex\":0}}}",
+             target);
+    payloads[count++] = (bench_payload_t){ "ice-candidate", buf, strlen(buf), true };
+
+    static char names[3][32];
+    for (size_t i = 0; i < sizeof(sdp_sizes) / sizeof(sdp_sizes[0]); i++) {
+        char *sdp = make_sdp(sdp_sizes[i]);
+        size_t cap = strlen(sdp) + 256;
+        buf = malloc(cap);
+        snprintf(buf, cap,
+                 "{\"event\":\"offer\",\"data\":{\"targetClientId\":\"%s\",\"offer\":"
+                 "{\"type\":\"offer\",\"sdp\":\"%s\"}}}", target, sdp);
+        free(sdp);
+        snprintf(names[i], sizeof(names[i]), "offer %zuK", sdp_sizes[i] / 1024);
+        payloads[count++] = (bench_payload_t){ names[i], buf, strlen(buf), true };
+    }
+
+    printf("消息解析 (ns/条, 括号内为 MB/s)\n");
+    printf("  %-16s %7s %18s %18s\n", "消息", "字节", "deserialize", "relay");
+    for (size_t i = 0; i < count; i++) {
+        const bench_payload_t *p = &payloads[i];
+        size_t parses = BENCH_PARSE_BYTES / p->len;
+        double full, relay = 0;
+
+        BENCH_MIN(full, parses, {
+            for (size_t n = 0; n < parses; n++) {
+                message_t *msg = message_deserialize(p->json, p->len);
+                bench_sink += msg != NULL;
+                message_unref(msg);
+            }
+        });
+        if (p->relay) {
+            BENCH_MIN(relay, parses, {
+                for (size_t n = 0; n < parses; n++) {
+                    message_t *msg = message_deserialize_relay(p->json, p->len);
+                    bench_sink += msg != NULL;
+                    message_unref(msg);
+                }
+            });
+        }
+
+        printf("  %-16s %7zu %9.0f (%6.0f)", p->name, p->len, full, (double)p->len * 1e3 / full);
+        if (p->relay) {
+            printf(" %9.0f (%6.0f)\n", relay, (double)p->len * 1e3 / relay);
+        } else {
+            printf(" %18s\n", "-");
+        }
+        free(payloads[i].json);
+    }
+}
+
+/* 吞吐 (MB/s)：每次处理 bytes 字节，耗时 ns */
+static double mb_per_sec(size_t bytes, double ns) {
+    return (double)bytes * 1e3 / ns;
+}
+
+static void bench_codec(void) {
+    static const char target[] = "6f1d2c3b-4a59-4e87-9c10-2b3a4c5d6e7f";
+    static const size_t sdp_sizes[] = { 1024, 4096, 16384 };
+    json_scan_impl_t initial = json_scan_impl();
+    id128_t from;
+    id128_generate(&from);
+
+    printf("编解码 (MB/s，按扫描实现，当前为 %s)\n", json_scan_impl_name(initial));
+    printf("  %-10s %-8s %9s %9s %9s\n", "消息", "实现", "解析", "转义", "UTF-8");
+    for (size_t i = 0; i < sizeof(sdp_sizes) / sizeof(sdp_sizes[0]); i++) {
+        char *sdp = make_sdp(sdp_sizes[i]);
+        size_t cap = strlen(sdp) + 256;
+        char *json = malloc(cap);
+        char *payload = malloc(cap);
+        snprintf(payload, cap, "{\"type\":\"offer\",\"sdp\":\"%s\"}", sdp);
+        snprintf(json, cap, "{\"event\":\"offer\",\"data\":{\"targetClientId\":\"%s\",\"offer\":%s}}",
+                 target, payload);
+        free(sdp);
+        size_t json_len = strlen(json), payload_len = strlen(payload);
+        size_t parses = BENCH_PARSE_BYTES / json_len;
+        char name[32];
+        snprintf(name, sizeof(name), "offer %zuK", sdp_sizes[i] / 1024);
+
+        /* 基线：jansson 解析整条消息，序列化时对同一份 data 文本做字符串转义 */
+        double full, dump;
+        BENCH_MIN(full, parses, {
+            for (size_t n = 0; n < parses; n++) {
+                message_t *msg = message_deserialize(json, json_len);
+                bench_sink += msg != NULL;
+                message_unref(msg);
+            }
+        });
+        message_t *msg = message_create("offer", json_string(payload));
+        BENCH_MIN(dump, parses, {
+            for (size_t n = 0; n < parses; n++) {
+                char *out = message_serialize(msg);
+                bench_sink += out != NULL;
+                free(out);
+            }
+        });
+        message_unref(msg);
+        printf("  %-10s %-8s %9.0f %9.0f %9s\n", name, "jansson",
+               mb_per_sec(json_len, full), mb_per_sec(payload_len, dump), "-");
+
+        for (int impl = 0; impl < JSON_SCAN_IMPL_COUNT; impl++) {
+            if (json_scan_select((json_scan_impl_t)impl) != 0) continue;
+
+            double parse, escape, utf8;
+            BENCH_MIN(parse, parses, {
+                for (size_t n = 0; n < parses; n++) {
+                    message_t *relay = message_deserialize_relay(json, json_len);
+                    bench_sink += relay != NULL;
+                    message_unref(relay);
+                }
+            });
+            BENCH_MIN(escape, parses, {
+                for (size_t n = 0; n < parses; n++) {
+                    frame_t *frame = frame_create_relay("offer", &from, "offer", payload, payload_len);
+                    bench_sink += frame != NULL;
+                    frame_unref(frame);
+                }
+            });
+            BENCH_MIN(utf8, parses, {
+                for (size_t n = 0; n < parses; n++) {
+                    bench_sink += json_utf8_valid((const unsigned char *)payload, payload_len);
+                }
+            });
+            printf("  %-10s %-8s %9.0f %9.0f %9.0f\n", name, json_scan_impl_name((json_scan_impl_t)impl),
+                   mb_per_sec(json_len, parse), mb_per_sec(payload_len, escape),
+                   mb_per_sec(payload_len, utf8));
+        }
+        json_scan_select(initial);
+
+        free(payload);
+        free(json);
+    }
+}
+
+static void bench_room_lookup(size_t size, uint64_t *rng) {
+    room_registry_t reg;
+    memset(&reg, 0, sizeof(reg));
+    id128_t *ids = malloc(size * sizeof(id128_t));
+    id128_t *missing = malloc(size * sizeof(id128_t));
+    if (!ids || !missing || room_registry_init(&reg, size) != 0) {
+        fprintf(stderr, "内存不足: %zu 个房间\n", size);
+        free(ids);
+        free(missing);
+        return;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        room_t *room = room_registry_create(&reg, "bench", NULL, 0);
+        ids[i] = room->id;
+        id128_generate(&missing[i]);
+    }
+
+    uint32_t *order = random_order(size, rng);
+    double hit_ns, miss_ns;
+    BENCH_MIN(hit_ns, BENCH_LOOKUPS, {
+        for (size_t n = 0; n < BENCH_LOOKUPS; n++) {
+            bench_sink += room_registry_find_by_id(&reg, &ids[order[n]]) != NULL;
+        }
+    });
+    BENCH_MIN(miss_ns, BENCH_LOOKUPS, {
+        for (size_t n = 0; n < BENCH_LOOKUPS; n++) {
+            bench_sink += room_registry_find_by_id(&reg, &missing[order[n]]) != NULL;
+        }
+    });
+    printf("  room_registry_find_by_id   %8zu %9.2f %9.2f\n", size, hit_ns, miss_ns);
+
+    free(order);
+    free(ids);
+    free(missing);
+    room_registry_cleanup(&reg);
+}
+
+static void bench_wsi_lookup(size_t size, uint64_t *rng) {
+    client_registry_t reg;
+    memset(&reg, 0, sizeof(reg));
+    struct lws *wsis = calloc(size, sizeof(struct lws));
+    if (!wsis || client_registry_init(&reg, size) != 0) {
+        fprintf(stderr, "内存不足: %zu 个客户端\n", size);
+        free(wsis);
+        return;
+    }
+
+    /* 与 LWS_CALLBACK_ESTABLISHED 相同：会话中保存新客户端的句柄 */
+    for (size_t i = 0; i < size; i++) {
+        client_t *client = client_registry_add(&reg, &wsis[i]);
+        wsis[i].session = client_registry_handle(&reg, client);
+    }
+
+    uint32_t *order = random_order(size, rng);
+    double ns;
+    BENCH_MIN(ns, BENCH_LOOKUPS, {
+        for (size_t n = 0; n < BENCH_LOOKUPS; n++) {
+            bench_sink += client_registry_find_by_wsi(&reg, &wsis[order[n]]) != NULL;
+        }
+    });
+    printf("  client_registry_find_by_wsi %7zu %9.2f %9s\n", size, ns, "-");
+
+    free(order);
+    client_registry_cleanup(&reg);
+    free(wsis);
+}
+
+int main(int argc, char **argv) {
+    size_t max_size = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_MAX_SIZE_DEFAULT;
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+
+    memory_pool_t pool;
+    memory_pool_init(&pool, 64 * 1024 * 1024);
+    memory_pool_bind_thread(&pool);
+    coarse_clock_update();
+    
+    /* 注册表的 DEBUG/INFO 日志会淹没结果 */
+    logger_set_level(LOG_LEVEL_WARN);
+
+    bench_deserialize();
+    bench_codec();
+
+    printf("注册表查找 (ns/次)\n");
+    printf("  %-27s %8s %9s %9s\n", "函数", "规模", "命中", "未命中");
+    for (size_t i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++) {
+        if (bench_sizes[i] > max_size) break;
+        bench_room_lookup(bench_sizes[i], &rng);
+    }
+    for (size_t i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++) {
+        if (bench_sizes[i] > max_size) break;
+        bench_wsi_lookup(bench_sizes[i], &rng);
+    }
+
+    memory_pool_bind_thread(NULL);
+    memory_pool_cleanup(&pool);
+    return 0;
+}
@@ -6,6 +6,12 @@
 #include <libwebsockets.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+
+#include "id_table.h"
+#include "slot_region.h"
+#include "timer_wheel.h"
+#include "utilities.h"
 
 struct room_s;
 typedef struct room_s room_t;
@@ -17,30 +23,202 @@ typedef enum {
     CLIENT_STATE_DISCONNECTING
 } client_state_t;
 
+struct frame_s;
+
+/* Wire encoding negotiated through the WebSocket subprotocol */
+typedef enum {
+    CLIENT_ENCODING_JSON = 0,      /* "webrtc-signaling": JSON text frames */
+    CLIENT_ENCODING_MSGPACK        /* "webrtc-signaling-msgpack": MessagePack binary frames */
+} client_encoding_t;
+
+/* Default per-client outbound high-water mark (frames); ring holds twice this */
+#define CLIENT_SEND_HIGH_WATER_DEFAULT 32
+
+/* Default cap on a reassembled inbound message (bytes) */
+#define CLIENT_MAX_MESSAGE_DEFAULT (64 * 1024)
+
+/* Inbound message being reassembled from fragments, in pool storage */
+typedef struct client_recv_buf_s {
+    unsigned char *data;           /* NULL when no message is pending */
+    size_t len;
+    size_t cap;
+} client_recv_buf_t;
+
+/* Suggested per-client admission limits; a registry starts unlimited */
+#define CLIENT_MSG_RATE_DEFAULT 100          /* Messages per second */
+#define CLIENT_MSG_BURST_DEFAULT 200         /* Messages accepted at once after idling */
+#define CLIENT_BYTE_RATE_DEFAULT (256 * 1024) /* Inbound bytes per second */
+#define CLIENT_BYTE_BURST_DEFAULT (1024 * 1024)
+
+/* Frames shorter than this skip permessage-deflate by default (bytes) */
+#define CLIENT_COMPRESS_MIN_DEFAULT 256
+
+/* permessage-deflate state of a connection, known after the first write */
+typedef enum {
+    CLIENT_DEFLATE_UNKNOWN = 0,    /* Nothing written yet */
+    CLIENT_DEFLATE_NONE,           /* Extension not negotiated */
+    CLIENT_DEFLATE_STORE,          /* Compressor at level 0 (small frames) */
+    CLIENT_DEFLATE_COMPRESS        /* Compressor at the configured level */
+} client_deflate_t;
+
+/* A queued frame and the start of the dispatch that produced it */
+typedef struct client_send_slot_s {
+    struct frame_s *frame;
+    uint64_t dispatch_ns;          /* Monotonic ns, 0 when not measured */
+} client_send_slot_t;
+
+/* Bounded outbound ring, drained from LWS_CALLBACK_SERVER_WRITEABLE */
+typedef struct client_send_queue_s {
+    client_send_slot_t *slots;     /* Ring storage, allocated on first enqueue */
+    uint16_t capacity;
+    uint16_t head;
+    uint16_t count;
+    uint16_t high_water;           /* Above this, droppable frames are shed */
+} client_send_queue_t;
+
+/* 跨分片控制操作，经由分片的无锁控制栈传递 */
+typedef enum {
+    CLIENT_CONTROL_NONE = 0,
+    CLIENT_CONTROL_DISCONNECT,     /* 连接已关闭：由所属分片把客户端移出房间 */
+    CLIENT_CONTROL_RELEASE         /* 已移出房间：由连接所在分片释放槽位 */
+} client_control_t;
+
+struct client_registry_s;
+struct ice_batch_s;
+struct metrics_shard_s;
+
+/* 客户端句柄：槽位索引 + 代数，槽位复用后旧句柄自动失效 */
+typedef struct client_handle_s {
+    uint32_t index;                /* Slot index in registry */
+    uint32_t generation;           /* Slot generation (0 = invalid) */
+} client_handle_t;
+
+/* Where a client's real connection lives (cluster mode) */
+typedef struct client_origin_s {
+    id128_t id;                    /* Client ID assigned by the connection's node */
+    client_handle_t handle;        /* Handle in that node's shard registry */
+    uint16_t node;                 /* Node holding the connection */
+    uint16_t shard;                /* Shard (service thread) on that node */
+    client_encoding_t encoding;    /* Encoding of the connection */
+} client_origin_t;
+
 typedef struct client_s {
-    char id[37];                   /* UUID string (36 chars + null) */
+    /* Hot: read on every send, write and lookup; kept within the first cache line */
+    _Alignas(CACHE_LINE_SIZE)
     struct lws *wsi;               /* WebSocket connection */
     room_t *room;                  /* Joined room */
-    client_state_t state;          /* Client State */
+    struct client_registry_s *registry; /* Registry of the connection's service thread */
+    client_send_queue_t sendq;     /* Outbound frames awaiting WRITEABLE */
+    uint32_t generation;           /* Bumped each time the slot is reused */
     uint32_t last_activity;        /* Last message timestamp */
+    client_state_t state;          /* Client State */
+    client_encoding_t encoding;    /* Outbound frame encoding */
+    client_deflate_t deflate;      /* Current permessage-deflate level */
+    bool is_alive;                 /* Connection health flag */
+    uint16_t room_slot;            /* Index in the room's participant array while room is set */
+    
+    /* Shard routing: the connection lives on registry->shard, room state on owner_shard.
+     * Written by other threads, so kept off the hot line */
+    _Alignas(CACHE_LINE_SIZE)
+    atomic_uint owner_shard;       /* Shard whose thread handles this client's messages */
+    atomic_uint inflight;          /* Forwarded messages not yet handled */
+    uint32_t route_shard;          /* Shard the connection thread currently forwards to */
+    client_control_t control_op;   /* Pending control operation */
+    struct client_s *control_next; /* Link in a shard's control stack */
+    
+    /* Cold: identity, statistics and rarely used state */
+    id128_t id;                    /* Binary UUID, formatted only when sent */
     uint32_t connect_time;         /* Connection timestamp */
+    uint32_t join_time;            /* Time the current room was joined */
+    uint32_t active_pos;           /* Position in registry active list */
     uint64_t messages_sent;        /* Messages sent */
     uint64_t messages_received;    /* Messages received */
-    bool is_alive;                 /* Connection health flag */
+    uint64_t frames_dropped;       /* Outbound frames shed under backpressure */
+    client_recv_buf_t recv;        /* Partial inbound message */
+    token_bucket_t msg_bucket;     /* Admission: inbound messages per second */
+    token_bucket_t byte_bucket;    /* Admission: inbound bytes per second */
+    uint64_t messages_rejected;    /* Inbound messages dropped by admission */
+    bool recv_rejected;            /* Rest of the current inbound message is being dropped */
+    timer_node_t timeout_node;     /* Link in the registry's timeout wheel */
+    struct ice_batch_s *ice_batch; /* Candidates held for this client, owned by owner_shard */
+    bool ice_batch_ok;             /* Accepts coalesced "ice-candidates" frames (join-room) */
+    int16_t cluster_node;          /* Node hosting the joined remote room (-1: none), owned by owner_shard */
+    client_origin_t origin;        /* Proxies only: the connection this client stands in for */
+    id128_t resume_token;          /* Secret a reconnect presents to take over the session (zero: none) */
+    struct client_s *resume_from;  /* Detached client this connection takes over, set before hand-off */
+    struct client_s *detached_prev; /* Links in owner_shard's list of detached clients */
+    struct client_s *detached_next;
+    uint32_t detached_until;       /* End of the reconnect grace period */
+    uint32_t replay_seq;           /* First room replay entry addressed to this client while detached */
+    bool detached;                 /* Connection lost, slot and room membership held, owned by owner_shard */
 } client_t;
 
+_Static_assert(offsetof(client_t, owner_shard) == CACHE_LINE_SIZE,
+               "client_t hot fields must fit in one cache line");
+
+/* Hands a frame to the thread that owns the client's connection */
+typedef int (*client_forward_fn)(void *arg, client_t *client, struct frame_s *frame);
+
+/*
+ * Outbound compression counters. Timing and ratio are sampled (one write in
+ * CLIENT_DEFLATE_SAMPLE_INTERVAL of each kind, counted separately so that
+ * alternating sizes cannot alias) to keep clock reads and the ratio probe
+ * off the common path.
+ */
+typedef struct client_deflate_stats_s {
+    uint64_t frames;               /* Frames written through the compressor */
+    uint64_t bytes;                /* Their uncompressed size */
+    uint64_t skipped;              /* Frames below the threshold, sent stored */
+    uint64_t probe_in;             /* Sampled uncompressed bytes */
+    uint64_t probe_out;            /* Their deflated size */
+    uint64_t cpu_ns;               /* Thread CPU time of sampled compressed writes */
+    uint64_t cpu_bytes;            /* Bytes in those writes */
+    uint64_t plain_cpu_ns;         /* Same for sampled uncompressed writes */
+    uint64_t plain_cpu_bytes;
+} client_deflate_stats_t;
+
+#define CLIENT_DEFLATE_SAMPLE_INTERVAL 32
+
+struct z_stream_s;
+
+/* Called for each client whose idle time exceeded the registry timeout */
+typedef void (*client_timeout_fn)(void *arg, client_t *client);
+
 void client_init(client_t *client, struct lws *wsi);
 void client_cleanup(client_t *client);
 void client_update_activity(client_t *client);
-bool client_is_timed_out(const client_t *client, uint32_t timeout_sec);
 
 int client_send_message(client_t *client, const char *event, const char *data);
+int client_send_frame(client_t *client, struct frame_s *frame);
+int client_on_writable(client_t *client);
+
+int client_recv_append(client_t *client, const void *data, size_t len);
+void client_recv_reset(client_t *client);
+
+bool client_admit(client_t *client, size_t len, bool complete, uint64_t now_ns);
 
 typedef struct client_registry_s {
-    client_t *clients;
+    client_t *clients;             /* Slot array, base of slots */
     size_t max_clients;
     size_t active_count;
     uint64_t total_connections;
+    slot_region_t slots;           /* Reserved slot storage, committed in chunks */
+    uint32_t *active_slots;        /* Dense list of live slot indices (reserved, paged in on use) */
+    id_table_t by_id;              /* Client ID -> client_t* index */
+    uint16_t send_high_water;      /* Outbound high-water mark for new clients */
+    unsigned shard;                /* Shard (service thread) these connections live on */
+    client_forward_fn forward;     /* Used for sends issued from other threads */
+    void *forward_arg;
+    timer_wheel_t timeouts;        /* Idle deadlines of live connections */
+    uint32_t timeout_sec;          /* Idle timeout (0 = disabled), set before first add */
+    size_t max_message_size;       /* Inbound messages longer than this close the connection */
+    token_rate_t msg_rate;         /* Per-client message admission (unlimited by default) */
+    token_rate_t byte_rate;        /* Per-client byte admission (unlimited by default) */
+    bool compress;                 /* permessage-deflate offered to these connections */
+    size_t compress_min_size;      /* Smaller frames are sent stored */
+    struct z_stream_s *deflate_probe; /* Raw deflate used to estimate the ratio */
+    client_deflate_stats_t deflate_stats;
+    struct metrics_shard_s *metrics; /* Counters of the owning thread (or NULL) */
 } client_registry_t;
 
 int client_registry_init(client_registry_t *reg, size_t max_clients);
@@ -49,10 +227,31 @@ void client_registry_cleanup(client_registry_t *reg);
 
 client_t *client_registry_add(client_registry_t *reg, struct lws *wsi);
 
+client_t *client_registry_add_proxy(client_registry_t *reg, const client_origin_t *origin);
+
+void client_registry_unlink_id(client_registry_t *reg, client_t *client);
+
+void client_registry_rekey(client_registry_t *reg, client_t *client, const id128_t *id);
+
 void client_registry_remove(client_registry_t *reg, client_t *client);
 
 client_t *client_registry_find_by_wsi(client_registry_t *reg, struct lws *wsi);
 
+client_t *client_registry_find_by_id(const client_registry_t *reg, const id128_t *id);
+
+client_handle_t client_registry_handle(const client_registry_t *reg, const client_t *client);
+
+client_t *client_registry_get(client_registry_t *reg, client_handle_t handle);
+
 size_t client_registry_get_active_count(const client_registry_t *reg);
 
+client_t *client_registry_active_at(client_registry_t *reg, size_t pos);
+
+void client_registry_bind_thread(const client_registry_t *reg);
+
+size_t client_registry_trim(client_registry_t *reg, uint32_t now, uint32_t idle_sec);
+
+size_t client_registry_expire_timeouts(client_registry_t *reg, uint32_t now,
+                                       client_timeout_fn on_timeout, void *arg);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,188 @@
+#pragma once
+
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "messages.h"
+#include "utilities.h"
+
+/* 集群节点数上限，以及每个节点在一致性哈希环上的虚拟节点数 */
+#define CLUSTER_MAX_NODES 64
+#define CLUSTER_VNODES 64
+
+/* 节点地址 "host:port" 的最大长度 */
+#define CLUSTER_ADDR_LEN 256
+
+/* 每个对端待发送的记录数上限，超过后丢弃新记录 */
+#define CLUSTER_PENDING_MAX 65536
+
+/* 单条记录的最大长度 (字节)，超过时认为对端协议错误并断开 */
+#define CLUSTER_RECORD_MAX (16u * 1024 * 1024)
+
+/* 记录头：u32 长度 (不含自身) + 32 字节固定字段，之后是负载 */
+#define CLUSTER_HEADER_SIZE 36
+
+/* 节点间记录类型 */
+typedef enum {
+    CLUSTER_REC_HELLO = 1,         /* 连接建立后的第一条记录，告知对端本节点编号 */
+    CLUSTER_REC_CLIENT_MSG,        /* 客户端消息：连接所在节点 -> 房间所在节点 */
+    CLUSTER_REC_DELIVER,           /* 发送帧：房间所在节点 -> 连接所在节点 */
+    CLUSTER_REC_RELEASE            /* 客户端离开远程房间或断开：释放房间节点上的代理 */
+} cluster_record_type_t;
+
+/* 记录标志 */
+#define CLUSTER_REC_FLAG_BINARY    0x1 /* 负载为 MessagePack 编码 */
+#define CLUSTER_REC_FLAG_DROPPABLE 0x2 /* DELIVER: 帧在背压下可以被丢弃 */
+
+/* 解析后的一条记录；payload 只在回调期间有效 */
+typedef struct cluster_record_s {
+    cluster_record_type_t type;
+    uint8_t flags;                 /* CLUSTER_REC_FLAG_* */
+    uint16_t node;                 /* 发送记录的节点 */
+    client_origin_t origin;        /* 真实连接所在的位置和客户端 ID */
+    const unsigned char *payload;
+    size_t payload_len;
+} cluster_record_t;
+
+/* 在 backplane 线程上调用：收到一条记录 */
+typedef void (*cluster_deliver_fn)(void *arg, const cluster_record_t *rec);
+
+/* 在 backplane 线程上调用：与某节点的入站连接断开 (对端可能已宕机) */
+typedef void (*cluster_node_down_fn)(void *arg, unsigned node);
+
+/* 等待写出的一条记录：头部就地编码，负载引用共享的帧或消息，不复制 */
+typedef struct cluster_pending_s {
+    unsigned char header[CLUSTER_HEADER_SIZE];
+    frame_t *frame;                /* 负载所属的帧 (或 NULL) */
+    message_t *message;            /* 负载所属的消息 (或 NULL) */
+    const unsigned char *payload;
+    size_t payload_len;
+} cluster_pending_t;
+
+/* 待发送记录的数组 */
+typedef struct cluster_batch_s {
+    cluster_pending_t *items;
+    size_t count;
+    size_t capacity;
+} cluster_batch_t;
+
+/* 到一个对端节点的出站连接 */
+typedef struct cluster_peer_s {
+    char host[CLUSTER_ADDR_LEN];
+    char port[8];
+    int fd;                        /* 出站套接字，-1 表示未连接 */
+    bool connecting;               /* 非阻塞 connect 尚未完成 */
+    uint64_t retry_at;             /* 下次重连时间 (毫秒) */
+    atomic_bool up;                /* 连接可用：生产者据此快速失败 */
+    pthread_mutex_t lock;          /* 保护 pending */
+    cluster_batch_t pending;       /* 服务线程追加的记录 */
+    cluster_batch_t sending;       /* backplane 线程正在写出的记录 */
+    size_t send_pos;               /* sending 中下一条未写完的记录 */
+    size_t send_off;               /* 该记录已写出的字节数 (头部 + 负载) */
+} cluster_peer_t;
+
+/* 来自其他节点的入站连接 */
+typedef struct cluster_inbound_s {
+    int fd;
+    int node;                      /* 由 HELLO 得知，-1 表示未知 */
+    unsigned char *buf;            /* 尚未凑成完整记录的字节 */
+    size_t len;
+    size_t cap;
+} cluster_inbound_t;
+
+/* 哈希环上的一个点 */
+typedef struct cluster_point_s {
+    uint64_t hash;
+    uint32_t node;
+} cluster_point_t;
+
+/*
+ * 集群：静态成员表、一致性哈希环和节点间的 TCP 全互联 (backplane)。
+ * 每对节点各有一条单向的出站连接；一个 backplane 线程负责所有收发，
+ * 服务线程只在对端的 pending 数组中追加记录，一次唤醒后整批用 writev 写出。
+ */
+typedef struct cluster_s {
+    unsigned node_count;
+    unsigned self;                 /* 本节点编号 (成员表中的下标) */
+    cluster_point_t *ring;         /* node_count * CLUSTER_VNODES 个点，按哈希值排序 */
+    size_t ring_size;
+    cluster_peer_t peers[CLUSTER_MAX_NODES];
+    cluster_inbound_t inbound[CLUSTER_MAX_NODES * 2];
+    size_t inbound_count;
+    int listen_fd;
+    int wake_fds[2];               /* 自管道：有新记录或需要停止时唤醒 backplane 线程 */
+    atomic_bool running;
+    pthread_t thread;
+    cluster_deliver_fn deliver;
+    cluster_node_down_fn node_down;
+    void *arg;
+
+    /* 统计信息 */
+    atomic_uint_fast64_t records_sent;
+    atomic_uint_fast64_t records_received;
+    atomic_uint_fast64_t records_dropped;
+} cluster_t;
+
+/**
+ * @brief 解析成员表并监听本节点的端口
+ * @param cluster 要初始化的集群
+ * @param nodes 逗号分隔的 "host:port" 列表，所有节点必须使用相同的列表
+ * @param self 本节点在列表中的下标
+ * @param deliver 收到记录的回调
+ * @param node_down 入站连接断开的回调 (可以为 NULL)
+ * @param arg 传给回调的参数
+ * @return 成功返回 0，成员表无效返回 -1，内存不足返回 -2，监听失败返回 -3
+ */
+int cluster_init(cluster_t *cluster, const char *nodes, unsigned self,
+                 cluster_deliver_fn deliver, cluster_node_down_fn node_down, void *arg);
+
+/**
+ * @brief 启动 backplane 线程并开始连接其他节点
+ * @return 成功返回 0，线程创建失败返回 -1
+ */
+int cluster_start(cluster_t *cluster);
+
+/**
+ * @brief 停止 backplane 线程 (未写出的记录被丢弃)
+ */
+void cluster_stop(cluster_t *cluster);
+
+/**
+ * @brief 关闭所有连接并释放资源
+ */
+void cluster_cleanup(cluster_t *cluster);
+
+/**
+ * @brief 房间 ID 所属的节点 (忽略 ID 中的分片字节)
+ */
+unsigned cluster_owner(const cluster_t *cluster, const id128_t *room_id);
+
+/**
+ * @brief 房间 ID 是否哈希到本节点
+ */
+static inline bool cluster_is_local(const cluster_t *cluster, const id128_t *room_id) {
+    return cluster_owner(cluster, room_id) == cluster->self;
+}
+
+/**
+ * @brief 向节点发送一条记录 (任意线程)
+ *
+ * 负载取自 frame 或 message (二者至多一个非 NULL，都为 NULL 时记录没有负载)，
+ * 记录写出前持有其引用，负载字节不复制。
+ * @param cluster 集群
+ * @param node 目标节点 (不能是本节点)
+ * @param rec 记录头字段 (payload 字段被忽略)
+ * @param frame 负载为整个帧 (或 NULL)
+ * @param message 负载为消息的原始帧 raw (或 NULL)
+ * @return 成功返回 0，目标不可达返回 -1，待发送记录过多返回 -2，内存不足返回 -3
+ */
+int cluster_send(cluster_t *cluster, unsigned node, const cluster_record_t *rec,
+                 frame_t *frame, message_t *message);
+
+#endif
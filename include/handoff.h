@@ -0,0 +1,108 @@
+#pragma once
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "room.h"
+#include "utilities.h"
+
+/* 热重启时监听套接字经此环境变量交给新进程 (值为描述符编号) */
+#define HANDOFF_LISTEN_FD_ENV "REDRTC_LISTEN_FD"
+
+/* 新进程中监听套接字固定的描述符编号 (0..2 之后的第一个) */
+#define HANDOFF_LISTEN_FD 3
+
+/* 监听队列长度 */
+#define HANDOFF_LISTEN_BACKLOG 1024
+
+/* 快照文件头：魔数 + 版本 */
+#define HANDOFF_SNAPSHOT_MAGIC "REDRTCS1"
+#define HANDOFF_SNAPSHOT_VERSION 1
+
+/*
+ * 房间快照的追加缓冲区，每个分片在自己的线程上写入本分片的房间。
+ * 记录格式 (本机字节序，只在同一台机器上的新旧进程之间传递)：
+ *   id[16] created_at:u32 capacity:u16 members:u16 name_len:u8 name[name_len] member_id[16]*members
+ */
+typedef struct handoff_snapshot_s {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+    uint32_t rooms;                /* 记录的房间数 */
+    uint32_t clients;              /* 记录的成员数 */
+} handoff_snapshot_t;
+
+/* 从快照恢复的一个房间，members 只在回调期间有效 */
+typedef struct handoff_room_s {
+    id128_t id;
+    uint32_t created_at;
+    uint16_t capacity;
+    uint16_t member_count;
+    const id128_t *members;        /* 重启前的成员 (客户端 ID) */
+    char name[64];
+} handoff_room_t;
+
+typedef void (*handoff_room_fn)(void *arg, const handoff_room_t *room);
+
+/**
+ * @brief 取得服务端口的监听套接字
+ *
+ * 环境变量 HANDOFF_LISTEN_FD_ENV 存在时沿用旧进程交来的套接字 (必须处于监听状态)，
+ * 否则新建套接字并绑定端口。返回的描述符是非阻塞的，并带有 FD_CLOEXEC。
+ * @param iface 监听的地址或网络接口名 (NULL 表示所有地址)
+ * @param port 端口
+ * @param inherited 输出是否为旧进程交来的套接字
+ * @return 成功返回描述符，失败返回 -1
+ */
+int handoff_listen(const char *iface, int port, bool *inherited);
+
+/**
+ * @brief 启动接替的新进程，把监听套接字交给它
+ *
+ * 子进程中监听套接字固定为 HANDOFF_LISTEN_FD，其余描述符 (标准输入输出除外) 全部关闭。
+ * 只有 exec 成功后才返回子进程号，exec 失败时回收子进程并返回 -1。
+ * @param path 可执行文件路径
+ * @param argv 新进程的参数 (与旧进程相同)
+ * @param listen_fd 监听套接字
+ * @return 成功返回子进程号，失败返回 -1
+ */
+pid_t handoff_spawn(const char *path, char *const argv[], int listen_fd);
+
+/**
+ * @brief 把一个房间及其成员 ID 追加到快照缓冲区
+ * @param snap 快照缓冲区 (初始为全零)
+ * @param room 房间
+ * @return 成功返回 0x0，内存不足返回 -1
+ */
+int handoff_snapshot_add_room(handoff_snapshot_t *snap, const room_t *room);
+
+/**
+ * @brief 释放快照缓冲区
+ * @param snap 快照缓冲区
+ */
+void handoff_snapshot_free(handoff_snapshot_t *snap);
+
+/**
+ * @brief 合并各分片的快照写入文件 (先写临时文件再改名，新进程不会读到一半的文件)
+ * @param path 快照文件路径
+ * @param parts 各分片的快照缓冲区
+ * @param count 缓冲区个数
+ * @return 成功返回 0x0，写入失败返回 -1
+ */
+int handoff_snapshot_write(const char *path, const handoff_snapshot_t *parts, size_t count);
+
+/**
+ * @brief 读取快照文件，对每个房间调用一次回调，读完后删除文件
+ * @param path 快照文件路径
+ * @param fn 房间回调
+ * @param arg 回调参数
+ * @return 恢复的房间数，文件不存在返回 0，格式无效返回 -1
+ */
+int handoff_snapshot_load(const char *path, handoff_room_fn fn, void *arg);
+
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+#ifndef ID_TABLE_H
+#define ID_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utilities.h"
+
+/* 开放寻址哈希表槽位，value 为 NULL 表示空槽 */
+typedef struct id_table_entry_s {
+    id128_t key;
+    void *value;
+} id_table_entry_t;
+
+/* 128 位 ID -> 指针 的开放寻址哈希表 (线性探测，删除时回移，无墓碑) */
+typedef struct id_table_s {
+    id_table_entry_t *entries;     /* 槽位数组 (容量为 2 的幂) */
+    size_t mask;                   /* 容量 - 1 */
+    size_t count;                  /* 已占用槽位数 */
+} id_table_t;
+
+/**
+ * @brief 初始化哈希表
+ * @param table 要初始化的哈希表
+ * @param max_entries 最多同时存放的条目数，容量取其两倍以上的 2 的幂
+ * @return 成功返回 0x0，内存分配失败返回 -1
+ */
+int id_table_init(id_table_t *table, size_t max_entries);
+
+/**
+ * @brief 释放哈希表
+ * @param table 要清理的哈希表
+ */
+void id_table_cleanup(id_table_t *table);
+
+/**
+ * @brief 插入条目
+ * @param table 哈希表
+ * @param key 键
+ * @param value 值 (不能为 NULL)
+ * @return 成功返回 0x0，表已满返回 -1，键已存在返回 -2
+ */
+int id_table_insert(id_table_t *table, const id128_t *key, void *value);
+
+/**
+ * @brief 查找条目
+ * @param table 哈希表
+ * @param key 键
+ * @return 找到则返回值，否则返回 NULL
+ */
+void *id_table_find(const id_table_t *table, const id128_t *key);
+
+/**
+ * @brief 删除条目
+ * @param table 哈希表
+ * @param key 键
+ * @return 成功返回 0x0，未找到返回 -1
+ */
+int id_table_remove(id_table_t *table, const id128_t *key);
+
+#endif
@@ -0,0 +1,74 @@
+#pragma once
+
+#ifndef JSON_SCAN_H
+#define JSON_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * 信令编解码的字节扫描内核：在字符串内容中定位下一个需要处理的字节 (引号、反斜杠、
+ * 控制字符)，以及跳过 ASCII 前缀供 UTF-8 校验使用。按 16/32 字节块比较，
+ * 首次调用时按 CPU 选择实现 (x86-64: AVX2 或 SSE2，AArch64: NEON，其余为 8 字节 SWAR)。
+ *
+ * 没有按块输出结构字符 ({}[]:," 和 \) 位掩码的分类内核：中继解析必须逐字节校验转发的负载，
+ * 时间几乎全在字符串内容上，而 SDP 中的冒号和转义让位掩码的逐位遍历比直接定位停止字节更慢。
+ */
+typedef enum {
+    JSON_SCAN_SCALAR = 0,          /* 每次 8 字节的 SWAR，任何平台可用 */
+    JSON_SCAN_SSE2,
+    JSON_SCAN_AVX2,
+    JSON_SCAN_NEON,
+    JSON_SCAN_IMPL_COUNT
+} json_scan_impl_t;
+
+/**
+ * @brief 字符串内容中第一个引号、反斜杠或控制字符 (< 0x20) 的位置
+ *
+ * 既是解析时字符串的结束/转义位置，也是序列化时需要转义的第一个字节。
+ * @param p 字符串内容 (开引号之后)
+ * @param len 可读字节数
+ * @return 该字节的下标，没有时返回 len
+ */
+size_t json_scan_string(const char *p, size_t len);
+
+/**
+ * @brief ASCII 前缀的长度 (第一个最高位为 1 的字节的下标)
+ * @param p 字节
+ * @param len 字节数
+ * @return 前缀长度，全部为 ASCII 时返回 len
+ */
+size_t json_scan_ascii(const unsigned char *p, size_t len);
+
+/**
+ * @brief 严格的 UTF-8 校验 (拒绝过长编码、代理项和超出 U+10FFFF 的码点)
+ *
+ * ASCII 段由块内核跳过，只有多字节序列逐个解码。
+ * @param p 字节
+ * @param len 字节数
+ * @return 合法时返回 true
+ */
+bool json_utf8_valid(const unsigned char *p, size_t len);
+
+/**
+ * @brief 当前使用的实现
+ * @return 实现编号
+ */
+json_scan_impl_t json_scan_impl(void);
+
+/**
+ * @brief 实现的名称 ("scalar"、"sse2"、"avx2"、"neon")
+ * @param impl 实现编号
+ * @return 名称，编号无效时返回 NULL
+ */
+const char *json_scan_impl_name(json_scan_impl_t impl);
+
+/**
+ * @brief 切换实现 (基准测试对比各实现时使用，服务运行期间不要调用)
+ * @param impl 实现编号
+ * @return 成功返回 0x0，本机不支持该实现返回 -1
+ */
+int json_scan_select(json_scan_impl_t impl);
+
+#endif
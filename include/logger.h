@@ -0,0 +1,114 @@
+#pragma once
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+
+/* 日志级别：数值越大越详细 */
+typedef enum {
+    LOG_LEVEL_ERROR = 0,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG
+} log_level_t;
+
+/*
+ * 编译期级别：更详细的日志调用在预处理后条件恒假，整段被编译器删除
+ * (参数也不会求值)。发布版本默认保留到 INFO，可用 -DLOG_COMPILE_LEVEL=... 覆盖。
+ */
+#ifndef LOG_COMPILE_LEVEL
+#ifdef NDEBUG
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#else
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+/* 运行期级别，由 logger_set_level() 设置 */
+extern atomic_int logger_level;
+
+static inline bool logger_enabled(log_level_t level) {
+    return (int)level <= atomic_load_explicit(&logger_level, memory_order_relaxed);
+}
+
+/* 每个调用点的限流状态：每 LOG_RATELIMIT_INTERVAL 秒最多输出 LOG_RATELIMIT_BURST 条 */
+#define LOG_RATELIMIT_INTERVAL 5
+#define LOG_RATELIMIT_BURST 10
+
+typedef struct log_ratelimit_s {
+    atomic_uint_least32_t window;  /* 当前窗口的开始时间 (粗粒度时钟，秒) */
+    atomic_uint_least32_t count;   /* 窗口内的调用次数 */
+    atomic_uint_least32_t suppressed; /* 窗口内被省略的条数 */
+} log_ratelimit_t;
+
+/**
+ * @brief 启动后台格式化线程；之后的日志写入调用线程的环形缓冲区
+ * @param level 运行期级别
+ * @return 成功返回 0，线程创建失败返回 -1 (日志退回同步输出)
+ */
+int logger_start(log_level_t level);
+
+/**
+ * @brief 输出所有已缓冲的日志并停止后台线程，之后的日志同步输出
+ */
+void logger_stop(void);
+
+void logger_set_level(log_level_t level);
+
+/**
+ * @brief 写入一条日志 (通常经由 LOG_* 宏调用)
+ *
+ * 后台线程运行时只把格式串指针和原始参数拷贝进本线程的无锁环形缓冲区，
+ * 格式化和写出都在后台线程完成；缓冲区满时丢弃并计数。格式串必须是字符串常量，
+ * 支持标准的整数、浮点、%s、%c 和 %p 转换，不支持 * 宽度和 %n。
+ */
+void logger_write(log_level_t level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief 限流判断 (LOG_RATELIMITED 使用)
+ * @param rl 调用点的限流状态
+ * @param suppressed 新窗口开始时输出上一窗口省略的条数，否则不修改
+ * @return 本次允许输出返回 true
+ */
+bool logger_ratelimit(log_ratelimit_t *rl, uint32_t *suppressed);
+
+/* 因环形缓冲区已满丢弃的日志条数 */
+uint64_t logger_dropped(void);
+
+#define LOG_AT(level, ...) do {                                                 \
+    if ((level) <= LOG_COMPILE_LEVEL && logger_enabled(level)) {               \
+        logger_write((level), __VA_ARGS__);                                     \
+    }                                                                           \
+} while (0)
+
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+/* 可能被客户端反复触发的日志：按调用点限流，新窗口的第一条之前报告省略的条数 */
+#define LOG_RATELIMITED(level, ...) do {                                        \
+    if ((level) <= LOG_COMPILE_LEVEL && logger_enabled(level)) {               \
+        static log_ratelimit_t log_rl_;                                         \
+        uint32_t log_suppressed_ = 0;                                           \
+        if (logger_ratelimit(&log_rl_, &log_suppressed_)) {                     \
+            if (log_suppressed_) {                                              \
+                logger_write((level), "(省略了 %u 条重复日志)", log_suppressed_); \
+            }                                                                   \
+            logger_write((level), __VA_ARGS__);                                 \
+        }                                                                       \
+    }                                                                           \
+} while (0)
+
+/* 以二进制参数记录 128 位 ID，格式化推迟到后台线程 (与 id128_format 的输出相同) */
+#define LOG_ID_FMT "%08" PRIx64 "-%04" PRIx64 "-%04" PRIx64 "-%04" PRIx64 "-%012" PRIx64
+#define LOG_ID_ARGS(id)                                                        \
+    (uint64_t)((id)->hi >> 32), (uint64_t)(((id)->hi >> 16) & 0xffff),          \
+    (uint64_t)((id)->hi & 0xffff), (uint64_t)((id)->lo >> 48),                  \
+    (uint64_t)((id)->lo & 0xffffffffffffULL)
+
+#endif
@@ -6,6 +6,9 @@
 #include <jansson.h>
 #include <libwebsockets.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+
+#include "client.h"
 
 #define EVENT_CLIENT_ID         "client-id"
 #define EVENT_JOIN_ROOM         "join-room"
@@ -17,11 +20,54 @@
 #define EVENT_ROOM_CREATED      "room-created"
 #define EVENT_ERROR             "error"
 #define EVENT_PONG              "pong"
+#define EVENT_RESUME_ROOM       "resume-room"
+/* 仅由服务器下发：合并后的多个 ICE candidate，以及房间成员的增量变化 */
+#define EVENT_ICE_CANDIDATES    "ice-candidates"
+#define EVENT_PARTICIPANT_JOINED "participant-joined"
+#define EVENT_PARTICIPANT_LEFT  "participant-left"
+/* 热重启前的提示：客户端在 reconnectAfterMs 后重连，错开新进程的建连高峰 */
+#define EVENT_SERVER_SHUTDOWN   "server-shutdown"
+/* 恢复会话成功：新连接接替断线前的客户端 ID 和房间，随后重放暂离期间的帧 */
+#define EVENT_RESUMED           "resumed"
+
+/* 事件类型：协议中的事件名在收发时一次映射为枚举，之后按枚举分派 */
+typedef enum {
+    MESSAGE_EVENT_UNKNOWN = 0,
+    MESSAGE_EVENT_CLIENT_ID,
+    MESSAGE_EVENT_JOIN_ROOM,
+    MESSAGE_EVENT_LEAVE_ROOM,
+    MESSAGE_EVENT_OFFER,
+    MESSAGE_EVENT_ANSWER,
+    MESSAGE_EVENT_ICE_CANDIDATE,
+    MESSAGE_EVENT_PARTICIPANTS_LIST,
+    MESSAGE_EVENT_ROOM_CREATED,
+    MESSAGE_EVENT_ERROR,
+    MESSAGE_EVENT_PONG,
+    MESSAGE_EVENT_RESUME_ROOM,
+    MESSAGE_EVENT_COUNT
+} message_event_t;
+
+message_event_t message_event_lookup(const char *name, size_t len);
+const char *message_event_name(message_event_t type);
+
+/* 中继快速路径：原始帧中需要的字段位置 (相对 raw 的偏移量) */
+typedef struct relay_view_s {
+    size_t target_off;             /* targetClientId 字符串内容 */
+    size_t target_len;
+    size_t payload_off;            /* offer/answer/candidate 的原始 JSON 值 */
+    size_t payload_len;            /* 0 表示负载缺失 */
+} relay_view_t;
 
 typedef struct message_s {
-    char *event;
+    message_event_t type;          /* 事件类型，未知事件为 MESSAGE_EVENT_UNKNOWN */
+    const char *event;             /* 已知事件指向常量，其余保存在消息块末尾 */
     json_t *data;
-    size_t ref_count; 
+    atomic_size_t ref_count;       /* 原子计数：消息可被转交给其他分片 */
+    char *raw;                     /* 中继消息的原始帧副本，普通消息为 NULL */
+    size_t raw_len;
+    relay_view_t relay;
+    bool binary;                   /* raw 为 MessagePack 编码 (来自二进制子协议) */
+    uint64_t received_ns;          /* 收到完整消息的时间 (单调时钟纳秒)，0 表示不计入延迟统计 */
 } message_t;
 
 
@@ -32,31 +78,121 @@ void message_unref(message_t *msg);
 
 char *message_serialize(const message_t *msg);
 
-message_t *message_deserialize(const char *json_str);
+message_t *message_deserialize(const char *buf, size_t len);
+message_t *message_deserialize_relay(const char *buf, size_t len);
+message_t *message_deserialize_msgpack(const unsigned char *buf, size_t len);
 void message_destroy(message_t *msg);
 
+const char *message_relay_payload_key(message_event_t type);
+
+/* 帧在背压下可以被丢弃 (例如过时的 ICE candidate) */
+#define FRAME_FLAG_DROPPABLE 0x1
+/* 帧为 MessagePack 编码，以二进制 WebSocket 帧发送 */
+#define FRAME_FLAG_BINARY    0x2
+
+/* 引用计数的发送帧：信封只序列化一次，带 LWS_PRE 头部空间，可被多个接收者共享 */
+typedef struct frame_s {
+    atomic_size_t ref_count;       /* 原子计数：接收者可能分布在不同服务线程 */
+    size_t len;                    /* 负载长度 (不含 LWS_PRE) */
+    uint32_t flags;                /* FRAME_FLAG_* */
+    _Atomic(struct frame_s *) binary; /* JSON 帧的 MessagePack 版本，首次发给二进制客户端时生成 */
+    unsigned char buf[];           /* LWS_PRE + len + 1 */
+} frame_t;
+
+frame_t *frame_alloc(size_t len);
+frame_t *frame_create(const char *event, const char *data);
+frame_t *frame_create_json(const char *event, json_t *data);
+frame_t *frame_create_relay(const char *event, const id128_t *from,
+                            const char *key, const char *payload, size_t payload_len);
+frame_t *frame_create_relay_msgpack(const char *event, const id128_t *from, const char *key,
+                                    const unsigned char *payload, size_t payload_len);
+frame_t *message_relay_frame(const message_t *msg, const id128_t *from, bool binary);
+
+/* 合并发送的一条中继消息及其发送者 */
+typedef struct relay_entry_s {
+    const message_t *msg;
+    id128_t from;
+} relay_entry_t;
+
+/*
+ * 把多条中继消息合并为一帧：data 为 {list_key: [{"fromClientId": ..., key: payload}, ...]}，
+ * 每条的负载键取决于其事件类型。binary 选择目标的编码。
+ */
+frame_t *frame_create_relay_batch(const char *event, const char *list_key,
+                                  const relay_entry_t *entries, size_t count, bool binary);
+frame_t *frame_get_binary(frame_t *frame);
+
+void frame_ref(frame_t *frame);
+void frame_unref(frame_t *frame);
+
+static inline unsigned char *frame_payload(frame_t *frame) {
+    return frame->buf + LWS_PRE;
+}
+
+/* 分片收件箱中的条目类型 */
+typedef enum {
+    WS_MSG_CLIENT = 0,             /* 客户端消息：由客户端当前所属分片处理 */
+    WS_MSG_SEND,                   /* 待排入本分片某个客户端发送队列的帧 */
+    WS_MSG_REMOTE,                 /* 其他节点上的客户端的消息 (message 为 NULL 表示释放代理) */
+    WS_MSG_NODE_DOWN               /* 与某节点的连接断开：释放该节点的全部代理 */
+} ws_message_kind_t;
+
 typedef struct ws_message_s {
-    struct lws *wsi;
-    message_t *message;
-    uint64_t timestamp;
+    ws_message_kind_t kind;
+    client_t *client;              /* WS_MSG_CLIENT: 发送消息的客户端 */
+    client_handle_t handle;        /* WS_MSG_SEND: 接收分片注册表中的客户端句柄 */
+    message_t *message;            /* WS_MSG_CLIENT, WS_MSG_REMOTE */
+    frame_t *frame;                /* WS_MSG_SEND */
+    client_origin_t origin;        /* WS_MSG_REMOTE: 真实连接的位置；WS_MSG_NODE_DOWN: 只用 node */
+    uint64_t timestamp;            /* WS_MSG_SEND: 产生该帧的分派开始时间 (单调时钟纳秒，0 表示不统计) */
 } ws_message_t;
 
+/* 队列中的一个槽位：sequence 用于在生产者和消费者之间交接槽位 (Vyukov 有界队列) */
+typedef struct message_queue_slot_s {
+    atomic_size_t sequence;
+    ws_message_t message;
+} message_queue_slot_t;
+
+#define MESSAGE_QUEUE_CACHE_LINE 64
+#define MESSAGE_QUEUE_DEFAULT_CAPACITY 1024
+
+/* 生产者模式：多生产者需要 CAS 抢占槽位，单生产者直接推进 tail */
+typedef enum {
+    MESSAGE_QUEUE_MPSC = 0,
+    MESSAGE_QUEUE_SPSC
+} message_queue_mode_t;
+
+/*
+ * 有界无锁环形队列，只允许一个消费者。head (消费者) 与 tail (生产者)
+ * 用填充隔开，避免位于同一缓存行。满时 push 失败并计入 overflows。
+ */
 typedef struct message_queue_s {
-    ws_message_t *messages;
-    size_t capacity;
-    size_t head;
-    size_t tail;
-    size_t count;
-    pthread_mutex_t lock;
+    atomic_size_t tail;            /* 下一个待写入的位置 (生产者) */
+    char pad0[MESSAGE_QUEUE_CACHE_LINE - sizeof(atomic_size_t)];
+    atomic_size_t head;            /* 下一个待读取的位置 (消费者) */
+    char pad1[MESSAGE_QUEUE_CACHE_LINE - sizeof(atomic_size_t)];
+    message_queue_slot_t *slots;
+    size_t capacity;               /* 2 的幂 */
+    size_t mask;
+    message_queue_mode_t mode;
+    atomic_uint_fast64_t overflows; /* 因队列已满被拒绝的条目数 */
 } message_queue_t;
 
-int message_queue_init(message_queue_t *queue, size_t capacity);
+/* capacity 向上取整为 2 的幂 */
+int message_queue_init(message_queue_t *queue, size_t capacity, message_queue_mode_t mode);
 void message_queue_cleanup(message_queue_t *queue);
 
-int message_queue_push(message_queue_t *queue, struct lws *wsi, message_t *msg);
+/* 复制条目并为其中的 message/frame 各增加一个引用，调用者保留自己的引用 */
+int message_queue_push(message_queue_t *queue, const ws_message_t *item);
 int message_queue_pop(message_queue_t *queue, ws_message_t *result);
 
+/* 批量操作：返回实际入队/出队的条目数；批量入队要么全部成功，要么全部失败 */
+size_t message_queue_push_batch(message_queue_t *queue, const ws_message_t *items, size_t count);
+size_t message_queue_pop_batch(message_queue_t *queue, ws_message_t *results, size_t max);
+
+/* 其他线程调用时结果只是近似值 */
 bool message_queue_is_empty(const message_queue_t *queue);
 bool message_queue_is_full(const message_queue_t *queue);
+uint64_t message_queue_overflows(const message_queue_t *queue);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,155 @@
+#pragma once
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "messages.h"
+#include "utilities.h"
+
+/*
+ * HDR 风格的对数-线性直方图：每个 2 的幂区间再分 METRICS_HIST_SUB 个等宽子桶，
+ * 相对误差不超过 1/METRICS_HIST_SUB。桶为上闭区间 (lower, upper]，
+ * 因此导出时 2 的幂边界上的累计值与 Prometheus 的 le 语义一致。
+ */
+#define METRICS_HIST_SUB_BITS 2
+#define METRICS_HIST_SUB (1u << METRICS_HIST_SUB_BITS)
+#define METRICS_HIST_MAGNITUDES 40     /* 最大可区分的值约为 2^40，更大的值计入最后一个桶 */
+#define METRICS_HIST_BUCKETS (METRICS_HIST_MAGNITUDES * METRICS_HIST_SUB)
+
+/* 一个分片的直方图：只由所属线程写入，抓取时其他线程按 relaxed 读取 */
+typedef struct metrics_histogram_s {
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t sum;
+    atomic_uint_fast64_t buckets[METRICS_HIST_BUCKETS];
+} metrics_histogram_t;
+
+/* 多个分片合并后的直方图 (抓取时在栈上或堆上构造) */
+typedef struct metrics_snapshot_s {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t buckets[METRICS_HIST_BUCKETS];
+} metrics_snapshot_t;
+
+/* 发送帧被丢弃的原因 */
+typedef enum {
+    METRICS_DROP_SHED = 0,         /* 超过高水位时丢弃的新可丢弃帧 */
+    METRICS_DROP_EVICTED,          /* 被后来的帧挤出队列的可丢弃帧 */
+    METRICS_DROP_SLOW_CONSUMER,    /* 队列全满，连接被关闭 */
+    METRICS_DROP_COUNT
+} metrics_drop_t;
+
+/* 准入阶段拒绝的原因 */
+typedef enum {
+    METRICS_REJECT_MESSAGES = 0,   /* 客户端超过每秒消息数，整条消息丢弃 */
+    METRICS_REJECT_BYTES,          /* 客户端超过每秒字节数，整条消息丢弃 */
+    METRICS_REJECT_ACCEPT,         /* 超过全局建连速率，连接被关闭 */
+    METRICS_REJECT_COUNT
+} metrics_reject_t;
+
+/*
+ * 每个服务线程 (分片) 的计数器和直方图。单写者：只有所属线程更新，
+ * 更新是 relaxed 的读-改-写 (不带 lock 前缀)，抓取线程读到的是近似值但不会撕裂。
+ * 按缓存行对齐，避免不同分片的计数器共享缓存行。
+ */
+typedef struct metrics_shard_s {
+    _Alignas(CACHE_LINE_SIZE)
+    atomic_uint_fast64_t messages_received;  /* 解析成功的客户端消息 */
+    atomic_uint_fast64_t messages_dispatched; /* 在本分片上处理的消息 */
+    atomic_uint_fast64_t errors;             /* 解析失败、转交失败和处理错误 */
+    atomic_uint_fast64_t frames_written;     /* lws_write 成功的帧 */
+    atomic_uint_fast64_t bytes_written;      /* 这些帧的负载字节数 */
+    atomic_uint_fast64_t frames_dropped[METRICS_DROP_COUNT];
+    atomic_uint_fast64_t rejected[METRICS_REJECT_COUNT]; /* 准入阶段拒绝的消息和连接 */
+    atomic_uint_fast64_t sessions_resumed;   /* 断线后凭令牌恢复的会话 */
+    atomic_uint_fast64_t sessions_expired;   /* 保留期内未恢复的会话 */
+    uint64_t dispatch_ns;                    /* 当前分派的开始时间，分派之外为 0 (仅所属线程) */
+
+    metrics_histogram_t receive_latency;     /* 收到完整消息到开始处理 (纳秒) */
+    metrics_histogram_t write_latency;       /* 开始处理到帧写入套接字 (纳秒) */
+    metrics_histogram_t inbox_depth;         /* 每次唤醒从收件箱取出的条目数 */
+    metrics_histogram_t send_queue_depth;    /* 帧入队后客户端发送队列的长度 */
+    metrics_histogram_t frame_bytes;         /* 写出帧的长度 */
+    metrics_histogram_t message_bytes[MESSAGE_EVENT_COUNT]; /* 按事件类型的入站消息长度 */
+} metrics_shard_t;
+
+/* 单调时钟 (纳秒)，vDSO 实现，不进入内核 */
+static inline uint64_t metrics_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* 单写者计数器加 n */
+static inline void metrics_add(atomic_uint_fast64_t *counter, uint64_t n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static inline void metrics_inc(atomic_uint_fast64_t *counter) {
+    metrics_add(counter, 1);
+}
+
+static inline uint64_t metrics_read(const atomic_uint_fast64_t *counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+/* 值所在的桶：桶 i 覆盖 (upper(i-1), upper(i)]，0 和 1 落在桶 0 */
+static inline unsigned metrics_bucket(uint64_t value) {
+    uint64_t v = value ? value - 1 : 0;
+    if (v < METRICS_HIST_SUB) return (unsigned)v;
+
+    unsigned exp = 63u - (unsigned)__builtin_clzll(v);
+    unsigned index = (exp - METRICS_HIST_SUB_BITS + 1) * METRICS_HIST_SUB +
+                     (unsigned)((v >> (exp - METRICS_HIST_SUB_BITS)) & (METRICS_HIST_SUB - 1));
+    return index < METRICS_HIST_BUCKETS ? index : METRICS_HIST_BUCKETS - 1;
+}
+
+/* 记录一个观测值 (仅所属线程) */
+static inline void metrics_observe(metrics_histogram_t *hist, uint64_t value) {
+    metrics_inc(&hist->count);
+    metrics_add(&hist->sum, value);
+    metrics_inc(&hist->buckets[metrics_bucket(value)]);
+}
+
+/* 桶的上界 (含) */
+uint64_t metrics_bucket_upper(unsigned index);
+
+/* 把一个分片的直方图累加到快照中 (任意线程) */
+void metrics_snapshot_add(metrics_snapshot_t *snap, const metrics_histogram_t *hist);
+
+/* 快照的分位数 (0 < q <= 1)，返回所在桶的上界；没有观测值时返回 0 */
+uint64_t metrics_snapshot_quantile(const metrics_snapshot_t *snap, double q);
+
+/* 可增长的文本缓冲区，用于渲染 Prometheus 文本格式 */
+typedef struct metrics_text_s {
+    char *data;
+    size_t len;
+    size_t cap;
+    bool failed;                   /* 曾经扩容失败：内容不完整 */
+} metrics_text_t;
+
+void metrics_text_init(metrics_text_t *text);
+void metrics_text_free(metrics_text_t *text);
+void metrics_text_printf(metrics_text_t *text, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* 写出指标的 HELP 和 TYPE 行 */
+void metrics_text_header(metrics_text_t *text, const char *name, const char *type,
+                         const char *help);
+
+/*
+ * 以 Prometheus histogram 格式写出快照。只导出 2^min_shift 到 2^max_shift
+ * 的 2 的幂边界 (以及 +Inf)，保持每次抓取的桶集合固定；scale 把记录单位换算为
+ * 导出单位 (例如纳秒 -> 秒为 1e-9)。labels 为 NULL 或 `key="value"` 形式。
+ */
+void metrics_text_histogram(metrics_text_t *text, const char *name, const char *labels,
+                            const metrics_snapshot_t *snap, unsigned min_shift,
+                            unsigned max_shift, double scale);
+
+#endif
@@ -0,0 +1,76 @@
+#pragma once
+
+#ifndef MSGPACK_H
+#define MSGPACK_H
+
+#include <jansson.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* 解码 JSON 值时允许的最大嵌套深度 */
+#define MSGPACK_MAX_DEPTH 32
+
+/* MessagePack 读取游标 */
+typedef struct msgpack_reader_s {
+    const unsigned char *p;
+    const unsigned char *end;
+} msgpack_reader_t;
+
+/**
+ * @brief 读取一个字符串值
+ * @param r 读取游标，成功时前移到值之后
+ * @param str 输出字符串内容 (不以 NUL 结尾)
+ * @param len 输出字符串长度
+ * @return 成功返回 0x0，类型不符或数据截断返回 -1
+ */
+int msgpack_read_str(msgpack_reader_t *r, const char **str, size_t *len);
+
+/**
+ * @brief 读取一个 map 头部
+ * @param r 读取游标，成功时前移到第一个键
+ * @param count 输出键值对数量
+ * @return 成功返回 0x0，类型不符或数据截断返回 -1
+ */
+int msgpack_read_map(msgpack_reader_t *r, size_t *count);
+
+/**
+ * @brief 跳过一个完整的值 (含嵌套内容)，只检查结构完整性
+ * @param r 读取游标，成功时前移到值之后
+ * @return 成功返回 0x0，数据非法、截断或嵌套过深返回 -1
+ */
+int msgpack_skip(msgpack_reader_t *r);
+
+/**
+ * @brief 把一个值解码为 JSON
+ *
+ * map 的键必须是字符串，字符串必须是合法 UTF-8；bin 和 ext 类型没有 JSON 对应，视为非法。
+ * @param r 读取游标，成功时前移到值之后
+ * @return 新的 JSON 值 (调用者持有引用)，失败返回 NULL
+ */
+json_t *msgpack_read_json(msgpack_reader_t *r);
+
+/* 各类头部/值编码后的字节数，与对应的 msgpack_write_* 配合按实际长度分配缓冲区 */
+size_t msgpack_str_size(size_t len);
+size_t msgpack_map_size(size_t count);
+size_t msgpack_array_size(size_t count);
+
+/**
+ * @brief 计算 JSON 值编码后的字节数
+ * @param value JSON 值
+ * @return 字节数，值包含无法编码的类型时返回 0
+ */
+size_t msgpack_json_size(const json_t *value);
+
+unsigned char *msgpack_write_str(unsigned char *p, const char *str, size_t len);
+unsigned char *msgpack_write_map(unsigned char *p, size_t count);
+unsigned char *msgpack_write_array(unsigned char *p, size_t count);
+
+/**
+ * @brief 把 JSON 值编码为 MessagePack
+ * @param p 输出位置，至少有 msgpack_json_size() 字节可用
+ * @param value JSON 值
+ * @return 写入结束的位置
+ */
+unsigned char *msgpack_write_json(unsigned char *p, const json_t *value);
+
+#endif
@@ -7,10 +7,24 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#include "id_table.h"
+#include "slot_region.h"
+#include "utilities.h"
+
 struct client_s;
 typedef struct client_s client_t;
 
+struct frame_s;
+
+/* 未指定容量时每个房间的参与者上限，也是房间内联槽位的数量 */
 #define MAX_PARTICIPANTS 0x6
+#define ROOM_INLINE_SLOTS MAX_PARTICIPANTS
+
+/* 单个房间容量的硬上限 (SFU 后的大房间) */
+#define ROOM_MAX_CAPACITY 1024
+
+/* 重放环保留的最近帧数：有成员暂离时，房间内发给暂离成员的帧记录在环中 */
+#define ROOM_REPLAY_CAPACITY 64
 
 typedef enum {
     ROOM_STATE_ACTIVE = 0x0,
@@ -18,28 +32,71 @@ typedef enum {
     ROOM_STATE_CLOSING
 } room_state_t;
 
-typedef struct participant_s {
-    client_t *client;
-    uint32_t join_time;
-    bool is_owner;
-} participant_t;
-
+/*
+ * 参与者保存在紧凑数组 [0, participant_count) 中，客户端记录自己的下标，
+ * 移除时用末尾元素填补空位，增删均为 O(1)。下标 0 始终是房间所有者。
+ * 不超过 ROOM_INLINE_SLOTS 个参与者时数组内联在房间中，更多时换成内存池中按倍数增长的数组。
+ */
 typedef struct room_s {
-    char id[37];                    /* 房间 UUID (36 字符 + 空终止符) */
-    char name[64];                  /* 人类可读的房间名称 */
-    participant_t participants[MAX_PARTICIPANTS]; /* 容纳 6 个参与者的固定数组 */
-    uint8_t participant_count;      /* 当前参与者数量 */
-    room_state_t state;             /* 房间状态 */
-    uint32_t created_at;           /* 创建时间戳 */
+    /* 热字段：广播、成员查找和所有者转移只访问第一个缓存行 */
+    _Alignas(CACHE_LINE_SIZE)
+    union {
+        client_t *inline_slots[ROOM_INLINE_SLOTS]; /* slot_capacity <= ROOM_INLINE_SLOTS */
+        client_t **heap_slots;     /* 大房间的槽位数组 */
+    } slots;
     uint32_t last_activity;        /* 最后活动时间戳 */
-    client_t *owner;               /* 房间所有者/创建者 */
+    uint16_t participant_count;    /* 当前参与者数量 */
+    uint16_t capacity;             /* 参与者上限 */
+    uint16_t slot_capacity;        /* 当前槽位数组的长度 */
+    uint8_t state;                 /* 房间状态 (room_state_t) */
+    
+    /* 冷字段：只在创建房间和组装响应时访问 */
+    id128_t id;                    /* 房间二进制 UUID */
+    uint32_t created_at;           /* 创建时间戳 */
+    uint32_t active_pos;           /* 在注册表活跃列表中的位置 */
+    uint32_t version;              /* 成员版本：每次加入或离开递增，随增量事件下发 */
+    uint32_t reserved_until;       /* 在此之前房间为空也不清理 (热重启恢复的房间等待成员重连) */
+    struct frame_s *snapshot;      /* 当前版本的 participants 帧，成员变化时作废 */
+    struct room_replay_s *replay;  /* 发给暂离成员的最近帧，没有暂离成员时为 NULL */
+    uint16_t detached_count;       /* 暂离 (断线等待恢复) 的成员数 */
+    id_table_t *members;           /* 所属注册表的成员索引，NULL 表示未启用 */
+    char name[64];                 /* 人类可读的房间名称 */
 } room_t;
 
+_Static_assert(offsetof(room_t, id) == CACHE_LINE_SIZE,
+               "room_t hot fields must fit in one cache line");
+_Static_assert(ROOM_MAX_CAPACITY <= UINT16_MAX, "participant indices are 16-bit");
+
+/* 参与者数组 (内联或堆上)，有效元素为 [0, participant_count) */
+static inline client_t **room_participants(const room_t *room) {
+    return room->slot_capacity > ROOM_INLINE_SLOTS ? room->slots.heap_slots
+                                                   : (client_t **)room->slots.inline_slots;
+}
+
+/* 房间所有者：参与者数组的第一个元素 */
+static inline client_t *room_owner(const room_t *room) {
+    return room->participant_count ? room_participants(room)[0] : NULL;
+}
+
+/* 按顺序遍历参与者，循环体内不能增删成员 */
+#define ROOM_FOREACH_PARTICIPANT(room, client)                                \
+    for (client_t **_it = room_participants(room),                            \
+                  **_end = _it + (room)->participant_count, *client;          \
+         _it < _end && ((client = *_it), 1); _it++)
+
 typedef struct room_registry_s {
-    room_t *rooms;                 /* 房间数组 */
+    room_t *rooms;                 /* 房间数组 (slots 的起始地址) */
     size_t max_rooms;              /* 允许的最大房间数 */
     size_t active_rooms;           /* 当前活跃房间数 */
     uint64_t total_rooms_created;  /* 创建的房间总数 (统计) */
+    slot_region_t slots;           /* 按块提交的房间槽位 */
+    uint32_t *active_slots;        /* 活跃槽位索引的紧凑列表 (保留的地址空间，用到才占内存) */
+    id_table_t by_id;              /* 房间 ID -> room_t* 索引 */
+    id_table_t members;            /* 客户端 ID -> 房间成员 client_t* 索引 (entries 为 NULL 表示未启用) */
+    unsigned shard;                /* 所属分片，写入新房间 ID 的最低字节 */
+    uint16_t max_capacity;         /* 单个房间可申请的最大容量 */
+    bool (*accept_id)(void *arg, const id128_t *id); /* 新房间 ID 的过滤器 (NULL 表示全部接受) */
+    void *accept_id_arg;
 } room_registry_t;
 
 /**
@@ -47,8 +104,9 @@ typedef struct room_registry_s {
  * @param room 指向要初始化房间的指针
  * @param name 房间名称
  * @param owner 房间创建者
+ * @param capacity 参与者上限 (1 .. ROOM_MAX_CAPACITY)
  */
-void room_init(room_t *room, const char *name, client_t *owner);
+void room_init(room_t *room, const char *name, client_t *owner, uint16_t capacity);
 
 /**
  * @brief 清理房间资源
@@ -58,14 +116,28 @@ void room_cleanup(room_t *room);
 
 /**
  * @brief 添加参与者到房间
+ *
+ * 超出内联槽位时槽位数组按倍数增长，分配自当前线程的内存池。
  * @param room 房间指针
  * @param client 要添加的客户端
- * @return 成功返回 0x0，房间已满返回 -1，客户端已在房间中返回 -2
+ * @return 成功返回 0x0，房间已满返回 -1，客户端已在房间中返回 -2，
+ *         已在其他房间返回 -3，槽位数组扩容失败或成员索引无法写入返回 -4
  */
 int room_add_participant(room_t *room, client_t *client);
 
 /**
- * @brief 从房间中移除参与者
+ * @brief 让 client 接替 old 在房间中的槽位 (会话恢复，两者的客户端 ID 相同)
+ *
+ * 槽位下标、成员数和成员版本都不变，成员索引改为指向 client。
+ * @param room 房间指针
+ * @param old 原成员
+ * @param client 接替的客户端
+ * @return 成功返回 0x0，old 不在房间中返回 -1
+ */
+int room_replace_participant(room_t *room, client_t *old, client_t *client);
+
+/**
+ * @brief 从房间中移除参与者 (O(1)：按客户端记录的槽位下标)
  * @param room 房间指针
  * @param client 要移除的客户端
  * @return 成功返回 0x0，未找到客户端返回 -1
@@ -73,7 +145,7 @@ int room_add_participant(room_t *room, client_t *client);
 int room_remove_participant(room_t *room, client_t *client);
 
 /**
- * @brief 检查房间是否已满 (6 个参与者)
+ * @brief 检查房间是否已满 (达到房间容量)
  * @param room 要检查的房间
  * @return 如果房间已满则返回 true
  */
@@ -87,12 +159,12 @@ bool room_is_full(const room_t *room);
 bool room_is_empty(const room_t *room);
 
 /**
- * @brief 通过客户端 ID 查找参与者
- * @param room 要搜索的房间
- * @param client_id 要查找的客户端 ID
+ * @brief 通过客户端 ID 查找参与者 (一次成员索引探测加一次房间指针比较)
+ * @param room 要搜索的房间 (所属注册表须已启用成员索引)
+ * @param client_id 要查找的客户端二进制 ID
  * @return 如果找到则返回客户端指针，否则返回 NULL
  */
-client_t *room_find_participant(const room_t *room, const char *client_id);
+client_t *room_find_participant(const room_t *room, const id128_t *client_id);
 
 /**
  * @brief 向所有房间参与者广播消息，除了发送者
@@ -105,6 +177,57 @@ client_t *room_find_participant(const room_t *room, const char *client_id);
 int room_broadcast_message(room_t *room, client_t *exclude, 
                           const char *event, const char *data);
 
+/**
+ * @brief 向所有房间参与者广播同一个已序列化的帧，除了发送者
+ * @param room 要广播的房间
+ * @param exclude 要排除的客户端 (可为 NULL)
+ * @param frame 共享的发送帧 (调用者保留其引用)
+ * @return 消息发送到的客户端数量
+ */
+int room_broadcast_frame(room_t *room, client_t *exclude, struct frame_s *frame);
+
+/**
+ * @brief 向房间成员发送一帧：暂离的成员记入重放环，其余直接发送
+ * @param client 接收者 (room 为其所在房间，可为 NULL)
+ * @param frame 发送帧 (调用者保留其引用)
+ * @return 发送或记录成功返回 0x0，失败返回 client_send_frame 的错误码
+ */
+int room_send_frame(client_t *client, struct frame_s *frame);
+
+/**
+ * @brief 成员暂离：之后发给它的帧记入重放环 (首个暂离成员出现时分配)
+ * @param room 房间
+ * @param client 暂离的成员，记下重放起点 replay_seq
+ * @return 成功返回 0x0，内存不足返回 -1
+ */
+int room_replay_begin(room_t *room, client_t *client);
+
+/**
+ * @brief 取出重放环中发给暂离成员的帧 (按发送顺序，每帧增加一个引用)
+ * @param room 房间
+ * @param client 暂离的成员
+ * @param frames 输出帧数组，至少 ROOM_REPLAY_CAPACITY 个元素
+ * @param complete 输出是否完整：较早的帧已被环覆盖时为 false
+ * @return 取出的帧数
+ */
+size_t room_replay_collect(room_t *room, const client_t *client, struct frame_s **frames,
+                           bool *complete);
+
+/**
+ * @brief 一个暂离成员恢复或过期：最后一个暂离成员结束时释放重放环
+ * @param room 房间
+ */
+void room_replay_end(room_t *room);
+
+/**
+ * @brief 获取当前成员版本的 participants 快照帧
+ *
+ * 帧在首次请求时序列化并缓存在房间上，成员不变时后续请求 (包括二进制客户端的编码转换) 直接复用。
+ * @param room 房间
+ * @return 快照帧，由房间持有 (发送时 client_send_frame 自行增加引用)，内存不足时返回 NULL
+ */
+struct frame_s *room_snapshot_frame(room_t *room);
+
 /**
  * @brief 初始化房间注册表
  * @param reg 要初始化的注册表
@@ -119,37 +242,61 @@ int room_registry_init(room_registry_t *reg, size_t max_rooms);
  */
 void room_registry_cleanup(room_registry_t *reg);
 
+/**
+ * @brief 启用成员索引：本注册表所有房间的成员按客户端 ID 建立哈希索引
+ * @param reg 房间注册表 (尚未创建房间)
+ * @param max_members 同时在本注册表房间中的成员上限
+ * @return 成功返回 0x0，内存分配失败返回 -1
+ */
+int room_registry_index_members(room_registry_t *reg, size_t max_members);
+
 /**
  * @brief 在注册表中创建新房间
  * @param reg 房间注册表
  * @param name 房间名称
  * @param owner 房间创建者
+ * @param capacity 申请的参与者上限，0 表示默认的 MAX_PARTICIPANTS；超过 max_capacity 时按其截断
  * @return 指向新房间的指针，如果注册表已满则返回 NULL
  */
-room_t *room_registry_create(room_registry_t *reg, const char *name, client_t *owner);
+room_t *room_registry_create(room_registry_t *reg, const char *name, client_t *owner,
+                             uint16_t capacity);
 
 /**
- * @brief 通过 ID 查找房间
+ * @brief 按原有 ID 重建房间 (热重启时从快照恢复)，房间没有参与者
  * @param reg 房间注册表
- * @param room_id 要查找的房间 ID
- * @return 如果找到则返回房间指针，否则返回 NULL
+ * @param room_id 房间二进制 ID
+ * @param name 房间名称
+ * @param capacity 参与者上限，超过 max_capacity 时按其截断
+ * @param created_at 原房间的创建时间戳
+ * @param reserved_until 在此之前房间为空也保留
+ * @return 指向房间的指针，注册表已满或 ID 已存在时返回 NULL
  */
-room_t *room_registry_find_by_id(room_registry_t *reg, const char *room_id);
+room_t *room_registry_restore(room_registry_t *reg, const id128_t *room_id, const char *name,
+                              uint16_t capacity, uint32_t created_at, uint32_t reserved_until);
 
 /**
- * @brief 通过客户端查找房间
+ * @brief 通过 ID 查找房间 (一次哈希探测)
  * @param reg 房间注册表
- * @param client 要查找房间的客户端
- * @return 如果客户端在房间中则返回房间指针，否则返回 NULL
+ * @param room_id 要查找的房间二进制 ID
+ * @return 如果找到则返回房间指针，否则返回 NULL
  */
-room_t *room_registry_find_by_client(room_registry_t *reg, const client_t *client);
+room_t *room_registry_find_by_id(room_registry_t *reg, const id128_t *room_id);
 
 /**
- * @brief 从注册表中移除所有空房间
+ * @brief 从注册表中移除所有空房间 (保留期内的恢复房间除外)
  * @param reg 房间注册表
  */
 void room_registry_remove_empty_rooms(room_registry_t *reg);
 
+/**
+ * @brief 归还长时间空闲的房间槽位块的物理页
+ * @param reg 房间注册表
+ * @param now 当前时间戳，单位为秒
+ * @param idle_sec 块全部空闲后保留的秒数
+ * @return 归还的块数
+ */
+size_t room_registry_trim(room_registry_t *reg, uint32_t now, uint32_t idle_sec);
+
 /**
  * @brief 获取活跃房间的数量
  * @param reg 房间注册表
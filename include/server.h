@@ -11,11 +11,41 @@
 #include <stdint.h>
 // 引入布尔类型定义，如 bool
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 // 引入项目内部的头文件
 #include "client.h"   // 客户端相关定义
 #include "room.h"     // 房间相关定义
 #include "messages.h" // 消息相关定义
+#include "utilities.h" // 内存池等工具函数
+#include "cluster.h"  // 集群模式的节点间路由
+#include "metrics.h"  // 分片计数器和直方图
+#include "handoff.h"  // 热重启的监听套接字交接和房间快照
+
+// 服务线程 (分片) 数上限；房间 ID 的最低字节记录分片编号
+#define SERVER_MAX_THREADS 64
+
+// 客户端和房间数上限：注册表按上限保留地址空间，物理内存随活跃数增长
+#define SERVER_MAX_CLIENTS (1 << 20)
+#define SERVER_MAX_ROOMS (1 << 20)
+
+// 默认的全局建连速率 (每秒) 和突发量
+#define SERVER_ACCEPT_RATE_DEFAULT 1000
+#define SERVER_ACCEPT_BURST_DEFAULT 2000
+
+// 热重启后旧进程排空现有连接的最长时间 (秒)，也是新进程保留恢复房间的时间
+#define SERVER_DRAIN_SEC_DEFAULT 30
+
+// 断线后保留客户端会话 (槽位和房间成员身份) 等待恢复的默认时间 (秒)
+#define SERVER_RESUME_GRACE_SEC_DEFAULT 10
+
+// 热重启阶段：SIGUSR2 请求 -> 各分片写好快照 -> 新进程接管监听套接字，旧进程排空
+typedef enum {
+    SERVER_RESTART_NONE = 0,
+    SERVER_RESTART_REQUESTED,
+    SERVER_RESTART_DRAINING
+} server_restart_phase_t;
 
 // 服务器配置结构体
 typedef struct server_config_s {
@@ -25,26 +55,129 @@ typedef struct server_config_s {
     uint32_t client_timeout_sec; // 客户端超时时间 (秒)
     bool enable_stats;          // 是否启用统计功能
     const char *interface;      // 监听的网络接口 (例如 "eth0" 或 NULL)
+    size_t send_high_water;     // 每个客户端发送队列的高水位 (帧数)
+    unsigned threads;           // libwebsockets 服务线程数 (每个线程一个分片)
+    size_t queue_capacity;      // 每个分片收件箱的容量 (0 表示默认值)
+    size_t max_message_size;    // 重组后单条消息的最大长度 (0 表示默认值)
+    uint32_t ice_batch_ms;      // ICE candidate 合并窗口 (毫秒，0 表示不合并)
+    uint16_t max_room_size;     // 创建房间时可申请的最大容量 (0 表示 MAX_PARTICIPANTS)
+    bool compress;              // 是否启用 permessage-deflate
+    size_t compress_min_size;   // 短于此长度的帧不压缩 (字节)
+    const char *cluster_nodes;  // 集群节点列表 "host:port,..." (NULL 表示单机)
+    unsigned node_id;           // 本节点在集群节点列表中的下标
+    bool metrics;               // 是否在同一端口提供 HTTP /metrics (Prometheus 文本格式)
+    bool huge_pages;            // 注册表槽位建议使用透明大页
+    // 准入控制 (速率为 0 表示不限)：在解析之前按客户端限制消息数和字节数，全局限制建连速率
+    uint32_t msg_rate;          // 每个客户端每秒的消息数
+    uint32_t msg_burst;         // 每个客户端可以一次透支的消息数
+    size_t byte_rate;           // 每个客户端每秒的入站字节数
+    size_t byte_burst;          // 每个客户端可以一次透支的字节数 (不小于 max_message_size)
+    uint32_t accept_rate;       // 整个服务器每秒接受的新连接数
+    uint32_t accept_burst;      // 可以一次透支的新连接数
+    // 热重启 (SIGUSR2)：用相同参数启动 exec_path，交出监听套接字后排空现有连接
+    const char *exec_path;      // 新进程的可执行文件 (NULL 表示不支持热重启)
+    char *const *argv;          // 新进程的参数
+    uint32_t drain_sec;         // 排空现有连接的最长时间 (秒，0 表示默认值)
+    const char *snapshot_path;  // 房间快照文件，新进程从中恢复房间 (NULL 表示不写快照)
+    uint32_t resume_grace_sec;  // 断线后会话保留的时间，期间可凭恢复令牌接替 (秒，0 表示不保留)
 } server_config_t;
 
+struct server_context_s;
+
+// 分片：一个 libwebsockets 服务线程及其独占的状态。
+// 连接建立在哪个服务线程上，客户端就登记在该分片的注册表中；
+// 房间由创建它的分片拥有，房间内客户端的消息都在房间所在分片上处理。
+// 分片之间只通过收件箱和无锁控制栈交换数据。
+typedef struct server_shard_s {
+    struct server_context_s *server; // 所属服务器
+    unsigned index;                  // 分片编号，等于服务线程编号 (tsi)
+    client_registry_t clients;       // 连接在本线程上的客户端
+    room_registry_t rooms;           // 本分片拥有的房间
+    client_registry_t proxies;       // 集群模式：连接在其他节点上、按客户端 ID 归属本分片的代理
+    message_queue_t inbox;           // 转交给本分片的客户端消息和发送帧
+    _Atomic(client_t *) control;     // 待处理的断开/释放 (client_t.control_next 链接)
+    atomic_bool wake_pending;        // 已请求唤醒服务线程，避免重复唤醒
+    lws_sorted_usec_list_t sweep_timer; // 每秒的维护定时器 (lws_sul)：推进超时时间轮
+    uint32_t sweep_ticks;            // 维护定时器触发次数，用于间隔清理空房间
+    struct ice_batch_s *ice_batches; // 等待合并发送的 ICE candidate 批次
+    lws_sorted_usec_list_t ice_timer; // 合并窗口到期时发送全部批次
+    memory_pool_t pool;              // 本线程分配的消息、事件名和发送帧
+    memory_arena_t arena;            // 本线程每轮服务循环的临时内存
+    unsigned restart_gen;            // 已写入快照的热重启请求编号
+    unsigned drain_gen;              // 已向客户端发出 server-shutdown 的热重启请求编号
+    handoff_snapshot_t snapshot;     // 本分片房间的快照，由分片 0 合并写入文件
+    client_t *detached;              // 房间在本分片、断线后等待恢复的客户端 (detached_next 链接)
+    size_t detached_count;           // 其数量
+    pthread_t thread;                // 服务线程 (分片 0 使用调用 server_run 的线程)
+    
+    // 统计信息：只由本分片的线程写入，独占缓存行 (分片数组按缓存行对齐分配)
+    metrics_shard_t metrics;
+} server_shard_t;
+
 // 服务器上下文结构体，包含服务器运行所需的所有状态和数据
 typedef struct server_context_s {
     struct lws_context *lws_context; // libwebsockets 上下文对象
-    client_registry_t clients;       // 客户端注册表
-    room_registry_t rooms;           // 房间注册表
-    message_queue_t msg_queue;       // 消息队列
+    server_shard_t *shards;          // 每个服务线程一个分片
+    unsigned shard_count;            // 分片数
     server_config_t config;          // 服务器配置
+    cluster_t *cluster;              // 集群 backplane (单机模式为 NULL)
     
     // 统计信息
-    uint64_t total_messages;    // 总消息数
-    uint64_t total_errors;      // 总错误数
     uint64_t startup_time;      // 服务器启动时间
     
-    // 线程相关
-    pthread_t processing_thread; // 消息处理线程
-    bool running;                // 服务器运行状态标志
+    token_rate_t accept_rate;   // 全局建连速率
+    _Atomic uint64_t accept_tat_ns; // 建连令牌桶的理论到达时间 (各服务线程共享)
+    
+    int listen_fd;              // 服务端口的监听套接字 (创建或从旧进程继承，由 lws 接管)
+    _Atomic int restart_phase;  // 热重启阶段 (server_restart_phase_t)
+    atomic_uint restart_gen;    // 热重启请求编号，每次 SIGUSR2 递增
+    atomic_uint restart_acks;   // 已写好快照的分片数
+    uint32_t drain_deadline;    // 排空截止时间 (秒)
+    size_t restored_rooms;      // 启动时从快照恢复的房间数
+    
+    // 恢复令牌 -> 暂离的客户端；只在暂离、领取和过期时访问，由互斥锁保护
+    id_table_t resume_index;    // 未启用会话恢复时 entries 为 NULL
+    pthread_mutex_t resume_lock;
+    
+    atomic_bool running;        // 服务器运行状态标志
 } server_context_t;
 
+// 各分片统计信息汇总
+typedef struct server_stats_s {
+    size_t active_clients;          // 当前连接数
+    size_t max_clients;             // 客户端容量
+    size_t active_rooms;            // 当前房间数
+    size_t max_rooms;               // 房间容量
+    uint64_t total_connections;     // 总连接数
+    uint64_t total_rooms_created;   // 总创建房间数
+    uint64_t total_messages;        // 总消息数
+    uint64_t total_errors;          // 总错误数
+    uint64_t queue_overflows;       // 因收件箱已满丢弃的条目数
+    size_t registry_resident_bytes; // 注册表槽位可能占用的物理内存 (按已提交且未归还的块计)
+    uint64_t registry_chunks_released; // 空闲后归还的注册表块数
+    // permessage-deflate (启用时)：节省字节数按采样压缩比估算，CPU 开销为采样写出的平均值
+    uint64_t deflate_frames;        // 压缩发送的帧数
+    uint64_t deflate_skipped;       // 低于阈值未压缩的帧数
+    uint64_t deflate_bytes;         // 压缩帧的原始字节数
+    uint64_t deflate_bytes_saved;   // 估算节省的字节数
+    uint64_t deflate_ns_per_kib;    // 压缩写出每 KiB 的 CPU 时间 (纳秒)
+    uint64_t plain_ns_per_kib;      // 未压缩写出每 KiB 的 CPU 时间 (纳秒)
+    // 集群模式
+    size_t remote_clients;          // 其他节点上、在本节点房间中的客户端 (代理) 数
+    uint64_t cluster_sent;          // 发往其他节点的记录数
+    uint64_t cluster_received;      // 从其他节点收到的记录数
+    uint64_t cluster_dropped;       // 因节点不可达或积压丢弃的记录数
+    uint64_t frames_dropped;        // 背压下丢弃的发送帧数
+    uint64_t rejected_messages;     // 超过每客户端消息速率而丢弃的消息数
+    uint64_t rejected_bytes;        // 超过每客户端字节速率而丢弃的消息数
+    uint64_t rejected_connections;  // 超过全局建连速率而关闭的连接数
+    // 延迟分位数 (纳秒，按直方图桶的上界，误差不超过 25%)
+    uint64_t receive_p50_ns;        // 收到消息到开始处理
+    uint64_t receive_p99_ns;
+    uint64_t write_p50_ns;          // 开始处理到帧写入套接字
+    uint64_t write_p99_ns;
+} server_stats_t;
+
 // 服务器 API 函数声明
 
 // 初始化服务器上下文
@@ -66,6 +199,16 @@ void server_cleanup(server_context_t *ctx);
 // ctx: 服务器上下文指针
 void server_stop(server_context_t *ctx);
 
+// 汇总各分片的统计信息 (运行期间读取的是近似值)
+// ctx: 服务器上下文指针
+// stats: 输出统计信息
+void server_get_stats(const server_context_t *ctx, server_stats_t *stats);
+
+// 以 Prometheus 文本格式输出全部指标 (任意线程，读取的是近似值)
+// ctx: 服务器上下文指针
+// text: 输出缓冲区 (由调用者初始化和释放)
+void server_render_metrics(const server_context_t *ctx, metrics_text_t *text);
+
 // WebSocket 协议回调函数
 // wsi: WebSocket 连接会话信息
 // reason: 回调原因 (事件类型)
@@ -78,43 +221,48 @@ int webrtc_protocol_callback(struct lws *wsi, enum lws_callback_reasons reason,
 
 // 消息处理函数
 
-// 处理客户端发送的消息
-// ctx: 服务器上下文指针
-// wsi: WebSocket 连接会话信息
-// event: 事件类型
-// data: JSON 格式的消息数据
-void process_client_message(server_context_t *ctx, struct lws *wsi,
-                           const char *event, json_t *data);
+// 处理客户端发送的消息 (在客户端所属分片的线程上调用)
+// shard: 当前分片
+// client: 发送消息的客户端 (已通过句柄解析)
+// msg: 已解析的消息 (普通 JSON 消息或中继快速路径消息)
+void process_client_message(server_shard_t *shard, client_t *client,
+                           const message_t *msg);
 
 // 房间消息处理器
 
 // 处理客户端加入房间请求
-// ctx: 服务器上下文指针
+// shard: 当前分片
 // client: 客户端信息指针
 // data: 包含房间信息的 JSON 数据
-void handle_join_room(server_context_t *ctx, client_t *client, json_t *data);
+void handle_join_room(server_shard_t *shard, client_t *client, json_t *data);
 
 // 处理客户端离开房间请求
-// ctx: 服务器上下文指针
+// shard: 当前分片
 // client: 客户端信息指针
-void handle_leave_room(server_context_t *ctx, client_t *client);
+void handle_leave_room(server_shard_t *shard, client_t *client);
 
 // 处理客户端发送的 Offer 消息 (WebRTC SDP Offer)
-// ctx: 服务器上下文指针
+// shard: 当前分片
 // client: 客户端信息指针
 // data: 包含 Offer 信息的 JSON 数据
-void handle_offer_message(server_context_t *ctx, client_t *client, json_t *data);
+void handle_offer_message(server_shard_t *shard, client_t *client, json_t *data);
 
 // 处理客户端发送的 Answer 消息 (WebRTC SDP Answer)
-// ctx: 服务器上下文指针
+// shard: 当前分片
 // client: 客户端信息指针
 // data: 包含 Answer 信息的 JSON 数据
-void handle_answer_message(server_context_t *ctx, client_t *client, json_t *data);
+void handle_answer_message(server_shard_t *shard, client_t *client, json_t *data);
+
+// 处理中继快速路径消息：不解析负载，直接拼接 fromClientId 后转发
+// shard: 当前分片
+// client: 客户端信息指针
+// msg: message_deserialize_relay() 生成的中继消息
+void handle_relay_message(server_shard_t *shard, client_t *client, const message_t *msg);
 
 // 处理客户端发送的 ICE Candidate 消息 (WebRTC ICE 候选者)
-// ctx: 服务器上下文指针
+// shard: 当前分片
 // client: 客户端信息指针
 // data: 包含 ICE Candidate 信息的 JSON 数据
-void handle_ice_candidate(server_context_t *ctx, client_t *client, json_t *data);
+void handle_ice_candidate(server_shard_t *shard, client_t *client, json_t *data);
 
 #endif // SERVER_H
\ No newline at end of file
@@ -0,0 +1,116 @@
+#pragma once
+
+#ifndef SLOT_REGION_H
+#define SLOT_REGION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "utilities.h"
+
+/* 每块的槽位数：槽位大小是缓存行的整数倍，块长度因此总是页的整数倍 */
+#define SLOT_REGION_CHUNK_SHIFT 12
+#define SLOT_REGION_CHUNK_SLOTS (1u << SLOT_REGION_CHUNK_SHIFT)
+
+/* 块内槽位全部空闲超过这么久 (秒) 后，物理页还给系统 */
+#define SLOT_REGION_IDLE_SEC 60
+
+/* 空闲链表结束标记；也用作“槽位中没有代数字段” */
+#define SLOT_REGION_NONE UINT32_MAX
+
+typedef struct slot_chunk_s {
+    uint32_t free_head;            /* 块内已释放槽位的链表 */
+    uint32_t fresh;                /* 块内下一个未用过的槽位 (块归还后从 0 开始) */
+    uint32_t live;                 /* 块内正在使用的槽位数 */
+    uint32_t generation_floor;     /* 块归还时的最大槽位代数，新槽位从这里继续 */
+    uint32_t idle_since;           /* live 降为 0 的时间 */
+    bool committed;                /* 已提交为可读写 */
+} slot_chunk_t;
+
+/*
+ * 定长槽位数组：按 max_slots 保留连续的地址空间，槽位按块提交，
+ * 槽位地址在整个生命周期内不变，下标可以直接换算成指针。
+ * 分配总是取编号最小的有空位的块，流量高峰过后活跃槽位集中到低端，
+ * 高端的块空闲下来后用 madvise 归还。只由单个线程使用。
+ */
+typedef struct slot_region_s {
+    unsigned char *base;           /* 槽位数组 */
+    size_t slot_size;
+    size_t max_slots;
+    size_t reserved_bytes;
+    uint32_t generation_offset;    /* 槽位中 uint32_t 代数的偏移，SLOT_REGION_NONE 表示没有 */
+    uint32_t *next_free;           /* 每个槽位的空闲链表指针 (按需占用物理页) */
+    slot_chunk_t *chunks;
+    size_t chunk_count;
+    uint64_t *available;           /* 还有空位的块的位图 */
+    size_t committed_chunks;       /* 已提交的块数 */
+    size_t resident_chunks;        /* 用过且尚未归还的块数 */
+    size_t idle_chunks;            /* 其中已全部空闲、等待归还的块数 */
+    uint64_t chunks_released;      /* 累计归还的块数 (统计) */
+    bool huge_pages;               /* 提交时建议使用透明大页，首次分配前设置 */
+} slot_region_t;
+
+/**
+ * @brief 保留槽位数组的地址空间
+ * @param region 要初始化的槽位数组
+ * @param slot_size 槽位大小，必须是缓存行大小的整数倍
+ * @param max_slots 最大槽位数
+ * @param generation_offset 槽位中代数字段的偏移，没有时为 SLOT_REGION_NONE
+ * @return 成功返回 0x0，参数无效或地址空间不足返回 -1
+ */
+int slot_region_init(slot_region_t *region, size_t slot_size, size_t max_slots,
+                     uint32_t generation_offset);
+
+/**
+ * @brief 释放槽位数组 (调用者负责先清理仍在使用的槽位)
+ * @param region 槽位数组
+ */
+void slot_region_cleanup(slot_region_t *region);
+
+/**
+ * @brief 分配一个槽位，必要时提交新的块
+ *
+ * 复用的槽位保留上次的内容；新槽位内容为零，代数字段延续块归还前的最大值。
+ * @param region 槽位数组
+ * @param index 输出槽位下标
+ * @return 槽位指针，已满或提交失败时返回 NULL
+ */
+void *slot_region_alloc(slot_region_t *region, uint32_t *index);
+
+/**
+ * @brief 释放槽位 (内容保持不变，直到所在块被归还)
+ * @param region 槽位数组
+ * @param index 槽位下标
+ */
+void slot_region_free(slot_region_t *region, uint32_t index);
+
+/**
+ * @brief 归还空闲时间超过 idle_sec 的块的物理页
+ * @param region 槽位数组
+ * @param now 当前时间戳，单位为秒
+ * @param idle_sec 块全部空闲后保留的秒数
+ * @return 本次归还的块数
+ */
+size_t slot_region_trim(slot_region_t *region, uint32_t now, uint32_t idle_sec);
+
+/*
+ * 下标是否落在已提交的块中。块总是从低到高提交 (只有更低的块都满了才会提交新块)，
+ * 已提交的块构成前缀，越过它的下标 (例如来自其他节点的句柄) 不能解引用。
+ */
+static inline bool slot_region_contains(const slot_region_t *region, uint32_t index) {
+    return ((size_t)index >> SLOT_REGION_CHUNK_SHIFT) < region->committed_chunks &&
+           index < region->max_slots;
+}
+
+/* 块长度 (字节) */
+static inline size_t slot_region_chunk_bytes(const slot_region_t *region) {
+    return region->slot_size << SLOT_REGION_CHUNK_SHIFT;
+}
+
+/* 可能占用物理内存的槽位字节数上限 */
+static inline size_t slot_region_resident_bytes(const slot_region_t *region) {
+    return region->resident_chunks * slot_region_chunk_bytes(region);
+}
+
+#endif
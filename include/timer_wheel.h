@@ -0,0 +1,73 @@
+#pragma once
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* 每层 64 个槽位，共 3 层，以秒为刻度覆盖 2^18 秒 (约 3 天) */
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 3
+#define TIMER_WHEEL_RANGE (1u << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+/* 侵入式定时器节点，嵌入在被计时的对象中 */
+typedef struct timer_node_s {
+    struct timer_node_s *next;
+    struct timer_node_s **pprev;   /* 指向前一节点的 next (或槽位头)，NULL 表示未挂载 */
+    uint32_t expires;              /* 到期时间 (秒) */
+} timer_node_t;
+
+/* 分层时间轮：挂载/摘除为 O(1)，推进开销只与到期和跨层迁移的节点数成正比 */
+typedef struct timer_wheel_s {
+    timer_node_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    timer_node_t *pending;         /* 正在处理的槽位，推进期间回调仍可摘除其中的节点 */
+    uint32_t now;                  /* 已处理到的时刻 */
+    size_t count;                  /* 已挂载的节点数 */
+} timer_wheel_t;
+
+/* 到期回调：节点已从时间轮摘除，回调中可以重新挂载 */
+typedef void (*timer_expire_fn)(timer_node_t *node, void *arg);
+
+/**
+ * @brief 初始化时间轮
+ * @param wheel 要初始化的时间轮
+ * @param now 当前时间 (秒)
+ */
+void timer_wheel_init(timer_wheel_t *wheel, uint32_t now);
+
+/**
+ * @brief 挂载定时器节点，已挂载的节点会先被摘除
+ *
+ * 不晚于当前时刻的到期时间按下一秒处理；超出时间轮范围的先挂在范围末端，
+ * 到时由时间轮自动重新挂载，回调只在真实到期时调用。
+ * @param wheel 时间轮
+ * @param node 定时器节点
+ * @param expires 到期时间 (秒)
+ */
+void timer_wheel_add(timer_wheel_t *wheel, timer_node_t *node, uint32_t expires);
+
+/**
+ * @brief 摘除定时器节点，未挂载的节点忽略
+ * @param wheel 时间轮
+ * @param node 定时器节点
+ */
+void timer_wheel_remove(timer_wheel_t *wheel, timer_node_t *node);
+
+static inline bool timer_node_pending(const timer_node_t *node) {
+    return node->pprev != NULL;
+}
+
+/**
+ * @brief 推进时间轮到指定时刻，对每个到期节点调用回调
+ * @param wheel 时间轮
+ * @param now 当前时间 (秒)，早于已处理时刻时不做任何事
+ * @param expire 到期回调
+ * @param arg 传给回调的参数
+ * @return 到期的节点数
+ */
+size_t timer_wheel_advance(timer_wheel_t *wheel, uint32_t now, timer_expire_fn expire, void *arg);
+
+#endif
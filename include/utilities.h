@@ -4,33 +4,166 @@
 #define UTILS_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
 #include <time.h>
 #include <sys/time.h>
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
+/* 热/冷字段拆分和填充所按的缓存行大小 */
+#define CACHE_LINE_SIZE 64
+
 #define container_of(ptr, type, member) ({ \
     const typeof(((type *)0)->member) *__mptr = (ptr); \
     (type *)((char *)__mptr - offsetof(type, member)); })
 
-void generate_uuid(char *buffer, size_t size);
+/* UUID 文本长度 (36 字符 + 空终止符) */
+#define ID128_STR_LEN 37
+
+/* 128 位二进制 ID，hi 为 UUID 文本的前 16 个十六进制位 */
+typedef struct id128_s {
+    uint64_t hi;
+    uint64_t lo;
+} id128_t;
+
+void id128_generate(id128_t *id);
+void id128_format(const id128_t *id, char *buffer);
+int id128_parse(const char *str, id128_t *id);
+int id128_parse_n(const char *str, size_t len, id128_t *id);
+
+static inline bool id128_equal(const id128_t *a, const id128_t *b) {
+    return a->hi == b->hi && a->lo == b->lo;
+}
+
+static inline bool id128_is_zero(const id128_t *id) {
+    return (id->hi | id->lo) == 0;
+}
+
+static inline uint64_t id128_hash(const id128_t *id) {
+    uint64_t h = id->hi ^ (id->lo * 0x9E3779B97F4A7C15ULL);
+    return h ^ (h >> 32);
+}
+
+/* ID 最低字节记录分配它的分片，路由时无需查表 */
+static inline void id128_set_shard(id128_t *id, unsigned shard) {
+    id->lo = (id->lo & ~(uint64_t)0xff) | (shard & 0xff);
+}
+
+static inline unsigned id128_shard(const id128_t *id) {
+    return (unsigned)(id->lo & 0xff);
+}
 
 uint64_t get_timestamp_ms(void);
 uint32_t get_timestamp_sec(void);
 
+/* 粗粒度时钟：服务循环每轮刷新一次，热路径读取缓存值而不调用 time() */
+extern atomic_uint_least32_t coarse_clock_now;
+
+uint32_t coarse_clock_update(void);
+
+static inline uint32_t coarse_clock_sec(void) {
+    uint32_t now = (uint32_t)atomic_load_explicit(&coarse_clock_now, memory_order_relaxed);
+    return now ? now : coarse_clock_update();
+}
+
+/* 按缓存行对齐并清零的数组分配，用 free() 释放 */
+void *cache_aligned_calloc(size_t count, size_t size);
+
+/*
+ * 虚拟内存区：先保留地址空间，再按需提交。提交的页面在首次访问时才占用物理内存
+ * (内容为零)；归还后地址仍然可读写，再次访问时重新分配零页。
+ */
+#define VM_HUGE_PAGE_SIZE (2u * 1024 * 1024)
+
+void *vm_reserve(size_t bytes);
+int vm_commit(void *addr, size_t bytes, bool huge_pages);
+void vm_decommit(void *addr, size_t bytes);
+void vm_unreserve(void *addr, size_t bytes);
+size_t vm_page_size(void);
+
+/*
+ * 令牌桶，按 GCRA (虚拟调度) 实现：只记录理论到达时间 tat，
+ * 每次判断是一次比较和一次加法，不需要按时间补充令牌。
+ * 速率为每秒 per_sec 个单位，最多可以一次透支 burst 个单位。
+ */
+typedef struct token_rate_s {
+    uint64_t interval_ns;          /* 每个单位的间隔，0 表示不限速 */
+    uint64_t tolerance_ns;         /* burst * interval_ns */
+} token_rate_t;
+
+typedef struct token_bucket_s {
+    uint64_t tat_ns;               /* 理论到达时间 (单调时钟)，0 表示桶是满的 */
+} token_bucket_t;
+
+void token_rate_init(token_rate_t *rate, uint64_t per_sec, uint64_t burst);
+bool token_bucket_take_shared(_Atomic uint64_t *tat_ns, const token_rate_t *rate,
+                              uint64_t cost, uint64_t now_ns);
+
+/* 取出 cost 个单位，不足时返回 false 且不扣除 (单线程) */
+static inline bool token_bucket_take(token_bucket_t *bucket, const token_rate_t *rate,
+                                     uint64_t cost, uint64_t now_ns) {
+    if (rate->interval_ns == 0) return true;
+    
+    uint64_t tat = bucket->tat_ns > now_ns ? bucket->tat_ns : now_ns;
+    uint64_t next = tat + cost * rate->interval_ns;
+    if (next - now_ns > rate->tolerance_ns) return false;
+    
+    bucket->tat_ns = next;
+    return true;
+}
+
 int safe_strncpy(char *dest, const char *src, size_t dest_size);
 int safe_strncat(char *dest, const char *src, size_t dest_size);
 
+/*
+ * 按大小分级的 slab 内存池。每个服务线程拥有一个池，只有所属线程从中分配；
+ * 块可以在任意线程释放，其他线程释放的块挂到所属池的无锁回收栈上，由所属线程整体取回。
+ */
+#define MEMORY_POOL_CLASSES 8
+#define MEMORY_POOL_MIN_BLOCK 64
+#define MEMORY_POOL_MAX_BLOCK (MEMORY_POOL_MIN_BLOCK << (MEMORY_POOL_CLASSES - 1))
+#define MEMORY_POOL_SLAB_SIZE (64 * 1024)
+
+typedef struct memory_pool_class_s {
+    void *free_list;               /* 本线程可直接使用的空闲块 */
+    _Atomic(void *) remote_free;   /* 其他线程释放的块 */
+    size_t block_size;             /* 块大小，含块头 */
+} memory_pool_class_t;
+
 typedef struct memory_pool {
-    void **free_list;
-    size_t free_count;
-    size_t total_allocated;
-    size_t max_size;
+    memory_pool_class_t classes[MEMORY_POOL_CLASSES];
+    void *slabs;                   /* 已申请的 slab 链表，清理时整体释放 */
+    size_t total_allocated;        /* 已申请的 slab 字节数 */
+    size_t max_size;               /* slab 字节数上限，超出后退回 malloc */
 } memory_pool_t;
 
-void memory_pool_init(memory_pool_t *pool, size_t max_size);
+int memory_pool_init(memory_pool_t *pool, size_t max_size);
 void *memory_pool_alloc(memory_pool_t *pool, size_t size);
-void memory_pool_free(memory_pool_t *pool, void *ptr);
+void memory_pool_free(void *ptr);
 void memory_pool_cleanup(memory_pool_t *pool);
 
+void memory_pool_bind_thread(memory_pool_t *pool);
+memory_pool_t *memory_pool_thread(void);
+
+/* 单线程的临时分配区：按顺序分配，随服务循环每轮整体复位 */
+typedef struct memory_arena {
+    char *base;
+    size_t size;
+    size_t used;
+    void *overflow;                /* 本轮超出容量时临时追加的块，复位时释放 */
+    size_t overflow_bytes;
+} memory_arena_t;
+
+#define MEMORY_ARENA_MAX_SIZE (1024 * 1024)
+
+int memory_arena_init(memory_arena_t *arena, size_t size);
+void *memory_arena_alloc(memory_arena_t *arena, size_t size);
+void memory_arena_reset(memory_arena_t *arena);
+void memory_arena_cleanup(memory_arena_t *arena);
+
+void memory_arena_bind_thread(memory_arena_t *arena);
+memory_arena_t *memory_arena_thread(void);
+
 #endif
\ No newline at end of file
@@ -17,9 +17,12 @@
 #include <time.h>
 #include <locale.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <sys/resource.h>
 
 
 #include "./include/server.h"
+#include "./include/logger.h"
 #include "./include/utilities.h"
 
 
@@ -37,6 +40,29 @@ static void signal_handler(int sig) {
     }
 }
 
+/**
+ * @brief 解析 "速率[,突发量]" 形式的限速参数
+ * @param arg 参数文本
+ * @param rate 输出速率 (0 表示不限速)
+ * @param burst 输出突发量；未给出时为速率的两倍
+ * @return 0 表示成功，-1 表示格式无效
+ */
+static int parse_rate(const char *arg, uint64_t *rate, uint64_t *burst) {
+    char *end;
+    unsigned long long value = strtoull(arg, &end, 10);
+    if (end == arg || (*end != '\0' && *end != ',') || arg[0] == '-') return -1;
+    
+    *rate = value;
+    *burst = value * 2;
+    if (*end == ',') {
+        const char *b = end + 1;
+        value = strtoull(b, &end, 10);
+        if (end == b || *end != '\0' || b[0] == '-' || value == 0) return -1;
+        *burst = value;
+    }
+    return 0;
+}
+
 /**
  * @brief 打印使用说明
  * @param program_name 可执行文件名称
@@ -53,6 +79,35 @@ static void print_usage(const char *program_name) {
     printf("  -c, --clients 数量       最大并发客户端数 (默认: 1024)\n");
     printf("  -r, --rooms 数量         最大活跃房间数 (默认: 256)\n");
     printf("  -t, --timeout 秒数       客户端超时时间 (默认: 300)\n");
+    printf("  -w, --high-water 帧数    每个客户端发送队列高水位 (默认: %d)\n",
+           CLIENT_SEND_HIGH_WATER_DEFAULT);
+    printf("  -n, --threads 数量       服务线程数，房间按线程分片 (默认: 1，最多 %d)\n",
+           SERVER_MAX_THREADS);
+    printf("  -q, --queue-size 数量    每个分片收件箱容量，取整为 2 的幂 (默认: %d)\n",
+           MESSAGE_QUEUE_DEFAULT_CAPACITY);
+    printf("  -M, --max-message 字节   单条消息 (含分片重组) 的最大长度 (默认: %d)\n",
+           CLIENT_MAX_MESSAGE_DEFAULT);
+    printf("  -R, --max-room-size 数量 join-room 可申请的最大房间容量 (默认: %d，最多 %d)\n",
+           MAX_PARTICIPANTS, ROOM_MAX_CAPACITY);
+    printf("  -b, --ice-batch-ms 毫秒  合并发往同一客户端的 ICE candidate (默认: 0，不合并)\n");
+    printf("  -C, --cluster 节点列表   集群节点 host:port,...，各节点使用相同的列表 (默认: 单机)\n");
+    printf("  -N, --node-id 编号       本节点在集群节点列表中的下标 (默认: 0)\n");
+    printf("  -m, --metrics            在同一端口提供 HTTP /metrics (Prometheus 格式)\n");
+    printf("  -z, --compress           启用 permessage-deflate 压缩\n");
+    printf("  -Z, --compress-min 字节  短于此长度的帧不压缩 (默认: %d)\n",
+           CLIENT_COMPRESS_MIN_DEFAULT);
+    printf("  -H, --huge-pages         注册表使用透明大页\n");
+    printf("  -l, --msg-rate 速率[,突发] 每个客户端每秒的消息数，0 表示不限 (默认: %d,%d)\n",
+           CLIENT_MSG_RATE_DEFAULT, CLIENT_MSG_BURST_DEFAULT);
+    printf("  -B, --byte-rate 速率[,突发] 每个客户端每秒的入站字节数，0 表示不限 (默认: %d,%d)\n",
+           CLIENT_BYTE_RATE_DEFAULT, CLIENT_BYTE_BURST_DEFAULT);
+    printf("  -A, --accept-rate 速率[,突发] 每秒接受的新连接数，0 表示不限 (默认: %d,%d)\n",
+           SERVER_ACCEPT_RATE_DEFAULT, SERVER_ACCEPT_BURST_DEFAULT);
+    printf("  -D, --drain 秒数         热重启 (SIGUSR2) 后旧进程排空连接的最长时间 (默认: %d)\n",
+           SERVER_DRAIN_SEC_DEFAULT);
+    printf("  -S, --snapshot 文件      热重启时写入房间快照，新进程从中恢复房间 (默认: 不写)\n");
+    printf("  -g, --resume-grace 秒数  断线后保留会话等待凭令牌恢复的时间，0 表示不保留 (默认: %d)\n",
+           SERVER_RESUME_GRACE_SEC_DEFAULT);
     printf("  -d, --daemon             以守护进程模式运行\n");
     printf("  -v, --verbose            启用详细日志\n");
     printf("  -h, --help               显示此帮助信息\n");
@@ -60,6 +115,8 @@ static void print_usage(const char *program_name) {
     printf("  %s -p 8080 -c 2048 -r 512\n", program_name);
     printf("  %s --port 9000 --interface 0.0.0.0 --timeout 600\n", program_name);
     printf("  %s --daemon --verbose --clients 512 --rooms 128\n", program_name);
+    printf("  %s -p 8080 -C 10.0.0.1:7000,10.0.0.2:7000 -N 0\n", program_name);
+    printf("  %s -p 8080 -S /run/redrtc.snap   (部署后 kill -USR2 <pid> 热重启)\n", program_name);
 }
 
 /**
@@ -69,7 +126,7 @@ static void print_banner(void) {
     printf("=================================================\n");
     printf("            REd RTC 信令服务器\n");
     printf("            高性能、内存高效\n");
-    printf("            每个房间最多支持 %d 个参与者\n", MAX_PARTICIPANTS);
+    printf("            每个房间默认支持 %d 个参与者\n", MAX_PARTICIPANTS);
     printf("=================================================\n");
     printf("编译: %s %s\n", __DATE__, __TIME__);
     printf("进程ID: %d\n", getpid());
@@ -87,6 +144,50 @@ static void print_config(const server_config_t *config) {
     printf("  最大客户端数:     %zu\n", config->max_clients);
     printf("  最大房间数:       %zu\n", config->max_rooms);
     printf("  客户端超时:       %u 秒\n", config->client_timeout_sec);
+    printf("  发送队列高水位:   %zu 帧\n", config->send_high_water);
+    printf("  服务线程数:       %u\n", config->threads);
+    printf("  收件箱容量:       %zu\n", config->queue_capacity);
+    printf("  最大消息长度:     %zu 字节\n", config->max_message_size);
+    printf("  最大房间容量:     %u 人\n", config->max_room_size);
+    if (config->ice_batch_ms > 0) {
+        printf("  ICE 合并窗口:     %u 毫秒\n", config->ice_batch_ms);
+    } else {
+        printf("  ICE 合并窗口:     禁用\n");
+    }
+    if (config->compress) {
+        printf("  压缩:             permessage-deflate (最小 %zu 字节)\n", config->compress_min_size);
+    } else {
+        printf("  压缩:             禁用\n");
+    }
+    if (config->cluster_nodes) {
+        printf("  集群:             节点 %u，成员 %s\n", config->node_id, config->cluster_nodes);
+    } else {
+        printf("  集群:             禁用\n");
+    }
+    printf("  指标端点:         %s\n", config->metrics ? "/metrics" : "禁用");
+    printf("  注册表大页:       %s\n", config->huge_pages ? "启用" : "禁用");
+    if (config->msg_rate > 0) {
+        printf("  客户端消息速率:   %u/秒 (突发 %u)\n", config->msg_rate, config->msg_burst);
+    } else {
+        printf("  客户端消息速率:   不限\n");
+    }
+    if (config->byte_rate > 0) {
+        printf("  客户端字节速率:   %zu/秒 (突发 %zu)\n", config->byte_rate, config->byte_burst);
+    } else {
+        printf("  客户端字节速率:   不限\n");
+    }
+    if (config->accept_rate > 0) {
+        printf("  建连速率:         %u/秒 (突发 %u)\n", config->accept_rate, config->accept_burst);
+    } else {
+        printf("  建连速率:         不限\n");
+    }
+    printf("  热重启排空:       %u 秒，房间快照 %s\n", config->drain_sec,
+           config->snapshot_path ? config->snapshot_path : "禁用");
+    if (config->resume_grace_sec > 0) {
+        printf("  会话保留:         %u 秒\n", config->resume_grace_sec);
+    } else {
+        printf("  会话保留:         禁用\n");
+    }
     printf("  详细日志:         %s\n", config->enable_stats ? "启用" : "禁用");
     printf("=================================================\n");
 }
@@ -102,13 +203,14 @@ static int validate_config(const server_config_t *config) {
         return -1;
     }
     
-    if (config->max_clients < 1 || config->max_clients > 65536) {
-        fprintf(stderr, "错误: 最大客户端数必须在 1 到 65536 之间\n");
+    /* 注册表只保留地址空间、按块提交，上限不再决定启动时的内存占用 */
+    if (config->max_clients < 1 || config->max_clients > SERVER_MAX_CLIENTS) {
+        fprintf(stderr, "错误: 最大客户端数必须在 1 到 %d 之间\n", SERVER_MAX_CLIENTS);
         return -1;
     }
     
-    if (config->max_rooms < 1 || config->max_rooms > 10000) {
-        fprintf(stderr, "错误: 最大房间数必须在 1 到 10000 之间\n");
+    if (config->max_rooms < 1 || config->max_rooms > SERVER_MAX_ROOMS) {
+        fprintf(stderr, "错误: 最大房间数必须在 1 到 %d 之间\n", SERVER_MAX_ROOMS);
         return -1;
     }
     
@@ -117,6 +219,31 @@ static int validate_config(const server_config_t *config) {
         return -1;
     }
     
+    if (config->send_high_water < 1 || config->send_high_water > 32767) {
+        fprintf(stderr, "错误: 发送队列高水位必须在 1 到 32767 之间\n");
+        return -1;
+    }
+    
+    if (config->threads < 1 || config->threads > SERVER_MAX_THREADS) {
+        fprintf(stderr, "错误: 服务线程数必须在 1 到 %d 之间\n", SERVER_MAX_THREADS);
+        return -1;
+    }
+    
+    if (config->queue_capacity < 16 || config->queue_capacity > 1048576) {
+        fprintf(stderr, "错误: 收件箱容量必须在 16 到 1048576 之间\n");
+        return -1;
+    }
+    
+    if (config->drain_sec < 1 || config->drain_sec > 3600) {
+        fprintf(stderr, "错误: 排空时间必须在 1 到 3600 秒之间\n");
+        return -1;
+    }
+    
+    if (config->resume_grace_sec > 300) {
+        fprintf(stderr, "错误: 会话保留时间必须在 0 到 300 秒之间\n");
+        return -1;
+    }
+    
     return 0;
 }
 
@@ -197,13 +324,24 @@ static void display_runtime_stats(const server_context_t *server) {
     
     /* 每30秒显示一次统计信息 */
     if (now - last_stats_time >= 30) {
-        printf("[统计] 客户端: %zu/%zu, 房间: %zu/%zu, 消息: %" PRIu64 ", 错误: %" PRIu64 "\n",
-               client_registry_get_active_count(&server->clients),
-               server->clients.max_clients,
-               room_registry_get_active_count(&server->rooms),
-               server->rooms.max_rooms,
-               server->total_messages,
-               server->total_errors);
+        server_stats_t stats;
+        server_get_stats(server, &stats);
+        printf("[统计] 客户端: %zu/%zu, 房间: %zu/%zu, 消息: %" PRIu64 ", 错误: %" PRIu64
+               ", 队列溢出: %" PRIu64 ", 丢帧: %" PRIu64 "\n",
+               stats.active_clients,
+               stats.max_clients,
+               stats.active_rooms,
+               stats.max_rooms,
+               stats.total_messages,
+               stats.total_errors,
+               stats.queue_overflows,
+               stats.frames_dropped);
+        printf("[统计] 准入拒绝: 消息速率 %" PRIu64 ", 字节速率 %" PRIu64 ", 建连 %" PRIu64 "\n",
+               stats.rejected_messages, stats.rejected_bytes, stats.rejected_connections);
+        printf("[统计] 延迟 p50/p99: 接收->处理 %" PRIu64 "/%" PRIu64 " µs, 处理->写出 %" PRIu64
+               "/%" PRIu64 " µs\n",
+               stats.receive_p50_ns / 1000, stats.receive_p99_ns / 1000,
+               stats.write_p50_ns / 1000, stats.write_p99_ns / 1000);
         last_stats_time = now;
     }
 }
@@ -221,7 +359,28 @@ int main(int argc, char *argv[]) {
         .max_rooms = 256,
         .client_timeout_sec = 300, /* 5 分钟 */
         .enable_stats = false,
-        .interface = NULL
+        .interface = NULL,
+        .send_high_water = CLIENT_SEND_HIGH_WATER_DEFAULT,
+        .threads = 1,
+        .queue_capacity = MESSAGE_QUEUE_DEFAULT_CAPACITY,
+        .max_message_size = CLIENT_MAX_MESSAGE_DEFAULT,
+        .ice_batch_ms = 0,
+        .max_room_size = MAX_PARTICIPANTS,
+        .compress = false,
+        .compress_min_size = CLIENT_COMPRESS_MIN_DEFAULT,
+        .cluster_nodes = NULL,
+        .node_id = 0,
+        .metrics = false,
+        .huge_pages = false,
+        .msg_rate = CLIENT_MSG_RATE_DEFAULT,
+        .msg_burst = CLIENT_MSG_BURST_DEFAULT,
+        .byte_rate = CLIENT_BYTE_RATE_DEFAULT,
+        .byte_burst = CLIENT_BYTE_BURST_DEFAULT,
+        .accept_rate = SERVER_ACCEPT_RATE_DEFAULT,
+        .accept_burst = SERVER_ACCEPT_BURST_DEFAULT,
+        .drain_sec = SERVER_DRAIN_SEC_DEFAULT,
+        .snapshot_path = NULL,
+        .resume_grace_sec = SERVER_RESUME_GRACE_SEC_DEFAULT
     };
     
     int daemon_mode = 0;
@@ -234,6 +393,24 @@ int main(int argc, char *argv[]) {
         {"clients", required_argument, 0, 'c'},
         {"rooms", required_argument, 0, 'r'},
         {"timeout", required_argument, 0, 't'},
+        {"high-water", required_argument, 0, 'w'},
+        {"threads", required_argument, 0, 'n'},
+        {"queue-size", required_argument, 0, 'q'},
+        {"max-message", required_argument, 0, 'M'},
+        {"max-room-size", required_argument, 0, 'R'},
+        {"ice-batch-ms", required_argument, 0, 'b'},
+        {"cluster", required_argument, 0, 'C'},
+        {"node-id", required_argument, 0, 'N'},
+        {"metrics", no_argument, 0, 'm'},
+        {"compress", no_argument, 0, 'z'},
+        {"compress-min", required_argument, 0, 'Z'},
+        {"huge-pages", no_argument, 0, 'H'},
+        {"msg-rate", required_argument, 0, 'l'},
+        {"byte-rate", required_argument, 0, 'B'},
+        {"accept-rate", required_argument, 0, 'A'},
+        {"drain", required_argument, 0, 'D'},
+        {"snapshot", required_argument, 0, 'S'},
+        {"resume-grace", required_argument, 0, 'g'},
         {"daemon", no_argument, 0, 'd'},
         {"verbose", no_argument, 0, 'v'},
         {"help", no_argument, 0, 'h'},
@@ -244,7 +421,7 @@ int main(int argc, char *argv[]) {
     int opt;
     int option_index = 0;
     
-    while ((opt = getopt_long(argc, argv, "p:i:c:r:t:dvh", 
+    while ((opt = getopt_long(argc, argv, "p:i:c:r:t:w:n:q:M:R:b:C:N:mzZ:Hl:B:A:D:S:g:dvh", 
                              long_options, &option_index)) != -1) {
         switch (opt) {
             case 'p':
@@ -283,6 +460,120 @@ int main(int argc, char *argv[]) {
                 }
                 break;
                 
+            case 'w':
+                config.send_high_water = atoi(optarg);
+                if (config.send_high_water <= 0) {
+                    fprintf(stderr, "错误: 无效的发送队列高水位: %s\n", optarg);
+                    return 1;
+                }
+                break;
+                
+            case 'n':
+                config.threads = (unsigned)atoi(optarg);
+                if (atoi(optarg) <= 0) {
+                    fprintf(stderr, "错误: 无效的服务线程数: %s\n", optarg);
+                    return 1;
+                }
+                break;
+                
+            case 'q':
+                config.queue_capacity = atoi(optarg);
+                if (atoi(optarg) <= 0) {
+                    fprintf(stderr, "错误: 无效的收件箱容量: %s\n", optarg);
+                    return 1;
+                }
+                break;
+                
+            case 'M':
+                if (atoi(optarg) < 1024) {
+                    fprintf(stderr, "错误: 最大消息长度必须至少 1024 字节\n");
+                    return 1;
+                }
+                config.max_message_size = (size_t)atoi(optarg);
+                break;
+                
+            case 'R':
+                if (atoi(optarg) < 2 || atoi(optarg) > ROOM_MAX_CAPACITY) {
+                    fprintf(stderr, "错误: 最大房间容量必须在 2 到 %d 之间\n", ROOM_MAX_CAPACITY);
+                    return 1;
+                }
+                config.max_room_size = (uint16_t)atoi(optarg);
+                break;
+                
+            case 'b':
+                if (atoi(optarg) < 0 || atoi(optarg) > 1000) {
+                    fprintf(stderr, "错误: ICE 合并窗口必须在 0 到 1000 毫秒之间\n");
+                    return 1;
+                }
+                config.ice_batch_ms = (uint32_t)atoi(optarg);
+                break;
+                
+            case 'C':
+                config.cluster_nodes = optarg;
+                break;
+                
+            case 'N':
+                if (atoi(optarg) < 0 || atoi(optarg) >= CLUSTER_MAX_NODES) {
+                    fprintf(stderr, "错误: 节点编号必须在 0 到 %d 之间\n", CLUSTER_MAX_NODES - 1);
+                    return 1;
+                }
+                config.node_id = (unsigned)atoi(optarg);
+                break;
+                
+            case 'm':
+                config.metrics = true;
+                break;
+                
+            case 'z':
+                config.compress = true;
+                break;
+                
+            case 'Z':
+                if (atoi(optarg) < 0) {
+                    fprintf(stderr, "错误: 无效的压缩阈值: %s\n", optarg);
+                    return 1;
+                }
+                config.compress_min_size = (size_t)atoi(optarg);
+                break;
+                
+            case 'H':
+                config.huge_pages = true;
+                break;
+                
+            case 'l':
+            case 'B':
+            case 'A': {
+                uint64_t rate, burst;
+                if (parse_rate(optarg, &rate, &burst) != 0 ||
+                    rate > (opt == 'B' ? 1000000000ULL : 1000000ULL) || burst > UINT32_MAX) {
+                    fprintf(stderr, "错误: 无效的速率: %s\n", optarg);
+                    return 1;
+                }
+                if (opt == 'l') {
+                    config.msg_rate = (uint32_t)rate;
+                    config.msg_burst = (uint32_t)burst;
+                } else if (opt == 'B') {
+                    config.byte_rate = (size_t)rate;
+                    config.byte_burst = (size_t)burst;
+                } else {
+                    config.accept_rate = (uint32_t)rate;
+                    config.accept_burst = (uint32_t)burst;
+                }
+                break;
+            }
+                
+            case 'D':
+                config.drain_sec = (uint32_t)atoi(optarg);
+                break;
+                
+            case 'S':
+                config.snapshot_path = optarg;
+                break;
+                
+            case 'g':
+                config.resume_grace_sec = (uint32_t)atoi(optarg);
+                break;
+                
             case 'd':
                 daemon_mode = 1;
                 break;
@@ -307,6 +598,24 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
+    /* 热重启以相同参数重新执行本程序；守护进程会切换到根目录，路径先转为绝对路径 */
+    static char exec_path[PATH_MAX], snapshot_path[PATH_MAX];
+    if (!strchr(argv[0], '/') || !realpath(argv[0], exec_path)) {
+        snprintf(exec_path, sizeof(exec_path), "/proc/self/exe");
+    }
+    config.exec_path = exec_path;
+    config.argv = argv;
+    if (config.snapshot_path && config.snapshot_path[0] != '/') {
+        char cwd[PATH_MAX];
+        if (!getcwd(cwd, sizeof(cwd)) ||
+            snprintf(snapshot_path, sizeof(snapshot_path), "%s/%s", cwd,
+                     config.snapshot_path) >= (int)sizeof(snapshot_path)) {
+            fprintf(stderr, "错误: 无效的快照路径: %s\n", config.snapshot_path);
+            return 1;
+        }
+        config.snapshot_path = snapshot_path;
+    }
+    
     /* 如果请求了守护进程模式 */
     if (daemon_mode) {
         if (daemonize_server() != 0) {
@@ -322,10 +631,16 @@ int main(int argc, char *argv[]) {
     /* 设置信号处理器 */
     setup_signal_handlers();
     
+    /* 启动异步日志线程 (守护进程化之后，线程不会跨 fork 存活)；失败时日志同步输出 */
+    if (logger_start(verbose_mode ? LOG_LEVEL_DEBUG : LOG_LEVEL_INFO) != 0) {
+        fprintf(stderr, "日志线程启动失败，改为同步输出\n");
+    }
+    
     /* 初始化服务器 */
     server_context_t server;
     int ret = server_init(&server, &config);
     if (ret != 0) {
+        logger_stop();
         fprintf(stderr, "服务器初始化失败: 错误代码 %d\n", ret);
         
         if (ret == -2) {
@@ -337,6 +652,8 @@ int main(int argc, char *argv[]) {
         } else if (ret == -5) {
             fprintf(stderr, "  WebSocket 上下文创建失败\n");
             fprintf(stderr, "  请检查端口 %d 是否可用\n", config.port);
+        } else if (ret == -6) {
+            fprintf(stderr, "  集群初始化失败，请检查节点列表、节点编号和集群端口\n");
         }
         
         return 1;
@@ -361,9 +678,14 @@ int main(int argc, char *argv[]) {
     /* 计算运行时间 */
     time_t uptime = time(NULL) - start_time;
     
+    /* 清理前汇总统计信息 */
+    server_stats_t stats;
+    server_get_stats(&server, &stats);
+    
     /* 清理 */
     server_cleanup(&server);
     global_server_ctx = NULL;
+    logger_stop();
     
     if (!daemon_mode) {
         printf("\n=================================================\n");
@@ -372,10 +694,33 @@ int main(int argc, char *argv[]) {
         
         if (config.enable_stats) {
             printf("统计信息:\n");
-            printf("  总连接数: %" PRIu64 "\n", server.clients.total_connections);
-            printf("  总创建房间数: %" PRIu64 "\n", server.rooms.total_rooms_created);
-            printf("  总处理消息数: %" PRIu64 "\n", server.total_messages);
-            printf("  总错误数: %" PRIu64 "\n", server.total_errors);
+            printf("  总连接数: %" PRIu64 "\n", stats.total_connections);
+            printf("  总创建房间数: %" PRIu64 "\n", stats.total_rooms_created);
+            printf("  总处理消息数: %" PRIu64 "\n", stats.total_messages);
+            printf("  总错误数: %" PRIu64 "\n", stats.total_errors);
+            printf("  收件箱溢出数: %" PRIu64 "\n", stats.queue_overflows);
+            printf("  准入拒绝: 消息速率 %" PRIu64 ", 字节速率 %" PRIu64 ", 建连 %" PRIu64 "\n",
+                   stats.rejected_messages, stats.rejected_bytes, stats.rejected_connections);
+            printf("  注册表驻留内存: %zu KiB (归还块数: %" PRIu64 ")\n",
+                   stats.registry_resident_bytes / 1024, stats.registry_chunks_released);
+            printf("  丢弃发送帧数: %" PRIu64 "\n", stats.frames_dropped);
+            printf("  丢弃日志数: %" PRIu64 "\n", logger_dropped());
+            printf("  延迟 p50/p99: 接收->处理 %" PRIu64 "/%" PRIu64 " µs, 处理->写出 %" PRIu64
+                   "/%" PRIu64 " µs\n",
+                   stats.receive_p50_ns / 1000, stats.receive_p99_ns / 1000,
+                   stats.write_p50_ns / 1000, stats.write_p99_ns / 1000);
+            if (config.cluster_nodes) {
+                printf("  集群记录: 发送 %" PRIu64 ", 接收 %" PRIu64 ", 丢弃 %" PRIu64 "\n",
+                       stats.cluster_sent, stats.cluster_received, stats.cluster_dropped);
+            }
+            if (config.compress) {
+                printf("  压缩帧数: %" PRIu64 " (低于阈值未压缩: %" PRIu64 ")\n",
+                       stats.deflate_frames, stats.deflate_skipped);
+                printf("  压缩前字节数: %" PRIu64 ", 估算节省: %" PRIu64 "\n",
+                       stats.deflate_bytes, stats.deflate_bytes_saved);
+                printf("  写出 CPU: 压缩 %" PRIu64 " ns/KiB, 未压缩 %" PRIu64 " ns/KiB\n",
+                       stats.deflate_ns_per_kib, stats.plain_ns_per_kib);
+            }
         }
         printf("=================================================\n");
     }
@@ -6,10 +6,16 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
+#include <zlib.h>
 
 #include "../include/messages.h"
 #include "../include/utilities.h"
 #include "../include/client.h"
+#include "../include/metrics.h"
+
+/* 当前线程负责的注册表：其中客户端的发送队列只能由本线程操作 */
+static _Thread_local const client_registry_t *thread_registry = NULL;
 
 /**
  * @brief 初始化客户端结构体。
@@ -18,12 +24,15 @@
  */
 void client_init(client_t *client, struct lws *wsi) {
     memset(client, 0, sizeof(client_t));
-    generate_uuid(client->id, sizeof(client->id));
+    id128_generate(&client->id);
     client->wsi = wsi;
     client->state = CLIENT_STATE_CONNECTED;
-    client->connect_time = get_timestamp_sec();
+    client->connect_time = coarse_clock_sec();
     client->last_activity = client->connect_time;
     client->is_alive = true;
+    client->cluster_node = -1;
+    atomic_init(&client->owner_shard, 0);
+    atomic_init(&client->inflight, 0);
 }
 
 /**
@@ -31,6 +40,19 @@ void client_init(client_t *client, struct lws *wsi) {
  * @param client 指向 client_t 结构体的指针。
  */
 void client_cleanup(client_t *client) {
+    client_send_queue_t *q = &client->sendq;
+    
+    /* 释放尚未写出的帧 */
+    for (uint16_t i = 0; i < q->count; i++) {
+        frame_unref(q->slots[(q->head + i) % q->capacity].frame);
+    }
+    free(q->slots);
+    q->slots = NULL;
+    q->head = 0;
+    q->count = 0;
+    
+    client_recv_reset(client);
+    
     client->is_alive = false;
     client->state = CLIENT_STATE_DISCONNECTING;
 }
@@ -40,17 +62,7 @@ void client_cleanup(client_t *client) {
  * @param client 指向 client_t 结构体的指针。
  */
 void client_update_activity(client_t *client) {
-    client->last_activity = get_timestamp_sec();
-}
-
-/**
- * @brief 检查客户端是否超时。
- * @param client 指向 client_t 结构体的常量指针。
- * @param timeout_sec 超时时间，单位为秒。
- * @return 如果客户端超时则返回 true，否则返回 false。
- */
-bool client_is_timed_out(const client_t *client, uint32_t timeout_sec) {
-    return (get_timestamp_sec() - client->last_activity) > timeout_sec;
+    client->last_activity = coarse_clock_sec();
 }
 
 /**
@@ -58,39 +70,366 @@ bool client_is_timed_out(const client_t *client, uint32_t timeout_sec) {
  * @param client 指向 client_t 结构体的指针。
  * @param event 消息事件名称。
  * @param data 消息数据 (JSON 格式字符串)，可为 NULL。
- * @return 成功发送的字节数，或负数表示错误。
+ * @return 0 表示已加入发送队列，负数表示错误。
  */
 int client_send_message(client_t *client, const char *event, const char *data) {
+    /* 连接状态由 client_send_frame 在所属线程上检查 */
+    frame_t *frame = frame_create(event, data);
+    if (!frame) return -2;
+    
+    int ret = client_send_frame(client, frame);
+    frame_unref(frame);
+    
+    return ret;
+}
+
+/**
+ * @brief 从发送队列中移除最旧的可丢弃帧。
+ * @param q 发送队列。
+ * @return 移除成功返回 true，队列中没有可丢弃帧时返回 false。
+ */
+static bool send_queue_evict_droppable(client_send_queue_t *q) {
+    for (uint16_t i = 0; i < q->count; i++) {
+        uint16_t pos = (q->head + i) % q->capacity;
+        if (!(q->slots[pos].frame->flags & FRAME_FLAG_DROPPABLE)) continue;
+        
+        frame_unref(q->slots[pos].frame);
+        
+        /* 后续元素前移一位，保持顺序 */
+        for (uint16_t j = i; j + 1 < q->count; j++) {
+            q->slots[(q->head + j) % q->capacity] = q->slots[(q->head + j + 1) % q->capacity];
+        }
+        q->count--;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief 计入一次丢帧。
+ * @param client 指向 client_t 结构体的指针。
+ * @param reason 丢弃原因。
+ */
+static void client_count_drop(client_t *client, metrics_drop_t reason) {
+    client->frames_dropped++;
+    if (client->registry && client->registry->metrics) {
+        metrics_inc(&client->registry->metrics->frames_dropped[reason]);
+    }
+}
+
+/**
+ * @brief 将已序列化的帧加入客户端的发送队列。
+ *
+ * 帧只增加引用而不复制，因此同一帧可以排入多个客户端的队列，最后一次写出后释放。
+ * 实际写出发生在 LWS_CALLBACK_SERVER_WRITEABLE 中。超过高水位后，新的可丢弃帧
+ * 直接被丢弃，其他帧则会挤掉队列中最旧的可丢弃帧；队列全满且无帧可丢时，
+ * 认为对端过慢并关闭连接。
+ *
+ * 在其他服务线程上调用时，帧经注册表的 forward 回调转交给连接所在线程排队。
+ * 二进制子协议的客户端排入帧的 MessagePack 版本 (首次需要时转换并缓存在帧上)。
+ * @param client 指向 client_t 结构体的指针。
+ * @param frame 已序列化的发送帧 (调用者保留其引用)。
+ * @return 0 表示已入队 (或已转交)，负数表示错误或帧被丢弃。
+ */
+int client_send_frame(client_t *client, frame_t *frame) {
+    if (!frame) return -2;
+    
+    client_registry_t *reg = client->registry;
+    if (reg && reg->forward && reg != thread_registry) {
+        return reg->forward(reg->forward_arg, client, frame);
+    }
+    
     if (!client->is_alive || !client->wsi) return -1;
     
-    message_t *msg = message_create(event, data ? json_string(data) : NULL);
-    if (!msg) return -2;
+    if (client->encoding == CLIENT_ENCODING_MSGPACK) {
+        frame = frame_get_binary(frame);
+        if (!frame) return -2;
+    } else if (frame->flags & FRAME_FLAG_BINARY) {
+        return -2;
+    }
     
-    char *json_str = message_serialize(msg);
-    message_unref(msg);
+    client_send_queue_t *q = &client->sendq;
+    if (!q->slots) {
+        if (q->high_water == 0) q->high_water = CLIENT_SEND_HIGH_WATER_DEFAULT;
+        q->capacity = (uint16_t)(q->high_water * 2);
+        q->slots = malloc(q->capacity * sizeof(client_send_slot_t));
+        if (!q->slots) return -3;
+        q->head = 0;
+        q->count = 0;
+    }
+    
+    if (q->count >= q->high_water) {
+        if (frame->flags & FRAME_FLAG_DROPPABLE) {
+            client_count_drop(client, METRICS_DROP_SHED);
+            return -4;
+        }
+        if (send_queue_evict_droppable(q)) {
+            client_count_drop(client, METRICS_DROP_EVICTED);
+        }
+    }
     
-    if (!json_str) return -3;
+    if (q->count >= q->capacity) {
+        /* 慢消费者：丢弃连接，避免无限积压 */
+        client_count_drop(client, METRICS_DROP_SLOW_CONSUMER);
+        lws_set_timeout(client->wsi, PENDING_TIMEOUT_CLOSE_SEND, LWS_TO_KILL_ASYNC);
+        return -5;
+    }
     
-    size_t len = strlen(json_str);
-    unsigned char *buf = malloc(LWS_PRE + len + 1);
-    if (!buf) {
-        free(json_str);
-        return -4;
+    /* 记下产生该帧的分派开始时间，写出时计算分派到写出的延迟 */
+    metrics_shard_t *m = reg ? reg->metrics : NULL;
+    client_send_slot_t *slot = &q->slots[(q->head + q->count) % q->capacity];
+    frame_ref(frame);
+    slot->frame = frame;
+    slot->dispatch_ns = m ? m->dispatch_ns : 0;
+    q->count++;
+    if (m) {
+        metrics_observe(&m->send_queue_depth, q->count);
     }
     
-    memcpy(buf + LWS_PRE, json_str, len);
-    buf[LWS_PRE + len] = '\0';
+    if (q->count == 1) {
+        lws_callback_on_writable(client->wsi);
+    }
     
-    int ret = lws_write(client->wsi, buf + LWS_PRE, len, LWS_WRITE_TEXT);
+    return 0;
+}
+
+/* 接收缓冲区的初始容量，之后按倍数增长 */
+#define CLIENT_RECV_MIN_CAPACITY 1024
+
+/**
+ * @brief 把一段分片数据追加到客户端的接收缓冲区。
+ *
+ * 缓冲区取自当前线程的内存池，按倍数增长，总长度不超过注册表的 max_message_size。
+ * @param client 指向 client_t 结构体的指针。
+ * @param data 分片数据。
+ * @param len 数据长度。
+ * @return 0 表示成功，-1 表示消息超过上限，-2 表示内存不足。
+ */
+int client_recv_append(client_t *client, const void *data, size_t len) {
+    client_recv_buf_t *rb = &client->recv;
+    size_t limit = client->registry ? client->registry->max_message_size : CLIENT_MAX_MESSAGE_DEFAULT;
     
-    free(json_str);
-    free(buf);
+    if (len > limit - rb->len) return -1;
     
-    if (ret > 0) {
-        client->messages_sent++;
+    if (rb->len + len > rb->cap) {
+        size_t cap = rb->cap ? rb->cap * 2 : CLIENT_RECV_MIN_CAPACITY;
+        while (cap < rb->len + len) cap *= 2;
+        if (cap > limit) cap = limit;
+        
+        unsigned char *grown = memory_pool_alloc(memory_pool_thread(), cap);
+        if (!grown) return -2;
+        if (rb->len > 0) memcpy(grown, rb->data, rb->len);
+        memory_pool_free(rb->data);
+        rb->data = grown;
+        rb->cap = cap;
     }
     
-    return ret;
+    memcpy(rb->data + rb->len, data, len);
+    rb->len += len;
+    return 0;
+}
+
+/**
+ * @brief 丢弃接收缓冲区中的内容并把存储还给内存池。
+ * @param client 指向 client_t 结构体的指针。
+ */
+void client_recv_reset(client_t *client) {
+    memory_pool_free(client->recv.data);
+    client->recv.data = NULL;
+    client->recv.len = 0;
+    client->recv.cap = 0;
+}
+
+/**
+ * @brief 计入一次准入拒绝。
+ * @param client 指向 client_t 结构体的指针。
+ * @param reason 拒绝原因。
+ */
+static void client_count_reject(client_t *client, metrics_reject_t reason) {
+    client->messages_rejected++;
+    if (client->registry && client->registry->metrics) {
+        metrics_inc(&client->registry->metrics->rejected[reason]);
+    }
+}
+
+/**
+ * @brief 接收回调的准入判断，在复制和解析之前执行。
+ *
+ * 每次回调按交付的字节数扣字节桶，消息收齐时再扣一个消息令牌。
+ * 字节桶不足时丢弃整条消息：已缓冲的部分立即释放，其余分片到达时直接丢弃。
+ * 被拒绝的消息只计数，不回复，开销是两次比较。
+ * @param client 指向 client_t 结构体的指针。
+ * @param len 本次回调交付的字节数。
+ * @param complete 本次回调是否交付了消息的最后一个字节。
+ * @param now_ns 单调时钟 (纳秒)。
+ * @return true 表示继续处理这段数据，false 表示丢弃。
+ */
+bool client_admit(client_t *client, size_t len, bool complete, uint64_t now_ns) {
+    const client_registry_t *reg = client->registry;
+    
+    if (!client->recv_rejected &&
+        !token_bucket_take(&client->byte_bucket, &reg->byte_rate, len, now_ns)) {
+        client->recv_rejected = true;
+        client_recv_reset(client);
+        client_count_reject(client, METRICS_REJECT_BYTES);
+    }
+    if (client->recv_rejected) {
+        if (complete) client->recv_rejected = false;
+        return false;
+    }
+    
+    if (complete && !token_bucket_take(&client->msg_bucket, &reg->msg_rate, 1, now_ns)) {
+        client_recv_reset(client);
+        client_count_reject(client, METRICS_REJECT_MESSAGES);
+        return false;
+    }
+    return true;
+}
+
+/* 超过阈值的帧使用的压缩级别：信令文本在 level 1 已能得到大部分收益 */
+#define CLIENT_DEFLATE_LEVEL 1
+#define CLIENT_DEFLATE_LEVEL_STR "1"
+
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief 按帧长度切换连接的 permessage-deflate 压缩级别。
+ *
+ * 短于阈值的帧以 level 0 (stored) 发送，只在级别变化时通知扩展。
+ * 第一次设置失败说明连接没有协商该扩展，之后不再尝试。
+ * @param client 指向 client_t 结构体的指针。
+ * @param len 即将写出的帧长度。
+ * @return 连接启用了压缩扩展返回 true。
+ */
+static bool client_select_deflate(client_t *client, size_t len) {
+    client_registry_t *reg = client->registry;
+    if (!reg || !reg->compress || client->deflate == CLIENT_DEFLATE_NONE) return false;
+    
+    client_deflate_t want = len >= reg->compress_min_size ? CLIENT_DEFLATE_COMPRESS
+                                                          : CLIENT_DEFLATE_STORE;
+    if (want == client->deflate) return true;
+    
+    if (lws_set_extension_option(client->wsi, "permessage-deflate", "compression_level",
+                                 want == CLIENT_DEFLATE_COMPRESS ? CLIENT_DEFLATE_LEVEL_STR
+                                                                 : "0") != 0) {
+        client->deflate = CLIENT_DEFLATE_NONE;
+        return false;
+    }
+    client->deflate = want;
+    return true;
+}
+
+/**
+ * @brief 用独立的 raw deflate 流估算压缩后的长度，结果计入采样统计。
+ *
+ * 每帧单独压缩 (不保留上下文)，因此估算偏保守。输出只计数不保存。
+ * @param reg 指向 client_registry_t 结构体的指针。
+ * @param buf 帧负载。
+ * @param len 负载长度。
+ */
+static void client_deflate_probe(client_registry_t *reg, const unsigned char *buf, size_t len) {
+    if (!reg->deflate_probe) {
+        z_stream *z = calloc(1, sizeof(z_stream));
+        if (!z) return;
+        if (deflateInit2(z, CLIENT_DEFLATE_LEVEL, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            free(z);
+            return;
+        }
+        reg->deflate_probe = z;
+    }
+    
+    z_stream *z = reg->deflate_probe;
+    unsigned char out[1024];
+    z->next_in = (Bytef *)buf;
+    z->avail_in = (uInt)len;
+    do {
+        z->next_out = out;
+        z->avail_out = sizeof(out);
+        if (deflate(z, Z_SYNC_FLUSH) == Z_STREAM_ERROR) break;
+    } while (z->avail_out == 0);
+    
+    /* permessage-deflate 去掉同步刷新末尾的 4 字节 */
+    uint64_t produced = z->total_out > 4 ? z->total_out - 4 : z->total_out;
+    deflateReset(z);
+    
+    reg->deflate_stats.probe_in += len;
+    reg->deflate_stats.probe_out += produced;
+}
+
+/**
+ * @brief 在 LWS_CALLBACK_SERVER_WRITEABLE 中写出一个排队的帧。
+ *
+ * 每次回调只写一帧 (libwebsockets 的要求)，队列非空时重新请求可写回调。
+ * @param client 指向 client_t 结构体的指针。
+ * @return 0 表示成功，-1 表示写入失败 (应关闭连接)。
+ */
+int client_on_writable(client_t *client) {
+    client_send_queue_t *q = &client->sendq;
+    if (!client->is_alive || q->count == 0) return 0;
+    
+    client_send_slot_t slot = q->slots[q->head];
+    frame_t *frame = slot.frame;
+    q->head = (uint16_t)((q->head + 1) % q->capacity);
+    q->count--;
+    
+    /* 启用压缩时按采样间隔统计写出的 CPU 时间，压缩与不压缩的写出分别计数 */
+    client_registry_t *reg = client->registry;
+    bool deflating = client_select_deflate(client, frame->len);
+    bool compressed = client->deflate == CLIENT_DEFLATE_COMPRESS;
+    bool sample = false;
+    if (deflating) {
+        uint64_t n = compressed ? reg->deflate_stats.frames : reg->deflate_stats.skipped;
+        sample = n % CLIENT_DEFLATE_SAMPLE_INTERVAL == 0;
+    }
+    uint64_t start = sample ? thread_cpu_ns() : 0;
+    
+    enum lws_write_protocol mode = (frame->flags & FRAME_FLAG_BINARY) ? LWS_WRITE_BINARY
+                                                                      : LWS_WRITE_TEXT;
+    int ret = lws_write(client->wsi, frame_payload(frame), frame->len, mode);
+    
+    if (deflating && ret >= 0) {
+        client_deflate_stats_t *st = &reg->deflate_stats;
+        uint64_t spent = sample ? thread_cpu_ns() - start : 0;
+        if (compressed) {
+            st->frames++;
+            st->bytes += frame->len;
+            if (sample) {
+                st->cpu_ns += spent;
+                st->cpu_bytes += frame->len;
+                client_deflate_probe(reg, frame_payload(frame), frame->len);
+            }
+        } else {
+            st->skipped++;
+            if (sample) {
+                st->plain_cpu_ns += spent;
+                st->plain_cpu_bytes += frame->len;
+            }
+        }
+    }
+    
+    metrics_shard_t *m = reg ? reg->metrics : NULL;
+    if (m && ret >= 0) {
+        metrics_inc(&m->frames_written);
+        metrics_add(&m->bytes_written, frame->len);
+        metrics_observe(&m->frame_bytes, frame->len);
+        if (slot.dispatch_ns) {
+            metrics_observe(&m->write_latency, metrics_clock_ns() - slot.dispatch_ns);
+        }
+    }
+    frame_unref(frame);
+    
+    if (ret < 0) return -1;
+    
+    client->messages_sent++;
+    if (q->count > 0) {
+        lws_callback_on_writable(client->wsi);
+    }
+    
+    return 0;
 }
 
 /**
@@ -100,12 +439,38 @@ int client_send_message(client_t *client, const char *event, const char *data) {
  * @return 0 表示成功，-1 表示内存分配失败。
  */
 int client_registry_init(client_registry_t *reg, size_t max_clients) {
-    reg->clients = calloc(max_clients, sizeof(client_t));
-    if (!reg->clients) return -1;
+    /* 只保留地址空间：槽位按块提交，活跃列表的页面用到时才分配 */
+    reg->active_slots = vm_reserve(max_clients * sizeof(uint32_t));
+    if (slot_region_init(&reg->slots, sizeof(client_t), max_clients,
+                         offsetof(client_t, generation)) != 0 ||
+        !reg->active_slots ||
+        vm_commit(reg->active_slots, max_clients * sizeof(uint32_t), false) != 0 ||
+        id_table_init(&reg->by_id, max_clients) != 0) {
+        slot_region_cleanup(&reg->slots);
+        vm_unreserve(reg->active_slots, max_clients * sizeof(uint32_t));
+        reg->clients = NULL;
+        reg->active_slots = NULL;
+        return -1;
+    }
+    reg->clients = (client_t *)reg->slots.base;
     
     reg->max_clients = max_clients;
     reg->active_count = 0;
     reg->total_connections = 0;
+    reg->send_high_water = CLIENT_SEND_HIGH_WATER_DEFAULT;
+    reg->shard = 0;
+    reg->forward = NULL;
+    reg->forward_arg = NULL;
+    reg->timeout_sec = 0;
+    timer_wheel_init(&reg->timeouts, coarse_clock_sec());
+    reg->max_message_size = CLIENT_MAX_MESSAGE_DEFAULT;
+    reg->compress = false;
+    reg->compress_min_size = CLIENT_COMPRESS_MIN_DEFAULT;
+    token_rate_init(&reg->msg_rate, 0, 0);
+    token_rate_init(&reg->byte_rate, 0, 0);
+    reg->deflate_probe = NULL;
+    memset(&reg->deflate_stats, 0, sizeof(reg->deflate_stats));
+    reg->metrics = NULL;
     
     return 0;
 }
@@ -116,13 +481,60 @@ int client_registry_init(client_registry_t *reg, size_t max_clients) {
  */
 void client_registry_cleanup(client_registry_t *reg) {
     if (reg->clients) {
-        free(reg->clients);
+        for (size_t i = 0; i < reg->active_count; i++) {
+            client_cleanup(&reg->clients[reg->active_slots[i]]);
+        }
+
+        slot_region_cleanup(&reg->slots);
         reg->clients = NULL;
     }
+    vm_unreserve(reg->active_slots, reg->max_clients * sizeof(uint32_t));
+    reg->active_slots = NULL;
+    id_table_cleanup(&reg->by_id);
+    if (reg->deflate_probe) {
+        deflateEnd(reg->deflate_probe);
+        free(reg->deflate_probe);
+        reg->deflate_probe = NULL;
+    }
     reg->max_clients = 0;
     reg->active_count = 0;
 }
 
+/**
+ * @brief 取出一个槽位并初始化客户端 (ID 由调用者登记)。
+ *
+ * 取编号最小的有空位的块中的槽位，必要时提交新的块。
+ * @param reg 指向 client_registry_t 结构体的指针。
+ * @param wsi 指向 libwebsockets 实例的指针 (代理为 NULL)。
+ * @return 指向客户端的指针，如果注册表已满则返回 NULL。
+ */
+static client_t *client_registry_take_slot(client_registry_t *reg, struct lws *wsi) {
+    uint32_t index;
+    client_t *client = slot_region_alloc(&reg->slots, &index);
+    if (!client) return NULL;
+
+    /* client_init 会清零结构体，先保留槽位代数 */
+    uint32_t generation = client->generation + 1;
+    client_init(client, wsi);
+    client->generation = generation ? generation : 1;
+    client->sendq.high_water = reg->send_high_water;
+    client->registry = reg;
+    client->route_shard = (uint32_t)reg->shard;
+    atomic_store_explicit(&client->owner_shard, (unsigned)reg->shard, memory_order_relaxed);
+    return client;
+}
+
+/**
+ * @brief 把已登记 ID 的客户端加入活跃列表。
+ * @param reg 指向 client_registry_t 结构体的指针。
+ * @param client 刚取出槽位的客户端。
+ */
+static void client_registry_activate(client_registry_t *reg, client_t *client) {
+    client->active_pos = (uint32_t)reg->active_count;
+    reg->active_slots[reg->active_count++] = (uint32_t)(client - reg->clients);
+    reg->total_connections++;
+}
+
 /**
  * @brief 向客户端注册表添加一个新客户端。
  * @param reg 指向 client_registry_t 结构体的指针。
@@ -130,42 +542,160 @@ void client_registry_cleanup(client_registry_t *reg) {
  * @return 指向新添加客户端的指针，如果注册表已满则返回 NULL。
  */
 client_t *client_registry_add(client_registry_t *reg, struct lws *wsi) {
-    for (size_t i = 0; i < reg->max_clients; i++) {
-        if (!reg->clients[i].is_alive) {
-            client_init(&reg->clients[i], wsi);
-            reg->active_count++;
-            reg->total_connections++;
-            return &reg->clients[i];
-        }
+    client_t *client = client_registry_take_slot(reg, wsi);
+    if (!client) return NULL;
+
+    /* 极小概率的 ID 冲突：重新生成直到可以插入索引 */
+    while (id_table_insert(&reg->by_id, &client->id, client) == -2) {
+        id128_generate(&client->id);
+    }
+
+    client_registry_activate(reg, client);
+    
+    /* 按连接时间挂载超时定时器，之后的活动只更新 last_activity，到期时再重新挂载 */
+    if (reg->timeout_sec > 0) {
+        timer_wheel_add(&reg->timeouts, &client->timeout_node,
+                        client->connect_time + reg->timeout_sec + 1);
+    }
+    return client;
+}
+
+/**
+ * @brief 为另一个节点上的连接添加代理客户端 (集群模式)。
+ *
+ * 代理沿用连接节点分配的客户端 ID，没有 wsi，也不计超时：它的生命周期
+ * 由连接节点的 RELEASE 记录决定。发给代理的帧经注册表的 forward 回调发回连接节点。
+ * @param reg 指向代理注册表的指针。
+ * @param origin 真实连接的位置。
+ * @return 指向代理的指针；注册表已满或该 ID 已有代理时返回 NULL。
+ */
+client_t *client_registry_add_proxy(client_registry_t *reg, const client_origin_t *origin) {
+    if (id_table_find(&reg->by_id, &origin->id)) return NULL;
+
+    client_t *client = client_registry_take_slot(reg, NULL);
+    if (!client) return NULL;
+
+    client->id = origin->id;
+    client->origin = *origin;
+    client->encoding = origin->encoding;
+    if (id_table_insert(&reg->by_id, &client->id, client) != 0) {
+        /* 索引已满：归还槽位 */
+        client_cleanup(client);
+        slot_region_free(&reg->slots, (uint32_t)(client - reg->clients));
+        return NULL;
+    }
+
+    client_registry_activate(reg, client);
+    return client;
+}
+
+/**
+ * @brief 把客户端从 ID 索引中摘除，槽位保持有效直到 client_registry_remove。
+ *
+ * 用于正在释放的代理：之后同一 ID 的消息会登记一个新的代理，而不会排在旧代理的断开之后。
+ * @param reg 指向 client_registry_t 结构体的指针。
+ * @param client 要摘除的客户端。
+ */
+void client_registry_unlink_id(client_registry_t *reg, client_t *client) {
+    if (id_table_find(&reg->by_id, &client->id) == client) {
+        id_table_remove(&reg->by_id, &client->id);
     }
-    return NULL;
+}
+
+/**
+ * @brief 改用另一个客户端 ID (恢复会话时新连接接替暂离客户端的 ID)。
+ *
+ * 索引中同一 ID 的旧条目 (同一注册表中的暂离客户端) 被替换，旧客户端随后移除时
+ * client_registry_unlink_id 不会再摘除新条目。
+ * @param reg 指向 client_registry_t 结构体的指针。
+ * @param client 要改 ID 的客户端。
+ * @param id 新的客户端 ID。
+ */
+void client_registry_rekey(client_registry_t *reg, client_t *client, const id128_t *id) {
+    client_registry_unlink_id(reg, client);
+    id_table_remove(&reg->by_id, id);
+    
+    client->id = *id;
+    id_table_insert(&reg->by_id, &client->id, client);
 }
 
 /**
  * @brief 从客户端注册表移除一个客户端。
+ *
+ * 用活跃列表末尾元素填补空位，并把槽位还给所在的块，释放为 O(1)。
  * @param reg 指向 client_registry_t 结构体的指针。
  * @param client 指向要移除的 client_t 结构体的指针。
  */
 void client_registry_remove(client_registry_t *reg, client_t *client) {
     if (client && client->is_alive) {
+        uint32_t index = (uint32_t)(client - reg->clients);
+        uint32_t last = reg->active_slots[--reg->active_count];
+
+        reg->active_slots[client->active_pos] = last;
+        reg->clients[last].active_pos = client->active_pos;
+
+        client_registry_unlink_id(reg, client);
+        timer_wheel_remove(&reg->timeouts, &client->timeout_node);
         client_cleanup(client);
-        reg->active_count--;
+        slot_region_free(&reg->slots, index);
     }
 }
 
 /**
  * @brief 根据 libwebsockets 实例查找客户端。
+ *
+ * 会话数据 (per-session user data) 中保存了客户端句柄，因此查找为 O(1)，
+ * 无需扫描整个注册表。
  * @param reg 指向 client_registry_t 结构体的指针。
  * @param wsi 指向 libwebsockets 实例的指针。
  * @return 指向找到的客户端的指针，如果未找到则返回 NULL。
  */
 client_t *client_registry_find_by_wsi(client_registry_t *reg, struct lws *wsi) {
-    for (size_t i = 0; i < reg->max_clients; i++) {
-        if (reg->clients[i].is_alive && reg->clients[i].wsi == wsi) {
-            return &reg->clients[i];
-        }
+    const client_handle_t *session = wsi ? lws_wsi_user(wsi) : NULL;
+    if (!session) return NULL;
+
+    client_t *client = client_registry_get(reg, *session);
+    return (client && client->wsi == wsi) ? client : NULL;
+}
+
+/**
+ * @brief 根据客户端 ID 查找客户端 (一次哈希探测)。
+ * @param reg 指向 client_registry_t 结构体的常量指针。
+ * @param id 客户端二进制 ID。
+ * @return 指向找到的客户端的指针，如果未找到则返回 NULL。
+ */
+client_t *client_registry_find_by_id(const client_registry_t *reg, const id128_t *id) {
+    return id ? id_table_find(&reg->by_id, id) : NULL;
+}
+
+/**
+ * @brief 获取客户端对应的句柄。
+ * @param reg 指向 client_registry_t 结构体的常量指针。
+ * @param client 指向注册表中客户端的常量指针。
+ * @return 客户端句柄，client 为 NULL 时返回代数为 0 的无效句柄。
+ */
+client_handle_t client_registry_handle(const client_registry_t *reg, const client_t *client) {
+    client_handle_t handle = { 0, 0 };
+    if (client) {
+        handle.index = (uint32_t)(client - reg->clients);
+        handle.generation = client->generation;
     }
-    return NULL;
+    return handle;
+}
+
+/**
+ * @brief 通过句柄获取客户端 (O(1))。
+ * @param reg 指向 client_registry_t 结构体的指针。
+ * @param handle 客户端句柄。
+ * @return 句柄仍然有效时返回客户端指针；槽位已释放或被复用时返回 NULL。
+ */
+client_t *client_registry_get(client_registry_t *reg, client_handle_t handle) {
+    if (handle.generation == 0 || !slot_region_contains(&reg->slots, handle.index)) return NULL;
+
+    client_t *client = &reg->clients[handle.index];
+    if (!client->is_alive || client->generation != handle.generation) return NULL;
+
+    return client;
 }
 
 /**
@@ -175,4 +705,96 @@ client_t *client_registry_find_by_wsi(client_registry_t *reg, struct lws *wsi) {
  */
 size_t client_registry_get_active_count(const client_registry_t *reg) {
     return reg->active_count;
+}
+
+/**
+ * @brief 按活跃列表位置获取客户端。
+ *
+ * 遍历时若可能移除客户端，应从 active_count - 1 向 0 倒序遍历，
+ * 因为移除会把末尾元素换到当前位置。
+ * @param reg 指向 client_registry_t 结构体的指针。
+ * @param pos 活跃列表中的位置 (0 .. active_count - 1)。
+ * @return 指向活跃客户端的指针，越界时返回 NULL。
+ */
+client_t *client_registry_active_at(client_registry_t *reg, size_t pos) {
+    if (pos >= reg->active_count) return NULL;
+    return &reg->clients[reg->active_slots[pos]];
+}
+
+/**
+ * @brief 声明当前线程负责该注册表。
+ *
+ * 之后本线程对其他注册表中客户端的发送都会经 forward 回调转交。
+ * @param reg 指向 client_registry_t 结构体的常量指针。
+ */
+void client_registry_bind_thread(const client_registry_t *reg) {
+    thread_registry = reg;
+}
+
+/**
+ * @brief 归还长时间空闲的槽位块的物理页 (流量高峰之后)。
+ * @param reg 指向 client_registry_t 结构体的指针。
+ * @param now 当前时间戳，单位为秒。
+ * @param idle_sec 块全部空闲后保留的秒数。
+ * @return 归还的块数。
+ */
+size_t client_registry_trim(client_registry_t *reg, uint32_t now, uint32_t idle_sec) {
+    if (!reg->clients) return 0;
+
+    size_t released = slot_region_trim(&reg->slots, now, idle_sec);
+    if (released > 0) {
+        /* 活跃列表超出当前数量的部分同样不再需要 */
+        vm_decommit(&reg->active_slots[reg->active_count],
+                    (reg->max_clients - reg->active_count) * sizeof(uint32_t));
+    }
+    return released;
+}
+
+typedef struct client_timeout_ctx_s {
+    client_registry_t *reg;
+    uint32_t now;
+    client_timeout_fn on_timeout;
+    void *arg;
+    size_t expired;
+} client_timeout_ctx_t;
+
+/**
+ * @brief 时间轮到期回调：挂载后有过活动的客户端按新的截止时间重新挂载，真正超时的交给调用者。
+ * @param node 到期的定时器节点。
+ * @param arg 指向 client_timeout_ctx_t 的指针。
+ */
+static void client_timeout_expire(timer_node_t *node, void *arg) {
+    client_timeout_ctx_t *ctx = arg;
+    client_t *client = lws_container_of(node, client_t, timeout_node);
+    
+    /* wsi 为空表示连接已关闭，槽位释放前不再计时 */
+    if (!client->wsi) return;
+    
+    uint32_t deadline = client->last_activity + ctx->reg->timeout_sec + 1;
+    if ((int32_t)(deadline - ctx->now) > 0) {
+        timer_wheel_add(&ctx->reg->timeouts, node, deadline);
+        return;
+    }
+    
+    ctx->expired++;
+    ctx->on_timeout(ctx->arg, client);
+}
+
+/**
+ * @brief 推进注册表的超时时间轮，对每个空闲超时的客户端调用回调。
+ *
+ * 开销只与到期的定时器数量成正比，而不是与在线客户端总数成正比。
+ * 回调中不能移除客户端，应异步关闭连接，由正常的断开流程释放槽位。
+ * @param reg 指向 client_registry_t 结构体的指针。
+ * @param now 当前时间戳，单位为秒。
+ * @param on_timeout 超时回调。
+ * @param arg 传给回调的参数。
+ * @return 本次超时的客户端数量。
+ */
+size_t client_registry_expire_timeouts(client_registry_t *reg, uint32_t now,
+                                       client_timeout_fn on_timeout, void *arg) {
+    client_timeout_ctx_t ctx = { reg, now, on_timeout, arg, 0 };
+    
+    timer_wheel_advance(&reg->timeouts, now, client_timeout_expire, &ctx);
+    return ctx.expired;
 }
\ No newline at end of file
@@ -0,0 +1,712 @@
+/**
+ * @file cluster.c
+ * @brief 集群模式：房间 ID 到节点的一致性哈希，以及节点间批量、零拷贝的 TCP backplane。
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "../include/cluster.h"
+
+/* 出站连接失败后的重连间隔 */
+#define CLUSTER_RETRY_MS 1000
+
+/* 每次 writev 最多提交的记录数 (每条两段) */
+#define CLUSTER_WRITEV_RECORDS 256
+
+/* 入站缓冲区每次至少预留的读取空间 */
+#define CLUSTER_READ_CHUNK (64 * 1024)
+
+/* splitmix64 的最终混合：把相近的输入打散到整个 64 位空间 */
+static uint64_t cluster_mix(uint64_t h) {
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    return h;
+}
+
+/* 节点地址的 FNV-1a 哈希：虚拟节点的位置只取决于地址，而不是它在列表中的位置 */
+static uint64_t cluster_addr_hash(const char *host, const char *port) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (const char *p = host; *p; p++) h = (h ^ (unsigned char)*p) * 0x100000001B3ULL;
+    h = (h ^ ':') * 0x100000001B3ULL;
+    for (const char *p = port; *p; p++) h = (h ^ (unsigned char)*p) * 0x100000001B3ULL;
+    return h;
+}
+
+static int cluster_point_cmp(const void *a, const void *b) {
+    const cluster_point_t *pa = a, *pb = b;
+    if (pa->hash != pb->hash) return pa->hash < pb->hash ? -1 : 1;
+    return pa->node < pb->node ? -1 : (pa->node > pb->node);
+}
+
+unsigned cluster_owner(const cluster_t *cluster, const id128_t *room_id) {
+    /* 分片字节只在节点内部有意义，不参与节点选择 */
+    id128_t key = *room_id;
+    id128_set_shard(&key, 0);
+    uint64_t h = cluster_mix(id128_hash(&key));
+
+    /* 顺时针找到第一个不小于 h 的点 */
+    size_t lo = 0, hi = cluster->ring_size;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cluster->ring[mid].hash < h) lo = mid + 1;
+        else hi = mid;
+    }
+    return cluster->ring[lo == cluster->ring_size ? 0 : lo].node;
+}
+
+/* 解析 "host:port"，主机名可以用方括号包住 IPv6 地址 */
+static int cluster_parse_addr(const char *addr, size_t len, cluster_peer_t *peer) {
+    while (len > 0 && (*addr == ' ' || *addr == '\t')) { addr++; len--; }
+    while (len > 0 && (addr[len - 1] == ' ' || addr[len - 1] == '\t')) len--;
+
+    const char *colon = NULL;
+    for (size_t i = 0; i < len; i++) {
+        if (addr[i] == ':') colon = addr + i;
+    }
+    if (!colon) return -1;
+
+    const char *host = addr;
+    size_t host_len = (size_t)(colon - addr);
+    size_t port_len = len - host_len - 1;
+    if (host_len >= 2 && host[0] == '[' && host[host_len - 1] == ']') {
+        host++;
+        host_len -= 2;
+    }
+    if (host_len == 0 || host_len >= sizeof(peer->host) ||
+        port_len == 0 || port_len >= sizeof(peer->port)) {
+        return -1;
+    }
+
+    memcpy(peer->host, host, host_len);
+    peer->host[host_len] = '\0';
+    memcpy(peer->port, colon + 1, port_len);
+    peer->port[port_len] = '\0';
+    return 0;
+}
+
+static int cluster_set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* 监听本节点地址中的端口 (所有接口) */
+static int cluster_listen(const char *port) {
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(NULL, port, &hints, &res) != 0) return -1;
+
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 64) == 0 &&
+            cluster_set_nonblocking(fd) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+int cluster_init(cluster_t *cluster, const char *nodes, unsigned self,
+                 cluster_deliver_fn deliver, cluster_node_down_fn node_down, void *arg) {
+    memset(cluster, 0, sizeof(*cluster));
+    cluster->listen_fd = -1;
+    cluster->wake_fds[0] = cluster->wake_fds[1] = -1;
+    cluster->deliver = deliver;
+    cluster->node_down = node_down;
+    cluster->arg = arg;
+
+    /* 成员表：下标即节点编号 */
+    const char *p = nodes;
+    while (p && *p) {
+        const char *end = strchr(p, ',');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (cluster->node_count >= CLUSTER_MAX_NODES ||
+            cluster_parse_addr(p, len, &cluster->peers[cluster->node_count]) != 0) {
+            fprintf(stderr, "无效的集群节点列表: %s\n", nodes);
+            return -1;
+        }
+        cluster->node_count++;
+        p = end ? end + 1 : NULL;
+    }
+    if (cluster->node_count == 0 || self >= cluster->node_count) {
+        fprintf(stderr, "节点编号 %u 不在集群节点列表中\n", self);
+        return -1;
+    }
+    cluster->self = self;
+
+    /* 哈希环 */
+    cluster->ring_size = (size_t)cluster->node_count * CLUSTER_VNODES;
+    cluster->ring = malloc(cluster->ring_size * sizeof(cluster_point_t));
+    if (!cluster->ring) return -2;
+    for (unsigned n = 0; n < cluster->node_count; n++) {
+        uint64_t base = cluster_addr_hash(cluster->peers[n].host, cluster->peers[n].port);
+        for (unsigned v = 0; v < CLUSTER_VNODES; v++) {
+            cluster_point_t *pt = &cluster->ring[(size_t)n * CLUSTER_VNODES + v];
+            pt->hash = cluster_mix(base + v * 0x9E3779B97F4A7C15ULL);
+            pt->node = n;
+        }
+    }
+    qsort(cluster->ring, cluster->ring_size, sizeof(cluster_point_t), cluster_point_cmp);
+
+    for (unsigned n = 0; n < cluster->node_count; n++) {
+        cluster_peer_t *peer = &cluster->peers[n];
+        peer->fd = -1;
+        atomic_init(&peer->up, false);
+        pthread_mutex_init(&peer->lock, NULL);
+    }
+
+    if (pipe(cluster->wake_fds) != 0 ||
+        cluster_set_nonblocking(cluster->wake_fds[0]) != 0 ||
+        cluster_set_nonblocking(cluster->wake_fds[1]) != 0) {
+        cluster_cleanup(cluster);
+        return -2;
+    }
+
+    cluster->listen_fd = cluster_listen(cluster->peers[self].port);
+    if (cluster->listen_fd < 0) {
+        fprintf(stderr, "集群端口 %s 监听失败\n", cluster->peers[self].port);
+        cluster_cleanup(cluster);
+        return -3;
+    }
+
+    atomic_init(&cluster->running, false);
+    atomic_init(&cluster->records_sent, 0);
+    atomic_init(&cluster->records_received, 0);
+    atomic_init(&cluster->records_dropped, 0);
+    return 0;
+}
+
+static void put_u16(unsigned char *p, uint16_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static void put_u64(unsigned char *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint16_t get_u16(const unsigned char *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+static uint64_t get_u64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+/*
+ * 记录头 (小端)：
+ *   0 u32 长度 (头部其余部分 + 负载)   4 u8 类型   5 u8 标志   6 u16 发送节点
+ *   8 u16 连接分片   10 u8 连接编码   11 u8 保留   12 u32 句柄索引   16 u32 句柄代数
+ *   20 u64 客户端 ID 高位   28 u64 客户端 ID 低位
+ */
+static void cluster_encode_header(unsigned char *h, const cluster_record_t *rec,
+                                  uint16_t node, size_t payload_len) {
+    put_u32(h, (uint32_t)(CLUSTER_HEADER_SIZE - 4 + payload_len));
+    h[4] = (unsigned char)rec->type;
+    h[5] = rec->flags;
+    put_u16(h + 6, node);
+    put_u16(h + 8, rec->origin.shard);
+    h[10] = (unsigned char)rec->origin.encoding;
+    h[11] = 0;
+    put_u32(h + 12, rec->origin.handle.index);
+    put_u32(h + 16, rec->origin.handle.generation);
+    put_u64(h + 20, rec->origin.id.hi);
+    put_u64(h + 28, rec->origin.id.lo);
+}
+
+/* 解码记录头；DELIVER 的连接在接收方，其余记录的连接在发送方 */
+static void cluster_decode_header(const cluster_t *cluster, const unsigned char *h,
+                                  size_t len, cluster_record_t *rec) {
+    rec->type = (cluster_record_type_t)h[4];
+    rec->flags = h[5];
+    rec->node = get_u16(h + 6);
+    rec->origin.shard = get_u16(h + 8);
+    rec->origin.encoding = h[10] == CLIENT_ENCODING_MSGPACK ? CLIENT_ENCODING_MSGPACK
+                                                            : CLIENT_ENCODING_JSON;
+    rec->origin.handle.index = get_u32(h + 12);
+    rec->origin.handle.generation = get_u32(h + 16);
+    rec->origin.id.hi = get_u64(h + 20);
+    rec->origin.id.lo = get_u64(h + 28);
+    rec->origin.node = rec->type == CLUSTER_REC_DELIVER ? (uint16_t)cluster->self : rec->node;
+    rec->payload = h + CLUSTER_HEADER_SIZE;
+    rec->payload_len = len - CLUSTER_HEADER_SIZE;
+}
+
+static void cluster_batch_release(cluster_t *cluster, cluster_batch_t *batch, size_t from,
+                                  bool dropped) {
+    for (size_t i = from; i < batch->count; i++) {
+        frame_unref(batch->items[i].frame);
+        message_unref(batch->items[i].message);
+    }
+    if (dropped && batch->count > from) {
+        atomic_fetch_add_explicit(&cluster->records_dropped, batch->count - from,
+                                  memory_order_relaxed);
+    }
+    batch->count = 0;
+}
+
+static int cluster_batch_push(cluster_batch_t *batch, const cluster_pending_t *item) {
+    if (batch->count == batch->capacity) {
+        size_t capacity = batch->capacity ? batch->capacity * 2 : 64;
+        cluster_pending_t *items = realloc(batch->items, capacity * sizeof(cluster_pending_t));
+        if (!items) return -1;
+        batch->items = items;
+        batch->capacity = capacity;
+    }
+    batch->items[batch->count++] = *item;
+    return 0;
+}
+
+static void cluster_wake(cluster_t *cluster) {
+    char c = 1;
+    ssize_t n = write(cluster->wake_fds[1], &c, 1);
+    (void)n; /* 管道已满说明唤醒已在途 */
+}
+
+int cluster_send(cluster_t *cluster, unsigned node, const cluster_record_t *rec,
+                 frame_t *frame, message_t *message) {
+    if (node >= cluster->node_count || node == cluster->self) return -1;
+
+    cluster_peer_t *peer = &cluster->peers[node];
+    if (!atomic_load_explicit(&peer->up, memory_order_acquire)) {
+        atomic_fetch_add_explicit(&cluster->records_dropped, 1, memory_order_relaxed);
+        return -1;
+    }
+
+    cluster_pending_t item = { .frame = frame, .message = message };
+    if (frame) {
+        item.payload = frame_payload(frame);
+        item.payload_len = frame->len;
+    } else if (message) {
+        item.payload = (const unsigned char *)message->raw;
+        item.payload_len = message->raw_len;
+    }
+    cluster_encode_header(item.header, rec, (uint16_t)cluster->self, item.payload_len);
+
+    pthread_mutex_lock(&peer->lock);
+    int ret = 0;
+    bool was_empty = peer->pending.count == 0;
+    /*
+     * 引用在入队前取得：解锁后 I/O 线程随时可能写出并释放这条记录 (或连接失败时整批丢弃)，
+     * 调用者自己的引用也可能在返回后立即释放。
+     */
+    frame_ref(frame);
+    message_ref(message);
+    if (peer->pending.count >= CLUSTER_PENDING_MAX) {
+        ret = -2;
+    } else if (cluster_batch_push(&peer->pending, &item) != 0) {
+        ret = -3;
+    }
+    pthread_mutex_unlock(&peer->lock);
+
+    if (ret != 0) {
+        frame_unref(frame);
+        message_unref(message);
+        atomic_fetch_add_explicit(&cluster->records_dropped, 1, memory_order_relaxed);
+        return ret;
+    }
+
+    /* 只有第一条记录需要唤醒，之后的记录与它一起写出 */
+    if (was_empty) {
+        cluster_wake(cluster);
+    }
+    return 0;
+}
+
+/* 出站连接失败：丢弃所有未写出的记录，稍后重连 */
+static void cluster_peer_fail(cluster_t *cluster, cluster_peer_t *peer, uint64_t now) {
+    if (peer->fd >= 0) {
+        close(peer->fd);
+        peer->fd = -1;
+    }
+    peer->connecting = false;
+    peer->retry_at = now + CLUSTER_RETRY_MS;
+    atomic_store_explicit(&peer->up, false, memory_order_release);
+
+    cluster_batch_release(cluster, &peer->sending, peer->send_pos, true);
+    peer->send_pos = 0;
+    peer->send_off = 0;
+
+    pthread_mutex_lock(&peer->lock);
+    cluster_batch_release(cluster, &peer->pending, 0, true);
+    pthread_mutex_unlock(&peer->lock);
+}
+
+/* 连接建立：HELLO 排在最前面，然后开放给生产者 */
+static void cluster_peer_connected(cluster_t *cluster, cluster_peer_t *peer) {
+    cluster_record_t hello = { .type = CLUSTER_REC_HELLO };
+    cluster_pending_t item = { 0 };
+    cluster_encode_header(item.header, &hello, (uint16_t)cluster->self, 0);
+
+    peer->connecting = false;
+    peer->send_pos = 0;
+    peer->send_off = 0;
+    peer->sending.count = 0;
+    if (cluster_batch_push(&peer->sending, &item) != 0) {
+        cluster_peer_fail(cluster, peer, get_timestamp_ms());
+        return;
+    }
+    atomic_store_explicit(&peer->up, true, memory_order_release);
+}
+
+/* 发起非阻塞连接，完成与否在 poll 的 POLLOUT 中检查 */
+static void cluster_peer_connect(cluster_peer_t *peer, uint64_t now) {
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(peer->host, peer->port, &hints, &res) != 0 || !res) {
+        peer->retry_at = now + CLUSTER_RETRY_MS;
+        return;
+    }
+
+    int fd = socket(res->ai_family, res->ai_socktype | SOCK_CLOEXEC, res->ai_protocol);
+    if (fd >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (cluster_set_nonblocking(fd) != 0 ||
+            (connect(fd, res->ai_addr, res->ai_addrlen) != 0 && errno != EINPROGRESS)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+
+    peer->fd = fd;
+    if (fd < 0) {
+        peer->retry_at = now + CLUSTER_RETRY_MS;
+        return;
+    }
+    peer->connecting = true;
+}
+
+/*
+ * 把 pending 中的记录整批换到 sending，用 writev 写出：头部和负载各一段，
+ * 负载直接取自共享的帧和消息。返回 true 表示还有未写完的数据 (需要等待 POLLOUT)。
+ */
+static bool cluster_peer_flush(cluster_t *cluster, cluster_peer_t *peer, uint64_t now) {
+    for (;;) {
+        if (peer->send_pos == peer->sending.count) {
+            cluster_batch_release(cluster, &peer->sending, 0, false);
+            peer->send_pos = 0;
+            peer->send_off = 0;
+
+            pthread_mutex_lock(&peer->lock);
+            cluster_batch_t swap = peer->sending;
+            peer->sending = peer->pending;
+            peer->pending = swap;
+            pthread_mutex_unlock(&peer->lock);
+
+            if (peer->sending.count == 0) return false;
+        }
+
+        struct iovec iov[CLUSTER_WRITEV_RECORDS * 2];
+        int iovcnt = 0;
+        size_t off = peer->send_off;
+        for (size_t i = peer->send_pos;
+             i < peer->sending.count && iovcnt + 2 <= CLUSTER_WRITEV_RECORDS * 2; i++) {
+            cluster_pending_t *item = &peer->sending.items[i];
+            if (off < CLUSTER_HEADER_SIZE) {
+                iov[iovcnt].iov_base = item->header + off;
+                iov[iovcnt].iov_len = CLUSTER_HEADER_SIZE - off;
+                iovcnt++;
+                off = CLUSTER_HEADER_SIZE;
+            }
+            if (item->payload_len > off - CLUSTER_HEADER_SIZE) {
+                iov[iovcnt].iov_base = (void *)(item->payload + (off - CLUSTER_HEADER_SIZE));
+                iov[iovcnt].iov_len = item->payload_len - (off - CLUSTER_HEADER_SIZE);
+                iovcnt++;
+            }
+            off = 0;
+        }
+
+        ssize_t n = writev(peer->fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            if (errno == EINTR) continue;
+            cluster_peer_fail(cluster, peer, now);
+            return false;
+        }
+
+        /* 推进写出位置；写完的记录立即释放负载引用 */
+        size_t written = (size_t)n;
+        while (written > 0) {
+            cluster_pending_t *item = &peer->sending.items[peer->send_pos];
+            size_t remaining = CLUSTER_HEADER_SIZE + item->payload_len - peer->send_off;
+            if (written < remaining) {
+                peer->send_off += written;
+                break;
+            }
+            written -= remaining;
+            frame_unref(item->frame);
+            message_unref(item->message);
+            item->frame = NULL;
+            item->message = NULL;
+            peer->send_pos++;
+            peer->send_off = 0;
+            atomic_fetch_add_explicit(&cluster->records_sent, 1, memory_order_relaxed);
+        }
+    }
+}
+
+static void cluster_inbound_close(cluster_t *cluster, size_t index, bool notify) {
+    cluster_inbound_t *in = &cluster->inbound[index];
+    int node = in->node;
+
+    close(in->fd);
+    free(in->buf);
+    cluster->inbound[index] = cluster->inbound[--cluster->inbound_count];
+
+    if (notify && node >= 0 && cluster->node_down) {
+        cluster->node_down(cluster->arg, (unsigned)node);
+    }
+}
+
+/* 处理入站缓冲区中的完整记录，返回 -1 表示协议错误 */
+static int cluster_inbound_parse(cluster_t *cluster, size_t index) {
+    cluster_inbound_t *in = &cluster->inbound[index];
+    size_t pos = 0;
+
+    while (in->len - pos >= 4) {
+        uint32_t len = get_u32(in->buf + pos);
+        if (len < CLUSTER_HEADER_SIZE - 4 || len > CLUSTER_RECORD_MAX) return -1;
+        if (in->len - pos < 4 + (size_t)len) break;
+
+        cluster_record_t rec;
+        cluster_decode_header(cluster, in->buf + pos, 4 + (size_t)len, &rec);
+        pos += 4 + (size_t)len;
+        if (rec.node >= cluster->node_count) return -1;
+
+        if (rec.type == CLUSTER_REC_HELLO) {
+            /* 对端重连：旧连接随后关闭时不再按节点断开处理，代理仍然有效 */
+            for (size_t i = 0; i < cluster->inbound_count; i++) {
+                if (i != index && cluster->inbound[i].node == (int)rec.node) {
+                    cluster->inbound[i].node = -1;
+                }
+            }
+            in->node = rec.node;
+            continue;
+        }
+
+        atomic_fetch_add_explicit(&cluster->records_received, 1, memory_order_relaxed);
+        cluster->deliver(cluster->arg, &rec);
+    }
+
+    if (pos > 0) {
+        memmove(in->buf, in->buf + pos, in->len - pos);
+        in->len -= pos;
+    }
+    return 0;
+}
+
+/* 读取入站连接，返回 -1 表示连接已关闭或出错 */
+static int cluster_inbound_read(cluster_t *cluster, size_t index) {
+    cluster_inbound_t *in = &cluster->inbound[index];
+
+    for (;;) {
+        if (in->cap - in->len < CLUSTER_READ_CHUNK) {
+            size_t cap = in->cap ? in->cap * 2 : CLUSTER_READ_CHUNK * 2;
+            if (cap > CLUSTER_RECORD_MAX + CLUSTER_READ_CHUNK * 2) return -1;
+            unsigned char *buf = realloc(in->buf, cap);
+            if (!buf) return -1;
+            in->buf = buf;
+            in->cap = cap;
+        }
+
+        ssize_t n = recv(in->fd, in->buf + in->len, in->cap - in->len, 0);
+        if (n == 0) return -1;
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        in->len += (size_t)n;
+        if (cluster_inbound_parse(cluster, index) != 0) return -1;
+    }
+}
+
+static void cluster_accept(cluster_t *cluster) {
+    for (;;) {
+        int fd = accept(cluster->listen_fd, NULL, NULL);
+        if (fd < 0) return;
+
+        if (cluster->inbound_count >= sizeof(cluster->inbound) / sizeof(cluster->inbound[0]) ||
+            cluster_set_nonblocking(fd) != 0) {
+            close(fd);
+            continue;
+        }
+        cluster->inbound[cluster->inbound_count++] = (cluster_inbound_t){ .fd = fd, .node = -1 };
+    }
+}
+
+/*
+ * backplane 线程：每轮先写出所有对端的待发送记录，再在 poll 中等待新记录 (自管道)、
+ * 可写、入站数据和新连接。服务线程不会在网络 I/O 上阻塞。
+ */
+static void *cluster_thread_main(void *arg) {
+    cluster_t *cluster = arg;
+    struct pollfd fds[2 + CLUSTER_MAX_NODES * 3];
+    int peer_slot[CLUSTER_MAX_NODES];
+
+    while (atomic_load_explicit(&cluster->running, memory_order_acquire)) {
+        uint64_t now = get_timestamp_ms();
+        nfds_t nfds = 0;
+
+        fds[nfds++] = (struct pollfd){ .fd = cluster->wake_fds[0], .events = POLLIN };
+        fds[nfds++] = (struct pollfd){ .fd = cluster->listen_fd, .events = POLLIN };
+
+        for (unsigned n = 0; n < cluster->node_count; n++) {
+            cluster_peer_t *peer = &cluster->peers[n];
+            peer_slot[n] = -1;
+            if (n == cluster->self) continue;
+
+            if (peer->fd < 0 && (int64_t)(now - peer->retry_at) >= 0) {
+                cluster_peer_connect(peer, now);
+            }
+            if (peer->fd < 0) continue;
+
+            short events = POLLIN; /* 出站连接上没有数据，读到 EOF 说明对端已关闭 */
+            if (peer->connecting || cluster_peer_flush(cluster, peer, now)) {
+                events |= POLLOUT;
+            }
+            if (peer->fd < 0) continue;
+
+            peer_slot[n] = (int)nfds;
+            fds[nfds++] = (struct pollfd){ .fd = peer->fd, .events = events };
+        }
+
+        size_t inbound_base = nfds;
+        for (size_t i = 0; i < cluster->inbound_count; i++) {
+            fds[nfds++] = (struct pollfd){ .fd = cluster->inbound[i].fd, .events = POLLIN };
+        }
+
+        if (poll(fds, nfds, CLUSTER_RETRY_MS) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        now = get_timestamp_ms();
+
+        if (fds[0].revents & POLLIN) {
+            char drain[64];
+            while (read(cluster->wake_fds[0], drain, sizeof(drain)) > 0) {}
+        }
+
+        for (unsigned n = 0; n < cluster->node_count; n++) {
+            cluster_peer_t *peer = &cluster->peers[n];
+            if (peer_slot[n] < 0 || peer->fd < 0) continue;
+            short revents = fds[peer_slot[n]].revents;
+
+            if (peer->connecting) {
+                if (!(revents & (POLLOUT | POLLERR | POLLHUP))) continue;
+                int err = 0;
+                socklen_t err_len = sizeof(err);
+                if (getsockopt(peer->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0 || err != 0) {
+                    cluster_peer_fail(cluster, peer, now);
+                } else {
+                    cluster_peer_connected(cluster, peer);
+                }
+                continue;
+            }
+            if (revents & (POLLIN | POLLERR | POLLHUP)) {
+                char c;
+                ssize_t r = recv(peer->fd, &c, 1, 0);
+                if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                    cluster_peer_fail(cluster, peer, now);
+                }
+            }
+        }
+
+        /* 倒序处理入站连接：关闭时末尾元素会被换到当前位置 */
+        for (size_t i = nfds - inbound_base; i-- > 0;) {
+            if (fds[inbound_base + i].revents && cluster_inbound_read(cluster, i) != 0) {
+                cluster_inbound_close(cluster, i, true);
+            }
+        }
+
+        if (fds[1].revents & POLLIN) {
+            cluster_accept(cluster);
+        }
+    }
+
+    return NULL;
+}
+
+int cluster_start(cluster_t *cluster) {
+    atomic_store_explicit(&cluster->running, true, memory_order_release);
+    if (pthread_create(&cluster->thread, NULL, cluster_thread_main, cluster) != 0) {
+        atomic_store(&cluster->running, false);
+        return -1;
+    }
+    return 0;
+}
+
+void cluster_stop(cluster_t *cluster) {
+    if (!atomic_exchange(&cluster->running, false)) return;
+
+    cluster_wake(cluster);
+    pthread_join(cluster->thread, NULL);
+}
+
+void cluster_cleanup(cluster_t *cluster) {
+    cluster_stop(cluster);
+
+    for (unsigned n = 0; n < cluster->node_count; n++) {
+        cluster_peer_t *peer = &cluster->peers[n];
+        if (peer->fd >= 0) close(peer->fd);
+        peer->fd = -1;
+        cluster_batch_release(cluster, &peer->sending, peer->send_pos, true);
+        cluster_batch_release(cluster, &peer->pending, 0, true);
+        free(peer->sending.items);
+        free(peer->pending.items);
+        peer->sending.items = peer->pending.items = NULL;
+        pthread_mutex_destroy(&peer->lock);
+    }
+    while (cluster->inbound_count > 0) {
+        cluster_inbound_close(cluster, cluster->inbound_count - 1, false);
+    }
+
+    if (cluster->listen_fd >= 0) close(cluster->listen_fd);
+    if (cluster->wake_fds[0] >= 0) close(cluster->wake_fds[0]);
+    if (cluster->wake_fds[1] >= 0) close(cluster->wake_fds[1]);
+    cluster->listen_fd = cluster->wake_fds[0] = cluster->wake_fds[1] = -1;
+
+    free(cluster->ring);
+    cluster->ring = NULL;
+    cluster->node_count = 0;
+}
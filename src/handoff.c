@@ -0,0 +1,343 @@
+/**
+ * @file handoff.c
+ * @brief 热重启：监听套接字的创建与继承、接替进程的启动，以及房间注册表的二进制快照。
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+#include "../include/handoff.h"
+#include "../include/client.h"
+
+extern char **environ;
+
+/* 接口名对应的第一个 IPv4 地址 */
+static int handoff_iface_addr(const char *iface, int port, struct sockaddr_storage *addr,
+                              socklen_t *addr_len) {
+    struct ifaddrs *list = NULL;
+    if (getifaddrs(&list) != 0) return -1;
+
+    int ret = -1;
+    for (struct ifaddrs *ifa = list; ifa; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_INET &&
+            strcmp(ifa->ifa_name, iface) == 0) {
+            struct sockaddr_in *in = (struct sockaddr_in*)addr;
+            memcpy(in, ifa->ifa_addr, sizeof(*in));
+            in->sin_port = htons((uint16_t)port);
+            *addr_len = sizeof(*in);
+            ret = 0;
+            break;
+        }
+    }
+    freeifaddrs(list);
+    return ret;
+}
+
+/* 沿用旧进程交来的套接字：描述符有效且处于监听状态 */
+static int handoff_inherit(const char *value) {
+    char *end;
+    long fd = strtol(value, &end, 10);
+    int listening = 0;
+    socklen_t len = sizeof(listening);
+
+    if (*value == '\0' || *end != '\0' || fd < 0 || fd > INT32_MAX ||
+        getsockopt((int)fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) != 0 || !listening) {
+        return -1;
+    }
+    return (int)fd;
+}
+
+int handoff_listen(const char *iface, int port, bool *inherited) {
+    *inherited = false;
+
+    const char *value = getenv(HANDOFF_LISTEN_FD_ENV);
+    if (value) {
+        int fd = handoff_inherit(value);
+        unsetenv(HANDOFF_LISTEN_FD_ENV);
+        if (fd < 0) {
+            fprintf(stderr, "%s=%s 不是监听套接字，改为重新监听\n", HANDOFF_LISTEN_FD_ENV, value);
+        } else if (fcntl(fd, F_SETFD, FD_CLOEXEC) == 0 &&
+                   fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0) {
+            *inherited = true;
+            return fd;
+        }
+    }
+
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST;
+
+    /* 地址字面量直接解析，否则按接口名查找 */
+    struct sockaddr_storage addr;
+    socklen_t addr_len = 0;
+    if (getaddrinfo(iface, service, &hints, &res) == 0) {
+        /* 不指定地址时优先 IPv6 (双栈)，与 libwebsockets 的默认行为一致 */
+        struct addrinfo *pick = res;
+        for (struct addrinfo *ai = res; ai && !iface; ai = ai->ai_next) {
+            if (ai->ai_family == AF_INET6) {
+                pick = ai;
+                break;
+            }
+        }
+        memcpy(&addr, pick->ai_addr, pick->ai_addrlen);
+        addr_len = pick->ai_addrlen;
+        freeaddrinfo(res);
+    } else if (!iface || handoff_iface_addr(iface, port, &addr, &addr_len) != 0) {
+        fprintf(stderr, "无法解析监听地址: %s\n", iface ? iface : "*");
+        return -1;
+    }
+
+    int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    int one = 1, zero = 0;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (addr.ss_family == AF_INET6) {
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+    }
+    if (bind(fd, (struct sockaddr*)&addr, addr_len) != 0 ||
+        listen(fd, HANDOFF_LISTEN_BACKLOG) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* 新进程的环境：沿用当前环境，替换 HANDOFF_LISTEN_FD_ENV */
+static char **handoff_build_env(void) {
+    static char listen_fd_var[] = HANDOFF_LISTEN_FD_ENV "=3";
+    size_t prefix = strlen(HANDOFF_LISTEN_FD_ENV);
+    size_t count = 0;
+    while (environ[count]) count++;
+
+    char **envp = malloc((count + 2) * sizeof(char*));
+    if (!envp) return NULL;
+
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (strncmp(environ[i], HANDOFF_LISTEN_FD_ENV, prefix) != 0 || environ[i][prefix] != '=') {
+            envp[n++] = environ[i];
+        }
+    }
+    envp[n++] = listen_fd_var;
+    envp[n] = NULL;
+    return envp;
+}
+
+pid_t handoff_spawn(const char *path, char *const argv[], int listen_fd) {
+    _Static_assert(HANDOFF_LISTEN_FD == 3, "listen_fd_var hardcodes the descriptor number");
+
+    /* exec 成功时 CLOEXEC 的管道被关闭，父进程读到 EOF；失败时子进程写回 errno */
+    int status_pipe[2];
+    if (pipe2(status_pipe, O_CLOEXEC) != 0) return -1;
+
+    char **envp = handoff_build_env();
+    long max_fd = sysconf(_SC_OPEN_MAX);
+    if (!envp) {
+        close(status_pipe[0]);
+        close(status_pipe[1]);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* 子进程只调用异步信号安全的函数：监听套接字放到 3，状态管道放到 4，其余关闭 */
+        int status_fd = status_pipe[1];
+        if (status_fd == HANDOFF_LISTEN_FD) {
+            status_fd = fcntl(status_fd, F_DUPFD_CLOEXEC, HANDOFF_LISTEN_FD + 1);
+        }
+        if (listen_fd != HANDOFF_LISTEN_FD) {
+            dup2(listen_fd, HANDOFF_LISTEN_FD);
+        } else {
+            fcntl(HANDOFF_LISTEN_FD, F_SETFD, 0);
+        }
+        if (status_fd != HANDOFF_LISTEN_FD + 1) {
+            dup3(status_fd, HANDOFF_LISTEN_FD + 1, O_CLOEXEC);
+        }
+        for (long fd = HANDOFF_LISTEN_FD + 2; fd < max_fd; fd++) {
+            close((int)fd);
+        }
+
+        execve(path, argv, envp);
+        int err = errno;
+        ssize_t written = write(HANDOFF_LISTEN_FD + 1, &err, sizeof(err));
+        (void)written;
+        _exit(127);
+    }
+
+    free(envp);
+    close(status_pipe[1]);
+    if (pid < 0) {
+        close(status_pipe[0]);
+        return -1;
+    }
+
+    int err = 0;
+    ssize_t n;
+    do {
+        n = read(status_pipe[0], &err, sizeof(err));
+    } while (n < 0 && errno == EINTR);
+    close(status_pipe[0]);
+
+    if (n > 0) {
+        waitpid(pid, NULL, 0);
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
+
+static int handoff_snapshot_reserve(handoff_snapshot_t *snap, size_t extra) {
+    if (snap->len + extra <= snap->cap) return 0;
+
+    size_t cap = snap->cap ? snap->cap * 2 : 4096;
+    while (cap < snap->len + extra) cap *= 2;
+    unsigned char *data = realloc(snap->data, cap);
+    if (!data) return -1;
+    snap->data = data;
+    snap->cap = cap;
+    return 0;
+}
+
+static void handoff_put(handoff_snapshot_t *snap, const void *src, size_t len) {
+    memcpy(snap->data + snap->len, src, len);
+    snap->len += len;
+}
+
+int handoff_snapshot_add_room(handoff_snapshot_t *snap, const room_t *room) {
+    uint8_t name_len = (uint8_t)strnlen(room->name, sizeof(room->name) - 1);
+    uint16_t members = room->participant_count;
+    size_t size = sizeof(id128_t) + 4 + 2 + 2 + 1 + name_len + (size_t)members * sizeof(id128_t);
+    if (handoff_snapshot_reserve(snap, size) != 0) return -1;
+
+    handoff_put(snap, &room->id, sizeof(id128_t));
+    handoff_put(snap, &room->created_at, 4);
+    handoff_put(snap, &room->capacity, 2);
+    handoff_put(snap, &members, 2);
+    handoff_put(snap, &name_len, 1);
+    handoff_put(snap, room->name, name_len);
+    ROOM_FOREACH_PARTICIPANT(room, client) {
+        handoff_put(snap, &client->id, sizeof(id128_t));
+    }
+
+    snap->rooms++;
+    snap->clients += members;
+    return 0;
+}
+
+void handoff_snapshot_free(handoff_snapshot_t *snap) {
+    free(snap->data);
+    memset(snap, 0, sizeof(*snap));
+}
+
+int handoff_snapshot_write(const char *path, const handoff_snapshot_t *parts, size_t count) {
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return -1;
+
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) return -1;
+
+    uint32_t header[4] = { HANDOFF_SNAPSHOT_VERSION, 0, 0, 0 };
+    for (size_t i = 0; i < count; i++) {
+        header[1] += parts[i].rooms;
+        header[2] += parts[i].clients;
+    }
+
+    bool ok = fwrite(HANDOFF_SNAPSHOT_MAGIC, 8, 1, fp) == 1 &&
+              fwrite(header, sizeof(header), 1, fp) == 1;
+    for (size_t i = 0; ok && i < count; i++) {
+        ok = parts[i].len == 0 || fwrite(parts[i].data, parts[i].len, 1, fp) == 1;
+    }
+    ok = fclose(fp) == 0 && ok;
+
+    if (!ok || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+int handoff_snapshot_load(const char *path, handoff_room_fn fn, void *arg) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return errno == ENOENT ? 0 : -1;
+
+    /* 快照很小 (每个房间几十字节)，整个读入后解析 */
+    unsigned char *data = NULL;
+    size_t len = 0, cap = 0;
+    for (;;) {
+        if (len == cap) {
+            cap = cap ? cap * 2 : 65536;
+            unsigned char *grown = realloc(data, cap);
+            if (!grown) {
+                free(data);
+                fclose(fp);
+                return -1;
+            }
+            data = grown;
+        }
+        size_t n = fread(data + len, 1, cap - len, fp);
+        if (n == 0) break;
+        len += n;
+    }
+    fclose(fp);
+    unlink(path);
+
+    uint32_t header[4];
+    if (len < 8 + sizeof(header) || memcmp(data, HANDOFF_SNAPSHOT_MAGIC, 8) != 0) {
+        free(data);
+        return -1;
+    }
+    memcpy(header, data + 8, sizeof(header));
+    if (header[0] != HANDOFF_SNAPSHOT_VERSION) {
+        free(data);
+        return -1;
+    }
+
+    id128_t members[ROOM_MAX_CAPACITY];
+    size_t pos = 8 + sizeof(header);
+    int restored = 0;
+    for (uint32_t r = 0; r < header[1]; r++) {
+        handoff_room_t room;
+        memset(&room, 0, sizeof(room));
+        uint8_t name_len;
+
+        if (len - pos < sizeof(id128_t) + 4 + 2 + 2 + 1) break;
+        memcpy(&room.id, data + pos, sizeof(id128_t));
+        memcpy(&room.created_at, data + pos + 16, 4);
+        memcpy(&room.capacity, data + pos + 20, 2);
+        memcpy(&room.member_count, data + pos + 22, 2);
+        name_len = data[pos + 24];
+        pos += 25;
+
+        size_t body = name_len + (size_t)room.member_count * sizeof(id128_t);
+        if (len - pos < body || name_len >= sizeof(room.name) ||
+            room.member_count > ROOM_MAX_CAPACITY) {
+            break;
+        }
+        memcpy(room.name, data + pos, name_len);
+        memcpy(members, data + pos + name_len, (size_t)room.member_count * sizeof(id128_t));
+        room.members = members;
+        pos += body;
+
+        fn(arg, &room);
+        restored++;
+    }
+
+    free(data);
+    return restored == (int)header[1] ? restored : -1;
+}
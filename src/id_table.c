@@ -0,0 +1,85 @@
+/**
+ * @file id_table.c
+ * @brief 128 位 ID 到指针的开放寻址哈希表，用于按 ID 查找房间和客户端。
+ */
+
+#include <stdlib.h>
+
+#include "../include/id_table.h"
+
+int id_table_init(id_table_t *table, size_t max_entries) {
+    size_t capacity = 16;
+    while (capacity < max_entries * 2) {
+        capacity <<= 1;
+    }
+    
+    table->entries = calloc(capacity, sizeof(id_table_entry_t));
+    if (!table->entries) return -1;
+    
+    table->mask = capacity - 1;
+    table->count = 0;
+    return 0;
+}
+
+void id_table_cleanup(id_table_t *table) {
+    free(table->entries);
+    table->entries = NULL;
+    table->mask = 0;
+    table->count = 0;
+}
+
+int id_table_insert(id_table_t *table, const id128_t *key, void *value) {
+    if (!value || table->count >= table->mask) return -1;
+    
+    size_t i = id128_hash(key) & table->mask;
+    while (table->entries[i].value) {
+        if (id128_equal(&table->entries[i].key, key)) return -2;
+        i = (i + 1) & table->mask;
+    }
+    
+    table->entries[i].key = *key;
+    table->entries[i].value = value;
+    table->count++;
+    return 0;
+}
+
+void *id_table_find(const id_table_t *table, const id128_t *key) {
+    if (!table->entries) return NULL;
+    
+    size_t i = id128_hash(key) & table->mask;
+    while (table->entries[i].value) {
+        if (id128_equal(&table->entries[i].key, key)) {
+            return table->entries[i].value;
+        }
+        i = (i + 1) & table->mask;
+    }
+    return NULL;
+}
+
+int id_table_remove(id_table_t *table, const id128_t *key) {
+    if (!table->entries) return -1;
+    
+    size_t i = id128_hash(key) & table->mask;
+    while (table->entries[i].value) {
+        if (id128_equal(&table->entries[i].key, key)) break;
+        i = (i + 1) & table->mask;
+    }
+    if (!table->entries[i].value) return -1;
+    
+    /* 回移 (backward shift)：把后续探测链上的条目前移填补空位 */
+    size_t hole = i;
+    for (size_t j = (i + 1) & table->mask; table->entries[j].value;
+         j = (j + 1) & table->mask) {
+        size_t home = id128_hash(&table->entries[j].key) & table->mask;
+        
+        /* home 不在 (hole, j] 区间内时，条目可以移到 hole */
+        if (((j - home) & table->mask) >= ((j - hole) & table->mask)) {
+            table->entries[hole] = table->entries[j];
+            hole = j;
+        }
+    }
+    
+    table->entries[hole].value = NULL;
+    table->count--;
+    return 0;
+}
@@ -0,0 +1,341 @@
+/**
+ * @file json_scan.c
+ * @brief 信令编解码的字节扫描内核 (SWAR / SSE2 / AVX2 / NEON) 与运行时选择。
+ */
+
+#include <string.h>
+#include <stdatomic.h>
+
+#include "../include/json_scan.h"
+
+#if defined(__x86_64__) && defined(__SSE2__)
+#define JSON_SCAN_HAVE_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#define JSON_SCAN_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define JSON_SCAN_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+typedef struct json_scan_ops_s {
+    json_scan_impl_t impl;
+    size_t (*string)(const char *p, size_t len);
+    size_t (*ascii)(const unsigned char *p, size_t len);
+} json_scan_ops_t;
+
+static inline bool is_stop_byte(unsigned char c) {
+    return c == '"' || c == '\\' || c < 0x20;
+}
+
+/* ---- SWAR：每次 8 字节，任何平台可用，也负责各 SIMD 实现的尾部 ---- */
+
+#define SWAR_ONES  0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+
+static inline uint64_t swar_load(const void *p) {
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+/* 某字节为 0 时该字节的最高位被置位 (更高的字节可能误报，所以命中后逐字节确认) */
+static inline uint64_t swar_zero(uint64_t w) {
+    return (w - SWAR_ONES) & ~w & SWAR_HIGHS;
+}
+
+static size_t scalar_string(const char *p, size_t len) {
+    const unsigned char *s = (const unsigned char *)p;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w = swar_load(s + i);
+        uint64_t hit = swar_zero(w ^ (SWAR_ONES * '"')) |
+                       swar_zero(w ^ (SWAR_ONES * '\\')) |
+                       ((w - SWAR_ONES * 0x20) & ~w & SWAR_HIGHS);
+        if (hit) break;
+    }
+    for (; i < len; i++) {
+        if (is_stop_byte(s[i])) return i;
+    }
+    return len;
+}
+
+static size_t scalar_ascii(const unsigned char *p, size_t len) {
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        if (swar_load(p + i) & SWAR_HIGHS) break;
+    }
+    for (; i < len; i++) {
+        if (p[i] & 0x80) return i;
+    }
+    return len;
+}
+
+/* ---- SSE2：x86-64 的基线指令集 ---- */
+
+#ifdef JSON_SCAN_HAVE_SSE2
+/* 引号、反斜杠或 <= 0x1f (max(v, 0x1f) == 0x1f) 的字节 */
+static inline int sse2_stop_mask(__m128i v) {
+    __m128i quote = _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+    __m128i slash = _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+    __m128i ctrl = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1f)), _mm_set1_epi8(0x1f));
+    return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(quote, slash), ctrl));
+}
+
+static size_t sse2_string(const char *p, size_t len) {
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        int mask = sse2_stop_mask(_mm_loadu_si128((const __m128i *)(const void *)(p + i)));
+        if (mask) return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+    return i + scalar_string(p + i, len - i);
+}
+
+static size_t sse2_ascii(const unsigned char *p, size_t len) {
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(const void *)(p + i)));
+        if (mask) return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+    return i + scalar_ascii(p + i, len - i);
+}
+#endif
+
+/* ---- AVX2：按函数开启目标指令集，只在 CPU 支持时被选中 ---- */
+
+#ifdef JSON_SCAN_HAVE_AVX2
+/*
+ * 不足 32 字节的尾部：先清掉 ymm 高半部分，再在本函数内用 VEX 编码的 16 字节块和逐字节比较完成。
+ * 不能直接调用 sse2_string，传统 SSE 编码的指令遇到脏的高半部分会有状态切换的开销。
+ */
+__attribute__((target("avx2")))
+static inline size_t avx2_tail_string(const char *p, size_t len) {
+    size_t i = 0;
+
+    _mm256_zeroupper();
+    if (len >= 16) {
+        int mask = sse2_stop_mask(_mm_loadu_si128((const __m128i *)(const void *)p));
+        if (mask) return (size_t)__builtin_ctz((unsigned)mask);
+        i = 16;
+    }
+    for (; i < len; i++) {
+        if (is_stop_byte((unsigned char)p[i])) return i;
+    }
+    return len;
+}
+
+__attribute__((target("avx2")))
+static inline size_t avx2_tail_ascii(const unsigned char *p, size_t len) {
+    size_t i = 0;
+
+    _mm256_zeroupper();
+    if (len >= 16) {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(const void *)p));
+        if (mask) return (size_t)__builtin_ctz((unsigned)mask);
+        i = 16;
+    }
+    for (; i < len; i++) {
+        if (p[i] & 0x80) return i;
+    }
+    return len;
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_string(const char *p, size_t len) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i slash = _mm256_set1_epi8('\\');
+    const __m256i ctrl = _mm256_set1_epi8(0x1f);
+    size_t i = 0;
+
+    /* 信令字符串里的普通段通常很短 (SDP 每行都有转义)，先用 16 字节块探测 */
+    if (len >= 16) {
+        int mask = sse2_stop_mask(_mm_loadu_si128((const __m128i *)(const void *)p));
+        if (mask) return (size_t)__builtin_ctz((unsigned)mask);
+        i = 16;
+    }
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(p + i));
+        __m256i hit = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, slash)),
+            _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctrl), ctrl));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask) return i + (size_t)__builtin_ctz(mask);
+    }
+    return i + avx2_tail_string(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_ascii(const unsigned char *p, size_t len) {
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_loadu_si256((const __m256i *)(const void *)(p + i)));
+        if (mask) return i + (size_t)__builtin_ctz(mask);
+    }
+    return i + avx2_tail_ascii(p + i, len - i);
+}
+#endif
+
+/* ---- NEON：AArch64 的基线指令集 ---- */
+
+#ifdef JSON_SCAN_HAVE_NEON
+/* 比较结果压缩为每字节 4 位的 64 位掩码 */
+static inline uint64_t neon_mask(uint8x16_t cmp) {
+    uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+}
+
+static size_t neon_string(const char *p, size_t len) {
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t slash = vdupq_n_u8('\\');
+    const uint8x16_t ctrl = vdupq_n_u8(0x20);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)p + i);
+        uint8x16_t hit = vorrq_u8(vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, slash)),
+                                  vcltq_u8(v, ctrl));
+        uint64_t mask = neon_mask(hit);
+        if (mask) return i + (size_t)(__builtin_ctzll(mask) >> 2);
+    }
+    return i + scalar_string(p + i, len - i);
+}
+
+static size_t neon_ascii(const unsigned char *p, size_t len) {
+    const uint8x16_t high = vdupq_n_u8(0x80);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        uint64_t mask = neon_mask(vtstq_u8(vld1q_u8(p + i), high));
+        if (mask) return i + (size_t)(__builtin_ctzll(mask) >> 2);
+    }
+    return i + scalar_ascii(p + i, len - i);
+}
+#endif
+
+/* ---- 运行时选择 ---- */
+
+static const json_scan_ops_t scalar_ops = { JSON_SCAN_SCALAR, scalar_string, scalar_ascii };
+#ifdef JSON_SCAN_HAVE_SSE2
+static const json_scan_ops_t sse2_ops = { JSON_SCAN_SSE2, sse2_string, sse2_ascii };
+#endif
+#ifdef JSON_SCAN_HAVE_AVX2
+static const json_scan_ops_t avx2_ops = { JSON_SCAN_AVX2, avx2_string, avx2_ascii };
+#endif
+#ifdef JSON_SCAN_HAVE_NEON
+static const json_scan_ops_t neon_ops = { JSON_SCAN_NEON, neon_string, neon_ascii };
+#endif
+
+static _Atomic(const json_scan_ops_t *) current_ops = NULL;
+
+static const json_scan_ops_t *ops_for(json_scan_impl_t impl) {
+    switch (impl) {
+        case JSON_SCAN_SCALAR:
+            return &scalar_ops;
+#ifdef JSON_SCAN_HAVE_SSE2
+        case JSON_SCAN_SSE2:
+            return &sse2_ops;
+#endif
+#ifdef JSON_SCAN_HAVE_AVX2
+        case JSON_SCAN_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? &avx2_ops : NULL;
+#endif
+#ifdef JSON_SCAN_HAVE_NEON
+        case JSON_SCAN_NEON:
+            return &neon_ops;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+/* 首次调用时选出本机最快的实现；并发的首次调用结果相同，重复存储无害 */
+static const json_scan_ops_t *ops_get(void) {
+    const json_scan_ops_t *ops = atomic_load_explicit(&current_ops, memory_order_acquire);
+    if (ops) return ops;
+
+    static const json_scan_impl_t preferred[] = { JSON_SCAN_AVX2, JSON_SCAN_NEON, JSON_SCAN_SSE2 };
+    ops = &scalar_ops;
+    for (size_t i = 0; i < sizeof(preferred) / sizeof(preferred[0]); i++) {
+        const json_scan_ops_t *candidate = ops_for(preferred[i]);
+        if (candidate) {
+            ops = candidate;
+            break;
+        }
+    }
+
+    atomic_store_explicit(&current_ops, ops, memory_order_release);
+    return ops;
+}
+
+size_t json_scan_string(const char *p, size_t len) {
+    return ops_get()->string(p, len);
+}
+
+size_t json_scan_ascii(const unsigned char *p, size_t len) {
+    return ops_get()->ascii(p, len);
+}
+
+bool json_utf8_valid(const unsigned char *p, size_t len) {
+    const json_scan_ops_t *ops = ops_get();
+    const unsigned char *end = p + len;
+
+    while (p < end) {
+        unsigned char c = *p;
+        if (c < 0x80) {
+            p += ops->ascii(p, (size_t)(end - p));
+            continue;
+        }
+        p++;
+
+        size_t extra;
+        uint32_t cp;
+        if ((c & 0xe0) == 0xc0) { extra = 1; cp = c & 0x1f; }
+        else if ((c & 0xf0) == 0xe0) { extra = 2; cp = c & 0x0f; }
+        else if ((c & 0xf8) == 0xf0) { extra = 3; cp = c & 0x07; }
+        else return false;
+
+        if ((size_t)(end - p) < extra) return false;
+        for (size_t i = 0; i < extra; i++) {
+            if ((p[i] & 0xc0) != 0x80) return false;
+            cp = (cp << 6) | (p[i] & 0x3f);
+        }
+        p += extra;
+
+        if ((extra == 1 && cp < 0x80) || (extra == 2 && cp < 0x800) ||
+            (extra == 3 && cp < 0x10000) || cp > 0x10ffff ||
+            (cp >= 0xd800 && cp <= 0xdfff)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+json_scan_impl_t json_scan_impl(void) {
+    return ops_get()->impl;
+}
+
+const char *json_scan_impl_name(json_scan_impl_t impl) {
+    static const char *names[JSON_SCAN_IMPL_COUNT] = { "scalar", "sse2", "avx2", "neon" };
+    if ((unsigned)impl >= JSON_SCAN_IMPL_COUNT) return NULL;
+    return names[impl];
+}
+
+int json_scan_select(json_scan_impl_t impl) {
+    const json_scan_ops_t *ops = ops_for(impl);
+    if (!ops) return -1;
+
+    atomic_store_explicit(&current_ops, ops, memory_order_release);
+    return 0x0;
+}
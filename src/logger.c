@@ -0,0 +1,620 @@
+/**
+ * @file logger.c
+ * @brief 异步分级日志：每线程无锁环形缓冲区 + 后台格式化线程。
+ *
+ * 写日志的线程只做一次格式串扫描，把原始参数按固定编码拷贝进本线程的单生产者/
+ * 单消费者环形缓冲区；snprintf、时间格式化和 fwrite 都在后台线程完成。
+ * 同一线程的日志保持顺序，不同线程之间按每行的时间戳区分先后。
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "../include/logger.h"
+#include "../include/utilities.h"
+
+#define LOGGER_RECORD_SIZE 256         /* 每条记录的固定长度 (字节) */
+#define LOGGER_RING_RECORDS 512        /* 每个线程的记录数，必须是 2 的幂 */
+#define LOGGER_LINE_MAX 1024           /* 格式化后单行的最大长度 */
+#define LOGGER_BATCH_SIZE (64 * 1024)  /* 后台线程每次 fwrite 的最大字节数 */
+#define LOGGER_IDLE_NS 10000000L       /* 没有日志时后台线程的休眠时间 */
+#define LOGGER_SPEC_MAX 32             /* 单个转换说明的最大长度 */
+
+#define LOGGER_HEADER_SIZE (sizeof(const char *) + sizeof(uint64_t) + 4)
+#define LOGGER_ARGS_SIZE (LOGGER_RECORD_SIZE - LOGGER_HEADER_SIZE)
+
+/* 一条日志：格式串指针 + 按转换说明顺序编码的参数 */
+typedef struct logger_record_s {
+    const char *fmt;               /* 字符串常量，不拷贝 */
+    uint64_t time_ns;              /* CLOCK_REALTIME */
+    uint8_t level;
+    uint8_t nargs;                 /* 已编码的参数个数 */
+    uint8_t truncated;             /* 参数区不足，后面的转换没有编码 */
+    uint8_t reserved;
+    unsigned char args[LOGGER_ARGS_SIZE];
+} logger_record_t;
+
+_Static_assert(sizeof(logger_record_t) == LOGGER_RECORD_SIZE, "logger record size");
+
+/* 一个线程的环形缓冲区；线程退出后由下一个新线程复用，不释放 */
+typedef struct logger_ring_s {
+    _Alignas(CACHE_LINE_SIZE)
+    atomic_size_t head;            /* 生产者写入位置 */
+    _Alignas(CACHE_LINE_SIZE)
+    atomic_size_t tail;            /* 后台线程读取位置 */
+    atomic_bool owned;             /* 有线程正在使用 */
+    struct logger_ring_s *next;    /* 全局链表，发布后不变 */
+    logger_record_t records[LOGGER_RING_RECORDS];
+} logger_ring_t;
+
+atomic_int logger_level = LOG_LEVEL_INFO;
+
+static atomic_bool logger_running = false;
+static atomic_bool logger_stopping = false;
+static _Atomic(logger_ring_t *) logger_rings = NULL;
+static pthread_mutex_t logger_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t logger_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t logger_key;
+static pthread_t logger_thread;
+static atomic_uint_fast64_t logger_drop_count = 0;
+static _Thread_local logger_ring_t *thread_ring = NULL;
+
+static const char *const logger_level_names[] = {"ERROR", "WARN", "INFO", "DEBUG"};
+
+/* 参数的编码类型，由转换字符和长度修饰符决定 */
+typedef enum {
+    LOGGER_ARG_NONE = 0,           /* %% */
+    LOGGER_ARG_SIGNED,
+    LOGGER_ARG_UNSIGNED,
+    LOGGER_ARG_CHAR,
+    LOGGER_ARG_DOUBLE,
+    LOGGER_ARG_LONG_DOUBLE,
+    LOGGER_ARG_STRING,
+    LOGGER_ARG_POINTER,
+    LOGGER_ARG_UNSUPPORTED         /* * 宽度、%n、宽字符串等：之后的内容原样输出 */
+} logger_arg_t;
+
+/* 一个转换说明 */
+typedef struct logger_spec_s {
+    const char *end;               /* 转换字符之后 */
+    logger_arg_t type;
+    char length[3];                /* 长度修饰符 */
+} logger_spec_t;
+
+/**
+ * @brief 解析从 '%' 开始的转换说明。
+ * @param p 指向 '%'。
+ * @param spec 输出。
+ */
+static void logger_parse_spec(const char *p, logger_spec_t *spec) {
+    memset(spec, 0, sizeof(*spec));
+    p++;
+
+    if (*p == '%') {
+        spec->end = p + 1;
+        spec->type = LOGGER_ARG_NONE;
+        return;
+    }
+
+    while (*p && strchr("-+ #0'", *p)) p++;
+    while (*p >= '0' && *p <= '9') p++;
+    if (*p == '.') {
+        p++;
+        while (*p >= '0' && *p <= '9') p++;
+    }
+
+    size_t n = 0;
+    while (*p && strchr("hlLqjzt", *p) && n < sizeof(spec->length) - 1) {
+        spec->length[n++] = *p++;
+    }
+
+    spec->end = *p ? p + 1 : p;
+    switch (*p) {
+    case 'd': case 'i':
+        spec->type = LOGGER_ARG_SIGNED;
+        break;
+    case 'u': case 'o': case 'x': case 'X':
+        spec->type = LOGGER_ARG_UNSIGNED;
+        break;
+    case 'c':
+        spec->type = n ? LOGGER_ARG_UNSUPPORTED : LOGGER_ARG_CHAR;
+        break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        spec->type = spec->length[0] == 'L' ? LOGGER_ARG_LONG_DOUBLE : LOGGER_ARG_DOUBLE;
+        break;
+    case 's':
+        spec->type = n ? LOGGER_ARG_UNSUPPORTED : LOGGER_ARG_STRING;
+        break;
+    case 'p':
+        spec->type = LOGGER_ARG_POINTER;
+        break;
+    default:
+        /* '*' falls here as well: the width would consume an argument */
+        spec->type = LOGGER_ARG_UNSUPPORTED;
+        break;
+    }
+}
+
+/* 按长度修饰符读取有符号整数，并按 printf 的规则截断 */
+static int64_t logger_arg_signed(const char *length, va_list *ap) {
+    if (!strcmp(length, "hh")) return (signed char)va_arg(*ap, int);
+    if (!strcmp(length, "h")) return (short)va_arg(*ap, int);
+    if (!strcmp(length, "l")) return va_arg(*ap, long);
+    if (!strcmp(length, "ll") || !strcmp(length, "q")) return va_arg(*ap, long long);
+    if (!strcmp(length, "j")) return va_arg(*ap, intmax_t);
+    if (!strcmp(length, "z")) return (int64_t)va_arg(*ap, size_t);
+    if (!strcmp(length, "t")) return va_arg(*ap, ptrdiff_t);
+    return va_arg(*ap, int);
+}
+
+static uint64_t logger_arg_unsigned(const char *length, va_list *ap) {
+    if (!strcmp(length, "hh")) return (unsigned char)va_arg(*ap, unsigned int);
+    if (!strcmp(length, "h")) return (unsigned short)va_arg(*ap, unsigned int);
+    if (!strcmp(length, "l")) return va_arg(*ap, unsigned long);
+    if (!strcmp(length, "ll") || !strcmp(length, "q")) return va_arg(*ap, unsigned long long);
+    if (!strcmp(length, "j")) return va_arg(*ap, uintmax_t);
+    if (!strcmp(length, "z")) return va_arg(*ap, size_t);
+    if (!strcmp(length, "t")) return (uint64_t)va_arg(*ap, ptrdiff_t);
+    return va_arg(*ap, unsigned int);
+}
+
+/**
+ * @brief 按格式串把参数编码进记录。
+ *
+ * 整数和指针占 8 字节，double 8 字节，long double 为其原生大小，
+ * 字符串为 2 字节长度加内容 (超出参数区的部分被截断)。
+ */
+static void logger_encode(logger_record_t *rec, const char *fmt, va_list *ap) {
+    unsigned char *out = rec->args;
+    unsigned char *limit = rec->args + sizeof(rec->args);
+
+    for (const char *p = strchr(fmt, '%'); p; p = strchr(p, '%')) {
+        logger_spec_t spec;
+        logger_parse_spec(p, &spec);
+        p = spec.end;
+
+        size_t need;
+        switch (spec.type) {
+        case LOGGER_ARG_NONE:
+            continue;
+        case LOGGER_ARG_UNSUPPORTED:
+            return;
+        case LOGGER_ARG_LONG_DOUBLE:
+            need = sizeof(long double);
+            break;
+        case LOGGER_ARG_STRING:
+            need = sizeof(uint16_t);
+            break;
+        default:
+            need = sizeof(uint64_t);
+            break;
+        }
+        if ((size_t)(limit - out) < need || rec->nargs == UINT8_MAX) {
+            rec->truncated = 1;
+            return;
+        }
+
+        switch (spec.type) {
+        case LOGGER_ARG_SIGNED: {
+            int64_t v = logger_arg_signed(spec.length, ap);
+            memcpy(out, &v, sizeof(v));
+            break;
+        }
+        case LOGGER_ARG_UNSIGNED: {
+            uint64_t v = logger_arg_unsigned(spec.length, ap);
+            memcpy(out, &v, sizeof(v));
+            break;
+        }
+        case LOGGER_ARG_CHAR: {
+            int64_t v = va_arg(*ap, int);
+            memcpy(out, &v, sizeof(v));
+            break;
+        }
+        case LOGGER_ARG_DOUBLE: {
+            double v = va_arg(*ap, double);
+            memcpy(out, &v, sizeof(v));
+            break;
+        }
+        case LOGGER_ARG_LONG_DOUBLE: {
+            long double v = va_arg(*ap, long double);
+            memcpy(out, &v, sizeof(v));
+            break;
+        }
+        case LOGGER_ARG_POINTER: {
+            uint64_t v = (uint64_t)(uintptr_t)va_arg(*ap, void *);
+            memcpy(out, &v, sizeof(v));
+            break;
+        }
+        case LOGGER_ARG_STRING: {
+            const char *s = va_arg(*ap, const char *);
+            if (!s) s = "(null)";
+            size_t room = (size_t)(limit - out) - sizeof(uint16_t);
+            size_t len = strnlen(s, room);
+            uint16_t len16 = (uint16_t)len;
+            memcpy(out, &len16, sizeof(len16));
+            memcpy(out + sizeof(len16), s, len);
+            need += len;
+            break;
+        }
+        default:
+            break;
+        }
+        out += need;
+        rec->nargs++;
+    }
+}
+
+/* 向行缓冲区追加，超出时截断 */
+static void logger_append(char *line, size_t *len, const char *data, size_t n) {
+    if (*len >= LOGGER_LINE_MAX - 1) return;
+    if (n > LOGGER_LINE_MAX - 1 - *len) n = LOGGER_LINE_MAX - 1 - *len;
+    memcpy(line + *len, data, n);
+    *len += n;
+}
+
+static void logger_append_spec(char *line, size_t *len, const char *spec, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static void logger_append_spec(char *line, size_t *len, const char *spec, ...) {
+    if (*len >= LOGGER_LINE_MAX - 1) return;
+    va_list ap;
+    va_start(ap, spec);
+    int n = vsnprintf(line + *len, LOGGER_LINE_MAX - *len, spec, ap);
+    va_end(ap);
+    if (n > 0) {
+        *len += (size_t)n < LOGGER_LINE_MAX - *len ? (size_t)n : LOGGER_LINE_MAX - 1 - *len;
+    }
+}
+
+/* 时间戳前缀 "YYYY-MM-DD HH:MM:SS.mmm [LEVEL] "；同一秒内复用上次的日期部分 */
+static size_t logger_prefix(char *line, uint64_t time_ns, unsigned level) {
+    static _Thread_local time_t cached_sec = -1;
+    static _Thread_local char cached[32];
+
+    time_t sec = (time_t)(time_ns / 1000000000ull);
+    if (sec != cached_sec) {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        strftime(cached, sizeof(cached), "%Y-%m-%d %H:%M:%S", &tm);
+        cached_sec = sec;
+    }
+
+    int n = snprintf(line, LOGGER_LINE_MAX, "%s.%03u [%s] ", cached,
+                     (unsigned)(time_ns / 1000000ull % 1000),
+                     logger_level_names[level <= LOG_LEVEL_DEBUG ? level : LOG_LEVEL_DEBUG]);
+    return n > 0 ? (size_t)n : 0;
+}
+
+/**
+ * @brief 把一条记录格式化为一行 (以换行结尾)。
+ *
+ * 再次扫描格式串，每个转换说明用编码时确定的类型单独调用 snprintf；
+ * 整数统一以 ll 长度修饰符输出。
+ * @return 行的长度。
+ */
+static size_t logger_format(const logger_record_t *rec, char *line) {
+    size_t len = logger_prefix(line, rec->time_ns, rec->level);
+    const unsigned char *in = rec->args;
+    unsigned nargs = 0;
+    const char *p = rec->fmt;
+
+    while (*p) {
+        const char *pct = strchr(p, '%');
+        if (!pct) {
+            logger_append(line, &len, p, strlen(p));
+            break;
+        }
+        logger_append(line, &len, p, (size_t)(pct - p));
+
+        logger_spec_t spec;
+        logger_parse_spec(pct, &spec);
+        if (spec.type == LOGGER_ARG_NONE) {
+            logger_append(line, &len, "%", 1);
+            p = spec.end;
+            continue;
+        }
+        if (spec.type == LOGGER_ARG_UNSUPPORTED || nargs == rec->nargs) {
+            if (rec->truncated) logger_append(line, &len, "[...]", 5);
+            logger_append(line, &len, pct, strlen(pct));
+            break;
+        }
+
+        /* Rebuild the spec without its length modifier */
+        char fmt[LOGGER_SPEC_MAX];
+        size_t body = (size_t)(spec.end - pct) - 1 - strlen(spec.length);
+        if (body + 4 > sizeof(fmt)) {
+            logger_append(line, &len, pct, strlen(pct));
+            break;
+        }
+        memcpy(fmt, pct, body);
+        fmt[body] = '\0';
+        char conv[2] = {spec.end[-1], '\0'};
+
+        switch (spec.type) {
+        case LOGGER_ARG_SIGNED: {
+            int64_t v;
+            memcpy(&v, in, sizeof(v));
+            in += sizeof(v);
+            strcat(fmt, "ll");
+            strcat(fmt, conv);
+            logger_append_spec(line, &len, fmt, (long long)v);
+            break;
+        }
+        case LOGGER_ARG_UNSIGNED: {
+            uint64_t v;
+            memcpy(&v, in, sizeof(v));
+            in += sizeof(v);
+            strcat(fmt, "ll");
+            strcat(fmt, conv);
+            logger_append_spec(line, &len, fmt, (unsigned long long)v);
+            break;
+        }
+        case LOGGER_ARG_CHAR: {
+            int64_t v;
+            memcpy(&v, in, sizeof(v));
+            in += sizeof(v);
+            strcat(fmt, conv);
+            logger_append_spec(line, &len, fmt, (int)v);
+            break;
+        }
+        case LOGGER_ARG_DOUBLE: {
+            double v;
+            memcpy(&v, in, sizeof(v));
+            in += sizeof(v);
+            strcat(fmt, conv);
+            logger_append_spec(line, &len, fmt, v);
+            break;
+        }
+        case LOGGER_ARG_LONG_DOUBLE: {
+            long double v;
+            memcpy(&v, in, sizeof(v));
+            in += sizeof(v);
+            strcat(fmt, "L");
+            strcat(fmt, conv);
+            logger_append_spec(line, &len, fmt, v);
+            break;
+        }
+        case LOGGER_ARG_POINTER: {
+            uint64_t v;
+            memcpy(&v, in, sizeof(v));
+            in += sizeof(v);
+            strcat(fmt, conv);
+            logger_append_spec(line, &len, fmt, (void *)(uintptr_t)v);
+            break;
+        }
+        case LOGGER_ARG_STRING: {
+            uint16_t n;
+            memcpy(&n, in, sizeof(n));
+            in += sizeof(n);
+            char s[LOGGER_ARGS_SIZE + 1];
+            memcpy(s, in, n);
+            s[n] = '\0';
+            in += n;
+            strcat(fmt, conv);
+            logger_append_spec(line, &len, fmt, s);
+            break;
+        }
+        default:
+            break;
+        }
+        nargs++;
+        p = spec.end;
+    }
+
+    line[len++] = '\n';
+    return len;
+}
+
+/* 后台线程的输出批次：ERROR/WARN 写 stderr，INFO/DEBUG 写 stdout */
+typedef struct logger_batch_s {
+    FILE *stream;
+    size_t len;
+    char data[LOGGER_BATCH_SIZE];
+} logger_batch_t;
+
+static void logger_batch_flush(logger_batch_t *batch) {
+    if (batch->len) {
+        fwrite(batch->data, 1, batch->len, batch->stream);
+        fflush(batch->stream);
+        batch->len = 0;
+    }
+}
+
+/**
+ * @brief 取出所有线程缓冲区中的记录并写出 (只由后台线程或停止后的调用者执行)。
+ * @return 取出的记录数。
+ */
+static size_t logger_drain(logger_batch_t *out, logger_batch_t *err) {
+    size_t drained = 0;
+    char line[LOGGER_LINE_MAX + 1];
+
+    for (logger_ring_t *ring = atomic_load_explicit(&logger_rings, memory_order_acquire);
+         ring; ring = ring->next) {
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        while (tail != head) {
+            const logger_record_t *rec = &ring->records[tail & (LOGGER_RING_RECORDS - 1)];
+            logger_batch_t *batch = rec->level <= LOG_LEVEL_WARN ? err : out;
+            size_t len = logger_format(rec, line);
+            if (batch->len + len > sizeof(batch->data)) {
+                logger_batch_flush(batch);
+            }
+            memcpy(batch->data + batch->len, line, len);
+            batch->len += len;
+            tail++;
+            drained++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+
+    logger_batch_flush(err);
+    logger_batch_flush(out);
+    return drained;
+}
+
+/* 批次缓冲区较大，放在静态存储中；只有后台线程 (或它退出后的 logger_stop) 使用 */
+static logger_batch_t logger_out_batch;
+static logger_batch_t logger_err_batch;
+
+static void *logger_thread_main(void *arg) {
+    (void)arg;
+    struct timespec idle = {0, LOGGER_IDLE_NS};
+
+    while (!atomic_load_explicit(&logger_stopping, memory_order_acquire)) {
+        if (logger_drain(&logger_out_batch, &logger_err_batch) == 0) {
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+/* 线程退出：交还缓冲区，未取出的记录仍由后台线程写出 */
+static void logger_release_ring(void *arg) {
+    logger_ring_t *ring = arg;
+    atomic_store_explicit(&ring->owned, false, memory_order_release);
+}
+
+static void logger_create_key(void) {
+    pthread_key_create(&logger_key, logger_release_ring);
+}
+
+/* 当前线程的缓冲区：优先复用已退出线程留下的，否则新建并发布到全局链表 */
+static logger_ring_t *logger_thread_ring(void) {
+    if (thread_ring) return thread_ring;
+
+    pthread_once(&logger_key_once, logger_create_key);
+
+    logger_ring_t *ring = atomic_load_explicit(&logger_rings, memory_order_acquire);
+    for (; ring; ring = ring->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong_explicit(&ring->owned, &expected, true,
+                                                    memory_order_acquire,
+                                                    memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    if (!ring) {
+        ring = cache_aligned_calloc(1, sizeof(*ring));
+        if (!ring) return NULL;
+        atomic_init(&ring->owned, true);
+
+        pthread_mutex_lock(&logger_rings_lock);
+        ring->next = atomic_load_explicit(&logger_rings, memory_order_relaxed);
+        atomic_store_explicit(&logger_rings, ring, memory_order_release);
+        pthread_mutex_unlock(&logger_rings_lock);
+    }
+
+    pthread_setspecific(logger_key, ring);
+    thread_ring = ring;
+    return ring;
+}
+
+static uint64_t logger_realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void logger_write(log_level_t level, const char *fmt, ...) {
+    if (!fmt) return;
+
+    va_list ap;
+    va_start(ap, fmt);
+
+    if (!atomic_load_explicit(&logger_running, memory_order_acquire)) {
+        /* Not started (or already stopped): format and write synchronously */
+        char line[LOGGER_LINE_MAX + 1];
+        size_t len = logger_prefix(line, logger_realtime_ns(), level);
+        int n = vsnprintf(line + len, LOGGER_LINE_MAX - len, fmt, ap);
+        if (n > 0) len += (size_t)n < LOGGER_LINE_MAX - len ? (size_t)n : LOGGER_LINE_MAX - 1 - len;
+        line[len++] = '\n';
+        va_end(ap);
+
+        fwrite(line, 1, len, level <= LOG_LEVEL_WARN ? stderr : stdout);
+        return;
+    }
+
+    logger_ring_t *ring = logger_thread_ring();
+    size_t head = ring ? atomic_load_explicit(&ring->head, memory_order_relaxed) : 0;
+    if (!ring ||
+        head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOGGER_RING_RECORDS) {
+        atomic_fetch_add_explicit(&logger_drop_count, 1, memory_order_relaxed);
+        va_end(ap);
+        return;
+    }
+
+    logger_record_t *rec = &ring->records[head & (LOGGER_RING_RECORDS - 1)];
+    rec->fmt = fmt;
+    rec->time_ns = logger_realtime_ns();
+    rec->level = (uint8_t)level;
+    rec->nargs = 0;
+    rec->truncated = 0;
+    logger_encode(rec, fmt, &ap);
+    va_end(ap);
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+bool logger_ratelimit(log_ratelimit_t *rl, uint32_t *suppressed) {
+    uint32_t now = coarse_clock_sec();
+    uint32_t window = atomic_load_explicit(&rl->window, memory_order_relaxed);
+
+    /* The caller that moves the window forward reports what the last one swallowed */
+    if (now - window >= LOG_RATELIMIT_INTERVAL &&
+        atomic_compare_exchange_strong_explicit(&rl->window, &window, now,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        atomic_store_explicit(&rl->count, 1, memory_order_relaxed);
+        *suppressed = atomic_exchange_explicit(&rl->suppressed, 0, memory_order_relaxed);
+        return true;
+    }
+
+    if (atomic_fetch_add_explicit(&rl->count, 1, memory_order_relaxed) < LOG_RATELIMIT_BURST) {
+        return true;
+    }
+    atomic_fetch_add_explicit(&rl->suppressed, 1, memory_order_relaxed);
+    return false;
+}
+
+void logger_set_level(log_level_t level) {
+    atomic_store_explicit(&logger_level, (int)level, memory_order_relaxed);
+}
+
+int logger_start(log_level_t level) {
+    logger_set_level(level);
+    if (atomic_load_explicit(&logger_running, memory_order_acquire)) {
+        return 0;
+    }
+
+    atomic_store_explicit(&logger_stopping, false, memory_order_relaxed);
+    logger_out_batch.stream = stdout;
+    logger_err_batch.stream = stderr;
+    if (pthread_create(&logger_thread, NULL, logger_thread_main, NULL) != 0) {
+        return -1;
+    }
+
+    atomic_store_explicit(&logger_running, true, memory_order_release);
+    return 0;
+}
+
+void logger_stop(void) {
+    if (!atomic_exchange_explicit(&logger_running, false, memory_order_acq_rel)) {
+        return;
+    }
+
+    atomic_store_explicit(&logger_stopping, true, memory_order_release);
+    pthread_join(logger_thread, NULL);
+
+    /* The thread is gone: whatever it had not reached yet is written here */
+    logger_drain(&logger_out_batch, &logger_err_batch);
+}
+
+uint64_t logger_dropped(void) {
+    return atomic_load_explicit(&logger_drop_count, memory_order_relaxed);
+}
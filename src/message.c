@@ -1,30 +1,120 @@
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <ctype.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 
 #include "../include/messages.h"
+#include "../include/logger.h"
 #include "../include/utilities.h"
+#include "../include/msgpack.h"
+#include "../include/json_scan.h"
 
-message_t *message_create(const char *event, json_t *data) {
-    message_t *msg = malloc(sizeof(message_t));
+/* 事件名按枚举顺序排列，消息直接引用这些常量而不复制 */
+static const struct {
+    const char *name;
+    size_t len;
+} event_names[MESSAGE_EVENT_COUNT] = {
+    [MESSAGE_EVENT_UNKNOWN]           = { NULL, 0 },
+    [MESSAGE_EVENT_CLIENT_ID]         = { EVENT_CLIENT_ID, sizeof(EVENT_CLIENT_ID) - 1 },
+    [MESSAGE_EVENT_JOIN_ROOM]         = { EVENT_JOIN_ROOM, sizeof(EVENT_JOIN_ROOM) - 1 },
+    [MESSAGE_EVENT_LEAVE_ROOM]        = { EVENT_LEAVE_ROOM, sizeof(EVENT_LEAVE_ROOM) - 1 },
+    [MESSAGE_EVENT_OFFER]             = { EVENT_OFFER, sizeof(EVENT_OFFER) - 1 },
+    [MESSAGE_EVENT_ANSWER]            = { EVENT_ANSWER, sizeof(EVENT_ANSWER) - 1 },
+    [MESSAGE_EVENT_ICE_CANDIDATE]     = { EVENT_ICE_CANDIDATE, sizeof(EVENT_ICE_CANDIDATE) - 1 },
+    [MESSAGE_EVENT_PARTICIPANTS_LIST] = { EVENT_PARTICIPANTS_LIST, sizeof(EVENT_PARTICIPANTS_LIST) - 1 },
+    [MESSAGE_EVENT_ROOM_CREATED]      = { EVENT_ROOM_CREATED, sizeof(EVENT_ROOM_CREATED) - 1 },
+    [MESSAGE_EVENT_ERROR]             = { EVENT_ERROR, sizeof(EVENT_ERROR) - 1 },
+    [MESSAGE_EVENT_PONG]              = { EVENT_PONG, sizeof(EVENT_PONG) - 1 },
+    [MESSAGE_EVENT_RESUME_ROOM]       = { EVENT_RESUME_ROOM, sizeof(EVENT_RESUME_ROOM) - 1 },
+};
+
+/*
+ * 事件名的完美哈希：长度与首、次、末字符组合后取低 4 位，当前事件集合在 16 个槽位中
+ * 互不冲突。新增事件时需要重新选取移位量，使 event_hash_table 仍无冲突。
+ */
+#define EVENT_HASH_SIZE 16
+
+static inline unsigned event_hash(const char *name, size_t len) {
+    return ((unsigned)len + ((unsigned)(unsigned char)name[0] << 1) +
+            ((unsigned)(unsigned char)name[len - 1] << 4) +
+            (unsigned)(unsigned char)name[1]) & (EVENT_HASH_SIZE - 1);
+}
+
+static const message_event_t event_hash_table[EVENT_HASH_SIZE] = {
+    [1]  = MESSAGE_EVENT_ERROR,
+    [2]  = MESSAGE_EVENT_ICE_CANDIDATE,
+    [3]  = MESSAGE_EVENT_PONG,
+    [4]  = MESSAGE_EVENT_RESUME_ROOM,
+    [6]  = MESSAGE_EVENT_ANSWER,
+    [7]  = MESSAGE_EVENT_LEAVE_ROOM,
+    [9]  = MESSAGE_EVENT_OFFER,
+    [11] = MESSAGE_EVENT_CLIENT_ID,
+    [12] = MESSAGE_EVENT_JOIN_ROOM,
+    [13] = MESSAGE_EVENT_PARTICIPANTS_LIST,
+    [15] = MESSAGE_EVENT_ROOM_CREATED,
+};
+
+message_event_t message_event_lookup(const char *name, size_t len) {
+    if (len < 2) return MESSAGE_EVENT_UNKNOWN;
+    
+    message_event_t type = event_hash_table[event_hash(name, len)];
+    if (type != MESSAGE_EVENT_UNKNOWN && event_names[type].len == len &&
+        memcmp(event_names[type].name, name, len) == 0) {
+        return type;
+    }
+    return MESSAGE_EVENT_UNKNOWN;
+}
+
+const char *message_event_name(message_event_t type) {
+    return (unsigned)type < MESSAGE_EVENT_COUNT ? event_names[type].name : NULL;
+}
+
+/* 事件名不要求以 NUL 结尾，供 MessagePack 解码直接使用 */
+static message_t *message_create_n(const char *event, size_t len, json_t *data) {
+    /* 消息块来自当前线程的内存池，未知事件名紧跟在结构体之后 */
+    message_event_t type = message_event_lookup(event, len);
+    size_t event_size = type != MESSAGE_EVENT_UNKNOWN ? 0 : len + 1;
+    
+    message_t *msg = memory_pool_alloc(memory_pool_thread(), sizeof(message_t) + event_size);
     if (!msg) return NULL;
     
-    msg->event = strdup(event);
+    msg->type = type;
+    if (type != MESSAGE_EVENT_UNKNOWN) {
+        msg->event = event_names[type].name;
+    } else {
+        char *copy = (char *)(msg + 1);
+        memcpy(copy, event, len);
+        copy[len] = '\0';
+        msg->event = copy;
+    }
     msg->data = data ? json_incref(data) : NULL;
-    msg->ref_count = 1;
+    atomic_init(&msg->ref_count, 1);
+    msg->raw = NULL;
+    msg->raw_len = 0;
+    memset(&msg->relay, 0, sizeof(msg->relay));
+    msg->binary = false;
+    msg->received_ns = 0;
     
     return msg;
 }
 
+message_t *message_create(const char *event, json_t *data) {
+    return message_create_n(event, strlen(event), data);
+}
+
 void message_ref(message_t *msg) {
     if (msg) {
-        msg->ref_count++;
+        atomic_fetch_add_explicit(&msg->ref_count, 1, memory_order_relaxed);
     }
 }
 
 void message_unref(message_t *msg) {
-    if (msg && --msg->ref_count == 0) {
+    /* 消息可能在分片之间转交，最后一个释放者负责销毁 */
+    if (msg && atomic_fetch_sub_explicit(&msg->ref_count, 1, memory_order_acq_rel) == 1) {
         message_destroy(msg);
     }
 }
@@ -46,11 +136,12 @@ char *message_serialize(const message_t *msg) {
     return result;
 }
 
-message_t *message_deserialize(const char *json_str) {
+message_t *message_deserialize(const char *buf, size_t len) {
+    /* 按长度解析，输入不需要以 NUL 结尾 */
     json_error_t error;
-    json_t *root = json_loads(json_str, 0, &error);
+    json_t *root = json_loadb(buf, len, 0, &error);
     if (!root) {
-        fprintf(stderr, "JSON parse error: %s\n", error.text);
+        LOG_RATELIMITED(LOG_LEVEL_WARN, "JSON parse error: %s", error.text);
         return NULL;
     }
     
@@ -62,106 +153,1022 @@ message_t *message_deserialize(const char *json_str) {
         return NULL;
     }
     
-    message_t *msg = message_create(json_string_value(event), 
-                                   data ? json_incref(data) : NULL);
+    /* message_create 自行持有 data 的引用 */
+    message_t *msg = message_create(json_string_value(event), data);
     json_decref(root);
     
     return msg;
 }
 
+/*
+ * 中继快速路径的轻量扫描器：只定位 event、data.targetClientId 和负载值的位置，
+ * 不构建 JSON DOM。遇到带转义的键名等少见情况时返回失败，由调用者回退到完整解析。
+ */
+#define RELAY_MAX_DEPTH 64
+
+typedef struct relay_scan_s {
+    const char *p;
+    const char *end;
+} relay_scan_t;
+
+static void scan_ws(relay_scan_t *s) {
+    while (s->p < s->end &&
+           (*s->p == ' ' || *s->p == '\t' || *s->p == '\n' || *s->p == '\r')) {
+        s->p++;
+    }
+}
+
+static int scan_string(relay_scan_t *s, const char **start, size_t *len, bool *escaped) {
+    if (s->p >= s->end || *s->p != '"') return -1;
+    
+    const char *begin = ++s->p;
+    bool has_escape = false;
+    
+    while (s->p < s->end) {
+        /* 普通字节整段跳过，停在引号、反斜杠或控制字符上 */
+        s->p += json_scan_string(s->p, (size_t)(s->end - s->p));
+        if (s->p >= s->end) break;
+        
+        unsigned char c = (unsigned char)*s->p;
+        if (c == '"') {
+            if (start) *start = begin;
+            if (len) *len = (size_t)(s->p - begin);
+            if (escaped) *escaped = has_escape;
+            s->p++;
+            return 0;
+        }
+        if (c < 0x20) return -1;
+        if (c == '\\') {
+            has_escape = true;
+            if (++s->p >= s->end) return -1;
+            switch (*s->p) {
+                case '"': case '\\': case '/': case 'b':
+                case 'f': case 'n': case 'r': case 't':
+                    break;
+                case 'u':
+                    for (int i = 0; i < 4; i++) {
+                        if (++s->p >= s->end || !isxdigit((unsigned char)*s->p)) return -1;
+                    }
+                    break;
+                default:
+                    return -1;
+            }
+        }
+        s->p++;
+    }
+    return -1;
+}
+
+static int scan_literal(relay_scan_t *s, const char *word) {
+    size_t n = strlen(word);
+    if ((size_t)(s->end - s->p) < n || memcmp(s->p, word, n) != 0) return -1;
+    s->p += n;
+    return 0;
+}
+
+static size_t scan_digits(relay_scan_t *s) {
+    const char *begin = s->p;
+    while (s->p < s->end && isdigit((unsigned char)*s->p)) {
+        s->p++;
+    }
+    return (size_t)(s->p - begin);
+}
+
+/* -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)? */
+static int scan_number(relay_scan_t *s) {
+    if (s->p < s->end && *s->p == '-') s->p++;
+    if (s->p >= s->end) return -1;
+    
+    if (*s->p == '0') {
+        s->p++;
+    } else if (scan_digits(s) == 0) {
+        return -1;
+    }
+    
+    if (s->p < s->end && *s->p == '.') {
+        s->p++;
+        if (scan_digits(s) == 0) return -1;
+    }
+    
+    if (s->p < s->end && (*s->p == 'e' || *s->p == 'E')) {
+        s->p++;
+        if (s->p < s->end && (*s->p == '+' || *s->p == '-')) s->p++;
+        if (scan_digits(s) == 0) return -1;
+    }
+    
+    return 0;
+}
+
+static int scan_value(relay_scan_t *s, int depth) {
+    if (depth > RELAY_MAX_DEPTH || s->p >= s->end) return -1;
+    
+    switch (*s->p) {
+        case '"':
+            return scan_string(s, NULL, NULL, NULL);
+        case '{':
+        case '[': {
+            char close = *s->p == '{' ? '}' : ']';
+            bool is_object = close == '}';
+            s->p++;
+            scan_ws(s);
+            if (s->p < s->end && *s->p == close) {
+                s->p++;
+                return 0;
+            }
+            for (;;) {
+                if (is_object) {
+                    if (scan_string(s, NULL, NULL, NULL) != 0) return -1;
+                    scan_ws(s);
+                    if (s->p >= s->end || *s->p++ != ':') return -1;
+                    scan_ws(s);
+                }
+                if (scan_value(s, depth + 1) != 0) return -1;
+                scan_ws(s);
+                if (s->p >= s->end) return -1;
+                if (*s->p == close) {
+                    s->p++;
+                    return 0;
+                }
+                if (*s->p++ != ',') return -1;
+                scan_ws(s);
+            }
+        }
+        case 't':
+            return scan_literal(s, "true");
+        case 'f':
+            return scan_literal(s, "false");
+        case 'n':
+            return scan_literal(s, "null");
+        default:
+            return scan_number(s);
+    }
+}
+
+static bool key_equals(const char *key, size_t len, const char *expected) {
+    return strlen(expected) == len && memcmp(key, expected, len) == 0;
+}
+
+const char *message_relay_payload_key(message_event_t type) {
+    switch (type) {
+        case MESSAGE_EVENT_OFFER:         return "offer";
+        case MESSAGE_EVENT_ANSWER:        return "answer";
+        case MESSAGE_EVENT_ICE_CANDIDATE: return "candidate";
+        default:                          return NULL;
+    }
+}
+
+message_t *message_deserialize_relay(const char *buf, size_t len) {
+    relay_scan_t s = { buf, buf + len };
+    const char *event = NULL, *target = NULL;
+    size_t event_len = 0, target_len = 0;
+    const char *payloads[3] = { NULL, NULL, NULL };
+    size_t payload_lens[3] = { 0, 0, 0 };
+    static const char *payload_keys[3] = { "offer", "answer", "candidate" };
+    bool escaped;
+    
+    scan_ws(&s);
+    if (s.p >= s.end || *s.p++ != '{') return NULL;
+    scan_ws(&s);
+    
+    while (s.p < s.end && *s.p != '}') {
+        const char *key;
+        size_t key_len;
+        if (scan_string(&s, &key, &key_len, &escaped) != 0 || escaped) return NULL;
+        scan_ws(&s);
+        if (s.p >= s.end || *s.p++ != ':') return NULL;
+        scan_ws(&s);
+        
+        if (key_equals(key, key_len, "event")) {
+            if (scan_string(&s, &event, &event_len, &escaped) != 0 || escaped) return NULL;
+        } else if (key_equals(key, key_len, "data")) {
+            if (s.p >= s.end || *s.p++ != '{') return NULL;
+            scan_ws(&s);
+            while (s.p < s.end && *s.p != '}') {
+                if (scan_string(&s, &key, &key_len, &escaped) != 0 || escaped) return NULL;
+                scan_ws(&s);
+                if (s.p >= s.end || *s.p++ != ':') return NULL;
+                scan_ws(&s);
+                
+                const char *value = s.p;
+                if (key_equals(key, key_len, "targetClientId")) {
+                    if (scan_string(&s, &target, &target_len, &escaped) != 0 || escaped) return NULL;
+                } else {
+                    if (scan_value(&s, 2) != 0) return NULL;
+                    for (int i = 0; i < 3; i++) {
+                        if (key_equals(key, key_len, payload_keys[i])) {
+                            payloads[i] = value;
+                            payload_lens[i] = (size_t)(s.p - value);
+                        }
+                    }
+                }
+                
+                scan_ws(&s);
+                if (s.p < s.end && *s.p == ',') {
+                    s.p++;
+                    scan_ws(&s);
+                } else if (s.p >= s.end || *s.p != '}') {
+                    return NULL;
+                }
+            }
+            if (s.p >= s.end) return NULL;
+            s.p++;
+        } else if (scan_value(&s, 1) != 0) {
+            return NULL;
+        }
+        
+        scan_ws(&s);
+        if (s.p < s.end && *s.p == ',') {
+            s.p++;
+            scan_ws(&s);
+        } else if (s.p >= s.end || *s.p != '}') {
+            return NULL;
+        }
+    }
+    
+    if (s.p >= s.end) return NULL;
+    s.p++;
+    scan_ws(&s);
+    if (s.p != s.end || !event || !target) return NULL;
+    
+    /* 只有转发类事件走快速路径 */
+    message_event_t type = message_event_lookup(event, event_len);
+    int which;
+    if (type == MESSAGE_EVENT_OFFER) which = 0;
+    else if (type == MESSAGE_EVENT_ANSWER) which = 1;
+    else if (type == MESSAGE_EVENT_ICE_CANDIDATE) which = 2;
+    else return NULL;
+    
+    /* 负载将原样转发，必须是合法 UTF-8 */
+    if (payloads[which] &&
+        !json_utf8_valid((const unsigned char *)payloads[which], payload_lens[which])) {
+        return NULL;
+    }
+    
+    message_t *msg = message_create(event_names[type].name, NULL);
+    if (!msg) return NULL;
+    
+    msg->raw = memory_pool_alloc(memory_pool_thread(), len + 1);
+    if (!msg->raw) {
+        message_unref(msg);
+        return NULL;
+    }
+    memcpy(msg->raw, buf, len);
+    msg->raw[len] = '\0';
+    msg->raw_len = len;
+    
+    msg->relay.target_off = (size_t)(target - buf);
+    msg->relay.target_len = target_len;
+    if (payloads[which]) {
+        msg->relay.payload_off = (size_t)(payloads[which] - buf);
+        msg->relay.payload_len = payload_lens[which];
+    }
+    
+    return msg;
+}
+
+message_t *message_deserialize_msgpack(const unsigned char *buf, size_t len) {
+    msgpack_reader_t r = { buf, buf + len };
+    const char *event = NULL, *target = NULL;
+    size_t event_len = 0, target_len = 0;
+    const unsigned char *data = NULL, *data_end = NULL;
+    const unsigned char *payload = NULL;
+    size_t payload_len = 0;
+    size_t count;
+    
+    /* 顶层必须是 map，只取 event 和 data，其余键跳过 */
+    if (msgpack_read_map(&r, &count) != 0) return NULL;
+    for (size_t i = 0; i < count; i++) {
+        const char *key;
+        size_t key_len;
+        if (msgpack_read_str(&r, &key, &key_len) != 0) return NULL;
+        
+        if (key_equals(key, key_len, "event")) {
+            if (msgpack_read_str(&r, &event, &event_len) != 0) return NULL;
+        } else if (key_equals(key, key_len, "data")) {
+            data = r.p;
+            if (msgpack_skip(&r) != 0) return NULL;
+            data_end = r.p;
+        } else if (msgpack_skip(&r) != 0) {
+            return NULL;
+        }
+    }
+    if (r.p != r.end || !event) return NULL;
+    
+    message_event_t type = message_event_lookup(event, event_len);
+    const char *payload_key = message_relay_payload_key(type);
+    
+    /* 转发类事件：定位 targetClientId 和负载值，原始字节留给中继路径 */
+    if (payload_key && data) {
+        msgpack_reader_t d = { data, data_end };
+        if (msgpack_read_map(&d, &count) == 0) {
+            for (size_t i = 0; i < count; i++) {
+                const char *key;
+                size_t key_len;
+                if (msgpack_read_str(&d, &key, &key_len) != 0) return NULL;
+                
+                const unsigned char *value = d.p;
+                if (key_equals(key, key_len, "targetClientId")) {
+                    if (msgpack_read_str(&d, &target, &target_len) != 0) return NULL;
+                } else {
+                    if (msgpack_skip(&d) != 0) return NULL;
+                    if (key_equals(key, key_len, payload_key)) {
+                        payload = value;
+                        payload_len = (size_t)(d.p - value);
+                    }
+                }
+            }
+        }
+    }
+    
+    if (target) {
+        message_t *msg = message_create_n(event, event_len, NULL);
+        if (!msg) return NULL;
+        
+        msg->raw = memory_pool_alloc(memory_pool_thread(), len + 1);
+        if (!msg->raw) {
+            message_unref(msg);
+            return NULL;
+        }
+        memcpy(msg->raw, buf, len);
+        msg->raw[len] = '\0';
+        msg->raw_len = len;
+        msg->binary = true;
+        
+        msg->relay.target_off = (size_t)((const unsigned char *)target - buf);
+        msg->relay.target_len = target_len;
+        if (payload) {
+            msg->relay.payload_off = (size_t)(payload - buf);
+            msg->relay.payload_len = payload_len;
+        }
+        return msg;
+    }
+    
+    /* 其他事件解码为 JSON，之后与文本协议的消息走同一套处理 */
+    json_t *value = NULL;
+    if (data) {
+        msgpack_reader_t d = { data, data_end };
+        value = msgpack_read_json(&d);
+        if (!value) return NULL;
+    }
+    
+    message_t *msg = message_create_n(event, event_len, value);
+    json_decref(value);
+    
+    return msg;
+}
+
 void message_destroy(message_t *msg) {
     if (msg) {
-        free(msg->event);
         if (msg->data) {
             json_decref(msg->data);
         }
-        free(msg);
+        memory_pool_free(msg->raw);
+        memory_pool_free(msg);
+    }
+}
+
+frame_t *frame_alloc(size_t len) {
+    frame_t *frame = memory_pool_alloc(memory_pool_thread(), sizeof(frame_t) + LWS_PRE + len + 1);
+    if (!frame) return NULL;
+    
+    atomic_init(&frame->ref_count, 1);
+    frame->len = len;
+    frame->flags = 0;
+    atomic_init(&frame->binary, NULL);
+    frame->buf[LWS_PRE + len] = '\0';
+    
+    return frame;
+}
+
+/*
+ * 把字节转义为 JSON 字符串内容，返回写入的字节数。转义规则与 jansson 的紧凑输出一致：
+ * 引号、反斜杠和控制字符转义，其余字节 (包括 UTF-8 多字节序列) 原样输出，最坏情况长度为 6 倍。
+ */
+static size_t escape_into(unsigned char *out, const char *in, size_t len) {
+    static const char hex[] = "0123456789ABCDEF";
+    unsigned char *p = out;
+    size_t i = 0;
+    
+    for (;;) {
+        /* 无需转义的字节整段复制 */
+        size_t run = json_scan_string(in + i, len - i);
+        memcpy(p, in + i, run);
+        p += run;
+        i += run;
+        if (i >= len) break;
+        
+        unsigned char c = (unsigned char)in[i++];
+        switch (c) {
+            case '"':  *p++ = '\\'; *p++ = '"';  break;
+            case '\\': *p++ = '\\'; *p++ = '\\'; break;
+            case '\b': *p++ = '\\'; *p++ = 'b';  break;
+            case '\f': *p++ = '\\'; *p++ = 'f';  break;
+            case '\n': *p++ = '\\'; *p++ = 'n';  break;
+            case '\r': *p++ = '\\'; *p++ = 'r';  break;
+            case '\t': *p++ = '\\'; *p++ = 't';  break;
+            default:
+                p = (unsigned char *)memcpy(p, "\\u00", 4) + 4;
+                *p++ = (unsigned char)hex[c >> 4];
+                *p++ = (unsigned char)hex[c & 0xf];
+                break;
+        }
+    }
+    
+    return (size_t)(p - out);
+}
+
+/* escape_into 写出的字节数，用于按实际长度分配帧 */
+static size_t escaped_len(const char *in, size_t len) {
+    size_t n = len;
+    size_t i = 0;
+    
+    for (;;) {
+        i += json_scan_string(in + i, len - i);
+        if (i >= len) break;
+        
+        unsigned char c = (unsigned char)in[i++];
+        if (c == '"' || c == '\\' || c == '\b' || c == '\f' ||
+            c == '\n' || c == '\r' || c == '\t') {
+            n += 1;
+        } else {
+            n += 5;
+        }
     }
+    
+    return n;
+}
+
+static unsigned char *append(unsigned char *p, const char *s) {
+    size_t n = strlen(s);
+    memcpy(p, s, n);
+    return p + n;
 }
 
-int message_queue_init(message_queue_t *queue, size_t capacity) {
-    queue->messages = calloc(capacity, sizeof(ws_message_t));
-    if (!queue->messages) return -1;
+frame_t *frame_create(const char *event, const char *data) {
+    /*
+     * 直接写出信封 {"event":"...","data":"..."}，与经由 jansson 构建再序列化的结果相同：
+     * data 是 JSON 文本字符串 (客户端会再次解析)，不是合法 UTF-8 时省略。
+     */
+    size_t event_len = strlen(event);
+    size_t data_len = data ? strlen(data) : 0;
+    if (data && !json_utf8_valid((const unsigned char *)data, data_len)) {
+        data = NULL;
+        data_len = 0;
+    }
+    
+    size_t len = escaped_len(event, event_len) + 12;
+    if (data) len += escaped_len(data, data_len) + 10;
     
-    queue->capacity = capacity;
-    queue->head = 0;
-    queue->tail = 0;
-    queue->count = 0;
+    frame_t *frame = frame_alloc(len);
+    if (!frame) return NULL;
+    
+    unsigned char *p = frame_payload(frame);
+    p = append(p, "{\"event\":\"");
+    p += escape_into(p, event, event_len);
+    if (data) {
+        p = append(p, "\",\"data\":\"");
+        p += escape_into(p, data, data_len);
+    }
+    p = append(p, "\"}");
+    
+    frame->len = (size_t)(p - frame_payload(frame));
+    *p = '\0';
+    
+    return frame;
+}
+
+frame_t *frame_create_relay(const char *event, const id128_t *from,
+                            const char *key, const char *payload, size_t payload_len) {
+    char from_str[ID128_STR_LEN];
+    id128_format(from, from_str);
+    
+    /*
+     * 信封格式与 frame_create() 相同：data 是 JSON 文本字符串。
+     * 负载只在 (已校验过的) 原始字节上做一次转义拷贝，最坏情况长度翻倍。
+     */
+    size_t max_len = strlen(event) + (key ? strlen(key) : 0) + 2 * payload_len + 96;
+    frame_t *frame = frame_alloc(max_len);
+    if (!frame) return NULL;
+    
+    unsigned char *p = frame_payload(frame);
+    p = append(p, "{\"event\":\"");
+    p = append(p, event);
+    p = append(p, "\",\"data\":\"{\\\"fromClientId\\\":\\\"");
+    p = append(p, from_str);
+    p = append(p, "\\\"");
+    if (key && payload && payload_len > 0) {
+        p = append(p, ",\\\"");
+        p = append(p, key);
+        p = append(p, "\\\":");
+        p += escape_into(p, payload, payload_len);
+    }
+    p = append(p, "}\"}");
     
-    pthread_mutex_init(&queue->lock, NULL);
+    frame->len = (size_t)(p - frame_payload(frame));
+    *p = '\0';
+    
+    return frame;
+}
+
+/* json_dumpb 的首次尝试缓冲区大小，信令消息的 data 通常远小于此 */
+#define FRAME_JSON_SCRATCH 1024
+
+/* 临时缓冲区来自本轮循环的临时分配区，没有绑定分配区的线程退回 malloc */
+static void *scratch_alloc(size_t size) {
+    memory_arena_t *arena = memory_arena_thread();
+    return arena ? memory_arena_alloc(arena, size) : malloc(size);
+}
+
+static void scratch_free(void *buf) {
+    if (!memory_arena_thread()) free(buf);
+}
+
+/* 紧凑序列化到临时缓冲区 (以 NUL 结尾)，失败返回 NULL */
+static char *scratch_dump_json(const json_t *value, size_t *len_out) {
+    size_t cap = FRAME_JSON_SCRATCH;
+    char *buf = scratch_alloc(cap);
+    if (!buf) return NULL;
+    
+    /* 返回值为所需长度，超出缓冲区时按实际长度重新序列化一次 */
+    size_t len = json_dumpb(value, buf, cap - 1, JSON_COMPACT);
+    if (len >= cap) {
+        scratch_free(buf);
+        cap = len + 1;
+        buf = scratch_alloc(cap);
+        if (!buf) return NULL;
+        len = json_dumpb(value, buf, cap - 1, JSON_COMPACT);
+    }
+    
+    if (len == 0 || len >= cap) {
+        scratch_free(buf);
+        return NULL;
+    }
+    buf[len] = '\0';
+    *len_out = len;
+    return buf;
+}
+
+frame_t *frame_create_json(const char *event, json_t *data) {
+    if (!data) return frame_create(event, NULL);
+    
+    size_t len;
+    char *buf = scratch_dump_json(data, &len);
+    if (!buf) return NULL;
+    
+    frame_t *frame = frame_create(event, buf);
+    scratch_free(buf);
+    
+    return frame;
+}
+
+frame_t *frame_create_relay_msgpack(const char *event, const id128_t *from, const char *key,
+                                    const unsigned char *payload, size_t payload_len) {
+    char from_str[ID128_STR_LEN];
+    id128_format(from, from_str);
+    
+    /* {"event": event, "data": {"fromClientId": from, key: payload}}，负载是原样拷贝的编码值 */
+    bool has_payload = key && payload && payload_len > 0;
+    size_t event_len = strlen(event);
+    size_t from_len = strlen(from_str);
+    
+    size_t len = msgpack_map_size(2) +
+                 msgpack_str_size(5) + msgpack_str_size(event_len) +
+                 msgpack_str_size(4) + msgpack_map_size(has_payload ? 2 : 1) +
+                 msgpack_str_size(12) + msgpack_str_size(from_len);
+    if (has_payload) len += msgpack_str_size(strlen(key)) + payload_len;
+    
+    frame_t *frame = frame_alloc(len);
+    if (!frame) return NULL;
+    frame->flags |= FRAME_FLAG_BINARY;
+    
+    unsigned char *p = frame_payload(frame);
+    p = msgpack_write_map(p, 2);
+    p = msgpack_write_str(p, "event", 5);
+    p = msgpack_write_str(p, event, event_len);
+    p = msgpack_write_str(p, "data", 4);
+    p = msgpack_write_map(p, has_payload ? 2 : 1);
+    p = msgpack_write_str(p, "fromClientId", 12);
+    p = msgpack_write_str(p, from_str, from_len);
+    if (has_payload) {
+        p = msgpack_write_str(p, key, strlen(key));
+        memcpy(p, payload, payload_len);
+    }
+    
+    return frame;
+}
+
+/*
+ * 取出转发负载在目标编码下的字节：编码相同时直接指向 raw，不同时只转换负载这一个值，
+ * 结果放在临时缓冲区中并通过 scratch 返回，由调用者用 scratch_free() 释放。
+ */
+static int relay_payload(const message_t *msg, bool binary,
+                         const char **out, size_t *out_len, void **scratch) {
+    const char *payload = msg->raw ? msg->raw + msg->relay.payload_off : NULL;
+    size_t payload_len = msg->raw ? msg->relay.payload_len : 0;
+    
+    *scratch = NULL;
+    
+    /* 同一编码：负载原样拷贝，不解析 */
+    if (payload_len == 0 || msg->binary == binary) {
+        *out = payload;
+        *out_len = payload_len;
+        return 0;
+    }
+    
+    if (msg->binary) {
+        /* MessagePack -> JSON：只解码负载这一个值 */
+        msgpack_reader_t r = { (const unsigned char *)payload,
+                               (const unsigned char *)payload + payload_len };
+        json_t *value = msgpack_read_json(&r);
+        if (!value) return -1;
+        
+        char *buf = scratch_dump_json(value, out_len);
+        json_decref(value);
+        if (!buf) return -1;
+        
+        *out = buf;
+        *scratch = buf;
+        return 0;
+    }
+    
+    /* JSON -> MessagePack */
+    json_t *value = json_loadb(payload, payload_len, JSON_DECODE_ANY, NULL);
+    if (!value) return -1;
+    
+    size_t len = msgpack_json_size(value);
+    unsigned char *buf = len > 0 ? scratch_alloc(len) : NULL;
+    if (buf) msgpack_write_json(buf, value);
+    json_decref(value);
+    if (!buf) return -1;
+    
+    *out = (const char *)buf;
+    *out_len = len;
+    *scratch = buf;
     return 0;
 }
 
-void message_queue_cleanup(message_queue_t *queue) {
-    pthread_mutex_lock(&queue->lock);
+frame_t *message_relay_frame(const message_t *msg, const id128_t *from, bool binary) {
+    const char *key = message_relay_payload_key(msg->type);
+    const char *payload;
+    size_t payload_len;
+    void *scratch;
     
-    /* Free any remaining messages */
-    while (queue->count > 0) {
-        ws_message_t *msg = &queue->messages[queue->head];
-        if (msg->message) {
-            message_unref(msg->message);
+    if (relay_payload(msg, binary, &payload, &payload_len, &scratch) != 0) return NULL;
+    
+    frame_t *frame;
+    if (binary) {
+        frame = frame_create_relay_msgpack(msg->event, from, key,
+                                           (const unsigned char *)payload, payload_len);
+    } else {
+        frame = frame_create_relay(msg->event, from, key, payload, payload_len);
+    }
+    scratch_free(scratch);
+    
+    return frame;
+}
+
+frame_t *frame_create_relay_batch(const char *event, const char *list_key,
+                                  const relay_entry_t *entries, size_t count, bool binary) {
+    if (count == 0) return NULL;
+    
+    /* 先取出全部负载以便按实际长度分配帧；转换失败的条目省略负载 */
+    struct {
+        const char *p;
+        size_t len;
+        void *scratch;
+    } *parts = scratch_alloc(count * sizeof(*parts));
+    if (!parts) return NULL;
+    
+    size_t len = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (relay_payload(entries[i].msg, binary, &parts[i].p, &parts[i].len, &parts[i].scratch) != 0) {
+            parts[i].p = NULL;
+            parts[i].len = 0;
         }
-        queue->head = (queue->head + 1) % queue->capacity;
-        queue->count--;
     }
     
-    pthread_mutex_unlock(&queue->lock);
-    pthread_mutex_destroy(&queue->lock);
+    frame_t *frame = NULL;
+    char from_str[ID128_STR_LEN];
+    size_t event_len = strlen(event);
+    size_t list_len = strlen(list_key);
     
-    free(queue->messages);
-    queue->messages = NULL;
-    queue->capacity = 0;
+    if (binary) {
+        /* {"event": event, "data": {list_key: [{"fromClientId": id, key: payload}, ...]}} */
+        len = msgpack_map_size(2) + msgpack_str_size(5) + msgpack_str_size(event_len) +
+              msgpack_str_size(4) + msgpack_map_size(1) + msgpack_str_size(list_len) +
+              msgpack_array_size(count);
+        for (size_t i = 0; i < count; i++) {
+            const char *key = message_relay_payload_key(entries[i].msg->type);
+            len += msgpack_map_size(2) + msgpack_str_size(12) + msgpack_str_size(ID128_STR_LEN - 1);
+            if (key && parts[i].len > 0) len += msgpack_str_size(strlen(key)) + parts[i].len;
+        }
+        
+        frame = frame_alloc(len);
+        if (frame) {
+            frame->flags |= FRAME_FLAG_BINARY;
+            
+            unsigned char *p = frame_payload(frame);
+            p = msgpack_write_map(p, 2);
+            p = msgpack_write_str(p, "event", 5);
+            p = msgpack_write_str(p, event, event_len);
+            p = msgpack_write_str(p, "data", 4);
+            p = msgpack_write_map(p, 1);
+            p = msgpack_write_str(p, list_key, list_len);
+            p = msgpack_write_array(p, count);
+            for (size_t i = 0; i < count; i++) {
+                const char *key = message_relay_payload_key(entries[i].msg->type);
+                bool has_payload = key && parts[i].len > 0;
+                
+                id128_format(&entries[i].from, from_str);
+                p = msgpack_write_map(p, has_payload ? 2 : 1);
+                p = msgpack_write_str(p, "fromClientId", 12);
+                p = msgpack_write_str(p, from_str, ID128_STR_LEN - 1);
+                if (has_payload) {
+                    p = msgpack_write_str(p, key, strlen(key));
+                    memcpy(p, parts[i].p, parts[i].len);
+                    p += parts[i].len;
+                }
+            }
+        }
+    } else {
+        /* 信封与 frame_create_relay() 相同，data 是 JSON 文本字符串，负载只转义拷贝一次 */
+        len = escaped_len(event, event_len) + escaped_len(list_key, list_len) + 32;
+        for (size_t i = 0; i < count; i++) {
+            const char *key = message_relay_payload_key(entries[i].msg->type);
+            len += ID128_STR_LEN + 32;
+            if (key && parts[i].len > 0) len += strlen(key) + 8 + escaped_len(parts[i].p, parts[i].len);
+        }
+        
+        frame = frame_alloc(len);
+        if (frame) {
+            unsigned char *p = frame_payload(frame);
+            p = append(p, "{\"event\":\"");
+            p += escape_into(p, event, event_len);
+            p = append(p, "\",\"data\":\"{\\\"");
+            p += escape_into(p, list_key, list_len);
+            p = append(p, "\\\":[");
+            for (size_t i = 0; i < count; i++) {
+                const char *key = message_relay_payload_key(entries[i].msg->type);
+                
+                id128_format(&entries[i].from, from_str);
+                if (i > 0) *p++ = ',';
+                p = append(p, "{\\\"fromClientId\\\":\\\"");
+                p = append(p, from_str);
+                p = append(p, "\\\"");
+                if (key && parts[i].len > 0) {
+                    p = append(p, ",\\\"");
+                    p = append(p, key);
+                    p = append(p, "\\\":");
+                    p += escape_into(p, parts[i].p, parts[i].len);
+                }
+                *p++ = '}';
+            }
+            p = append(p, "]}\"}");
+            
+            frame->len = (size_t)(p - frame_payload(frame));
+            *p = '\0';
+        }
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        scratch_free(parts[i].scratch);
+    }
+    scratch_free(parts);
+    
+    return frame;
 }
 
-int message_queue_push(message_queue_t *queue, struct lws *wsi, message_t *msg) {
-    pthread_mutex_lock(&queue->lock);
+/*
+ * 把 JSON 信封转换为 MessagePack：data 在 JSON 信封中是 JSON 文本字符串，
+ * 二进制信封中直接编码为对应的值 (文本无法解析时保留为字符串)。
+ */
+static frame_t *frame_to_msgpack(frame_t *frame) {
+    json_t *root = json_loadb((const char *)frame_payload(frame), frame->len, 0, NULL);
+    if (!root) return NULL;
+    
+    json_t *event = json_object_get(root, "event");
+    json_t *data = json_object_get(root, "data");
+    frame_t *binary = NULL;
+    
+    if (!json_is_string(event)) {
+        json_decref(root);
+        return NULL;
+    }
     
-    if (queue->count >= queue->capacity) {
-        pthread_mutex_unlock(&queue->lock);
-        return -1; /* Queue full */
+    json_t *value = NULL;
+    if (json_is_string(data)) {
+        value = json_loadb(json_string_value(data), json_string_length(data), JSON_DECODE_ANY, NULL);
+        if (!value) value = json_incref(data);
     }
     
-    ws_message_t *slot = &queue->messages[queue->tail];
-    slot->wsi = wsi;
-    slot->message = msg;
-    slot->timestamp = get_timestamp_ms();
+    size_t event_len = json_string_length(event);
+    size_t value_len = value ? msgpack_json_size(value) : 0;
+    if (!value || value_len > 0) {
+        size_t len = msgpack_map_size(value ? 2 : 1) +
+                     msgpack_str_size(5) + msgpack_str_size(event_len);
+        if (value) len += msgpack_str_size(4) + value_len;
+        
+        binary = frame_alloc(len);
+        if (binary) {
+            binary->flags = (frame->flags & FRAME_FLAG_DROPPABLE) | FRAME_FLAG_BINARY;
+            
+            unsigned char *p = frame_payload(binary);
+            p = msgpack_write_map(p, value ? 2 : 1);
+            p = msgpack_write_str(p, "event", 5);
+            p = msgpack_write_str(p, json_string_value(event), event_len);
+            if (value) {
+                p = msgpack_write_str(p, "data", 4);
+                msgpack_write_json(p, value);
+            }
+        }
+    }
+    
+    json_decref(value);
+    json_decref(root);
+    return binary;
+}
+
+frame_t *frame_get_binary(frame_t *frame) {
+    if (!frame || (frame->flags & FRAME_FLAG_BINARY)) return frame;
     
-    message_ref(msg); /* Take reference */
+    frame_t *binary = atomic_load_explicit(&frame->binary, memory_order_acquire);
+    if (binary) return binary;
     
-    queue->tail = (queue->tail + 1) % queue->capacity;
-    queue->count++;
+    /* 多个线程可能同时转换，只保留先装入的一份 */
+    binary = frame_to_msgpack(frame);
+    if (!binary) return NULL;
+    
+    frame_t *expected = NULL;
+    if (!atomic_compare_exchange_strong_explicit(&frame->binary, &expected, binary,
+                                                 memory_order_acq_rel, memory_order_acquire)) {
+        frame_unref(binary);
+        binary = expected;
+    }
+    return binary;
+}
+
+void frame_ref(frame_t *frame) {
+    if (frame) {
+        atomic_fetch_add_explicit(&frame->ref_count, 1, memory_order_relaxed);
+    }
+}
+
+void frame_unref(frame_t *frame) {
+    /* 同一帧可能同时排在不同服务线程的客户端队列中 */
+    if (frame && atomic_fetch_sub_explicit(&frame->ref_count, 1, memory_order_acq_rel) == 1) {
+        frame_unref(atomic_load_explicit(&frame->binary, memory_order_acquire));
+        memory_pool_free(frame);
+    }
+}
+
+int message_queue_init(message_queue_t *queue, size_t capacity, message_queue_mode_t mode) {
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
     
-    pthread_mutex_unlock(&queue->lock);
+    queue->slots = calloc(size, sizeof(message_queue_slot_t));
+    if (!queue->slots) return -1;
+    
+    /* Slot i is free for the producer that claims position i */
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&queue->slots[i].sequence, i);
+    }
+    
+    queue->capacity = size;
+    queue->mask = size - 1;
+    queue->mode = mode;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->overflows, 0);
     return 0;
 }
 
-int message_queue_pop(message_queue_t *queue, ws_message_t *result) {
-    pthread_mutex_lock(&queue->lock);
+void message_queue_cleanup(message_queue_t *queue) {
+    if (!queue->slots) return;
     
-    if (queue->count == 0) {
-        pthread_mutex_unlock(&queue->lock);
-        return -1; /* Queue empty */
+    /* Free any remaining messages */
+    ws_message_t item;
+    while (message_queue_pop(queue, &item) == 0) {
+        message_unref(item.message);
+        frame_unref(item.frame);
     }
     
-    ws_message_t *msg = &queue->messages[queue->head];
-    if (result) {
-        *result = *msg;
+    free(queue->slots);
+    queue->slots = NULL;
+    queue->capacity = 0;
+}
+
+/* Claim count consecutive positions; returns false if the ring lacks room */
+static bool message_queue_claim(message_queue_t *queue, size_t count, size_t *pos_out) {
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    
+    for (;;) {
+        /* The last slot of the run being free implies the earlier ones are too */
+        message_queue_slot_t *last = &queue->slots[(pos + count - 1) & queue->mask];
+        size_t seq = atomic_load_explicit(&last->sequence, memory_order_acquire);
+        if (seq != pos + count - 1) {
+            if ((intptr_t)(seq - (pos + count - 1)) < 0) {
+                return false; /* Queue full */
+            }
+            /* Another producer moved tail; reload and retry */
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+            continue;
+        }
+        
+        if (queue->mode == MESSAGE_QUEUE_SPSC) {
+            atomic_store_explicit(&queue->tail, pos + count, memory_order_relaxed);
+            break;
+        }
+        if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + count,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+            break;
+        }
     }
     
-    /* Don't unref here - caller takes ownership */
-    memset(msg, 0, sizeof(ws_message_t));
+    *pos_out = pos;
+    return true;
+}
+
+/* Fill a claimed slot and hand it to the consumer */
+static void message_queue_publish(message_queue_t *queue, size_t pos, const ws_message_t *item) {
+    message_queue_slot_t *slot = &queue->slots[pos & queue->mask];
+    
+    slot->message = *item;
     
-    queue->head = (queue->head + 1) % queue->capacity;
-    queue->count--;
+    /* Take references; the caller keeps its own */
+    message_ref(slot->message.message);
+    frame_ref(slot->message.frame);
+    
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+}
+
+int message_queue_push(message_queue_t *queue, const ws_message_t *item) {
+    return message_queue_push_batch(queue, item, 1) == 1 ? 0 : -1;
+}
+
+size_t message_queue_push_batch(message_queue_t *queue, const ws_message_t *items, size_t count) {
+    if (count == 0) return 0;
+    
+    size_t pos;
+    if (count > queue->capacity || !message_queue_claim(queue, count, &pos)) {
+        atomic_fetch_add_explicit(&queue->overflows, count, memory_order_relaxed);
+        return 0;
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        message_queue_publish(queue, pos + i, &items[i]);
+    }
+    return count;
+}
+
+int message_queue_pop(message_queue_t *queue, ws_message_t *result) {
+    ws_message_t item;
+    if (message_queue_pop_batch(queue, &item, 1) == 0) {
+        return -1; /* Queue empty */
+    }
     
-    pthread_mutex_unlock(&queue->lock);
+    /* Don't unref here - caller takes ownership */
+    if (result) {
+        *result = item;
+    }
     return 0;
 }
 
+size_t message_queue_pop_batch(message_queue_t *queue, ws_message_t *results, size_t max) {
+    /* Single consumer: head is only written here */
+    size_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t n = 0;
+    
+    while (n < max) {
+        message_queue_slot_t *slot = &queue->slots[pos & queue->mask];
+        if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != pos + 1) {
+            break; /* Empty, or the producer has not published yet */
+        }
+        
+        results[n++] = slot->message;
+        memset(&slot->message, 0, sizeof(ws_message_t));
+        
+        /* Free the slot for the producer one lap ahead */
+        atomic_store_explicit(&slot->sequence, pos + queue->capacity, memory_order_release);
+        pos++;
+    }
+    
+    if (n > 0) {
+        atomic_store_explicit(&queue->head, pos, memory_order_relaxed);
+    }
+    return n;
+}
+
 bool message_queue_is_empty(const message_queue_t *queue) {
-    return queue->count == 0;
+    return atomic_load_explicit(&queue->head, memory_order_relaxed) ==
+           atomic_load_explicit(&queue->tail, memory_order_relaxed);
 }
 
 bool message_queue_is_full(const message_queue_t *queue) {
-    return queue->count >= queue->capacity;
+    return atomic_load_explicit(&queue->tail, memory_order_relaxed) -
+           atomic_load_explicit(&queue->head, memory_order_relaxed) >= queue->capacity;
+}
+
+uint64_t message_queue_overflows(const message_queue_t *queue) {
+    return atomic_load_explicit(&queue->overflows, memory_order_relaxed);
 }
\ No newline at end of file
@@ -0,0 +1,151 @@
+/**
+ * @file metrics.c
+ * @brief 分片指标：直方图快照、分位数和 Prometheus 文本格式输出。
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/metrics.h"
+
+/* 文本缓冲区的初始容量 */
+#define METRICS_TEXT_MIN_CAPACITY (16 * 1024)
+
+/**
+ * @brief 桶的上界 (含)。
+ * @param index 桶下标。
+ * @return 落入该桶的最大值；最后一个桶还包含所有更大的值。
+ */
+uint64_t metrics_bucket_upper(unsigned index) {
+    if (index < METRICS_HIST_SUB) return index + 1;
+
+    unsigned magnitude = index / METRICS_HIST_SUB;
+    uint64_t sub = index % METRICS_HIST_SUB;
+    return (METRICS_HIST_SUB + sub + 1) << (magnitude - 1);
+}
+
+/**
+ * @brief 把一个分片的直方图累加到快照中。
+ *
+ * 所属线程可能同时在写，各字段分别读取，因此 count 与桶的总和可能略有出入；
+ * 导出时 +Inf 桶和 _count 都取桶的总和，保证单调。
+ * @param snap 目标快照。
+ * @param hist 分片的直方图。
+ */
+void metrics_snapshot_add(metrics_snapshot_t *snap, const metrics_histogram_t *hist) {
+    snap->sum += metrics_read(&hist->sum);
+    for (unsigned i = 0; i < METRICS_HIST_BUCKETS; i++) {
+        uint64_t n = metrics_read(&hist->buckets[i]);
+        snap->buckets[i] += n;
+        snap->count += n;
+    }
+}
+
+/**
+ * @brief 快照的分位数。
+ * @param snap 快照。
+ * @param q 分位 (0 < q <= 1)。
+ * @return 分位数所在桶的上界，没有观测值时返回 0。
+ */
+uint64_t metrics_snapshot_quantile(const metrics_snapshot_t *snap, double q) {
+    if (snap->count == 0) return 0;
+
+    uint64_t rank = (uint64_t)((double)snap->count * q);
+    if (rank == 0) rank = 1;
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < METRICS_HIST_BUCKETS; i++) {
+        seen += snap->buckets[i];
+        if (seen >= rank) return metrics_bucket_upper(i);
+    }
+    return metrics_bucket_upper(METRICS_HIST_BUCKETS - 1);
+}
+
+void metrics_text_init(metrics_text_t *text) {
+    memset(text, 0, sizeof(*text));
+}
+
+void metrics_text_free(metrics_text_t *text) {
+    free(text->data);
+    metrics_text_init(text);
+}
+
+/**
+ * @brief 按格式追加文本，容量不足时倍增。
+ *
+ * 扩容失败后置 failed，之后的追加全部忽略。
+ */
+void metrics_text_printf(metrics_text_t *text, const char *fmt, ...) {
+    if (text->failed) return;
+
+    for (;;) {
+        size_t room = text->cap - text->len;
+        va_list ap;
+        va_start(ap, fmt);
+        int n = room ? vsnprintf(text->data + text->len, room, fmt, ap) : -1;
+        va_end(ap);
+
+        if (n >= 0 && (size_t)n < room) {
+            text->len += (size_t)n;
+            return;
+        }
+        if (n < 0 && room) {
+            text->failed = true;
+            return;
+        }
+
+        size_t cap = text->cap ? text->cap * 2 : METRICS_TEXT_MIN_CAPACITY;
+        if (n >= 0) {
+            while (cap - text->len <= (size_t)n) cap *= 2;
+        }
+        char *grown = realloc(text->data, cap);
+        if (!grown) {
+            text->failed = true;
+            return;
+        }
+        text->data = grown;
+        text->cap = cap;
+    }
+}
+
+void metrics_text_header(metrics_text_t *text, const char *name, const char *type,
+                         const char *help) {
+    metrics_text_printf(text, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+ * @brief 以 Prometheus histogram 格式写出快照。
+ *
+ * 桶为上闭区间，2 的幂边界恰好落在桶的上界上，因此每个 le 的累计值是精确的。
+ * 调用者负责在同名指标的第一组标签之前写出 HELP/TYPE。
+ */
+void metrics_text_histogram(metrics_text_t *text, const char *name, const char *labels,
+                            const metrics_snapshot_t *snap, unsigned min_shift,
+                            unsigned max_shift, double scale) {
+    const char *sep = labels ? "," : "";
+    if (!labels) labels = "";
+
+    uint64_t cumulative = 0;
+    unsigned bucket = 0;
+    for (unsigned shift = min_shift; shift <= max_shift; shift++) {
+        uint64_t bound = (uint64_t)1 << shift;
+        while (bucket < METRICS_HIST_BUCKETS && metrics_bucket_upper(bucket) <= bound) {
+            cumulative += snap->buckets[bucket++];
+        }
+        metrics_text_printf(text, "%s_bucket{%s%sle=\"%.9g\"} %llu\n", name, labels, sep,
+                            (double)bound * scale, (unsigned long long)cumulative);
+    }
+
+    metrics_text_printf(text, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep,
+                        (unsigned long long)snap->count);
+    if (*labels) {
+        metrics_text_printf(text, "%s_sum{%s} %.9g\n%s_count{%s} %llu\n", name, labels,
+                            (double)snap->sum * scale, name, labels,
+                            (unsigned long long)snap->count);
+    } else {
+        metrics_text_printf(text, "%s_sum %.9g\n%s_count %llu\n", name,
+                            (double)snap->sum * scale, name, (unsigned long long)snap->count);
+    }
+}
@@ -0,0 +1,395 @@
+/**
+ * @file msgpack.c
+ * @brief 二进制信令子协议使用的 MessagePack 编解码：与 jansson 的 JSON 值互相转换，
+ *        以及中继路径上不解码、只定位字段的读取函数。
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include "../include/msgpack.h"
+
+/* 解码后的一个头部 */
+typedef enum {
+    MP_NIL, MP_BOOL, MP_UINT, MP_INT, MP_FLOAT, MP_STR, MP_BIN, MP_ARRAY, MP_MAP, MP_EXT
+} mp_kind_t;
+
+typedef struct mp_token_s {
+    mp_kind_t kind;
+    uint64_t u;                    /* MP_UINT / MP_BOOL */
+    int64_t i;                     /* MP_INT */
+    double d;                      /* MP_FLOAT */
+    size_t len;                    /* 字符串/二进制/扩展的字节数，数组/map 的元素数 */
+    const unsigned char *data;     /* 字符串/二进制/扩展的内容 */
+} mp_token_t;
+
+static int read_be(msgpack_reader_t *r, size_t n, uint64_t *out) {
+    if ((size_t)(r->end - r->p) < n) return -1;
+
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; i++) {
+        v = (v << 8) | r->p[i];
+    }
+    r->p += n;
+    *out = v;
+    return 0;
+}
+
+/* 读取长度字段后的负载字节 */
+static int read_payload(msgpack_reader_t *r, mp_token_t *t, size_t len_bytes) {
+    uint64_t len;
+    if (read_be(r, len_bytes, &len) != 0 || len > (uint64_t)(r->end - r->p)) return -1;
+
+    t->len = (size_t)len;
+    t->data = r->p;
+    r->p += t->len;
+    return 0;
+}
+
+/* 读取容器的元素数，每个元素至少占一个字节，据此拒绝虚报的数量 */
+static int read_count(msgpack_reader_t *r, mp_token_t *t, size_t len_bytes, size_t per_item) {
+    uint64_t count;
+    if (read_be(r, len_bytes, &count) != 0) return -1;
+    if (count > (uint64_t)(r->end - r->p) / per_item) return -1;
+
+    t->len = (size_t)count;
+    return 0;
+}
+
+static int read_token(msgpack_reader_t *r, mp_token_t *t) {
+    if (r->p >= r->end) return -1;
+
+    unsigned char c = *r->p++;
+    uint64_t v;
+
+    if (c <= 0x7f) { t->kind = MP_UINT; t->u = c; return 0; }
+    if (c >= 0xe0) { t->kind = MP_INT; t->i = (int8_t)c; return 0; }
+    if ((c & 0xf0) == 0x80) { t->kind = MP_MAP; t->len = c & 0x0f; return 0; }
+    if ((c & 0xf0) == 0x90) { t->kind = MP_ARRAY; t->len = c & 0x0f; return 0; }
+    if ((c & 0xe0) == 0xa0) {
+        t->kind = MP_STR;
+        t->len = c & 0x1f;
+        if (t->len > (size_t)(r->end - r->p)) return -1;
+        t->data = r->p;
+        r->p += t->len;
+        return 0;
+    }
+
+    switch (c) {
+        case 0xc0: t->kind = MP_NIL; return 0;
+        case 0xc2: t->kind = MP_BOOL; t->u = 0; return 0;
+        case 0xc3: t->kind = MP_BOOL; t->u = 1; return 0;
+        case 0xc4: t->kind = MP_BIN; return read_payload(r, t, 1);
+        case 0xc5: t->kind = MP_BIN; return read_payload(r, t, 2);
+        case 0xc6: t->kind = MP_BIN; return read_payload(r, t, 4);
+        case 0xc7: case 0xc8: case 0xc9: {
+            /* ext 8/16/32：长度之后还有一个类型字节 */
+            uint64_t len;
+            if (read_be(r, (size_t)1 << (c - 0xc7), &len) != 0) return -1;
+            if ((uint64_t)(r->end - r->p) < len + 1) return -1;
+            t->kind = MP_EXT;
+            t->len = (size_t)len + 1;
+            t->data = r->p;
+            r->p += t->len;
+            return 0;
+        }
+        case 0xca: {
+            if (read_be(r, 4, &v) != 0) return -1;
+            uint32_t bits = (uint32_t)v;
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            t->kind = MP_FLOAT;
+            t->d = f;
+            return 0;
+        }
+        case 0xcb:
+            if (read_be(r, 8, &v) != 0) return -1;
+            t->kind = MP_FLOAT;
+            memcpy(&t->d, &v, sizeof(t->d));
+            return 0;
+        case 0xcc: case 0xcd: case 0xce: case 0xcf:
+            t->kind = MP_UINT;
+            return read_be(r, (size_t)1 << (c - 0xcc), &t->u);
+        case 0xd0: case 0xd1: case 0xd2: case 0xd3: {
+            size_t n = (size_t)1 << (c - 0xd0);
+            if (read_be(r, n, &v) != 0) return -1;
+            /* 按宽度符号扩展 */
+            if (n < 8 && (v & ((uint64_t)1 << (n * 8 - 1)))) {
+                v |= ~(uint64_t)0 << (n * 8);
+            }
+            t->kind = MP_INT;
+            t->i = (int64_t)v;
+            return 0;
+        }
+        case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8: {
+            /* fixext：一个类型字节加 1/2/4/8/16 字节数据 */
+            size_t len = ((size_t)1 << (c - 0xd4)) + 1;
+            if ((size_t)(r->end - r->p) < len) return -1;
+            t->kind = MP_EXT;
+            t->len = len;
+            t->data = r->p;
+            r->p += len;
+            return 0;
+        }
+        case 0xd9: t->kind = MP_STR; return read_payload(r, t, 1);
+        case 0xda: t->kind = MP_STR; return read_payload(r, t, 2);
+        case 0xdb: t->kind = MP_STR; return read_payload(r, t, 4);
+        case 0xdc: t->kind = MP_ARRAY; return read_count(r, t, 2, 1);
+        case 0xdd: t->kind = MP_ARRAY; return read_count(r, t, 4, 1);
+        case 0xde: t->kind = MP_MAP; return read_count(r, t, 2, 2);
+        case 0xdf: t->kind = MP_MAP; return read_count(r, t, 4, 2);
+        default:
+            /* 0xc1 未定义 */
+            return -1;
+    }
+}
+
+int msgpack_read_str(msgpack_reader_t *r, const char **str, size_t *len) {
+    msgpack_reader_t save = *r;
+    mp_token_t t;
+
+    if (read_token(r, &t) != 0 || t.kind != MP_STR) {
+        *r = save;
+        return -1;
+    }
+    *str = (const char *)t.data;
+    *len = t.len;
+    return 0;
+}
+
+int msgpack_read_map(msgpack_reader_t *r, size_t *count) {
+    msgpack_reader_t save = *r;
+    mp_token_t t;
+
+    if (read_token(r, &t) != 0 || t.kind != MP_MAP) {
+        *r = save;
+        return -1;
+    }
+    *count = t.len;
+    return 0;
+}
+
+static int skip_value(msgpack_reader_t *r, int depth) {
+    mp_token_t t;
+    if (depth > MSGPACK_MAX_DEPTH || read_token(r, &t) != 0) return -1;
+
+    size_t items = t.kind == MP_ARRAY ? t.len : t.kind == MP_MAP ? t.len * 2 : 0;
+    for (size_t i = 0; i < items; i++) {
+        if (skip_value(r, depth + 1) != 0) return -1;
+    }
+    return 0;
+}
+
+int msgpack_skip(msgpack_reader_t *r) {
+    return skip_value(r, 0);
+}
+
+static json_t *read_json(msgpack_reader_t *r, int depth);
+
+static json_t *read_json_map(msgpack_reader_t *r, size_t count, int depth) {
+    json_t *object = json_object();
+    if (!object) return NULL;
+
+    char small[128];
+    for (size_t i = 0; i < count; i++) {
+        const char *key;
+        size_t key_len;
+        if (msgpack_read_str(r, &key, &key_len) != 0 || memchr(key, '\0', key_len)) goto fail;
+
+        /* jansson 的键需要以 NUL 结尾 */
+        char *copy = key_len < sizeof(small) ? small : malloc(key_len + 1);
+        if (!copy) goto fail;
+        memcpy(copy, key, key_len);
+        copy[key_len] = '\0';
+
+        json_t *value = read_json(r, depth + 1);
+        int ret = value ? json_object_set_new(object, copy, value) : -1;
+        if (copy != small) free(copy);
+        if (ret != 0) goto fail;
+    }
+    return object;
+
+fail:
+    json_decref(object);
+    return NULL;
+}
+
+static json_t *read_json(msgpack_reader_t *r, int depth) {
+    mp_token_t t;
+    if (depth > MSGPACK_MAX_DEPTH || read_token(r, &t) != 0) return NULL;
+
+    switch (t.kind) {
+        case MP_NIL:   return json_null();
+        case MP_BOOL:  return json_boolean(t.u);
+        case MP_UINT:
+            /* 超出 json_int_t 的无符号整数只能用浮点数表示 */
+            return t.u <= (uint64_t)LLONG_MAX ? json_integer((json_int_t)t.u)
+                                              : json_real((double)t.u);
+        case MP_INT:   return json_integer((json_int_t)t.i);
+        case MP_FLOAT: return json_real(t.d);
+        case MP_STR:   return json_stringn((const char *)t.data, t.len);
+        case MP_ARRAY: {
+            json_t *array = json_array();
+            for (size_t i = 0; array && i < t.len; i++) {
+                json_t *item = read_json(r, depth + 1);
+                if (!item || json_array_append_new(array, item) != 0) {
+                    json_decref(array);
+                    return NULL;
+                }
+            }
+            return array;
+        }
+        case MP_MAP:
+            return read_json_map(r, t.len, depth);
+        default:
+            return NULL;
+    }
+}
+
+json_t *msgpack_read_json(msgpack_reader_t *r) {
+    msgpack_reader_t save = *r;
+
+    json_t *value = read_json(r, 0);
+    if (!value) *r = save;
+    return value;
+}
+
+static unsigned char *write_be(unsigned char *p, unsigned char tag, uint64_t v, size_t n) {
+    *p++ = tag;
+    for (size_t i = n; i-- > 0;) {
+        *p++ = (unsigned char)(v >> (i * 8));
+    }
+    return p;
+}
+
+size_t msgpack_str_size(size_t len) {
+    return len + (len < 32 ? 1 : len < 0x100 ? 2 : len < 0x10000 ? 3 : 5);
+}
+
+size_t msgpack_map_size(size_t count) {
+    return count < 16 ? 1 : count < 0x10000 ? 3 : 5;
+}
+
+/* 数组头与 map 头的长度规则相同 */
+size_t msgpack_array_size(size_t count) {
+    return msgpack_map_size(count);
+}
+
+unsigned char *msgpack_write_str(unsigned char *p, const char *str, size_t len) {
+    if (len < 32) *p++ = (unsigned char)(0xa0 | len);
+    else if (len < 0x100) p = write_be(p, 0xd9, len, 1);
+    else if (len < 0x10000) p = write_be(p, 0xda, len, 2);
+    else p = write_be(p, 0xdb, len, 4);
+
+    memcpy(p, str, len);
+    return p + len;
+}
+
+unsigned char *msgpack_write_map(unsigned char *p, size_t count) {
+    if (count < 16) {
+        *p++ = (unsigned char)(0x80 | count);
+        return p;
+    }
+    return count < 0x10000 ? write_be(p, 0xde, count, 2) : write_be(p, 0xdf, count, 4);
+}
+
+unsigned char *msgpack_write_array(unsigned char *p, size_t count) {
+    if (count < 16) {
+        *p++ = (unsigned char)(0x90 | count);
+        return p;
+    }
+    return count < 0x10000 ? write_be(p, 0xdc, count, 2) : write_be(p, 0xdd, count, 4);
+}
+
+static size_t int_size(json_int_t v) {
+    if (v >= 0) {
+        return v < 0x80 ? 1 : v < 0x100 ? 2 : v < 0x10000 ? 3 : v <= 0xffffffffLL ? 5 : 9;
+    }
+    return v >= -32 ? 1 : v >= INT8_MIN ? 2 : v >= INT16_MIN ? 3 : v >= INT32_MIN ? 5 : 9;
+}
+
+static unsigned char *write_int(unsigned char *p, json_int_t v) {
+    switch (int_size(v)) {
+        case 1: *p++ = (unsigned char)v; return p;
+        case 2: return write_be(p, v >= 0 ? 0xcc : 0xd0, (uint64_t)v, 1);
+        case 3: return write_be(p, v >= 0 ? 0xcd : 0xd1, (uint64_t)v, 2);
+        case 5: return write_be(p, v >= 0 ? 0xce : 0xd2, (uint64_t)v, 4);
+        default: return write_be(p, 0xd3, (uint64_t)v, 8);
+    }
+}
+
+size_t msgpack_json_size(const json_t *value) {
+    /* jansson 的迭代接口不接受 const */
+    json_t *v = (json_t *)value;
+
+    switch (json_typeof(v)) {
+        case JSON_OBJECT: {
+            size_t size = msgpack_map_size(json_object_size(v));
+            const char *key;
+            json_t *item;
+            json_object_foreach(v, key, item) {
+                size_t item_size = msgpack_json_size(item);
+                if (item_size == 0) return 0;
+                size += msgpack_str_size(strlen(key)) + item_size;
+            }
+            return size;
+        }
+        case JSON_ARRAY: {
+            size_t count = json_array_size(v);
+            size_t size = msgpack_array_size(count);
+            for (size_t i = 0; i < count; i++) {
+                size_t item_size = msgpack_json_size(json_array_get(v, i));
+                if (item_size == 0) return 0;
+                size += item_size;
+            }
+            return size;
+        }
+        case JSON_STRING:  return msgpack_str_size(json_string_length(v));
+        case JSON_INTEGER: return int_size(json_integer_value(v));
+        case JSON_REAL:    return 9;
+        case JSON_TRUE:
+        case JSON_FALSE:
+        case JSON_NULL:    return 1;
+        default:           return 0;
+    }
+}
+
+unsigned char *msgpack_write_json(unsigned char *p, const json_t *value) {
+    json_t *v = (json_t *)value;
+
+    switch (json_typeof(v)) {
+        case JSON_OBJECT: {
+            p = msgpack_write_map(p, json_object_size(v));
+            const char *key;
+            json_t *item;
+            json_object_foreach(v, key, item) {
+                p = msgpack_write_str(p, key, strlen(key));
+                p = msgpack_write_json(p, item);
+            }
+            return p;
+        }
+        case JSON_ARRAY: {
+            size_t count = json_array_size(v);
+            p = msgpack_write_array(p, count);
+            for (size_t i = 0; i < count; i++) {
+                p = msgpack_write_json(p, json_array_get(v, i));
+            }
+            return p;
+        }
+        case JSON_STRING:
+            return msgpack_write_str(p, json_string_value(v), json_string_length(v));
+        case JSON_INTEGER:
+            return write_int(p, json_integer_value(v));
+        case JSON_REAL: {
+            double d = json_real_value(v);
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            return write_be(p, 0xcb, bits, 8);
+        }
+        case JSON_TRUE:  *p++ = 0xc3; return p;
+        case JSON_FALSE: *p++ = 0xc2; return p;
+        default:         *p++ = 0xc0; return p;
+    }
+}
@@ -4,18 +4,49 @@
 #include <jansson.h>
 
 #include "../include/room.h"
+#include "../include/logger.h"
 #include "../include/client.h"
 #include "../include/messages.h"
 #include "../include/utilities.h"
 
-void room_init(room_t *room, const char *name, client_t *owner) {
+/*
+ * Frames addressed to detached members, in send order. Entry seq % capacity
+ * holds frame number seq; a detached member replays the entries for it from
+ * the seq at which it detached.
+ */
+typedef struct room_replay_entry_s {
+    frame_t *frame;
+    const client_t *target;
+    uint32_t seq;
+} room_replay_entry_t;
+
+typedef struct room_replay_s {
+    uint32_t next_seq;             /* Sequence number of the next recorded frame */
+    room_replay_entry_t entries[ROOM_REPLAY_CAPACITY];
+} room_replay_t;
+
+/* Release the replay ring and the frames it still holds */
+static void room_replay_free(room_t *room) {
+    room_replay_t *replay = room->replay;
+    if (!replay) return;
+    
+    room->replay = NULL;
+    for (size_t i = 0; i < ROOM_REPLAY_CAPACITY; i++) {
+        if (replay->entries[i].frame) {
+            frame_unref(replay->entries[i].frame);
+        }
+    }
+    memory_pool_free(replay);
+}
+
+void room_init(room_t *room, const char *name, client_t *owner, uint16_t capacity) {
     if (!room) return;
     
     /* Zero the entire structure */
     memset(room, 0, sizeof(room_t));
     
     /* Generate unique room ID */
-    generate_uuid(room->id, sizeof(room->id));
+    id128_generate(&room->id);
     
     /* Copy room name safely */
     if (name) {
@@ -24,39 +55,85 @@ void room_init(room_t *room, const char *name, client_t *owner) {
         safe_strncpy(room->name, "Unnamed Room", sizeof(room->name));
     }
     
-    /* Set initial state */
+    /* Set initial state; participants start in the inline slots */
     room->state = ROOM_STATE_ACTIVE;
-    room->created_at = get_timestamp_sec();
+    room->created_at = coarse_clock_sec();
     room->last_activity = room->created_at;
-    room->owner = owner;
+    room->capacity = capacity ? capacity : MAX_PARTICIPANTS;
+    room->slot_capacity = ROOM_INLINE_SLOTS;
     
-    /* Add owner as first participant if provided */
+    /* Add owner as first participant (slot 0) if provided */
     if (owner) {
         room_add_participant(room, owner);
     }
     
-    printf("Room initialized: %s (%s)\n", room->id, room->name);
+    LOG_DEBUG("Room initialized: %s", room->name);
+}
+
+/* Drop the cached snapshot; called whenever membership changes */
+static void room_invalidate_snapshot(room_t *room) {
+    if (room->snapshot) {
+        frame_unref(room->snapshot);
+        room->snapshot = NULL;
+    }
+}
+
+/* Drop a member's index entry, unless the ID already routes to someone else */
+static void room_unindex_member(room_t *room, client_t *client) {
+    if (room->members && id_table_find(room->members, &client->id) == client) {
+        id_table_remove(room->members, &client->id);
+    }
 }
 
 void room_cleanup(room_t *room) {
     if (!room) return;
     
-    /* Only print cleanup message if it's not a mass cleanup */
+    /* Only log cleanup if it's not a mass cleanup */
     if (room->state == ROOM_STATE_ACTIVE) {
-        printf("Cleaning up room: %s\n", room->id);
+        LOG_DEBUG("Cleaning up room: " LOG_ID_FMT, LOG_ID_ARGS(&room->id));
     }
     
     /* Remove all participants from the room */
-    for (int i = 0; i < MAX_PARTICIPANTS; i++) {
-        if (room->participants[i].client) {
-            room->participants[i].client->room = NULL;
-            room->participants[i].client->state = CLIENT_STATE_CONNECTED;
-        }
+    ROOM_FOREACH_PARTICIPANT(room, client) {
+        room_unindex_member(room, client);
+        client->room = NULL;
+        client->state = CLIENT_STATE_CONNECTED;
     }
     
+    /* Return an out-of-line slot array to its pool */
+    if (room->slot_capacity > ROOM_INLINE_SLOTS) {
+        memory_pool_free(room->slots.heap_slots);
+    }
+    memset(&room->slots, 0, sizeof(room->slots));
+    room->slot_capacity = ROOM_INLINE_SLOTS;
+    room_invalidate_snapshot(room);
+    
+    /* Drop frames still held for detached members */
+    room_replay_free(room);
+    room->detached_count = 0;
+    
     room->participant_count = 0;
     room->state = ROOM_STATE_CLOSING;
-    room->owner = NULL;
+}
+
+/* Grow the slot array (doubling, capped at the room capacity) once it is full */
+static int room_grow_slots(room_t *room) {
+    uint32_t cap = room->slot_capacity * 2u;
+    if (cap < 16) cap = 16;
+    if (cap > room->capacity) cap = room->capacity;
+    
+    client_t **grown = memory_pool_alloc(memory_pool_thread(), cap * sizeof(client_t *));
+    if (!grown) {
+        return -1;
+    }
+    
+    memcpy(grown, room_participants(room), room->participant_count * sizeof(client_t *));
+    if (room->slot_capacity > ROOM_INLINE_SLOTS) {
+        memory_pool_free(room->slots.heap_slots);
+    }
+    room->slots.heap_slots = grown;
+    room->slot_capacity = (uint16_t)cap;
+    return 0;
 }
 
 int room_add_participant(room_t *room, client_t *client) {
@@ -66,45 +143,56 @@ int room_add_participant(room_t *room, client_t *client) {
     
     /* Check if room is full */
     if (room_is_full(room)) {
-        printf("Room %s is full, cannot add client %s\n", room->id, client->id);
+        LOG_DEBUG("Room " LOG_ID_FMT " is full, cannot add client " LOG_ID_FMT,
+                  LOG_ID_ARGS(&room->id), LOG_ID_ARGS(&client->id));
         return -1;
     }
     
-    /* Check if client is already in room */
-    if (room_find_participant(room, client->id) != NULL) {
-        printf("Client %s already in room %s\n", client->id, room->id);
+    /* Check if client is already in room (back-pointer, no slot search) */
+    if (client->room == room) {
+        LOG_DEBUG("Client " LOG_ID_FMT " already in room " LOG_ID_FMT,
+                  LOG_ID_ARGS(&client->id), LOG_ID_ARGS(&room->id));
         return -2;
     }
     
     /* Check if client is already in another room */
     if (client->room != NULL && client->room != room) {
-        printf("Client %s is already in room %s\n", client->id, client->room->id);
+        LOG_RATELIMITED(LOG_LEVEL_WARN, "Client " LOG_ID_FMT " is already in room " LOG_ID_FMT,
+                        LOG_ID_ARGS(&client->id), LOG_ID_ARGS(&client->room->id));
         return -3;
     }
     
-    /* Find empty slot in participants array */
-    for (int i = 0; i < MAX_PARTICIPANTS; i++) {
-        if (room->participants[i].client == NULL) {
-            /* Add client to room */
-            room->participants[i].client = client;
-            room->participants[i].join_time = get_timestamp_sec();
-            room->participants[i].is_owner = (room->owner == client);
-            room->participant_count++;
-            room->last_activity = get_timestamp_sec();
-            
-            /* Update client state */
-            client->room = room;
-            client->state = CLIENT_STATE_IN_ROOM;
-            
-            printf("Client %s added to room %s (participants: %d/%d)\n", 
-                   client->id, room->id, room->participant_count, MAX_PARTICIPANTS);
-            return 0;
-        }
+    /* Spill to (or grow) the out-of-line array when the current slots are used up */
+    if (room->participant_count == room->slot_capacity && room_grow_slots(room) != 0) {
+        LOG_RATELIMITED(LOG_LEVEL_WARN, "Failed to grow participant slots of room " LOG_ID_FMT,
+                        LOG_ID_ARGS(&room->id));
+        return -4;
+    }
+    
+    /* Route the client's ID to it for targeted relays */
+    if (room->members && id_table_insert(room->members, &client->id, client) != 0) {
+        LOG_RATELIMITED(LOG_LEVEL_WARN, "Failed to index client " LOG_ID_FMT " in room " LOG_ID_FMT,
+                        LOG_ID_ARGS(&client->id), LOG_ID_ARGS(&room->id));
+        return -4;
     }
     
-    /* This should never happen if room_is_full check passed */
-    printf("CRITICAL: No empty slot found in room %s\n", room->id);
-    return -4;
+    /* Append the client to the dense participant array */
+    uint16_t slot = room->participant_count++;
+    room_participants(room)[slot] = client;
+    room->last_activity = coarse_clock_sec();
+    room->version++;
+    room_invalidate_snapshot(room);
+    
+    /* Update client state */
+    client->room = room;
+    client->room_slot = slot;
+    client->join_time = room->last_activity;
+    client->state = CLIENT_STATE_IN_ROOM;
+    
+    LOG_DEBUG("Client " LOG_ID_FMT " added to room " LOG_ID_FMT " (participants: %u/%u)",
+              LOG_ID_ARGS(&client->id), LOG_ID_ARGS(&room->id),
+              room->participant_count, room->capacity);
+    return 0;
 }
 
 int room_remove_participant(room_t *room, client_t *client) {
@@ -112,64 +200,112 @@ int room_remove_participant(room_t *room, client_t *client) {
         return -1;
     }
     
-    /* Find and remove client from room */
-    for (int i = 0; i < MAX_PARTICIPANTS; i++) {
-        if (room->participants[i].client == client) {
-            /* Clear participant slot */
-            room->participants[i].client = NULL;
-            room->participants[i].is_owner = false;
-            room->participant_count--;
-            room->last_activity = get_timestamp_sec();
-            
-            /* Update client state */
-            client->room = NULL;
-            client->state = CLIENT_STATE_CONNECTED;
-            
-            printf("Client %s removed from room %s (participants: %d/%d)\n", 
-                   client->id, room->id, room->participant_count, MAX_PARTICIPANTS);
-            
-            /* Handle owner transfer if owner left */
-            if (room->owner == client && room->participant_count > 0) {
-                /* Find first available participant to become new owner */
-                for (int j = 0; j < MAX_PARTICIPANTS; j++) {
-                    if (room->participants[j].client != NULL) {
-                        room->owner = room->participants[j].client;
-                        room->participants[j].is_owner = true;
-                        printf("Transferred room ownership to %s\n", room->owner->id);
-                        break;
-                    }
-                }
-            }
-            
-            return 0;
-        }
+    /* The client records its own slot, so removal needs no search */
+    client_t **slots = room_participants(room);
+    uint16_t slot = client->room_slot;
+    if (client->room != room || slot >= room->participant_count || slots[slot] != client) {
+        LOG_DEBUG("Client " LOG_ID_FMT " not found in room " LOG_ID_FMT,
+                  LOG_ID_ARGS(&client->id), LOG_ID_ARGS(&room->id));
+        return -1;
+    }
+    
+    room_unindex_member(room, client);
+    
+    /* Move the last participant into the vacated slot */
+    uint16_t last = --room->participant_count;
+    if (slot != last) {
+        slots[slot] = slots[last];
+        slots[slot]->room_slot = slot;
+    }
+    slots[last] = NULL;
+    room->last_activity = coarse_clock_sec();
+    room->version++;
+    room_invalidate_snapshot(room);
+    
+    /* Update client state */
+    client->room = NULL;
+    client->state = CLIENT_STATE_CONNECTED;
+    
+    LOG_DEBUG("Client " LOG_ID_FMT " removed from room " LOG_ID_FMT " (participants: %u/%u)",
+              LOG_ID_ARGS(&client->id), LOG_ID_ARGS(&room->id),
+              room->participant_count, room->capacity);
+    
+    /* Slot 0 is the owner: if the owner left, whoever filled the slot takes over */
+    if (slot == 0 && room->participant_count > 0) {
+        LOG_DEBUG("Transferred room ownership to " LOG_ID_FMT, LOG_ID_ARGS(&slots[0]->id));
     }
     
-    printf("Client %s not found in room %s\n", client->id, room->id);
-    return -1;
+    return 0;
+}
+
+int room_replace_participant(room_t *room, client_t *old, client_t *client) {
+    if (!room || !old || !client) {
+        return -1;
+    }
+    
+    client_t **slots = room_participants(room);
+    uint16_t slot = old->room_slot;
+    if (old->room != room || slot >= room->participant_count || slots[slot] != old) {
+        return -1;
+    }
+    
+    /* Same ID, same slot: only the pointer behind both changes */
+    room_unindex_member(room, old);
+    if (room->members) {
+        id_table_insert(room->members, &client->id, client);
+    }
+    slots[slot] = client;
+    client->room = room;
+    client->room_slot = slot;
+    old->room = NULL;
+    return 0;
 }
 
 bool room_is_full(const room_t *room) {
-    return room && room->participant_count >= MAX_PARTICIPANTS;
+    return room && room->participant_count >= room->capacity;
 }
 
 bool room_is_empty(const room_t *room) {
     return room && room->participant_count == 0;
 }
 
-client_t *room_find_participant(const room_t *room, const char *client_id) {
-    if (!room || !client_id) {
+client_t *room_find_participant(const room_t *room, const id128_t *client_id) {
+    if (!room || !client_id || !room->members) {
         return NULL;
     }
     
-    for (int i = 0; i < MAX_PARTICIPANTS; i++) {
-        if (room->participants[i].client != NULL && 
-            strcmp(room->participants[i].client->id, client_id) == 0) {
-            return room->participants[i].client;
-        }
+    /* One probe in the registry-wide index, then make sure the member is in this room */
+    client_t *client = id_table_find(room->members, client_id);
+    return client && client->room == room ? client : NULL;
+}
+
+frame_t *room_snapshot_frame(room_t *room) {
+    if (!room) {
+        return NULL;
+    }
+    
+    if (room->snapshot) {
+        return room->snapshot;
+    }
+    
+    char id[ID128_STR_LEN];
+    json_t *participants = json_array();
+    ROOM_FOREACH_PARTICIPANT(room, client) {
+        id128_format(&client->id, id);
+        json_array_append_new(participants, json_string(id));
     }
     
-    return NULL;
+    id128_format(&room->id, id);
+    json_t *data = json_object();
+    json_object_set_new(data, "roomId", json_string(id));
+    json_object_set_new(data, "version", json_integer(room->version));
+    json_object_set_new(data, "capacity", json_integer(room->capacity));
+    json_object_set_new(data, "participants", participants);
+    
+    room->snapshot = frame_create_json(EVENT_PARTICIPANTS_LIST, data);
+    json_decref(data);
+    
+    return room->snapshot;
 }
 
 int room_broadcast_message(room_t *room, client_t *exclude, 
@@ -178,47 +314,143 @@ int room_broadcast_message(room_t *room, client_t *exclude,
         return 0;
     }
     
+    /* Serialize the envelope once and share it with every recipient */
+    frame_t *frame = frame_create(event, data);
+    if (!frame) {
+        return 0;
+    }
+    
+    int sent_count = room_broadcast_frame(room, exclude, frame);
+    frame_unref(frame);
+    
+    return sent_count;
+}
+
+int room_broadcast_frame(room_t *room, client_t *exclude, frame_t *frame) {
+    if (!room || !frame) {
+        return 0;
+    }
+    
     int sent_count = 0;
     
-    /* Send message to all participants except excluded client */
-    for (int i = 0; i < MAX_PARTICIPANTS; i++) {
-        client_t *client = room->participants[i].client;
-        
-        /* Skip if: no client, client is excluded, or client is not alive */
-        if (client == NULL || client == exclude || !client->is_alive) {
+    /* Send frame to all participants except excluded client */
+    ROOM_FOREACH_PARTICIPANT(room, client) {
+        /* Skip if: client is excluded, or client is not alive */
+        if (client == exclude || !client->is_alive) {
             continue;
         }
         
-        /* Send message and count successful sends */
-        if (client_send_message(client, event, data) > 0) {
+        /* Queue frame (or hold it for a detached member) and count successes */
+        if (room_send_frame(client, frame) == 0) {
             sent_count++;
         }
     }
     
     /* Update room activity timestamp */
-    room->last_activity = get_timestamp_sec();
+    room->last_activity = coarse_clock_sec();
     
     return sent_count;
 }
 
+int room_send_frame(client_t *client, frame_t *frame) {
+    room_t *room = client->room;
+    if (!client->detached || !room || !room->replay) {
+        return client_send_frame(client, frame);
+    }
+    
+    /* Overwrite the oldest entry once the ring is full */
+    room_replay_t *replay = room->replay;
+    room_replay_entry_t *entry = &replay->entries[replay->next_seq % ROOM_REPLAY_CAPACITY];
+    if (entry->frame) {
+        frame_unref(entry->frame);
+    }
+    frame_ref(frame);
+    entry->frame = frame;
+    entry->target = client;
+    entry->seq = replay->next_seq++;
+    return 0;
+}
+
+int room_replay_begin(room_t *room, client_t *client) {
+    if (!room->replay) {
+        room->replay = memory_pool_alloc(memory_pool_thread(), sizeof(room_replay_t));
+        if (!room->replay) {
+            return -1;
+        }
+        memset(room->replay, 0, sizeof(room_replay_t));
+    }
+    
+    room->detached_count++;
+    client->replay_seq = room->replay->next_seq;
+    return 0;
+}
+
+size_t room_replay_collect(room_t *room, const client_t *client, frame_t **frames,
+                           bool *complete) {
+    room_replay_t *replay = room->replay;
+    size_t count = 0;
+    
+    *complete = true;
+    if (!replay) {
+        return 0;
+    }
+    
+    /* Frames older than the ring's oldest entry were overwritten */
+    uint32_t oldest = replay->next_seq > ROOM_REPLAY_CAPACITY
+                    ? replay->next_seq - ROOM_REPLAY_CAPACITY : 0;
+    uint32_t seq = client->replay_seq;
+    if (seq < oldest) {
+        *complete = false;
+        seq = oldest;
+    }
+    
+    for (; seq < replay->next_seq; seq++) {
+        room_replay_entry_t *entry = &replay->entries[seq % ROOM_REPLAY_CAPACITY];
+        if (entry->target == client && entry->seq == seq) {
+            frame_ref(entry->frame);
+            frames[count++] = entry->frame;
+        }
+    }
+    return count;
+}
+
+void room_replay_end(room_t *room) {
+    if (room->detached_count > 0 && --room->detached_count == 0) {
+        room_replay_free(room);
+    }
+}
+
 int room_registry_init(room_registry_t *reg, size_t max_rooms) {
     if (!reg || max_rooms == 0) {
         return -1;
     }
     
-    /* Allocate room array */
-    reg->rooms = calloc(max_rooms, sizeof(room_t));
-    if (!reg->rooms) {
-        fprintf(stderr, "Failed to allocate room registry: %zu rooms\n", max_rooms);
+    /* Reserve the room slots and the active list; pages are committed as rooms are created */
+    reg->active_slots = vm_reserve(max_rooms * sizeof(uint32_t));
+    if (slot_region_init(&reg->slots, sizeof(room_t), max_rooms, SLOT_REGION_NONE) != 0 ||
+        !reg->active_slots ||
+        vm_commit(reg->active_slots, max_rooms * sizeof(uint32_t), false) != 0 ||
+        id_table_init(&reg->by_id, max_rooms) != 0) {
+        LOG_ERROR("Failed to allocate room registry: %zu rooms", max_rooms);
+        slot_region_cleanup(&reg->slots);
+        vm_unreserve(reg->active_slots, max_rooms * sizeof(uint32_t));
+        reg->rooms = NULL;
+        reg->active_slots = NULL;
         return -1;
     }
+    reg->rooms = (room_t *)reg->slots.base;
     
     /* Initialize registry state */
     reg->max_rooms = max_rooms;
     reg->active_rooms = 0;
     reg->total_rooms_created = 0;
+    reg->shard = 0;
+    reg->max_capacity = MAX_PARTICIPANTS;
+    reg->accept_id = NULL;
+    reg->accept_id_arg = NULL;
+    memset(&reg->members, 0, sizeof(reg->members));
     
-    printf("Room registry initialized: %zu max rooms\n", max_rooms);
+    LOG_INFO("Room registry initialized: %zu max rooms", max_rooms);
     return 0;
 }
 
@@ -227,111 +459,177 @@ void room_registry_cleanup(room_registry_t *reg) {
     
     /* Clean up all active rooms */
     if (reg->rooms) {
-        /* Mark all rooms as closing first to prevent individual cleanup messages */
-        for (size_t i = 0; i < reg->max_rooms; i++) {
-            if (reg->rooms[i].state == ROOM_STATE_ACTIVE) {
-                reg->rooms[i].state = ROOM_STATE_CLOSING;
-            }
-        }
-        
-        /* Now clean up all rooms */
-        for (size_t i = 0; i < reg->max_rooms; i++) {
-            if (reg->rooms[i].state == ROOM_STATE_CLOSING) {
-                room_cleanup(&reg->rooms[i]);
-            }
+        /* Mark rooms as closing first to prevent individual cleanup messages */
+        for (size_t i = 0; i < reg->active_rooms; i++) {
+            room_t *room = &reg->rooms[reg->active_slots[i]];
+            room->state = ROOM_STATE_CLOSING;
+            room_cleanup(room);
         }
         
-        /* Free the room array */
-        free(reg->rooms);
+        /* Release the room slots */
+        slot_region_cleanup(&reg->slots);
         reg->rooms = NULL;
     }
     
+    vm_unreserve(reg->active_slots, reg->max_rooms * sizeof(uint32_t));
+    reg->active_slots = NULL;
+    id_table_cleanup(&reg->by_id);
+    id_table_cleanup(&reg->members);
     reg->max_rooms = 0;
     reg->active_rooms = 0;
     reg->total_rooms_created = 0;
 }
 
-room_t *room_registry_create(room_registry_t *reg, const char *name, client_t *owner) {
+int room_registry_index_members(room_registry_t *reg, size_t max_members) {
+    if (!reg || reg->active_rooms > 0 || max_members == 0) {
+        return -1;
+    }
+    
+    id_table_cleanup(&reg->members);
+    if (id_table_init(&reg->members, max_members) != 0) {
+        LOG_ERROR("Failed to allocate room member index: %zu members", max_members);
+        return -1;
+    }
+    return 0;
+}
+
+room_t *room_registry_create(room_registry_t *reg, const char *name, client_t *owner,
+                             uint16_t capacity) {
     if (!reg || !reg->rooms || !name) {
         return NULL;
     }
     
-    /* Find first available room slot */
-    for (size_t i = 0; i < reg->max_rooms; i++) {
-        if (reg->rooms[i].state != ROOM_STATE_ACTIVE) {
-            /* Initialize the room */
-            room_init(&reg->rooms[i], name, owner);
-            reg->active_rooms++;
-            reg->total_rooms_created++;
-            
-            printf("Room created in registry: %s (active: %zu/%zu)\n", 
-                   reg->rooms[i].id, reg->active_rooms, reg->max_rooms);
-            return &reg->rooms[i];
-        }
+    /* Default to the classic mesh size; never exceed the registry's limit */
+    if (capacity == 0) capacity = MAX_PARTICIPANTS;
+    if (capacity > reg->max_capacity) capacity = reg->max_capacity;
+    
+    /* Take a free slot from the lowest chunk that has one */
+    uint32_t index;
+    room_t *room = slot_region_alloc(&reg->slots, &index);
+    if (!room) {
+        LOG_RATELIMITED(LOG_LEVEL_WARN, "Room registry full: %zu/%zu rooms",
+                        reg->active_rooms, reg->max_rooms);
+        return NULL;
+    }
+    
+    /* Initialize the room and append it to the active list; the owner joins once the
+     * room can reach the member index */
+    room_init(room, name, NULL, capacity);
+    room->members = reg->members.entries ? &reg->members : NULL;
+    if (owner) {
+        room_add_participant(room, owner);
+    }
+    
+    /* Tag the ID with the owning shard; regenerate until the filter accepts it (in
+     * cluster mode, until it hashes to this node) and on the unlikely collision */
+    id128_set_shard(&room->id, reg->shard);
+    while ((reg->accept_id && !reg->accept_id(reg->accept_id_arg, &room->id)) ||
+           id_table_insert(&reg->by_id, &room->id, room) == -2) {
+        id128_generate(&room->id);
+        id128_set_shard(&room->id, reg->shard);
     }
     
-    printf("Room registry full: %zu/%zu rooms\n", reg->active_rooms, reg->max_rooms);
-    return NULL;
+    room->active_pos = (uint32_t)reg->active_rooms;
+    reg->active_slots[reg->active_rooms++] = index;
+    reg->total_rooms_created++;
+    
+    LOG_DEBUG("Room created in registry: " LOG_ID_FMT " (active: %zu/%zu)",
+              LOG_ID_ARGS(&room->id), reg->active_rooms, reg->max_rooms);
+    return room;
 }
 
-room_t *room_registry_find_by_id(room_registry_t *reg, const char *room_id) {
-    if (!reg || !reg->rooms || !room_id) {
+room_t *room_registry_restore(room_registry_t *reg, const id128_t *room_id, const char *name,
+                              uint16_t capacity, uint32_t created_at, uint32_t reserved_until) {
+    if (!reg || !reg->rooms || !room_id || !name) {
+        return NULL;
+    }
+    if (id_table_find(&reg->by_id, room_id)) {
         return NULL;
     }
     
-    /* Linear search for room by ID */
-    for (size_t i = 0; i < reg->max_rooms; i++) {
-        if (reg->rooms[i].state == ROOM_STATE_ACTIVE && 
-            strcmp(reg->rooms[i].id, room_id) == 0) {
-            return &reg->rooms[i];
-        }
+    if (capacity == 0) capacity = MAX_PARTICIPANTS;
+    if (capacity > reg->max_capacity) capacity = reg->max_capacity;
+    
+    uint32_t index;
+    room_t *room = slot_region_alloc(&reg->slots, &index);
+    if (!room) {
+        return NULL;
     }
     
-    return NULL;
-}
-
-room_t *room_registry_find_by_client(room_registry_t *reg, const client_t *client) {
-    if (!reg || !reg->rooms || !client) {
+    /* Same state as a fresh room, but keep the identity clients already know */
+    room_init(room, name, NULL, capacity);
+    room->members = reg->members.entries ? &reg->members : NULL;
+    room->id = *room_id;
+    room->created_at = created_at;
+    room->reserved_until = reserved_until;
+    if (id_table_insert(&reg->by_id, &room->id, room) != 0) {
+        room_cleanup(room);
+        slot_region_free(&reg->slots, index);
         return NULL;
     }
     
-    /* Search all rooms for this client */
-    for (size_t i = 0; i < reg->max_rooms; i++) {
-        if (reg->rooms[i].state == ROOM_STATE_ACTIVE) {
-            for (int j = 0; j < MAX_PARTICIPANTS; j++) {
-                if (reg->rooms[i].participants[j].client == client) {
-                    return &reg->rooms[i];
-                }
-            }
-        }
+    room->active_pos = (uint32_t)reg->active_rooms;
+    reg->active_slots[reg->active_rooms++] = index;
+    reg->total_rooms_created++;
+    return room;
+}
+
+/* Swap-remove a room from the active list and return its slot to the region */
+static void room_registry_release(room_registry_t *reg, room_t *room) {
+    uint32_t index = (uint32_t)(room - reg->rooms);
+    uint32_t last = reg->active_slots[--reg->active_rooms];
+    
+    reg->active_slots[room->active_pos] = last;
+    reg->rooms[last].active_pos = room->active_pos;
+    id_table_remove(&reg->by_id, &room->id);
+    slot_region_free(&reg->slots, index);
+}
+
+room_t *room_registry_find_by_id(room_registry_t *reg, const id128_t *room_id) {
+    if (!reg || !reg->rooms || !room_id) {
+        return NULL;
     }
     
-    return NULL;
+    return id_table_find(&reg->by_id, room_id);
 }
 
 void room_registry_remove_empty_rooms(room_registry_t *reg) {
     if (!reg || !reg->rooms) return;
     
     size_t removed_count = 0;
+    uint32_t now = coarse_clock_sec();
     
-    /* Find and remove empty rooms */
-    for (size_t i = 0; i < reg->max_rooms; i++) {
-        if (reg->rooms[i].state == ROOM_STATE_ACTIVE && 
-            room_is_empty(&reg->rooms[i])) {
-            
+    /* Walk the active list backwards so swap-removal is safe */
+    for (size_t i = reg->active_rooms; i-- > 0; ) {
+        room_t *room = &reg->rooms[reg->active_slots[i]];
+        if (room_is_empty(room) && room->reserved_until <= now) {
             /* Mark room as closing before cleanup to suppress message */
-            reg->rooms[i].state = ROOM_STATE_CLOSING;
-            room_cleanup(&reg->rooms[i]);
-            reg->active_rooms--;
+            room->state = ROOM_STATE_CLOSING;
+            room_cleanup(room);
+            room_registry_release(reg, room);
             removed_count++;
         }
     }
     
-    /* Only print summary if rooms were actually removed during normal operation */
+    /* Only log a summary if rooms were actually removed during normal operation */
     if (removed_count > 0 && reg->active_rooms < reg->max_rooms) {
-        printf("已清理 %zu 个空房间（当前活跃：%zu/%zu）\n", 
-               removed_count, reg->active_rooms, reg->max_rooms);
+        LOG_DEBUG("已清理 %zu 个空房间（当前活跃：%zu/%zu）",
+                  removed_count, reg->active_rooms, reg->max_rooms);
+    }
+}
+
+size_t room_registry_trim(room_registry_t *reg, uint32_t now, uint32_t idle_sec) {
+    if (!reg || !reg->rooms) return 0;
+    
+    size_t released = slot_region_trim(&reg->slots, now, idle_sec);
+    if (released > 0) {
+        /* The tail of the active list past the current count is not needed either */
+        vm_decommit(&reg->active_slots[reg->active_rooms],
+                    (reg->max_rooms - reg->active_rooms) * sizeof(uint32_t));
+        LOG_DEBUG("Released %zu idle room chunks (active: %zu/%zu)",
+                  released, reg->active_rooms, reg->max_rooms);
     }
+    return released;
 }
 
 size_t room_registry_get_active_count(const room_registry_t *reg) {
@@ -3,13 +3,84 @@
 #include <stdio.h>
 #include <signal.h>
 #include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 #include "../include/server.h"
+#include "../include/logger.h"
 #include "../include/utilities.h"
 
+/* 维护定时器周期：推进客户端超时时间轮并刷新粗粒度时钟 */
+#define SERVER_TICK_INTERVAL_SEC 1
+
+/* 每隔多少个维护周期清理一次空房间 */
+#define SERVER_ROOM_SWEEP_TICKS 10
+
+/* 超过建连速率时的关闭码 (RFC 6455 注册的 1013 Try Again Later) */
+#define SERVER_CLOSE_TRY_AGAIN_LATER 1013
+
+/* 监听套接字每次可读时最多接受的连接数，其余留到下一轮，不饿死同线程上的其他连接 */
+#define SERVER_ACCEPT_BATCH 64
+
+/* server-shutdown 提示的最短重连分散窗口 (毫秒) */
+#define SERVER_RESTART_SPREAD_MIN_MS 1000
+
+/* 每个分片内存池的 slab 上限和临时分配区的初始大小 */
+#define SERVER_POOL_MAX_BYTES (64u * 1024 * 1024)
+#define SERVER_ARENA_SIZE (64 * 1024)
+
 /* 全局服务器上下文指针，用于信号处理 */
 static server_context_t *global_ctx = NULL;
 
+/* /metrics 请求的会话数据：渲染好的响应体和已写出的长度 */
+typedef struct metrics_session_s {
+    metrics_text_t body;
+    size_t sent;
+} metrics_session_t;
+
+static int metrics_http_callback(struct lws *wsi, enum lws_callback_reasons reason,
+                                 void *user, void *in, size_t len);
+static int listen_callback(struct lws *wsi, enum lws_callback_reasons reason,
+                           void *user, void *in, size_t len);
+
+/* --metrics 时把 /metrics 交给指标协议的回调处理 (LWSMPRO_CALLBACK 的 origin 为协议名) */
+static const struct lws_http_mount server_metrics_mount = {
+    .mountpoint = "/metrics",
+    .origin = "redrtc-metrics",
+    .origin_protocol = LWSMPRO_CALLBACK,
+    .mountpoint_len = 8,
+};
+
+/* --compress 时提供的扩展；lws 在上下文生命周期内引用此数组 */
+static const struct lws_extension server_extensions[] = {
+    {
+        "permessage-deflate",
+        lws_extension_callback_pm_deflate,
+        "permessage-deflate; client_no_context_takeover; client_max_window_bits"
+    },
+    { NULL, NULL, NULL } /* 终止符 */
+};
+
+/* 序列化一次 JSON 数据并作为共享帧发送给单个客户端 */
+static void send_json_frame(client_t *client, const char *event, json_t *data) {
+    frame_t *frame = frame_create_json(event, data);
+    if (frame) {
+        client_send_frame(client, frame);
+        frame_unref(frame);
+    }
+}
+
+/* 将二进制 ID 格式化为 JSON 字符串 */
+static json_t *json_id(const id128_t *id) {
+    char buffer[ID128_STR_LEN];
+    id128_format(id, buffer);
+    return json_string(buffer);
+}
+
+/* 当前线程负责的分片，在服务线程启动时绑定 */
+static _Thread_local server_shard_t *current_shard = NULL;
+
 /* 信号处理函数，处理服务器关闭信号 */
 static void signal_handler(int sig) {
     if (global_ctx) {
@@ -18,164 +89,1655 @@ static void signal_handler(int sig) {
     }
 }
 
+/* SIGUSR2：请求热重启，实际工作在分片 0 的维护定时器中进行 */
+static void restart_signal_handler(int sig) {
+    (void)sig;
+    if (global_ctx && (global_ctx->cluster || !global_ctx->config.exec_path)) {
+        /* 集群端口和节点身份不能在两个进程之间交接 */
+        static const char msg[] = "忽略 SIGUSR2：集群模式或未配置可执行文件时不支持热重启\n";
+        ssize_t n = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+        (void)n;
+    } else if (global_ctx) {
+        int expected = SERVER_RESTART_NONE;
+        if (atomic_compare_exchange_strong(&global_ctx->restart_phase, &expected,
+                                           SERVER_RESTART_REQUESTED)) {
+            atomic_fetch_add(&global_ctx->restart_gen, 1);
+        }
+    }
+}
+
+/* 把当前线程绑定到分片：之后发往其他分片客户端的帧都会被转交 */
+static void shard_bind_thread(server_shard_t *shard) {
+    current_shard = shard;
+    client_registry_bind_thread(&shard->clients);
+    memory_pool_bind_thread(&shard->pool);
+    memory_arena_bind_thread(&shard->arena);
+}
+
+/* 唤醒目标分片的服务线程；在其下一次处理收件箱之前只唤醒一次 */
+static void shard_wake(server_shard_t *shard) {
+    server_context_t *ctx = shard->server;
+    
+    if (shard == current_shard || !atomic_load_explicit(&ctx->running, memory_order_relaxed)) {
+        return;
+    }
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_exchange_explicit(&shard->wake_pending, true, memory_order_relaxed)) {
+        lws_cancel_service(ctx->lws_context);
+    }
+}
+
+/* 向分片收件箱投递条目 (队列为条目中的消息/帧增加引用) */
+static int shard_push(server_shard_t *shard, const ws_message_t *item) {
+    if (message_queue_push(&shard->inbox, item) != 0) {
+        return -1;
+    }
+    shard_wake(shard);
+    return 0;
+}
+
+/*
+ * 把控制操作压入分片的无锁控制栈 (Treiber 栈，经 client->control_next 链接)。
+ * 消费者一次取走整个栈，因此不存在 ABA 问题；压栈永远不会失败。
+ */
+static void shard_push_control(server_shard_t *shard, client_t *client, client_control_t op) {
+    client->control_op = op;
+    
+    client_t *head = atomic_load_explicit(&shard->control, memory_order_relaxed);
+    do {
+        client->control_next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&shard->control, &head, client,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+    shard_wake(shard);
+}
+
+/* 注册表的 forward 回调：其他线程发往本分片客户端的帧经收件箱转交 */
+static int shard_forward_frame(void *arg, client_t *client, frame_t *frame) {
+    server_shard_t *shard = (server_shard_t*)arg;
+    ws_message_t item = {
+        .kind = WS_MSG_SEND,
+        .handle = client_registry_handle(&shard->clients, client),
+        .frame = frame,
+        .timestamp = current_shard ? current_shard->metrics.dispatch_ns : 0
+    };
+    
+    return shard_push(shard, &item) == 0 ? 0 : -6;
+}
+
+/* 把客户端消息转交给目标分片；转交失败时丢弃消息并撤销 inflight 计数 */
+static void shard_forward_message(server_shard_t *from, server_shard_t *to,
+                                  client_t *client, message_t *msg) {
+    ws_message_t item = { .kind = WS_MSG_CLIENT, .client = client, .message = msg };
+    
+    if (shard_push(to, &item) != 0) {
+        metrics_inc(&from->metrics.errors);
+        atomic_fetch_sub_explicit(&client->inflight, 1, memory_order_release);
+    }
+}
+
+/* 加入房间请求的目标分片：房间 ID 记录了所属分片，新建房间留在当前分片 */
+static unsigned join_target_shard(const server_shard_t *shard, const message_t *msg) {
+    json_t *room_id_json = msg->data ? json_object_get(msg->data, "roomId") : NULL;
+    const char *room_id = room_id_json ? json_string_value(room_id_json) : NULL;
+    id128_t room_key;
+    
+    if (room_id && id128_parse(room_id, &room_key) == 0) {
+        return id128_shard(&room_key) % shard->server->shard_count;
+    }
+    return shard->index;
+}
+
+/* 代理代表其他节点上的连接：它的 origin 记录了连接节点上的有效句柄 */
+static inline bool client_is_proxy(const client_t *client) {
+    return client->origin.handle.generation != 0;
+}
+
+/* 本节点上一个真实连接的位置，随记录发给房间所在节点 */
+static client_origin_t shard_client_origin(const server_context_t *ctx, const client_t *client) {
+    client_origin_t origin = {
+        .id = client->id,
+        .handle = client_registry_handle(client->registry, client),
+        .node = (uint16_t)ctx->cluster->self,
+        .shard = (uint16_t)client->registry->shard,
+        .encoding = client->encoding
+    };
+    return origin;
+}
+
+/* 代理注册表的 forward 回调：发给代理的帧原样发回连接所在节点 */
+static int shard_forward_remote(void *arg, client_t *client, frame_t *frame) {
+    server_shard_t *shard = (server_shard_t*)arg;
+    cluster_record_t rec = { .type = CLUSTER_REC_DELIVER, .origin = client->origin };
+    
+    if (frame->flags & FRAME_FLAG_BINARY) rec.flags |= CLUSTER_REC_FLAG_BINARY;
+    if (frame->flags & FRAME_FLAG_DROPPABLE) rec.flags |= CLUSTER_REC_FLAG_DROPPABLE;
+    
+    return cluster_send(shard->server->cluster, client->origin.node, &rec, frame, NULL) == 0 ? 0 : -6;
+}
+
+/*
+ * 把客户端消息转发给房间所在节点。中继消息直接引用接收时的原始帧；
+ * 其余消息 (加入/离开/列表请求) 很少，重新序列化为 JSON。
+ */
+static int shard_forward_remote_message(server_shard_t *shard, client_t *client, message_t *msg) {
+    server_context_t *ctx = shard->server;
+    cluster_record_t rec = { .type = CLUSTER_REC_CLIENT_MSG, .origin = shard_client_origin(ctx, client) };
+    
+    if (msg->raw) {
+        if (msg->binary) rec.flags |= CLUSTER_REC_FLAG_BINARY;
+        return cluster_send(ctx->cluster, (unsigned)client->cluster_node, &rec, NULL, msg);
+    }
+    
+    char *json = message_serialize(msg);
+    if (!json) return -3;
+    
+    size_t len = strlen(json);
+    frame_t *frame = frame_alloc(len);
+    int ret = -3;
+    if (frame) {
+        memcpy(frame_payload(frame), json, len);
+        ret = cluster_send(ctx->cluster, (unsigned)client->cluster_node, &rec, frame, NULL);
+        frame_unref(frame);
+    }
+    free(json);
+    return ret;
+}
+
+/* 客户端离开远程房间 (或断开)：通知房间所在节点释放代理 */
+static void shard_release_remote(server_shard_t *shard, client_t *client) {
+    server_context_t *ctx = shard->server;
+    cluster_record_t rec = { .type = CLUSTER_REC_RELEASE, .origin = shard_client_origin(ctx, client) };
+    
+    cluster_send(ctx->cluster, (unsigned)client->cluster_node, &rec, NULL, NULL);
+    client->cluster_node = -1;
+}
+
+/*
+ * 集群模式下连接节点上的分派：加入哈希到其他节点的房间时，先离开本地房间，
+ * 再把请求转发给该节点；之后客户端的消息都转发过去，直到离开房间或加入别处的房间。
+ * 返回 true 表示消息已转发。
+ */
+static bool shard_dispatch_remote(server_shard_t *shard, client_t *client, message_t *msg) {
+    cluster_t *cluster = shard->server->cluster;
+    bool join = !msg->raw && msg->type == MESSAGE_EVENT_JOIN_ROOM;
+    
+    if (join) {
+        json_t *room_id_json = msg->data ? json_object_get(msg->data, "roomId") : NULL;
+        const char *room_id = room_id_json ? json_string_value(room_id_json) : NULL;
+        id128_t room_key;
+        
+        /* 新建房间和本节点的房间在本地处理 (handle_join_room 会先离开远程房间) */
+        if (!room_id || id128_parse(room_id, &room_key) != 0 || cluster_is_local(cluster, &room_key)) {
+            return false;
+        }
+        
+        /* 换到同一节点上的另一个房间时由该节点处理离开 */
+        int node = (int)cluster_owner(cluster, &room_key);
+        if (node != client->cluster_node) {
+            handle_leave_room(shard, client);
+            client->cluster_node = (int16_t)node;
+        }
+    } else if (client->cluster_node < 0 ||
+               (!msg->raw && msg->type == MESSAGE_EVENT_LEAVE_ROOM)) {
+        return false;
+    }
+    
+    if (shard_forward_remote_message(shard, client, msg) != 0) {
+        metrics_inc(&shard->metrics.errors);
+        client_send_message(client, EVENT_ERROR, "房间所在节点不可用");
+        if (join) {
+            client->cluster_node = -1;
+        }
+    }
+    return true;
+}
+
+/*
+ * 在分片上处理一条客户端消息。客户端的房间状态只由 owner_shard 的线程读写：
+ * 途中所属分片已变更时继续转交；加入其他分片的房间时，先在本分片离开旧房间，
+ * 再把消息和所有权一起移交。移交时必须先入队再发布新的 owner_shard，
+ * 这样任何按新值转交的后续消息都排在加入请求之后。
+ */
+static void shard_dispatch(server_shard_t *shard, client_t *client, message_t *msg) {
+    server_context_t *ctx = shard->server;
+    unsigned owner = atomic_load_explicit(&client->owner_shard, memory_order_acquire);
+    
+    if (owner != shard->index) {
+        shard_forward_message(shard, &ctx->shards[owner], client, msg);
+        return;
+    }
+    
+    if (ctx->cluster && !client_is_proxy(client) && shard_dispatch_remote(shard, client, msg)) {
+        atomic_fetch_sub_explicit(&client->inflight, 1, memory_order_release);
+        return;
+    }
+    
+    if (!msg->raw && msg->type == MESSAGE_EVENT_JOIN_ROOM) {
+        unsigned target = join_target_shard(shard, msg);
+        if (target != shard->index) {
+            handle_leave_room(shard, client);
+            
+            ws_message_t item = { .kind = WS_MSG_CLIENT, .client = client, .message = msg };
+            if (shard_push(&ctx->shards[target], &item) == 0) {
+                atomic_store_explicit(&client->owner_shard, target, memory_order_release);
+                return; /* inflight 计数随消息一起移交 */
+            }
+            
+            metrics_inc(&shard->metrics.errors);
+            client_send_message(client, EVENT_ERROR, "服务器繁忙，无法加入房间");
+            atomic_fetch_sub_explicit(&client->inflight, 1, memory_order_release);
+            return;
+        }
+    }
+    
+    process_client_message(shard, client, msg);
+    atomic_fetch_sub_explicit(&client->inflight, 1, memory_order_release);
+}
+
+/* 释放已移出房间的客户端槽位：连接在其他分片上时交给该分片释放 */
+static void shard_release_client(server_shard_t *shard, client_t *client) {
+    if (client->registry->shard == shard->index) {
+        client_registry_remove(client->registry, client);
+    } else {
+        shard_push_control(&shard->server->shards[client->registry->shard], client,
+                           CLIENT_CONTROL_RELEASE);
+    }
+}
+
+/*
+ * 连接断开后暂留客户端 (在所属分片上)：槽位和房间成员身份保留 resume_grace_sec 秒，
+ * 期间发给它的帧记入房间的重放环，新连接凭恢复令牌接替。
+ * 不在房间中的客户端、代理和热重启排空期间不暂留。返回 true 表示已暂留。
+ */
+static bool shard_detach_client(server_shard_t *shard, client_t *client) {
+    server_context_t *ctx = shard->server;
+    room_t *room = client->room;
+    
+    if (!ctx->resume_index.entries || !room || client_is_proxy(client) ||
+        atomic_load(&ctx->restart_phase) != SERVER_RESTART_NONE ||
+        room_replay_begin(room, client) != 0) {
+        return false;
+    }
+    
+    pthread_mutex_lock(&ctx->resume_lock);
+    int ret = id_table_insert(&ctx->resume_index, &client->resume_token, client);
+    pthread_mutex_unlock(&ctx->resume_lock);
+    if (ret != 0) {
+        room_replay_end(room);
+        return false;
+    }
+    
+    client->detached = true;
+    client->detached_until = coarse_clock_sec() + ctx->config.resume_grace_sec;
+    client->detached_prev = NULL;
+    client->detached_next = shard->detached;
+    if (shard->detached) shard->detached->detached_prev = client;
+    shard->detached = client;
+    shard->detached_count++;
+    return true;
+}
+
+/* 暂留结束 (恢复或过期)：移出暂离列表，不再为它记录重放帧 */
+static void shard_detach_end(server_shard_t *shard, client_t *client) {
+    if (client->detached_prev) {
+        client->detached_prev->detached_next = client->detached_next;
+    } else {
+        shard->detached = client->detached_next;
+    }
+    if (client->detached_next) {
+        client->detached_next->detached_prev = client->detached_prev;
+    }
+    client->detached_prev = client->detached_next = NULL;
+    shard->detached_count--;
+    
+    client->detached = false;
+    room_replay_end(client->room);
+}
+
+/*
+ * 处理控制栈：断开的客户端在其所属分片上离开房间 (须等转交中的消息全部处理完，
+ * 保证断开总是最后一个操作)，然后由连接所在分片释放槽位。
+ * 留到下一轮的断开请求由最后一条在途消息到达时的唤醒处理，清理定时器兜底。
+ */
+static void shard_process_control(server_shard_t *shard) {
+    server_context_t *ctx = shard->server;
+    client_t *client = atomic_exchange_explicit(&shard->control, NULL, memory_order_acquire);
+    
+    while (client) {
+        client_t *next = client->control_next;
+        
+        if (client->control_op == CLIENT_CONTROL_RELEASE) {
+            client_registry_remove(client->registry, client);
+        } else {
+            unsigned owner = atomic_load_explicit(&client->owner_shard, memory_order_acquire);
+            if (owner != shard->index) {
+                shard_push_control(&ctx->shards[owner], client, CLIENT_CONTROL_DISCONNECT);
+            } else if (atomic_load_explicit(&client->inflight, memory_order_acquire) > 0) {
+                /* 仍有消息在途：留到下一轮 */
+                shard_push_control(shard, client, CLIENT_CONTROL_DISCONNECT);
+            } else if (!shard_detach_client(shard, client)) {
+                handle_leave_room(shard, client);
+                shard_release_client(shard, client);
+            }
+        }
+        
+        client = next;
+    }
+}
+
+/*
+ * 把客户端消息交给所属分片，在连接所在分片 (代理为其所属分片) 上调用。
+ * 只有没有在途消息时才切换到新的所属分片，保证同一客户端的消息按序处理。
+ */
+static void shard_route(server_shard_t *shard, client_t *client, message_t *msg) {
+    server_context_t *ctx = shard->server;
+    
+    bool idle = atomic_load_explicit(&client->inflight, memory_order_acquire) == 0;
+    if (idle) {
+        client->route_shard = atomic_load_explicit(&client->owner_shard, memory_order_acquire);
+    }
+    atomic_fetch_add_explicit(&client->inflight, 1, memory_order_relaxed);
+    
+    if (idle && client->route_shard == shard->index) {
+        /* 由本线程处理：直接分发，不等待下一轮服务 */
+        shard_dispatch(shard, client, msg);
+    } else {
+        shard_forward_message(shard, &ctx->shards[client->route_shard], client, msg);
+    }
+}
+
+/*
+ * 释放代理：先从 ID 索引摘除 (之后同一客户端的消息会登记新的代理)，
+ * 再让代理按序离开房间：离开请求与它之前的消息走同一条路由，
+ * 因此总排在新代理的加入之前。最后走与连接关闭相同的断开流程回收槽位。
+ */
+static void shard_release_proxy(server_shard_t *shard, client_t *proxy) {
+    if (client_registry_find_by_id(&shard->proxies, &proxy->id) != proxy) {
+        return; /* 已在释放中 */
+    }
+    
+    client_registry_unlink_id(&shard->proxies, proxy);
+    
+    message_t *leave = message_create(EVENT_LEAVE_ROOM, NULL);
+    if (leave) {
+        shard_route(shard, proxy, leave);
+        message_unref(leave);
+    }
+    
+    unsigned owner = atomic_load_explicit(&proxy->owner_shard, memory_order_acquire);
+    shard_push_control(&shard->server->shards[owner], proxy, CLIENT_CONTROL_DISCONNECT);
+}
+
+/* 处理其他节点转来的条目：客户端消息经代理进入正常的路由，释放和节点断开回收代理 */
+static void shard_receive_remote(server_shard_t *shard, const ws_message_t *item) {
+    if (item->kind == WS_MSG_NODE_DOWN) {
+        for (size_t i = client_registry_get_active_count(&shard->proxies); i-- > 0;) {
+            client_t *proxy = client_registry_active_at(&shard->proxies, i);
+            if (proxy->origin.node == item->origin.node) {
+                shard_release_proxy(shard, proxy);
+            }
+        }
+        return;
+    }
+    
+    client_t *proxy = client_registry_find_by_id(&shard->proxies, &item->origin.id);
+    if (!item->message) {
+        if (proxy) shard_release_proxy(shard, proxy);
+        return;
+    }
+    
+    if (!proxy) {
+        proxy = client_registry_add_proxy(&shard->proxies, &item->origin);
+        if (!proxy) {
+            metrics_inc(&shard->metrics.errors);
+            return;
+        }
+    }
+    shard_route(shard, proxy, item->message);
+}
+
+/*
+ * backplane 线程收到的记录：发给本节点连接的帧进入连接所在分片的收件箱；
+ * 客户端消息和释放按客户端 ID 交给固定的分片，由它持有该客户端的代理。
+ */
+static void server_cluster_deliver(void *arg, const cluster_record_t *rec) {
+    server_context_t *ctx = (server_context_t*)arg;
+    
+    if (rec->type == CLUSTER_REC_DELIVER) {
+        if (rec->origin.shard >= ctx->shard_count) return;
+        
+        frame_t *frame = frame_alloc(rec->payload_len);
+        if (!frame) return;
+        memcpy(frame_payload(frame), rec->payload, rec->payload_len);
+        if (rec->flags & CLUSTER_REC_FLAG_BINARY) frame->flags |= FRAME_FLAG_BINARY;
+        if (rec->flags & CLUSTER_REC_FLAG_DROPPABLE) frame->flags |= FRAME_FLAG_DROPPABLE;
+        
+        /* 两个节点的单调时钟不可比较，写出延迟从记录到达本节点算起 */
+        ws_message_t item = {
+            .kind = WS_MSG_SEND,
+            .handle = rec->origin.handle,
+            .frame = frame,
+            .timestamp = metrics_clock_ns()
+        };
+        shard_push(&ctx->shards[rec->origin.shard], &item);
+        frame_unref(frame);
+        return;
+    }
+    
+    message_t *msg = NULL;
+    if (rec->type == CLUSTER_REC_CLIENT_MSG) {
+        if (rec->flags & CLUSTER_REC_FLAG_BINARY) {
+            msg = message_deserialize_msgpack(rec->payload, rec->payload_len);
+        } else {
+            msg = message_deserialize_relay((const char*)rec->payload, rec->payload_len);
+            if (!msg) {
+                msg = message_deserialize((const char*)rec->payload, rec->payload_len);
+            }
+        }
+        if (!msg) return;
+        msg->received_ns = metrics_clock_ns();
+    } else if (rec->type != CLUSTER_REC_RELEASE) {
+        return;
+    }
+    
+    ws_message_t item = { .kind = WS_MSG_REMOTE, .message = msg, .origin = rec->origin };
+    shard_push(&ctx->shards[id128_hash(&rec->origin.id) % ctx->shard_count], &item);
+    message_unref(msg);
+}
+
+/* 与某节点的入站连接断开：各分片释放该节点的代理 */
+static void server_cluster_node_down(void *arg, unsigned node) {
+    server_context_t *ctx = (server_context_t*)arg;
+    ws_message_t item = { .kind = WS_MSG_NODE_DOWN, .origin = { .node = (uint16_t)node } };
+    
+    for (unsigned i = 0; i < ctx->shard_count; i++) {
+        shard_push(&ctx->shards[i], &item);
+    }
+}
+
+/* 房间注册表的 ID 过滤器：本节点新建的房间必须哈希到本节点 */
+static bool server_accept_room_id(void *arg, const id128_t *id) {
+    return cluster_is_local((const cluster_t*)arg, id);
+}
+
+/* 每次从收件箱批量取出的条目数 */
+#define SHARD_DRAIN_BATCH 32
+
+/* 处理收件箱中的消息和转交帧，然后处理控制栈 */
+static void shard_drain(server_shard_t *shard) {
+    /* 先清除唤醒标志再读队列；与 shard_wake() 中的栅栏配对，避免丢失唤醒 */
+    atomic_store_explicit(&shard->wake_pending, false, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    
+    ws_message_t items[SHARD_DRAIN_BATCH];
+    size_t count, drained = 0;
+    while ((count = message_queue_pop_batch(&shard->inbox, items, SHARD_DRAIN_BATCH)) > 0) {
+        drained += count;
+        for (size_t i = 0; i < count; i++) {
+            ws_message_t *item = &items[i];
+            if (item->kind == WS_MSG_SEND) {
+                /* 句柄失效说明客户端已断开，丢弃帧；写出延迟从产生该帧的分派算起 */
+                client_t *client = client_registry_get(&shard->clients, item->handle);
+                if (client) {
+                    shard->metrics.dispatch_ns = item->timestamp;
+                    client_send_frame(client, item->frame);
+                    shard->metrics.dispatch_ns = 0;
+                }
+                frame_unref(item->frame);
+            } else if (item->kind == WS_MSG_CLIENT) {
+                shard_dispatch(shard, item->client, item->message);
+                message_unref(item->message);
+            } else {
+                shard_receive_remote(shard, item);
+                message_unref(item->message);
+            }
+        }
+    }
+    if (drained > 0) {
+        metrics_observe(&shard->metrics.inbox_depth, drained);
+    }
+    
+    shard_process_control(shard);
+}
+
+/* 时间轮到期的空闲客户端：关闭连接，后续清理走 LWS_CALLBACK_CLOSED 的正常路径 */
+static void shard_client_timed_out(void *arg, client_t *client) {
+    (void)arg;
+    
+    /* 已断开、在所属分片上暂留的客户端由保留期决定去留 */
+    if (!client->wsi) return;
+    
+    LOG_RATELIMITED(LOG_LEVEL_INFO, "客户端 " LOG_ID_FMT " 超时", LOG_ID_ARGS(&client->id));
+    
+    lws_set_timeout(client->wsi, PENDING_TIMEOUT_CLOSE_SEND, LWS_TO_KILL_ASYNC);
+}
+
+/* 放弃本次热重启，旧进程照常服务 */
+static void server_restart_abort(server_context_t *ctx) {
+    for (unsigned i = 0; i < ctx->shard_count; i++) {
+        handoff_snapshot_free(&ctx->shards[i].snapshot);
+    }
+    atomic_store(&ctx->restart_acks, 0);
+    atomic_store(&ctx->restart_phase, SERVER_RESTART_NONE);
+}
+
+/* 所有分片的快照都已就绪 (在分片 0 上)：写快照、启动新进程，成功后进入排空阶段 */
+static void server_restart_handoff(server_context_t *ctx) {
+    const server_config_t *config = &ctx->config;
+    
+    if (config->snapshot_path) {
+        server_shard_t *shards = ctx->shards;
+        handoff_snapshot_t *parts = malloc(ctx->shard_count * sizeof(handoff_snapshot_t));
+        int ret = -1;
+        if (parts) {
+            for (unsigned i = 0; i < ctx->shard_count; i++) parts[i] = shards[i].snapshot;
+            ret = handoff_snapshot_write(config->snapshot_path, parts, ctx->shard_count);
+            free(parts);
+        }
+        if (ret != 0) {
+            LOG_WARN("写入房间快照 %s 失败，新进程将不恢复房间", config->snapshot_path);
+        }
+        for (unsigned i = 0; i < ctx->shard_count; i++) handoff_snapshot_free(&shards[i].snapshot);
+    }
+    
+    pid_t pid = handoff_spawn(config->exec_path, config->argv, ctx->listen_fd);
+    if (pid < 0) {
+        LOG_ERROR("热重启失败：无法启动 %s (%s)", config->exec_path, strerror(errno));
+        if (config->snapshot_path) unlink(config->snapshot_path);
+        server_restart_abort(ctx);
+        return;
+    }
+    
+    uint32_t drain_sec = config->drain_sec ? config->drain_sec : SERVER_DRAIN_SEC_DEFAULT;
+    ctx->drain_deadline = coarse_clock_sec() + drain_sec;
+    atomic_store(&ctx->restart_phase, SERVER_RESTART_DRAINING);
+    LOG_INFO("热重启：新进程 %d 已接管监听套接字，%u 秒内排空现有连接", (int)pid, drain_sec);
+}
+
+/* 向本分片的客户端发出 server-shutdown，重连时间在窗口内均匀分散 */
+static void shard_send_shutdown_hints(server_shard_t *shard) {
+    server_context_t *ctx = shard->server;
+    uint32_t drain_sec = ctx->config.drain_sec ? ctx->config.drain_sec : SERVER_DRAIN_SEC_DEFAULT;
+    
+    /* 窗口按全局建连速率接纳全部客户端所需的时间估算，不超过排空时间的一半 */
+    size_t total = 0;
+    for (unsigned i = 0; i < ctx->shard_count; i++) total += ctx->shards[i].clients.active_count;
+    uint64_t window_ms = SERVER_RESTART_SPREAD_MIN_MS;
+    if (ctx->config.accept_rate > 0 && total * 1000 / ctx->config.accept_rate > window_ms) {
+        window_ms = total * 1000 / ctx->config.accept_rate;
+    }
+    if (window_ms > (uint64_t)drain_sec * 500) window_ms = (uint64_t)drain_sec * 500;
+    if (window_ms == 0) window_ms = 1;
+    
+    for (size_t i = 0; i < client_registry_get_active_count(&shard->clients); i++) {
+        client_t *client = client_registry_active_at(&shard->clients, i);
+        id128_t jitter;
+        id128_generate(&jitter);
+        
+        json_t *data = json_object();
+        json_object_set_new(data, "reconnectAfterMs", json_integer((json_int_t)(jitter.hi % window_ms)));
+        json_object_set_new(data, "drainMs", json_integer((json_int_t)drain_sec * 1000));
+        send_json_frame(client, EVENT_SERVER_SHUTDOWN, data);
+        json_decref(data);
+    }
+}
+
+/* 热重启的每秒推进：每个分片写一次快照；排空阶段发一次提示，分片 0 判断何时退出 */
+static void shard_restart_step(server_shard_t *shard, uint32_t now) {
+    server_context_t *ctx = shard->server;
+    int phase = atomic_load(&ctx->restart_phase);
+    unsigned gen = atomic_load(&ctx->restart_gen);
+    
+    if (phase == SERVER_RESTART_REQUESTED && shard->restart_gen != gen) {
+        shard->restart_gen = gen;
+        if (ctx->config.snapshot_path) {
+            for (size_t i = 0; i < room_registry_get_active_count(&shard->rooms); i++) {
+                room_t *room = &shard->rooms.rooms[shard->rooms.active_slots[i]];
+                if (handoff_snapshot_add_room(&shard->snapshot, room) != 0) break;
+            }
+        }
+        atomic_fetch_add(&ctx->restart_acks, 1);
+    }
+    
+    if (phase == SERVER_RESTART_DRAINING && shard->drain_gen != gen) {
+        shard->drain_gen = gen;
+        shard_send_shutdown_hints(shard);
+    }
+    
+    if (shard->index != 0) return;
+    
+    if (phase == SERVER_RESTART_REQUESTED) {
+        if (atomic_load(&ctx->restart_acks) == ctx->shard_count) {
+            server_restart_handoff(ctx);
+        }
+    } else if (phase == SERVER_RESTART_DRAINING) {
+        size_t remaining = 0;
+        for (unsigned i = 0; i < ctx->shard_count; i++) {
+            remaining += ctx->shards[i].clients.active_count;
+        }
+        if (remaining == 0 || (int32_t)(now - ctx->drain_deadline) >= 0) {
+            LOG_INFO("热重启：排空结束，关闭剩余 %zu 个连接", remaining);
+            server_stop(ctx);
+        }
+    }
+}
+
+/*
+ * 保留期已过 (或热重启开始排空) 的暂离客户端离开房间并释放槽位。
+ * 令牌已不在索引中说明连接分片已领取，接替请求正在途中，留给它处理。
+ */
+static void shard_expire_detached(server_shard_t *shard, uint32_t now) {
+    server_context_t *ctx = shard->server;
+    bool draining = atomic_load(&ctx->restart_phase) == SERVER_RESTART_DRAINING;
+    client_t *client = shard->detached;
+    
+    while (client) {
+        client_t *next = client->detached_next;
+        
+        if (draining || (int32_t)(now - client->detached_until) >= 0) {
+            pthread_mutex_lock(&ctx->resume_lock);
+            bool claimed = id_table_find(&ctx->resume_index, &client->resume_token) != client;
+            if (!claimed) {
+                id_table_remove(&ctx->resume_index, &client->resume_token);
+            }
+            pthread_mutex_unlock(&ctx->resume_lock);
+            
+            if (!claimed) {
+                shard_detach_end(shard, client);
+                handle_leave_room(shard, client);
+                shard_release_client(shard, client);
+                metrics_inc(&shard->metrics.sessions_expired);
+            }
+        }
+        
+        client = next;
+    }
+}
+
+/* 每秒的维护工作：只触及到期的超时定时器，空房间按更长的间隔清理 */
+static void shard_sweep(server_shard_t *shard) {
+    uint32_t now = coarse_clock_update();
+    
+    client_registry_expire_timeouts(&shard->clients, now, shard_client_timed_out, shard);
+    
+    /* 移除空房间，归还高峰过后长时间空闲的注册表块 */
+    if (++shard->sweep_ticks % SERVER_ROOM_SWEEP_TICKS == 0) {
+        room_registry_remove_empty_rooms(&shard->rooms);
+        
+        client_registry_trim(&shard->clients, now, SLOT_REGION_IDLE_SEC);
+        client_registry_trim(&shard->proxies, now, SLOT_REGION_IDLE_SEC);
+        room_registry_trim(&shard->rooms, now, SLOT_REGION_IDLE_SEC);
+    }
+    
+    /* 处理仍在等待的断开请求，然后回收保留期已过的会话 */
+    shard_process_control(shard);
+    shard_expire_detached(shard, now);
+    
+    shard_restart_step(shard, now);
+}
+
+/* 维护定时器回调：在分片自己的服务线程上运行，然后重新调度 */
+static void shard_sweep_timer(lws_sorted_usec_list_t *sul) {
+    server_shard_t *shard = lws_container_of(sul, server_shard_t, sweep_timer);
+    
+    shard_sweep(shard);
+    lws_sul_schedule(shard->server->lws_context, (int)shard->index, &shard->sweep_timer,
+                     shard_sweep_timer, SERVER_TICK_INTERVAL_SEC * LWS_US_PER_SEC);
+}
+
+/* 一个批次最多合并的 candidate 数，达到后立即发送 */
+#define SERVER_ICE_BATCH_MAX 16
+
+/* 发往同一客户端、等待合并的 ICE candidate，在房间所在分片上收集和发送 */
+typedef struct ice_batch_s {
+    struct ice_batch_s *next;        // 分片的待发送批次链表
+    client_t *target;                // 接收者，提前发送或接收者离开后为 NULL
+    size_t count;
+    relay_entry_t entries[SERVER_ICE_BATCH_MAX];
+} ice_batch_t;
+
+/* 发送客户端的待合并批次；只有一条时按普通 ice-candidate 发送 */
+static void shard_flush_ice_batch(client_t *target) {
+    ice_batch_t *batch = target->ice_batch;
+    if (!batch) return;
+    
+    target->ice_batch = NULL;
+    batch->target = NULL;
+    
+    bool binary = target->encoding == CLIENT_ENCODING_MSGPACK;
+    frame_t *frame;
+    if (batch->count == 1) {
+        frame = message_relay_frame(batch->entries[0].msg, &batch->entries[0].from, binary);
+    } else {
+        frame = frame_create_relay_batch(EVENT_ICE_CANDIDATES, "candidates",
+                                         batch->entries, batch->count, binary);
+    }
+    if (frame) {
+        frame->flags |= FRAME_FLAG_DROPPABLE;
+        room_send_frame(target, frame);
+        frame_unref(frame);
+    }
+    
+    for (size_t i = 0; i < batch->count; i++) {
+        message_unref((message_t *)batch->entries[i].msg);
+    }
+    batch->count = 0;
+}
+
+/* 释放分片上的所有批次：send 为 true 时尚未发送的先发送，否则直接丢弃 (服务器关闭时) */
+static void shard_release_ice_batches(server_shard_t *shard, bool send) {
+    ice_batch_t *batch = shard->ice_batches;
+    shard->ice_batches = NULL;
+    
+    while (batch) {
+        ice_batch_t *next = batch->next;
+        if (batch->target && send) {
+            shard_flush_ice_batch(batch->target);
+        } else if (batch->target) {
+            batch->target->ice_batch = NULL;
+            for (size_t i = 0; i < batch->count; i++) {
+                message_unref((message_t *)batch->entries[i].msg);
+            }
+        }
+        memory_pool_free(batch);
+        batch = next;
+    }
+}
+
+/* 合并窗口到期：在分片自己的服务线程上运行 */
+static void shard_ice_timer(lws_sorted_usec_list_t *sul) {
+    server_shard_t *shard = lws_container_of(sul, server_shard_t, ice_timer);
+    shard_release_ice_batches(shard, true);
+}
+
+/*
+ * 把一条 ICE candidate 加入接收者的批次。第一条 candidate 启动分片的合并窗口，
+ * 窗口到期时发送全部批次，批次满时立即发送。
+ * 返回 0 表示已接管 (消息增加一个引用)，-1 表示调用者应直接发送。
+ */
+static int shard_batch_ice(server_shard_t *shard, client_t *target, client_t *from,
+                           const message_t *msg) {
+    ice_batch_t *batch = target->ice_batch;
+    
+    if (!batch) {
+        batch = memory_pool_alloc(&shard->pool, sizeof(ice_batch_t));
+        if (!batch) return -1;
+        
+        batch->target = target;
+        batch->count = 0;
+        batch->next = shard->ice_batches;
+        if (!shard->ice_batches) {
+            lws_sul_schedule(shard->server->lws_context, (int)shard->index, &shard->ice_timer,
+                             shard_ice_timer,
+                             (lws_usec_t)shard->server->config.ice_batch_ms * LWS_US_PER_MS);
+        }
+        shard->ice_batches = batch;
+        target->ice_batch = batch;
+    }
+    
+    message_ref((message_t *)msg);
+    batch->entries[batch->count].msg = msg;
+    batch->entries[batch->count].from = from->id;
+    if (++batch->count == SERVER_ICE_BATCH_MAX) {
+        shard_flush_ice_batch(target);
+    }
+    return 0;
+}
+
+/*
+ * 分片服务循环。没有固定的轮询间隔：lws_service_tsi() 一直阻塞到有网络事件、
+ * 定时器到期或其他线程调用 lws_cancel_service()，本线程的消息在接收回调中直接处理，
+ * 其他分片转交的工作在 LWS_CALLBACK_EVENT_WAIT_CANCELLED 中处理。
+ */
+static void shard_service(server_shard_t *shard) {
+    server_context_t *ctx = shard->server;
+    
+    lws_sul_schedule(ctx->lws_context, (int)shard->index, &shard->sweep_timer,
+                     shard_sweep_timer, SERVER_TICK_INTERVAL_SEC * LWS_US_PER_SEC);
+    
+    /* 维护定时器保证每次等待不超过一秒，因此回调中读到的粗粒度时钟最多滞后一秒 */
+    while (atomic_load_explicit(&ctx->running, memory_order_relaxed)) {
+        coarse_clock_update();
+        if (lws_service_tsi(ctx->lws_context, 0, (int)shard->index) < 0) {
+            break;
+        }
+        shard_drain(shard);
+        
+        /* 本轮回调中的临时内存到此全部失效 */
+        memory_arena_reset(&shard->arena);
+    }
+    
+    /* 信号只会打断一个线程的等待，唤醒其余服务线程让它们也退出 */
+    atomic_store(&ctx->running, false);
+    lws_cancel_service(ctx->lws_context);
+}
+
+/* 额外服务线程入口 */
+static void *shard_thread_main(void *arg) {
+    server_shard_t *shard = (server_shard_t*)arg;
+    
+    shard_bind_thread(shard);
+    shard_service(shard);
+    return NULL;
+}
+
+/* 初始化一个分片，返回值与 server_init 的错误码一致 */
+static int shard_init(server_context_t *ctx, server_shard_t *shard, unsigned index,
+                      size_t max_clients, size_t max_rooms) {
+    shard->server = ctx;
+    shard->index = index;
+    atomic_init(&shard->control, NULL);
+    atomic_init(&shard->wake_pending, false);
+    shard->sweep_ticks = 0;
+    shard->ice_batches = NULL;
+    
+    /* 初始化客户端注册表 */
+    if (client_registry_init(&shard->clients, max_clients) != 0) {
+        fprintf(stderr, "客户端注册表初始化失败\n");
+        return -2;
+    }
+    
+    shard->clients.shard = index;
+    shard->clients.forward = shard_forward_frame;
+    shard->clients.forward_arg = shard;
+    shard->clients.timeout_sec = ctx->config.client_timeout_sec;
+    if (ctx->config.send_high_water > 0) {
+        shard->clients.send_high_water = (uint16_t)ctx->config.send_high_water;
+    }
+    if (ctx->config.max_message_size > 0) {
+        shard->clients.max_message_size = ctx->config.max_message_size;
+    }
+    
+    /* 准入速率：一次回调最多交付一条完整消息，字节桶的突发量不能小于消息上限 */
+    size_t byte_burst = ctx->config.byte_burst;
+    if (byte_burst < shard->clients.max_message_size) byte_burst = shard->clients.max_message_size;
+    token_rate_init(&shard->clients.msg_rate, ctx->config.msg_rate, ctx->config.msg_burst);
+    token_rate_init(&shard->clients.byte_rate, ctx->config.byte_rate, byte_burst);
+    shard->clients.slots.huge_pages = ctx->config.huge_pages;
+    shard->clients.compress = ctx->config.compress;
+    shard->clients.compress_min_size = ctx->config.compress_min_size;
+    shard->clients.metrics = &shard->metrics;
+    
+    /* 初始化房间注册表 */
+    if (room_registry_init(&shard->rooms, max_rooms) != 0) {
+        fprintf(stderr, "房间注册表初始化失败\n");
+        client_registry_cleanup(&shard->clients);
+        return -3;
+    }
+    shard->rooms.shard = index;
+    shard->rooms.slots.huge_pages = ctx->config.huge_pages;
+    if (ctx->config.max_room_size > 0) {
+        shard->rooms.max_capacity = ctx->config.max_room_size;
+    }
+    
+    /* 定向转发按客户端 ID 在成员索引中探测一次。本分片房间的成员可能来自任意分片
+     * (集群模式下还有代理)，上限取全部本地客户端加代理，但不超过所有房间坐满 */
+    size_t max_members = ctx->config.max_clients + (ctx->cluster ? max_clients : 0);
+    if (max_members > max_rooms * shard->rooms.max_capacity) {
+        max_members = max_rooms * shard->rooms.max_capacity;
+    }
+    if (room_registry_index_members(&shard->rooms, max_members) != 0) {
+        fprintf(stderr, "房间成员索引初始化失败\n");
+        room_registry_cleanup(&shard->rooms);
+        client_registry_cleanup(&shard->clients);
+        return -3;
+    }
+    
+    /* 集群模式：其他节点的客户端以代理的身份加入本节点的房间，发给代理的帧经 backplane 发回 */
+    if (ctx->cluster) {
+        shard->rooms.accept_id = server_accept_room_id;
+        shard->rooms.accept_id_arg = ctx->cluster;
+        
+        if (client_registry_init(&shard->proxies, max_clients) != 0) {
+            fprintf(stderr, "代理注册表初始化失败\n");
+            room_registry_cleanup(&shard->rooms);
+            client_registry_cleanup(&shard->clients);
+            return -2;
+        }
+        shard->proxies.shard = index;
+        shard->proxies.slots.huge_pages = ctx->config.huge_pages;
+        shard->proxies.forward = shard_forward_remote;
+        shard->proxies.forward_arg = shard;
+    }
+    
+    /* 初始化收件箱：只有一个分片时唯一的生产者就是它自己 */
+    message_queue_mode_t mode = ctx->config.threads > 1 ? MESSAGE_QUEUE_MPSC : MESSAGE_QUEUE_SPSC;
+    size_t capacity = ctx->config.queue_capacity ? ctx->config.queue_capacity
+                                                 : MESSAGE_QUEUE_DEFAULT_CAPACITY;
+    if (message_queue_init(&shard->inbox, capacity, mode) != 0) {
+        fprintf(stderr, "消息队列初始化失败\n");
+        client_registry_cleanup(&shard->proxies);
+        room_registry_cleanup(&shard->rooms);
+        client_registry_cleanup(&shard->clients);
+        return -4;
+    }
+    
+    /* 初始化内存池和临时分配区 */
+    memory_pool_init(&shard->pool, SERVER_POOL_MAX_BYTES);
+    if (memory_arena_init(&shard->arena, SERVER_ARENA_SIZE) != 0) {
+        fprintf(stderr, "临时分配区初始化失败\n");
+        message_queue_cleanup(&shard->inbox);
+        client_registry_cleanup(&shard->proxies);
+        room_registry_cleanup(&shard->rooms);
+        client_registry_cleanup(&shard->clients);
+        return -4;
+    }
+    
+    return 0;
+}
+
+/*
+ * 释放所有分片。房间清理会重置参与者 (可能属于其他分片) 的房间指针，
+ * 因此先清理全部房间，再清理客户端。消息和帧可能来自任意分片的内存池，
+ * 内存池最后释放。
+ */
+static void shards_cleanup(server_context_t *ctx, unsigned count) {
+    for (unsigned i = 0; i < count; i++) {
+        message_queue_cleanup(&ctx->shards[i].inbox);
+    }
+    for (unsigned i = 0; i < count; i++) {
+        lws_sul_cancel(&ctx->shards[i].ice_timer);
+        shard_release_ice_batches(&ctx->shards[i], false);
+    }
+    for (unsigned i = 0; i < count; i++) {
+        room_registry_cleanup(&ctx->shards[i].rooms);
+    }
+    for (unsigned i = 0; i < count; i++) {
+        client_registry_cleanup(&ctx->shards[i].clients);
+        client_registry_cleanup(&ctx->shards[i].proxies);
+    }
+    for (unsigned i = 0; i < count; i++) {
+        handoff_snapshot_free(&ctx->shards[i].snapshot);
+        memory_arena_cleanup(&ctx->shards[i].arena);
+        memory_pool_cleanup(&ctx->shards[i].pool);
+    }
+    
+    free(ctx->shards);
+    ctx->shards = NULL;
+    ctx->shard_count = 0;
+}
+
+/* 关闭集群 backplane：之后不会再有记录投递到分片收件箱 */
+static void server_cluster_cleanup(server_context_t *ctx) {
+    if (ctx->cluster) {
+        cluster_cleanup(ctx->cluster);
+        free(ctx->cluster);
+        ctx->cluster = NULL;
+    }
+}
+
+/* 快照中的一个房间：按 ID 记录的分片放回对应分片，保留到排空时间结束 */
+static void server_restore_room(void *arg, const handoff_room_t *rec) {
+    server_context_t *ctx = (server_context_t*)arg;
+    server_shard_t *shard = &ctx->shards[id128_shard(&rec->id) % ctx->shard_count];
+    uint32_t drain_sec = ctx->config.drain_sec ? ctx->config.drain_sec : SERVER_DRAIN_SEC_DEFAULT;
+    
+    if (room_registry_restore(&shard->rooms, &rec->id, rec->name, rec->capacity,
+                              rec->created_at, get_timestamp_sec() + drain_sec)) {
+        ctx->restored_rooms++;
+    }
+}
+
 /* 服务器初始化函数 */
 int server_init(server_context_t *ctx, const server_config_t *config) {
     if (!ctx || !config) return -1;
     
-    /* 复制配置信息并初始化服务器状态 */
-    memcpy(&ctx->config, config, sizeof(server_config_t));
-    ctx->running = false;
-    ctx->total_messages = 0;
-    ctx->total_errors = 0;
-    ctx->startup_time = get_timestamp_sec();
+    /* 复制配置信息并初始化服务器状态 */
+    memcpy(&ctx->config, config, sizeof(server_config_t));
+    atomic_init(&ctx->running, false);
+    ctx->startup_time = get_timestamp_sec();
+    
+    unsigned threads = config->threads ? config->threads : 1;
+    if (threads > SERVER_MAX_THREADS) threads = SERVER_MAX_THREADS;
+    ctx->config.threads = threads;
+    ctx->cluster = NULL;
+    token_rate_init(&ctx->accept_rate, config->accept_rate, config->accept_burst);
+    atomic_init(&ctx->accept_tat_ns, 0);
+    
+    /* 集群模式：先监听节点端口，backplane 线程在 server_run 中启动 */
+    if (config->cluster_nodes) {
+        ctx->cluster = calloc(1, sizeof(cluster_t));
+        if (!ctx->cluster ||
+            cluster_init(ctx->cluster, config->cluster_nodes, config->node_id,
+                         server_cluster_deliver, server_cluster_node_down, ctx) != 0) {
+            free(ctx->cluster);
+            ctx->cluster = NULL;
+            return -6;
+        }
+    }
+    
+    /* 每个服务线程一个分片，容量按线程数均分 (libwebsockets 把新连接分给最空闲的线程)；
+     * 按缓存行对齐，各分片的计数器不共享缓存行 */
+    ctx->shards = cache_aligned_calloc(threads, sizeof(server_shard_t));
+    if (!ctx->shards) {
+        fprintf(stderr, "分片分配失败\n");
+        server_cluster_cleanup(ctx);
+        return -2;
+    }
+    
+    size_t clients_per_shard = (config->max_clients + threads - 1) / threads;
+    size_t rooms_per_shard = (config->max_rooms + threads - 1) / threads;
+    for (unsigned i = 0; i < threads; i++) {
+        int ret = shard_init(ctx, &ctx->shards[i], i, clients_per_shard, rooms_per_shard);
+        if (ret != 0) {
+            shards_cleanup(ctx, i);
+            server_cluster_cleanup(ctx);
+            return ret;
+        }
+        ctx->shard_count = i + 1;
+    }
+    
+    /* 热重启的新进程：恢复旧进程快照中的房间，重连的客户端按原房间 ID 加入 */
+    ctx->restored_rooms = 0;
+    if (config->snapshot_path &&
+        handoff_snapshot_load(config->snapshot_path, server_restore_room, ctx) < 0) {
+        fprintf(stderr, "房间快照 %s 无效，已忽略\n", config->snapshot_path);
+    }
+    
+    /* 监听套接字由服务器持有 (热重启时原样交给新进程)，lws 只处理接受后的连接 */
+    bool inherited = false;
+    ctx->listen_fd = handoff_listen(config->interface, config->port, &inherited);
+    if (ctx->listen_fd < 0) {
+        fprintf(stderr, "监听端口 %d 失败: %s\n", config->port, strerror(errno));
+        shards_cleanup(ctx, ctx->shard_count);
+        server_cluster_cleanup(ctx);
+        return -5;
+    }
+    atomic_init(&ctx->restart_phase, SERVER_RESTART_NONE);
+    atomic_init(&ctx->restart_gen, 0);
+    atomic_init(&ctx->restart_acks, 0);
+    ctx->drain_deadline = 0;
+    
+    /* 设置 libwebsockets 上下文 */
+    struct lws_context_creation_info info;
+    memset(&info, 0, sizeof(info));
+    
+    info.port = CONTEXT_PORT_NO_LISTEN_SERVER;
+    info.protocols = (struct lws_protocols[]){
+        {
+            "webrtc-signaling",
+            webrtc_protocol_callback,
+            sizeof(client_handle_t), /* 每个会话数据：客户端句柄 */
+            4096, /* 接收缓冲区大小：单次回调交付的最大长度，更长的消息在客户端缓冲区中重组 */
+            CLIENT_ENCODING_JSON, /* ID 即客户端编码 */
+            NULL, /* 用户数据 */
+            0 /* 发送包大小 */
+        },
+        {
+            /* 同一组事件的 MessagePack 编码，以二进制帧收发 */
+            "webrtc-signaling-msgpack",
+            webrtc_protocol_callback,
+            sizeof(client_handle_t),
+            4096,
+            CLIENT_ENCODING_MSGPACK, /* ID 即客户端编码 */
+            NULL,
+            0
+        },
+        {
+            /* HTTP /metrics，只有挂载了 server_metrics_mount 才会收到请求 */
+            "redrtc-metrics",
+            metrics_http_callback,
+            sizeof(metrics_session_t),
+            0,
+            0,
+            NULL,
+            0
+        },
+        {
+            /* 监听套接字以原始描述符接入事件循环，可读时接受连接并交给 lws */
+            "redrtc-listen",
+            listen_callback,
+            0,
+            0,
+            0,
+            NULL,
+            0
+        },
+        { NULL, NULL, 0, 0, 0, NULL, 0 } /* 终止符 */
+    };
+    if (config->compress) {
+        info.extensions = server_extensions;
+    }
+    if (config->metrics) {
+        info.mounts = &server_metrics_mount;
+    }
+    info.gid = -1;
+    info.uid = -1;
+    info.user = ctx;
+    info.count_threads = threads;
+    
+    /* 创建 libwebsockets 上下文 */
+    ctx->lws_context = lws_create_context(&info);
+    if (!ctx->lws_context) {
+        fprintf(stderr, "创建 libwebsockets 上下文失败\n");
+        close(ctx->listen_fd);
+        shards_cleanup(ctx, ctx->shard_count);
+        server_cluster_cleanup(ctx);
+        return -5;
+    }
+    
+    /* 之后监听套接字归 lws 所有，随上下文一起关闭 */
+    lws_sock_file_fd_type listen_desc;
+    listen_desc.filefd = ctx->listen_fd;
+    if (!lws_adopt_descriptor_vhost(lws_get_vhost_by_name(ctx->lws_context, "default"),
+                                    LWS_ADOPT_RAW_FILE_DESC, listen_desc, "redrtc-listen", NULL)) {
+        fprintf(stderr, "监听套接字接入事件循环失败\n");
+        lws_context_destroy(ctx->lws_context);
+        ctx->lws_context = NULL;
+        close(ctx->listen_fd);
+        shards_cleanup(ctx, ctx->shard_count);
+        server_cluster_cleanup(ctx);
+        return -5;
+    }
+    
+    /* 会话恢复：集群模式下连接和房间可能不在同一节点，不支持；索引分配失败时不启用 */
+    memset(&ctx->resume_index, 0, sizeof(ctx->resume_index));
+    if (config->resume_grace_sec > 0 && !ctx->cluster) {
+        if (id_table_init(&ctx->resume_index, config->max_clients) == 0) {
+            pthread_mutex_init(&ctx->resume_lock, NULL);
+        } else {
+            fprintf(stderr, "恢复令牌索引分配失败，不启用会话恢复\n");
+        }
+    }
+    
+    /* 调用 server_init 的线程随后运行分片 0 */
+    shard_bind_thread(&ctx->shards[0]);
+    
+    /* 设置信号处理器 */
+    global_ctx = ctx;
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGUSR2, restart_signal_handler);
+    
+    printf("WebRTC 信令服务器初始化完成\n");
+    printf("  端口: %d%s\n", config->port, inherited ? " (沿用旧进程的监听套接字)" : "");
+    if (ctx->restored_rooms > 0) {
+        printf("  从快照恢复房间: %zu\n", ctx->restored_rooms);
+    }
+    if (ctx->resume_index.entries) {
+        printf("  会话保留: %u 秒\n", config->resume_grace_sec);
+    }
+    printf("  服务线程数: %u\n", threads);
+    printf("  最大客户端数: %zu\n", config->max_clients);
+    printf("  最大房间数: %zu\n", config->max_rooms);
+    printf("  客户端超时时间: %u 秒\n", config->client_timeout_sec);
+    printf("  发送队列高水位: %u 帧\n", ctx->shards[0].clients.send_high_water);
+    printf("  分片收件箱容量: %zu\n", ctx->shards[0].inbox.capacity);
+    if (config->compress) {
+        printf("  permessage-deflate: 启用 (最小 %zu 字节)\n", config->compress_min_size);
+    }
+    if (config->metrics) {
+        printf("  指标: http://<主机>:%d/metrics\n", config->port);
+    }
+    if (ctx->cluster) {
+        const cluster_peer_t *self = &ctx->cluster->peers[ctx->cluster->self];
+        printf("  集群: 节点 %u/%u (%s:%s)\n", ctx->cluster->self, ctx->cluster->node_count,
+               self->host, self->port);
+    }
+    
+    return 0;
+}
+
+/* 服务器运行函数 */
+int server_run(server_context_t *ctx) {
+    if (!ctx || !ctx->lws_context) return -1;
+    
+    atomic_store(&ctx->running, true);
+    printf("服务器正在启动...\n");
+    
+    if (ctx->cluster && cluster_start(ctx->cluster) != 0) {
+        fprintf(stderr, "创建集群 backplane 线程失败\n");
+        atomic_store(&ctx->running, false);
+        return -2;
+    }
+    
+    /* 分片 1..N-1 各自一个服务线程，分片 0 在当前线程上运行 */
+    unsigned started = 1;
+    for (; started < ctx->shard_count; started++) {
+        server_shard_t *shard = &ctx->shards[started];
+        if (pthread_create(&shard->thread, NULL, shard_thread_main, shard) != 0) {
+            fprintf(stderr, "创建服务线程 %u 失败\n", started);
+            atomic_store(&ctx->running, false);
+            break;
+        }
+    }
+    
+    shard_bind_thread(&ctx->shards[0]);
+    shard_service(&ctx->shards[0]);
+    
+    for (unsigned i = 1; i < started; i++) {
+        pthread_join(ctx->shards[i].thread, NULL);
+    }
+    
+    return started == ctx->shard_count ? 0 : -2;
+}
+
+/* 服务器清理函数 */
+void server_cleanup(server_context_t *ctx) {
+    if (!ctx) return;
+    
+    printf("正在清理服务器...\n");
+    
+    if (ctx->lws_context) {
+        lws_context_destroy(ctx->lws_context);
+        ctx->lws_context = NULL;
+    }
+    
+    server_cluster_cleanup(ctx);
+    
+    if (ctx->shards) {
+        shards_cleanup(ctx, ctx->shard_count);
+    }
+    
+    if (ctx->resume_index.entries) {
+        id_table_cleanup(&ctx->resume_index);
+        pthread_mutex_destroy(&ctx->resume_lock);
+    }
+    
+    printf("服务器清理完成\n");
+}
+
+/* 服务器停止函数 */
+void server_stop(server_context_t *ctx) {
+    if (ctx) {
+        atomic_store(&ctx->running, false);
+    }
+}
+
+/* 汇总各分片的统计信息 */
+void server_get_stats(const server_context_t *ctx, server_stats_t *stats) {
+    uint64_t probe_in = 0, probe_out = 0;
+    uint64_t cpu_ns = 0, cpu_bytes = 0, plain_ns = 0, plain_bytes = 0;
+    metrics_snapshot_t receive = { 0 }, write = { 0 };
+    
+    memset(stats, 0, sizeof(*stats));
+    
+    for (unsigned i = 0; i < ctx->shard_count; i++) {
+        const server_shard_t *shard = &ctx->shards[i];
+        metrics_snapshot_add(&receive, &shard->metrics.receive_latency);
+        metrics_snapshot_add(&write, &shard->metrics.write_latency);
+        stats->active_clients += client_registry_get_active_count(&shard->clients);
+        stats->max_clients += shard->clients.max_clients;
+        stats->active_rooms += room_registry_get_active_count(&shard->rooms);
+        stats->max_rooms += shard->rooms.max_rooms;
+        stats->total_connections += shard->clients.total_connections;
+        stats->total_rooms_created += shard->rooms.total_rooms_created;
+        stats->total_messages += metrics_read(&shard->metrics.messages_dispatched);
+        stats->total_errors += metrics_read(&shard->metrics.errors);
+        for (unsigned r = 0; r < METRICS_DROP_COUNT; r++) {
+            stats->frames_dropped += metrics_read(&shard->metrics.frames_dropped[r]);
+        }
+        stats->queue_overflows += message_queue_overflows(&shard->inbox);
+        stats->rejected_messages += metrics_read(&shard->metrics.rejected[METRICS_REJECT_MESSAGES]);
+        stats->rejected_bytes += metrics_read(&shard->metrics.rejected[METRICS_REJECT_BYTES]);
+        stats->rejected_connections += metrics_read(&shard->metrics.rejected[METRICS_REJECT_ACCEPT]);
+        stats->registry_resident_bytes += slot_region_resident_bytes(&shard->clients.slots) +
+                                          slot_region_resident_bytes(&shard->proxies.slots) +
+                                          slot_region_resident_bytes(&shard->rooms.slots);
+        stats->registry_chunks_released += shard->clients.slots.chunks_released +
+                                           shard->proxies.slots.chunks_released +
+                                           shard->rooms.slots.chunks_released;
+        stats->remote_clients += client_registry_get_active_count(&shard->proxies);
+        
+        const client_deflate_stats_t *st = &shard->clients.deflate_stats;
+        stats->deflate_frames += st->frames;
+        stats->deflate_skipped += st->skipped;
+        stats->deflate_bytes += st->bytes;
+        probe_in += st->probe_in;
+        probe_out += st->probe_out;
+        cpu_ns += st->cpu_ns;
+        cpu_bytes += st->cpu_bytes;
+        plain_ns += st->plain_cpu_ns;
+        plain_bytes += st->plain_cpu_bytes;
+    }
+    
+    /* 按采样得到的压缩比和每字节开销外推 */
+    if (probe_in > 0 && probe_out < probe_in) {
+        stats->deflate_bytes_saved =
+            (uint64_t)((double)stats->deflate_bytes * (double)(probe_in - probe_out) / (double)probe_in);
+    }
+    if (ctx->cluster) {
+        stats->cluster_sent = atomic_load_explicit(&ctx->cluster->records_sent, memory_order_relaxed);
+        stats->cluster_received = atomic_load_explicit(&ctx->cluster->records_received,
+                                                       memory_order_relaxed);
+        stats->cluster_dropped = atomic_load_explicit(&ctx->cluster->records_dropped,
+                                                      memory_order_relaxed);
+    }
+    
+    if (cpu_bytes > 0) stats->deflate_ns_per_kib = cpu_ns * 1024 / cpu_bytes;
+    if (plain_bytes > 0) stats->plain_ns_per_kib = plain_ns * 1024 / plain_bytes;
+    
+    stats->receive_p50_ns = metrics_snapshot_quantile(&receive, 0.5);
+    stats->receive_p99_ns = metrics_snapshot_quantile(&receive, 0.99);
+    stats->write_p50_ns = metrics_snapshot_quantile(&write, 0.5);
+    stats->write_p99_ns = metrics_snapshot_quantile(&write, 0.99);
+}
+
+/* 导出的直方图边界 (2 的幂)：延迟 1µs..17s，长度 16B..16MiB，队列深度 1..64Ki */
+#define METRICS_LATENCY_SHIFTS 10, 34
+#define METRICS_BYTES_SHIFTS 4, 24
+#define METRICS_DEPTH_SHIFTS 0, 16
+#define METRICS_NS_TO_SEC 1e-9
+
+/* 写出按分片区分的一组样本；value 为以 shard 表示的表达式 */
+#define METRICS_PER_SHARD(text, ctx, name, type, help, value) do {               \
+    metrics_text_header((text), (name), (type), (help));                         \
+    for (unsigned i_ = 0; i_ < (ctx)->shard_count; i_++) {                       \
+        const server_shard_t *shard = &(ctx)->shards[i_];                        \
+        metrics_text_printf((text), "%s{shard=\"%u\"} %llu\n", (name), i_,        \
+                            (unsigned long long)(value));                        \
+    }                                                                            \
+} while (0)
+
+/* 合并各分片中同一位置的直方图 (offset 为其在 metrics_shard_t 中的偏移) */
+static void server_collect_histogram(const server_context_t *ctx, size_t offset,
+                                     metrics_snapshot_t *snap) {
+    memset(snap, 0, sizeof(*snap));
+    for (unsigned i = 0; i < ctx->shard_count; i++) {
+        const char *base = (const char *)&ctx->shards[i].metrics;
+        metrics_snapshot_add(snap, (const metrics_histogram_t *)(base + offset));
+    }
+}
+
+/* 写出一个合并后的直方图 */
+static void server_render_histogram(const server_context_t *ctx, metrics_text_t *text,
+                                    metrics_snapshot_t *snap, size_t offset, const char *name,
+                                    const char *help, unsigned min_shift, unsigned max_shift,
+                                    double scale) {
+    server_collect_histogram(ctx, offset, snap);
+    metrics_text_header(text, name, "histogram", help);
+    metrics_text_histogram(text, name, NULL, snap, min_shift, max_shift, scale);
+}
+
+/*
+ * 以 Prometheus 文本格式输出指标。计数器按分片给出 (shard 标签)，
+ * 直方图在抓取时合并各分片，避免输出随线程数成倍增长。
+ */
+void server_render_metrics(const server_context_t *ctx, metrics_text_t *text) {
+    static const char *const drop_reasons[METRICS_DROP_COUNT] = {
+        [METRICS_DROP_SHED] = "shed",
+        [METRICS_DROP_EVICTED] = "evicted",
+        [METRICS_DROP_SLOW_CONSUMER] = "slow_consumer",
+    };
+    static const char *const reject_reasons[METRICS_REJECT_COUNT] = {
+        [METRICS_REJECT_MESSAGES] = "messages",
+        [METRICS_REJECT_BYTES] = "bytes",
+        [METRICS_REJECT_ACCEPT] = "accept",
+    };
+    metrics_snapshot_t *snap = malloc(sizeof(metrics_snapshot_t));
+    if (!snap) {
+        text->failed = true;
+        return;
+    }
+    
+    metrics_text_header(text, "redrtc_start_time_seconds", "gauge", "服务器启动时间 (Unix 时间)");
+    metrics_text_printf(text, "redrtc_start_time_seconds %llu\n",
+                        (unsigned long long)ctx->startup_time);
     
-    /* 初始化客户端注册表 */
-    if (client_registry_init(&ctx->clients, config->max_clients) != 0) {
-        fprintf(stderr, "客户端注册表初始化失败\n");
-        return -2;
-    }
+    METRICS_PER_SHARD(text, ctx, "redrtc_clients", "gauge", "当前连接数",
+                      client_registry_get_active_count(&shard->clients));
+    METRICS_PER_SHARD(text, ctx, "redrtc_rooms", "gauge", "当前房间数",
+                      room_registry_get_active_count(&shard->rooms));
+    METRICS_PER_SHARD(text, ctx, "redrtc_connections_total", "counter", "接受的连接数",
+                      shard->clients.total_connections);
+    METRICS_PER_SHARD(text, ctx, "redrtc_rooms_created_total", "counter", "创建的房间数",
+                      shard->rooms.total_rooms_created);
+    METRICS_PER_SHARD(text, ctx, "redrtc_messages_received_total", "counter",
+                      "解析成功的客户端消息数",
+                      metrics_read(&shard->metrics.messages_received));
+    METRICS_PER_SHARD(text, ctx, "redrtc_messages_dispatched_total", "counter",
+                      "在本分片上处理的消息数",
+                      metrics_read(&shard->metrics.messages_dispatched));
+    METRICS_PER_SHARD(text, ctx, "redrtc_errors_total", "counter", "解析、转交和处理错误数",
+                      metrics_read(&shard->metrics.errors));
+    METRICS_PER_SHARD(text, ctx, "redrtc_frames_written_total", "counter", "写入套接字的帧数",
+                      metrics_read(&shard->metrics.frames_written));
+    METRICS_PER_SHARD(text, ctx, "redrtc_bytes_written_total", "counter",
+                      "写入套接字的帧负载字节数 (压缩前)",
+                      metrics_read(&shard->metrics.bytes_written));
+    METRICS_PER_SHARD(text, ctx, "redrtc_inbox_overflows_total", "counter",
+                      "因分片收件箱已满丢弃的条目数",
+                      message_queue_overflows(&shard->inbox));
+    METRICS_PER_SHARD(text, ctx, "redrtc_registry_resident_bytes", "gauge",
+                      "注册表中已提交且未归还的槽位块字节数",
+                      slot_region_resident_bytes(&shard->clients.slots) +
+                      slot_region_resident_bytes(&shard->proxies.slots) +
+                      slot_region_resident_bytes(&shard->rooms.slots));
+    METRICS_PER_SHARD(text, ctx, "redrtc_registry_chunks_released_total", "counter",
+                      "空闲后用 madvise 归还的注册表块数",
+                      shard->clients.slots.chunks_released + shard->proxies.slots.chunks_released +
+                      shard->rooms.slots.chunks_released);
     
-    /* 初始化房间注册表 */
-    if (room_registry_init(&ctx->rooms, config->max_rooms) != 0) {
-        fprintf(stderr, "房间注册表初始化失败\n");
-        client_registry_cleanup(&ctx->clients);
-        return -3;
+    metrics_text_header(text, "redrtc_frames_dropped_total", "counter", "背压下丢弃的发送帧数");
+    for (unsigned i = 0; i < ctx->shard_count; i++) {
+        for (unsigned r = 0; r < METRICS_DROP_COUNT; r++) {
+            metrics_text_printf(text,
+                                "redrtc_frames_dropped_total{shard=\"%u\",reason=\"%s\"} %llu\n",
+                                i, drop_reasons[r],
+                                (unsigned long long)metrics_read(&ctx->shards[i].metrics.frames_dropped[r]));
+        }
     }
     
-    /* 初始化消息队列 */
-    if (message_queue_init(&ctx->msg_queue, 1024) != 0) {
-        fprintf(stderr, "消息队列初始化失败\n");
-        room_registry_cleanup(&ctx->rooms);
-        client_registry_cleanup(&ctx->clients);
-        return -4;
+    metrics_text_header(text, "redrtc_admission_rejected_total", "counter",
+                        "准入阶段拒绝的消息 (messages/bytes) 和连接 (accept)");
+    for (unsigned i = 0; i < ctx->shard_count; i++) {
+        for (unsigned r = 0; r < METRICS_REJECT_COUNT; r++) {
+            metrics_text_printf(text,
+                                "redrtc_admission_rejected_total{shard=\"%u\",reason=\"%s\"} %llu\n",
+                                i, reject_reasons[r],
+                                (unsigned long long)metrics_read(&ctx->shards[i].metrics.rejected[r]));
+        }
     }
     
-    /* 设置 libwebsockets 上下文 */
-    struct lws_context_creation_info info;
-    memset(&info, 0, sizeof(info));
+    if (ctx->resume_index.entries) {
+        METRICS_PER_SHARD(text, ctx, "redrtc_detached_clients", "gauge",
+                          "断线后保留会话、等待恢复的客户端数", shard->detached_count);
+        METRICS_PER_SHARD(text, ctx, "redrtc_sessions_resumed_total", "counter",
+                          "凭恢复令牌接替的会话数",
+                          metrics_read(&shard->metrics.sessions_resumed));
+        METRICS_PER_SHARD(text, ctx, "redrtc_sessions_expired_total", "counter",
+                          "保留期内未恢复、离开房间的会话数",
+                          metrics_read(&shard->metrics.sessions_expired));
+    }
     
-    info.port = config->port;
-    info.iface = config->interface;
-    info.protocols = (struct lws_protocols[]){
-        {
-            "webrtc-signaling",
-            webrtc_protocol_callback,
-            sizeof(void*), /* 每个会话数据大小 */
-            4096, /* 接收缓冲区大小 */
-            0, /* ID */
-            NULL, /* 用户数据 */
-            0 /* 发送包大小 */
-        },
-        { NULL, NULL, 0, 0, 0, NULL, 0 } /* 终止符 */
-    };
-    info.gid = -1;
-    info.uid = -1;
-    info.user = ctx;
+    if (ctx->config.compress) {
+        METRICS_PER_SHARD(text, ctx, "redrtc_deflate_frames_total", "counter",
+                          "经 permessage-deflate 压缩发送的帧数",
+                          shard->clients.deflate_stats.frames);
+        METRICS_PER_SHARD(text, ctx, "redrtc_deflate_skipped_total", "counter",
+                          "低于阈值未压缩发送的帧数",
+                          shard->clients.deflate_stats.skipped);
+    }
     
-    /* 创建 libwebsockets 上下文 */
-    ctx->lws_context = lws_create_context(&info);
-    if (!ctx->lws_context) {
-        fprintf(stderr, "创建 libwebsockets 上下文失败\n");
-        message_queue_cleanup(&ctx->msg_queue);
-        room_registry_cleanup(&ctx->rooms);
-        client_registry_cleanup(&ctx->clients);
-        return -5;
+    if (ctx->cluster) {
+        METRICS_PER_SHARD(text, ctx, "redrtc_remote_clients", "gauge",
+                          "其他节点上、在本节点房间中的客户端数",
+                          client_registry_get_active_count(&shard->proxies));
+        metrics_text_header(text, "redrtc_cluster_records_total", "counter", "节点间记录数");
+        metrics_text_printf(text,
+                            "redrtc_cluster_records_total{direction=\"sent\"} %llu\n"
+                            "redrtc_cluster_records_total{direction=\"received\"} %llu\n"
+                            "redrtc_cluster_records_total{direction=\"dropped\"} %llu\n",
+                            (unsigned long long)atomic_load_explicit(&ctx->cluster->records_sent,
+                                                                    memory_order_relaxed),
+                            (unsigned long long)atomic_load_explicit(&ctx->cluster->records_received,
+                                                                    memory_order_relaxed),
+                            (unsigned long long)atomic_load_explicit(&ctx->cluster->records_dropped,
+                                                                    memory_order_relaxed));
     }
     
-    /* 设置信号处理器 */
-    global_ctx = ctx;
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+    server_render_histogram(ctx, text, snap, offsetof(metrics_shard_t, receive_latency),
+                            "redrtc_receive_dispatch_seconds", "收到完整消息到开始处理的延迟",
+                            METRICS_LATENCY_SHIFTS, METRICS_NS_TO_SEC);
+    server_render_histogram(ctx, text, snap, offsetof(metrics_shard_t, write_latency),
+                            "redrtc_dispatch_write_seconds", "开始处理到帧写入套接字的延迟",
+                            METRICS_LATENCY_SHIFTS, METRICS_NS_TO_SEC);
+    server_render_histogram(ctx, text, snap, offsetof(metrics_shard_t, inbox_depth),
+                            "redrtc_inbox_batch_items", "每次唤醒从分片收件箱取出的条目数",
+                            METRICS_DEPTH_SHIFTS, 1.0);
+    server_render_histogram(ctx, text, snap, offsetof(metrics_shard_t, send_queue_depth),
+                            "redrtc_send_queue_depth", "帧入队后客户端发送队列的长度",
+                            METRICS_DEPTH_SHIFTS, 1.0);
+    server_render_histogram(ctx, text, snap, offsetof(metrics_shard_t, frame_bytes),
+                            "redrtc_frame_bytes", "写出帧的负载长度 (压缩前)",
+                            METRICS_BYTES_SHIFTS, 1.0);
     
-    printf("WebRTC 信令服务器初始化完成\n");
-    printf("  端口: %d\n", config->port);
-    printf("  最大客户端数: %zu\n", config->max_clients);
-    printf("  最大房间数: %zu\n", config->max_rooms);
-    printf("  客户端超时时间: %u 秒\n", config->client_timeout_sec);
+    /* 入站消息长度按事件类型分组，只输出出现过的事件 */
+    metrics_text_header(text, "redrtc_message_bytes", "histogram", "入站消息长度 (按事件类型)");
+    for (unsigned t = 0; t < MESSAGE_EVENT_COUNT; t++) {
+        server_collect_histogram(ctx, offsetof(metrics_shard_t, message_bytes) +
+                                      t * sizeof(metrics_histogram_t), snap);
+        if (snap->count == 0) continue;
+        
+        const char *event = message_event_name((message_event_t)t);
+        char labels[64];
+        snprintf(labels, sizeof(labels), "event=\"%s\"", event ? event : "unknown");
+        metrics_text_histogram(text, "redrtc_message_bytes", labels, snap, METRICS_BYTES_SHIFTS, 1.0);
+    }
     
-    return 0;
+    free(snap);
 }
 
-/* 服务器运行函数 */
-int server_run(server_context_t *ctx) {
-    if (!ctx || !ctx->lws_context) return -1;
+/*
+ * 恢复会话的第一步，在新连接所在分片上执行，必须在加入任何房间之前发送。
+ * 从索引中取走令牌即领取了暂离客户端 (此后它不会过期)，新连接改用它的 ID，
+ * 再把请求交给暂离客户端的所属分片接替房间槽位。
+ */
+static void shard_resume_claim(server_shard_t *shard, client_t *client, message_t *msg) {
+    server_context_t *ctx = shard->server;
     
-    ctx->running = true;
-    printf("服务器正在启动...\n");
+    /* 所属分片是本分片且没有在途消息时，房间状态可以在本线程读取 */
+    if (!ctx->resume_index.entries || client->resume_from ||
+        atomic_load_explicit(&client->owner_shard, memory_order_acquire) != shard->index ||
+        atomic_load_explicit(&client->inflight, memory_order_acquire) != 0 || client->room) {
+        client_send_message(client, EVENT_ERROR, "无法恢复会话：未启用会话恢复或已加入房间");
+        metrics_inc(&shard->metrics.errors);
+        return;
+    }
     
-    while (ctx->running) {
-        lws_service(ctx->lws_context, 50); /* 50毫秒超时 */
-        
-        /* 处理队列中的消息 */
-        ws_message_t msg;
-        while (message_queue_pop(&ctx->msg_queue, &msg) == 0) {
-            process_client_message(ctx, msg.wsi, 
-                                 msg.message->event, 
-                                 msg.message->data);
-            message_unref(msg.message);
-        }
-        
-        /* 每10秒清理超时客户端 */
-        static uint32_t last_cleanup = 0;
-        uint32_t now = get_timestamp_sec();
-        if (now - last_cleanup >= 10) {
-            for (size_t i = 0; i < ctx->clients.max_clients; i++) {
-                client_t *client = &ctx->clients.clients[i];
-                if (client->is_alive && 
-                    client_is_timed_out(client, ctx->config.client_timeout_sec)) {
-                    printf("客户端 %s 超时\n", client->id);
-                    client_registry_remove(&ctx->clients, client);
-                }
-            }
-            
-            /* 移除空房间 */
-            room_registry_remove_empty_rooms(&ctx->rooms);
-            last_cleanup = now;
+    json_t *token_json = msg->data ? json_object_get(msg->data, "token") : NULL;
+    const char *token_str = token_json ? json_string_value(token_json) : NULL;
+    id128_t token;
+    client_t *old = NULL;
+    
+    if (token_str && id128_parse(token_str, &token) == 0) {
+        pthread_mutex_lock(&ctx->resume_lock);
+        old = id_table_find(&ctx->resume_index, &token);
+        if (old) {
+            id_table_remove(&ctx->resume_index, &token);
         }
+        pthread_mutex_unlock(&ctx->resume_lock);
+    }
+    if (!old) {
+        client_send_message(client, EVENT_ERROR, "恢复令牌无效或已过期");
+        metrics_inc(&shard->metrics.errors);
+        return;
     }
     
-    return 0;
-}
-
-/* 服务器清理函数 */
-void server_cleanup(server_context_t *ctx) {
-    if (!ctx) return;
+    /* 已领取的暂离客户端不会被释放，它的 ID 和所属分片不再变化 */
+    id128_t own_id = client->id;
+    unsigned owner = atomic_load_explicit(&old->owner_shard, memory_order_acquire);
+    client_registry_rekey(&shard->clients, client, &old->id);
+    client->resume_from = old;
     
-    printf("正在清理服务器...\n");
+    atomic_store_explicit(&client->owner_shard, owner, memory_order_release);
+    client->route_shard = owner;
+    atomic_fetch_add_explicit(&client->inflight, 1, memory_order_relaxed);
+    if (owner == shard->index) {
+        shard_dispatch(shard, client, msg);
+        return;
+    }
     
-    if (ctx->lws_context) {
-        lws_context_destroy(ctx->lws_context);
-        ctx->lws_context = NULL;
+    ws_message_t item = { .kind = WS_MSG_CLIENT, .client = client, .message = msg };
+    if (shard_push(&ctx->shards[owner], &item) == 0) {
+        return;
     }
     
-    message_queue_cleanup(&ctx->msg_queue);
-    room_registry_cleanup(&ctx->rooms);
-    client_registry_cleanup(&ctx->clients);
+    /* 所属分片收件箱已满：撤销领取，暂离客户端照常等待，客户端可以重试 */
+    atomic_fetch_sub_explicit(&client->inflight, 1, memory_order_release);
+    atomic_store_explicit(&client->owner_shard, shard->index, memory_order_release);
+    client->resume_from = NULL;
+    client_registry_rekey(&shard->clients, client, &own_id);
     
-    printf("服务器清理完成\n");
+    pthread_mutex_lock(&ctx->resume_lock);
+    id_table_insert(&ctx->resume_index, &token, old);
+    pthread_mutex_unlock(&ctx->resume_lock);
+    
+    metrics_inc(&shard->metrics.errors);
+    client_send_message(client, EVENT_ERROR, "服务器繁忙，无法恢复会话");
 }
 
-/* 服务器停止函数 */
-void server_stop(server_context_t *ctx) {
-    if (ctx) {
-        ctx->running = false;
+/* 解析一条完整的客户端消息并分发到所属分片 */
+static void shard_receive(server_shard_t *shard, client_t *client, const void *buf, size_t len,
+                          uint64_t received_ns) {
+    /* 转发类消息走零解析中继路径，其余消息完整解析；两者都按长度解析 */
+    message_t *msg;
+    if (client->encoding == CLIENT_ENCODING_MSGPACK) {
+        msg = message_deserialize_msgpack((const unsigned char*)buf, len);
+    } else {
+        msg = message_deserialize_relay((const char*)buf, len);
+        if (!msg) {
+            msg = message_deserialize((const char*)buf, len);
+        }
+    }
+    if (!msg) {
+        metrics_inc(&shard->metrics.errors);
+        return;
+    }
+    
+    msg->received_ns = received_ns;
+    metrics_inc(&shard->metrics.messages_received);
+    metrics_observe(&shard->metrics.message_bytes[msg->type], len);
+    
+    if (msg->type == MESSAGE_EVENT_RESUME_ROOM) {
+        shard_resume_claim(shard, client, msg);
+    } else {
+        shard_route(shard, client, msg);
     }
+    message_unref(msg);
 }
 
-/* WebRTC 协议回调函数 */
+/* WebRTC 协议回调函数 (在连接所属的服务线程上调用) */
 int webrtc_protocol_callback(struct lws *wsi, enum lws_callback_reasons reason,
                             void *user, void *in, size_t len) {
     server_context_t *ctx = (server_context_t*)lws_context_user(lws_get_context(wsi));
+    client_handle_t *session = (client_handle_t*)user;
+    
+    if (!ctx->shards) return 0;
+    server_shard_t *shard = &ctx->shards[lws_get_tsi(wsi)];
     
     switch (reason) {
         case LWS_CALLBACK_ESTABLISHED: {
+            /* 建连准入：超过全局速率时在分配槽位之前关闭，客户端应稍后重连 */
+            if (!token_bucket_take_shared(&ctx->accept_tat_ns, &ctx->accept_rate, 1,
+                                          metrics_clock_ns())) {
+                metrics_inc(&shard->metrics.rejected[METRICS_REJECT_ACCEPT]);
+                LOG_RATELIMITED(LOG_LEVEL_WARN, "超过建连速率限制，拒绝新连接");
+                lws_close_reason(wsi, SERVER_CLOSE_TRY_AGAIN_LATER, NULL, 0);
+                return -1;
+            }
+            
             /* 客户端连接建立 */
-            client_t *client = client_registry_add(&ctx->clients, wsi);
+            client_t *client = client_registry_add(&shard->clients, wsi);
             if (client) {
+                /* 将句柄保存在会话数据中，后续回调 O(1) 定位客户端 */
+                *session = client_registry_handle(&shard->clients, client);
+                
+                const struct lws_protocols *protocol = lws_get_protocol(wsi);
+                if (protocol && protocol->id == CLIENT_ENCODING_MSGPACK) {
+                    client->encoding = CLIENT_ENCODING_MSGPACK;
+                }
+
                 /* 发送客户端ID */
                 json_t *data = json_object();
-                json_object_set_new(data, "clientId", json_string(client->id));
-                client_send_message(client, EVENT_CLIENT_ID, json_dumps(data, 0));
+                json_object_set_new(data, "clientId", json_id(&client->id));
+                if (ctx->resume_index.entries) {
+                    /* 只发给客户端本人，断线重连时凭它恢复会话 */
+                    id128_generate(&client->resume_token);
+                    json_object_set_new(data, "resumeToken", json_id(&client->resume_token));
+                }
+                send_json_frame(client, EVENT_CLIENT_ID, data);
                 json_decref(data);
             }
             break;
@@ -183,31 +1745,70 @@ int webrtc_protocol_callback(struct lws *wsi, enum lws_callback_reasons reason,
         
         case LWS_CALLBACK_RECEIVE: {
             /* 接收客户端消息 */
-            client_t *client = client_registry_find_by_wsi(&ctx->clients, wsi);
+            client_t *client = session ? client_registry_get(&shard->clients, *session) : NULL;
             if (client) {
                 client_update_activity(client);
+                uint64_t now_ns = metrics_clock_ns();
                 
-                message_t *msg = message_deserialize((const char*)in);
-                if (msg) {
-                    message_queue_push(&ctx->msg_queue, wsi, msg);
-                    message_unref(msg); /* 队列已获取引用 */
+                /* 一条消息可能分成多个分片，单个分片也可能分多次回调交付 */
+                bool complete = lws_is_final_fragment(wsi) &&
+                                lws_remaining_packet_payload(wsi) == 0;
+                
+                /* 准入：超过消息或字节速率的消息在复制和解析之前整条丢弃 */
+                if (!client_admit(client, len, complete, now_ns)) {
+                    LOG_RATELIMITED(LOG_LEVEL_WARN, "客户端 " LOG_ID_FMT " 超过速率限制，丢弃消息",
+                                    LOG_ID_ARGS(&client->id));
+                    break;
+                }
+                
+                if (complete && client->recv.len == 0 && len <= shard->clients.max_message_size) {
+                    /* 常见情况：整条消息一次交付，直接解析 lws 的接收缓冲区，不复制 */
+                    shard_receive(shard, client, in, len, now_ns);
                 } else {
-                    ctx->total_errors++;
+                    int ret = client_recv_append(client, in, len);
+                    if (ret != 0) {
+                        /* 超过上限或内存不足：剩余分片无法再与消息对齐，关闭连接 */
+                        client_recv_reset(client);
+                        metrics_inc(&shard->metrics.errors);
+                        if (ret == -1) {
+                            lws_close_reason(wsi, LWS_CLOSE_STATUS_MESSAGE_TOO_LARGE, NULL, 0);
+                        }
+                        return -1;
+                    }
+                    if (complete) {
+                        shard_receive(shard, client, client->recv.data, client->recv.len, now_ns);
+                        client_recv_reset(client);
+                    }
                 }
             }
             break;
         }
         
+        case LWS_CALLBACK_SERVER_WRITEABLE: {
+            /* 套接字可写：写出发送队列中的下一帧 */
+            client_t *client = session ? client_registry_get(&shard->clients, *session) : NULL;
+            if (client && client_on_writable(client) < 0) {
+                return -1;
+            }
+            break;
+        }
+        
         case LWS_CALLBACK_CLOSED: {
-            /* 客户端连接关闭 */
-            client_t *client = client_registry_find_by_wsi(&ctx->clients, wsi);
+            /* 客户端连接关闭：房间状态由所属分片清理，之后再释放槽位 */
+            client_t *client = session ? client_registry_get(&shard->clients, *session) : NULL;
             if (client) {
-                handle_leave_room(ctx, client);
-                client_registry_remove(&ctx->clients, client);
+                client->wsi = NULL;
+                unsigned owner = atomic_load_explicit(&client->owner_shard, memory_order_acquire);
+                shard_push_control(&ctx->shards[owner], client, CLIENT_CONTROL_DISCONNECT);
             }
             break;
         }
         
+        case LWS_CALLBACK_EVENT_WAIT_CANCELLED:
+            /* 其他分片调用了 lws_cancel_service()：处理转交给本分片的工作 */
+            shard_drain(shard);
+            break;
+        
         default:
             break;
     }
@@ -215,35 +1816,266 @@ int webrtc_protocol_callback(struct lws *wsi, enum lws_callback_reasons reason,
     return 0;
 }
 
+/*
+ * 监听套接字的回调：可读时接受一批连接，交给 lws 按 HTTP 连接处理 (之后升级为 WebSocket)，
+ * lws 把它们分配给最空闲的服务线程。热重启排空期间不再接受，关闭本进程中的这份描述符，
+ * 排队的连接留给持有同一套接字的新进程。
+ */
+static int listen_callback(struct lws *wsi, enum lws_callback_reasons reason,
+                           void *user, void *in, size_t len) {
+    (void)user;
+    (void)in;
+    (void)len;
+    
+    if (reason != LWS_CALLBACK_RAW_RX_FILE) return 0;
+    
+    server_context_t *ctx = (server_context_t*)lws_context_user(lws_get_context(wsi));
+    if (atomic_load(&ctx->restart_phase) == SERVER_RESTART_DRAINING) {
+        return -1;
+    }
+    
+    int listen_fd = lws_get_socket_fd(wsi);
+    for (int i = 0; i < SERVER_ACCEPT_BATCH; i++) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+                errno != ECONNABORTED) {
+                LOG_RATELIMITED(LOG_LEVEL_WARN, "accept 失败: %s", strerror(errno));
+            }
+            break;
+        }
+        
+        /* 接管失败时 lws 负责关闭描述符 */
+        if (!lws_adopt_socket_vhost(lws_get_vhost(wsi), fd)) {
+            LOG_RATELIMITED(LOG_LEVEL_WARN, "lws 接管连接失败");
+        }
+    }
+    return 0;
+}
+
+/* 每次可写回调写出的响应体长度 */
+#define SERVER_METRICS_CHUNK 4096
+
+/*
+ * /metrics 请求：在收到请求的服务线程上一次渲染完整响应，
+ * 之后按可写回调分块写出，不阻塞该线程上的其他连接。
+ */
+static int metrics_http_callback(struct lws *wsi, enum lws_callback_reasons reason,
+                                 void *user, void *in, size_t len) {
+    server_context_t *ctx = (server_context_t*)lws_context_user(lws_get_context(wsi));
+    metrics_session_t *session = (metrics_session_t*)user;
+    
+    switch (reason) {
+        case LWS_CALLBACK_HTTP: {
+            unsigned char headers[LWS_PRE + 512];
+            unsigned char *start = headers + LWS_PRE, *p = start;
+            unsigned char *end = headers + sizeof(headers) - 1;
+            
+            metrics_text_free(&session->body);
+            session->sent = 0;
+            if (ctx->shards) {
+                server_render_metrics(ctx, &session->body);
+            }
+            if (!ctx->shards || session->body.failed) {
+                metrics_text_free(&session->body);
+                lws_return_http_status(wsi, HTTP_STATUS_INTERNAL_SERVER_ERROR, NULL);
+                return -1;
+            }
+            
+            if (lws_add_http_common_headers(wsi, HTTP_STATUS_OK, "text/plain; version=0.0.4; charset=utf-8",
+                                            (lws_filepos_t)session->body.len, &p, end) ||
+                lws_finalize_write_http_header(wsi, start, &p, end)) {
+                return 1;
+            }
+            lws_callback_on_writable(wsi);
+            return 0;
+        }
+        
+        case LWS_CALLBACK_HTTP_WRITEABLE: {
+            if (!session->body.data) break;
+            
+            unsigned char buf[LWS_PRE + SERVER_METRICS_CHUNK];
+            size_t n = session->body.len - session->sent;
+            if (n > SERVER_METRICS_CHUNK) n = SERVER_METRICS_CHUNK;
+            bool last = session->sent + n == session->body.len;
+            
+            memcpy(buf + LWS_PRE, session->body.data + session->sent, n);
+            if (lws_write(wsi, buf + LWS_PRE, n, last ? LWS_WRITE_HTTP_FINAL : LWS_WRITE_HTTP) != (int)n) {
+                return -1;
+            }
+            session->sent += n;
+            
+            if (!last) {
+                lws_callback_on_writable(wsi);
+                return 0;
+            }
+            metrics_text_free(&session->body);
+            return lws_http_transaction_completed(wsi) ? -1 : 0;
+        }
+        
+        case LWS_CALLBACK_CLOSED_HTTP:
+            metrics_text_free(&session->body);
+            break;
+        
+        default:
+            break;
+    }
+    
+    return lws_callback_http_dummy(wsi, reason, user, in, len);
+}
+
+/* 客户端可以发送的事件的处理函数 */
+typedef void (*event_handler_fn)(server_shard_t *shard, client_t *client, json_t *data);
+
+static void handle_leave_room_event(server_shard_t *shard, client_t *client, json_t *data) {
+    (void)data;
+    handle_leave_room(shard, client);
+}
+
+/* 客户端请求完整的参与者列表 (例如发现增量事件的版本号不连续时)，回复房间缓存的快照 */
+static void handle_participants_request(server_shard_t *shard, client_t *client, json_t *data) {
+    (void)data;
+    
+    frame_t *snapshot = client->room ? room_snapshot_frame(client->room) : NULL;
+    if (!snapshot) {
+        client_send_message(client, EVENT_ERROR, "未在房间中");
+        metrics_inc(&shard->metrics.errors);
+        return;
+    }
+    
+    client_send_frame(client, snapshot);
+}
+
+/*
+ * 恢复会话的第二步，在暂离客户端的所属分片上执行：新连接接替它在房间中的槽位，
+ * 先收到 resumed，再按原顺序收到暂离期间发给它的帧，最后释放暂离客户端的槽位。
+ * 其余成员看到的 ID 和成员版本都不变。
+ */
+static void handle_resume_room(server_shard_t *shard, client_t *client, json_t *data) {
+    (void)data;
+    client_t *old = client->resume_from;
+    client->resume_from = NULL;
+    
+    if (!old || !old->detached) {
+        client_send_message(client, EVENT_ERROR, "恢复令牌无效或已过期");
+        metrics_inc(&shard->metrics.errors);
+        return;
+    }
+    
+    /* 尚未发出的 ICE 批次先记入重放环 */
+    shard_flush_ice_batch(old);
+    
+    room_t *room = old->room;
+    frame_t *frames[ROOM_REPLAY_CAPACITY];
+    bool complete;
+    size_t count = room_replay_collect(room, old, frames, &complete);
+    shard_detach_end(shard, old);
+    
+    room_replace_participant(room, old, client);
+    client->state = old->state;
+    client->join_time = old->join_time;
+    client->ice_batch_ok = old->ice_batch_ok;
+    old->state = CLIENT_STATE_CONNECTED;
+    
+    /* 一次重放不超过新连接发送队列的高水位 (否则可丢弃的帧会被立即丢弃)，只保留最近的帧 */
+    size_t limit = client->registry->send_high_water ? client->registry->send_high_water
+                                                     : CLIENT_SEND_HIGH_WATER_DEFAULT;
+    if (limit > 1) limit--; /* 留给 resumed */
+    if (count > limit) {
+        for (size_t i = 0; i < count - limit; i++) {
+            frame_unref(frames[i]);
+        }
+        memmove(frames, frames + (count - limit), limit * sizeof(frames[0]));
+        count = limit;
+        complete = false;
+    }
+    
+    /* 为二进制客户端生成的帧无法发给改用 JSON 的新连接 */
+    size_t replayed = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (client->encoding == CLIENT_ENCODING_MSGPACK || !(frames[i]->flags & FRAME_FLAG_BINARY)) {
+            replayed++;
+        }
+    }
+    
+    json_t *resumed = json_object();
+    json_object_set_new(resumed, "clientId", json_id(&client->id));
+    json_object_set_new(resumed, "roomId", json_id(&room->id));
+    json_object_set_new(resumed, "version", json_integer(room->version));
+    json_object_set_new(resumed, "replayed", json_integer((json_int_t)replayed));
+    json_object_set_new(resumed, "complete", json_boolean(complete && replayed == count));
+    send_json_frame(client, EVENT_RESUMED, resumed);
+    json_decref(resumed);
+    
+    for (size_t i = 0; i < count; i++) {
+        client_send_frame(client, frames[i]);
+        frame_unref(frames[i]);
+    }
+    
+    shard_release_client(shard, old);
+    metrics_inc(&shard->metrics.sessions_resumed);
+}
+
+/* 按事件类型分派：新增事件只需在 messages.h 中增加枚举和名称，再在这里登记处理函数 */
+static const event_handler_fn event_handlers[MESSAGE_EVENT_COUNT] = {
+    [MESSAGE_EVENT_JOIN_ROOM]     = handle_join_room,
+    [MESSAGE_EVENT_LEAVE_ROOM]    = handle_leave_room_event,
+    [MESSAGE_EVENT_OFFER]         = handle_offer_message,
+    [MESSAGE_EVENT_ANSWER]        = handle_answer_message,
+    [MESSAGE_EVENT_ICE_CANDIDATE] = handle_ice_candidate,
+    [MESSAGE_EVENT_PARTICIPANTS_LIST] = handle_participants_request,
+    [MESSAGE_EVENT_RESUME_ROOM]   = handle_resume_room,
+};
+
 /* 处理客户端消息函数 */
-void process_client_message(server_context_t *ctx, struct lws *wsi, 
-                           const char *event, json_t *data) {
-    client_t *client = client_registry_find_by_wsi(&ctx->clients, wsi);
-    if (!client) return;
-    
-    ctx->total_messages++;
-    
-    /* 根据事件类型处理消息 */
-    if (strcmp(event, EVENT_JOIN_ROOM) == 0) {
-        handle_join_room(ctx, client, data);
-    } else if (strcmp(event, EVENT_LEAVE_ROOM) == 0) {
-        handle_leave_room(ctx, client);
-    } else if (strcmp(event, EVENT_OFFER) == 0) {
-        handle_offer_message(ctx, client, data);
-    } else if (strcmp(event, EVENT_ANSWER) == 0) {
-        handle_answer_message(ctx, client, data);
-    } else if (strcmp(event, EVENT_ICE_CANDIDATE) == 0) {
-        handle_ice_candidate(ctx, client, data);
+void process_client_message(server_shard_t *shard, client_t *client,
+                           const message_t *msg) {
+    if (!client || !msg) return;
+    
+    /* 处理期间产生的帧记下分派开始时间，写出时得到分派到写出的延迟 */
+    uint64_t now = metrics_clock_ns();
+    shard->metrics.dispatch_ns = now;
+    metrics_inc(&shard->metrics.messages_dispatched);
+    if (msg->received_ns) {
+        metrics_observe(&shard->metrics.receive_latency, now - msg->received_ns);
+    }
+    
+    if (msg->raw) {
+        /* 中继消息在接收时已定位好字段，直接拼接转发 */
+        handle_relay_message(shard, client, msg);
     } else {
-        fprintf(stderr, "未知事件: %s\n", event);
-        ctx->total_errors++;
+        /* 根据事件类型查表处理消息 */
+        event_handler_fn handler = event_handlers[msg->type];
+        if (handler) {
+            handler(shard, client, msg->data);
+        } else {
+            LOG_RATELIMITED(LOG_LEVEL_WARN, "未知事件: %s", msg->event);
+            metrics_inc(&shard->metrics.errors);
+        }
     }
+    
+    shard->metrics.dispatch_ns = 0;
+}
+
+/* 向房间其余成员广播一次成员变化 (participant-joined / participant-left) */
+static void broadcast_membership(room_t *room, client_t *exclude, const char *event,
+                                 const client_t *member) {
+    json_t *data = json_object();
+    json_object_set_new(data, "roomId", json_id(&room->id));
+    json_object_set_new(data, "clientId", json_id(&member->id));
+    json_object_set_new(data, "version", json_integer(room->version));
+    
+    frame_t *frame = frame_create_json(event, data);
+    room_broadcast_frame(room, exclude, frame);
+    frame_unref(frame);
+    json_decref(data);
 }
 
 /* 处理加入房间请求 */
-void handle_join_room(server_context_t *ctx, client_t *client, json_t *data) {
+void handle_join_room(server_shard_t *shard, client_t *client, json_t *data) {
     const char *room_id = NULL;
     const char *room_name = "未命名房间";
+    json_int_t capacity = 0;
     
     if (data) {
         json_t *room_id_json = json_object_get(data, "roomId");
@@ -251,19 +2083,28 @@ void handle_join_room(server_context_t *ctx, client_t *client, json_t *data) {
         
         room_id = room_id_json ? json_string_value(room_id_json) : NULL;
         room_name = room_name_json ? json_string_value(room_name_json) : room_name;
+        
+        /* 新建房间时可申请容量，超过服务器上限时按上限截断 */
+        capacity = json_integer_value(json_object_get(data, "capacity"));
+        if (capacity < 0) capacity = 0;
+        if (capacity > ROOM_MAX_CAPACITY) capacity = ROOM_MAX_CAPACITY;
     }
     
     /* 离开当前房间（如果有） */
-    handle_leave_room(ctx, client);
+    handle_leave_room(shard, client);
+    
+    /* 能力声明：客户端能处理合并后的 ice-candidates 帧 */
+    client->ice_batch_ok = data && json_is_true(json_object_get(data, "iceBatch"));
     
-    /* 查找或创建房间 */
+    /* 查找或创建房间 (无法解析的房间 ID 视为不存在) */
     room_t *room = NULL;
-    if (room_id) {
-        room = room_registry_find_by_id(&ctx->rooms, room_id);
+    id128_t room_key;
+    if (room_id && id128_parse(room_id, &room_key) == 0) {
+        room = room_registry_find_by_id(&shard->rooms, &room_key);
     }
     
     if (!room) {
-        room = room_registry_create(&ctx->rooms, room_name, client);
+        room = room_registry_create(&shard->rooms, room_name, client, (uint16_t)capacity);
         if (!room) {
             client_send_message(client, EVENT_ERROR, "无法创建房间");
             return;
@@ -271,158 +2112,207 @@ void handle_join_room(server_context_t *ctx, client_t *client, json_t *data) {
         
         /* 通知房间创建者 */
         json_t *room_data = json_object();
-        json_object_set_new(room_data, "roomId", json_string(room->id));
+        json_object_set_new(room_data, "roomId", json_id(&room->id));
         json_object_set_new(room_data, "roomName", json_string(room->name));
-        client_send_message(client, EVENT_ROOM_CREATED, json_dumps(room_data, 0));
+        json_object_set_new(room_data, "capacity", json_integer(room->capacity));
+        send_json_frame(client, EVENT_ROOM_CREATED, room_data);
         json_decref(room_data);
     }
     
-    /* 加入房间 */
-    if (room_add_participant(room, client) != 0) {
-        client_send_message(client, EVENT_ERROR, "房间已满（最多6名参与者）");
+    /* 加入房间 (新建房间时 room_init 已将创建者加入) */
+    int joined = client->room == room ? 0 : room_add_participant(room, client);
+    if (joined != 0) {
+        char error[64];
+        switch (joined) {
+            case -1:
+                snprintf(error, sizeof(error), "房间已满（最多%u名参与者）", room->capacity);
+                break;
+            case -3:
+                snprintf(error, sizeof(error), "已在其他房间中");
+                break;
+            default:
+                /* -4: 槽位数组扩容失败 */
+                snprintf(error, sizeof(error), "服务器内部错误，无法加入房间");
+                break;
+        }
+        client_send_message(client, EVENT_ERROR, error);
         return;
     }
     
-    /* 向所有房间成员发送参与者列表 */
-    json_t *participants = json_array();
-    for (int i = 0; i < MAX_PARTICIPANTS; i++) {
-        if (room->participants[i].client) {
-            json_array_append_new(participants, 
-                                json_string(room->participants[i].client->id));
-        }
+    /* 只有新成员收到完整的参与者列表，其余成员只收到一条增量，避免大房间逐个加入时 O(N²) 的流量 */
+    frame_t *snapshot = room_snapshot_frame(room);
+    if (snapshot) {
+        client_send_frame(client, snapshot);
     }
     
-    json_t *participants_data = json_object();
-    json_object_set_new(participants_data, "roomId", json_string(room->id));
-    json_object_set_new(participants_data, "participants", participants);
-    
-    room_broadcast_message(room, NULL, EVENT_PARTICIPANTS_LIST, 
-                          json_dumps(participants_data, 0));
-    json_decref(participants_data);
+    if (room->participant_count > 1) {
+        broadcast_membership(room, client, EVENT_PARTICIPANT_JOINED, client);
+    }
 }
 
 /* 处理离开房间请求 */
-void handle_leave_room(server_context_t *ctx, client_t *client) {
+void handle_leave_room(server_shard_t *shard, client_t *client) {
+    /* 房间在其他节点上：由该节点移除代理 */
+    if (client->cluster_node >= 0) {
+        shard_release_remote(shard, client);
+    }
+    
+    /* 批次由房间所在分片持有，离开前发送 (已断开的客户端发送会失败并丢弃) */
+    shard_flush_ice_batch(client);
+    
     if (client->room) {
         room_t *room = client->room;
         room_remove_participant(room, client);
         
-        /* 更新剩余参与者 */
+        /* 通知剩余参与者 */
         if (!room_is_empty(room)) {
-            json_t *participants = json_array();
-            for (int i = 0; i < MAX_PARTICIPANTS; i++) {
-                if (room->participants[i].client) {
-                    json_array_append_new(participants, 
-                                        json_string(room->participants[i].client->id));
-                }
-            }
-            
-            json_t *participants_data = json_object();
-            json_object_set_new(participants_data, "roomId", json_string(room->id));
-            json_object_set_new(participants_data, "participants", participants);
-            
-            room_broadcast_message(room, NULL, EVENT_PARTICIPANTS_LIST, 
-                                  json_dumps(participants_data, 0));
-            json_decref(participants_data);
+            broadcast_membership(room, NULL, EVENT_PARTICIPANT_LEFT, client);
         }
     }
 }
 
-/* 处理 WebRTC Offer 消息 */
-void handle_offer_message(server_context_t *ctx, client_t *client, json_t *data) {
+/*
+ * 解析转发目标：要求发送者在房间中，目标 ID 可解析且在同一房间。
+ * 房间由当前分片独占，直接在参与者中按二进制 ID 查找 (比较次数不超过房间人数)。
+ * 失败时向发送者回复错误并返回 NULL。
+ */
+static client_t *resolve_target(server_shard_t *shard, client_t *client,
+                                const char *target_client_id, size_t len) {
     if (!client->room) {
         client_send_message(client, EVENT_ERROR, "未在房间中");
-        return;
-    }
-    
-    const char *target_client_id = NULL;
-    json_t *target_json = json_object_get(data, "targetClientId");
-    if (target_json) {
-        target_client_id = json_string_value(target_json);
+        metrics_inc(&shard->metrics.errors);
+        return NULL;
     }
     
     if (!target_client_id) {
         client_send_message(client, EVENT_ERROR, "缺少目标客户端ID");
-        return;
+        metrics_inc(&shard->metrics.errors);
+        return NULL;
     }
     
-    client_t *target = room_find_participant(client->room, target_client_id);
+    id128_t target_id;
+    client_t *target = NULL;
+    if (id128_parse_n(target_client_id, len, &target_id) == 0) {
+        target = room_find_participant(client->room, &target_id);
+    }
     if (!target) {
         client_send_message(client, EVENT_ERROR, "在房间中未找到目标客户端");
+        metrics_inc(&shard->metrics.errors);
+        return NULL;
+    }
+    
+    return target;
+}
+
+/*
+ * 发送不经批次的中继帧。目标有未发出的 ICE 批次时先冲刷，保证之前的 candidate 先于这一帧到达：
+ * ICE 重启或重新协商时新的 offer/answer 不能越过旧 ufrag 的 candidate，同一发送者的 candidate 也不会乱序。
+ */
+static void shard_send_relay(client_t *target, frame_t *frame) {
+    if (target->ice_batch) {
+        shard_flush_ice_batch(target);
+    }
+    room_send_frame(target, frame);
+}
+
+/* 处理中继快速路径消息 (offer/answer/ice-candidate) */
+void handle_relay_message(server_shard_t *shard, client_t *client, const message_t *msg) {
+    client_t *target = resolve_target(shard, client, msg->raw + msg->relay.target_off,
+                                      msg->relay.target_len);
+    if (!target) return;
+    
+    /* 接收者支持合并时，ICE candidate 先留在批次中，窗口到期或批次满时一起发送 */
+    if (msg->type == MESSAGE_EVENT_ICE_CANDIDATE && target->ice_batch_ok && !target->detached &&
+        shard->server->config.ice_batch_ms > 0 &&
+        shard_batch_ice(shard, target, client, msg) == 0) {
         return;
     }
     
+    /* 把 fromClientId 拼接进原始负载；双方编码相同时负载字节只拷贝一次，不同时只转换负载 */
+    frame_t *frame = message_relay_frame(msg, &client->id,
+                                         target->encoding == CLIENT_ENCODING_MSGPACK);
+    if (frame) {
+        /* 背压时过时的 ICE candidate 可以被丢弃 */
+        if (msg->type == MESSAGE_EVENT_ICE_CANDIDATE) {
+            frame->flags |= FRAME_FLAG_DROPPABLE;
+        }
+        shard_send_relay(target, frame);
+        frame_unref(frame);
+    }
+}
+
+/* 处理 WebRTC Offer 消息 */
+void handle_offer_message(server_shard_t *shard, client_t *client, json_t *data) {
+    const char *target_client_id = NULL;
+    json_t *target_json = json_object_get(data, "targetClientId");
+    if (target_json) {
+        target_client_id = json_string_value(target_json);
+    }
+    
+    client_t *target = resolve_target(shard, client, target_client_id,
+                                      target_client_id ? strlen(target_client_id) : 0);
+    if (!target) return;
+    
     /* 转发 offer 到目标客户端 */
     json_t *offer_data = json_object();
-    json_object_set_new(offer_data, "fromClientId", json_string(client->id));
+    json_object_set_new(offer_data, "fromClientId", json_id(&client->id));
     json_object_set_new(offer_data, "offer", json_incref(json_object_get(data, "offer")));
     
-    client_send_message(target, EVENT_OFFER, json_dumps(offer_data, 0));
+    frame_t *frame = frame_create_json(EVENT_OFFER, offer_data);
+    if (frame) {
+        shard_send_relay(target, frame);
+        frame_unref(frame);
+    }
     json_decref(offer_data);
 }
 
 /* 处理 WebRTC Answer 消息 */
-void handle_answer_message(server_context_t *ctx, client_t *client, json_t *data) {
-    if (!client->room) {
-        client_send_message(client, EVENT_ERROR, "未在房间中");
-        return;
-    }
-    
+void handle_answer_message(server_shard_t *shard, client_t *client, json_t *data) {
     const char *target_client_id = NULL;
     json_t *target_json = json_object_get(data, "targetClientId");
     if (target_json) {
         target_client_id = json_string_value(target_json);
     }
     
-    if (!target_client_id) {
-        client_send_message(client, EVENT_ERROR, "缺少目标客户端ID");
-        return;
-    }
-    
-    client_t *target = room_find_participant(client->room, target_client_id);
-    if (!target) {
-        client_send_message(client, EVENT_ERROR, "在房间中未找到目标客户端");
-        return;
-    }
+    client_t *target = resolve_target(shard, client, target_client_id,
+                                      target_client_id ? strlen(target_client_id) : 0);
+    if (!target) return;
     
     /* 转发 answer 到目标客户端 */
     json_t *answer_data = json_object();
-    json_object_set_new(answer_data, "fromClientId", json_string(client->id));
+    json_object_set_new(answer_data, "fromClientId", json_id(&client->id));
     json_object_set_new(answer_data, "answer", json_incref(json_object_get(data, "answer")));
     
-    client_send_message(target, EVENT_ANSWER, json_dumps(answer_data, 0));
+    frame_t *frame = frame_create_json(EVENT_ANSWER, answer_data);
+    if (frame) {
+        shard_send_relay(target, frame);
+        frame_unref(frame);
+    }
     json_decref(answer_data);
 }
 
 /* 处理 ICE Candidate 消息 */
-void handle_ice_candidate(server_context_t *ctx, client_t *client, json_t *data) {
-    if (!client->room) {
-        client_send_message(client, EVENT_ERROR, "未在房间中");
-        return;
-    }
-    
+void handle_ice_candidate(server_shard_t *shard, client_t *client, json_t *data) {
     const char *target_client_id = NULL;
     json_t *target_json = json_object_get(data, "targetClientId");
     if (target_json) {
         target_client_id = json_string_value(target_json);
     }
     
-    if (!target_client_id) {
-        client_send_message(client, EVENT_ERROR, "缺少目标客户端ID");
-        return;
-    }
-    
-    client_t *target = room_find_participant(client->room, target_client_id);
-    if (!target) {
-        client_send_message(client, EVENT_ERROR, "在房间中未找到目标客户端");
-        return;
-    }
+    client_t *target = resolve_target(shard, client, target_client_id,
+                                      target_client_id ? strlen(target_client_id) : 0);
+    if (!target) return;
     
     /* 转发 ICE candidate 到目标客户端 */
     json_t *candidate_data = json_object();
-    json_object_set_new(candidate_data, "fromClientId", json_string(client->id));
+    json_object_set_new(candidate_data, "fromClientId", json_id(&client->id));
     json_object_set_new(candidate_data, "candidate", json_incref(json_object_get(data, "candidate")));
     
-    client_send_message(target, EVENT_ICE_CANDIDATE, json_dumps(candidate_data, 0));
+    frame_t *frame = frame_create_json(EVENT_ICE_CANDIDATE, candidate_data);
+    if (frame) {
+        frame->flags |= FRAME_FLAG_DROPPABLE;
+        shard_send_relay(target, frame);
+        frame_unref(frame);
+    }
     json_decref(candidate_data);
 }
\ No newline at end of file
@@ -0,0 +1,161 @@
+/**
+ * @file slot_region.c
+ * @brief 按块提交、空闲块归还物理页的定长槽位数组，承载客户端和房间注册表。
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/slot_region.h"
+
+int slot_region_init(slot_region_t *region, size_t slot_size, size_t max_slots,
+                     uint32_t generation_offset) {
+    memset(region, 0, sizeof(*region));
+    if (slot_size == 0 || slot_size % CACHE_LINE_SIZE != 0 ||
+        max_slots == 0 || max_slots >= SLOT_REGION_NONE) {
+        return -1;
+    }
+
+    size_t chunk_count = (max_slots + SLOT_REGION_CHUNK_SLOTS - 1) >> SLOT_REGION_CHUNK_SHIFT;
+    size_t slots = chunk_count << SLOT_REGION_CHUNK_SHIFT;
+    if (slots > SIZE_MAX / slot_size) return -1;
+
+    region->slot_size = slot_size;
+    region->max_slots = max_slots;
+    region->reserved_bytes = slots * slot_size;
+    region->generation_offset = generation_offset;
+    region->chunk_count = chunk_count;
+
+    region->base = vm_reserve(region->reserved_bytes);
+    region->next_free = vm_reserve(slots * sizeof(uint32_t));
+    region->chunks = calloc(chunk_count, sizeof(slot_chunk_t));
+    region->available = calloc((chunk_count + 63) / 64, sizeof(uint64_t));
+    if (!region->base || !region->next_free || !region->chunks || !region->available ||
+        vm_commit(region->next_free, slots * sizeof(uint32_t), false) != 0) {
+        slot_region_cleanup(region);
+        return -1;
+    }
+
+    for (size_t c = 0; c < chunk_count; c++) {
+        region->chunks[c].free_head = SLOT_REGION_NONE;
+        region->available[c / 64] |= 1ULL << (c % 64);
+    }
+    return 0;
+}
+
+void slot_region_cleanup(slot_region_t *region) {
+    size_t slots = region->chunk_count << SLOT_REGION_CHUNK_SHIFT;
+
+    vm_unreserve(region->base, region->reserved_bytes);
+    vm_unreserve(region->next_free, slots * sizeof(uint32_t));
+    free(region->chunks);
+    free(region->available);
+    memset(region, 0, sizeof(*region));
+}
+
+/* 块中的槽位数：最后一块可能不满 */
+static uint32_t slot_chunk_limit(const slot_region_t *region, size_t c) {
+    size_t first = c << SLOT_REGION_CHUNK_SHIFT;
+    size_t left = region->max_slots - first;
+    return left < SLOT_REGION_CHUNK_SLOTS ? (uint32_t)left : SLOT_REGION_CHUNK_SLOTS;
+}
+
+void *slot_region_alloc(slot_region_t *region, uint32_t *index) {
+    /* 编号最小的有空位的块 */
+    size_t c = SIZE_MAX;
+    for (size_t w = 0; w < (region->chunk_count + 63) / 64; w++) {
+        if (region->available[w]) {
+            c = w * 64 + (size_t)__builtin_ctzll(region->available[w]);
+            break;
+        }
+    }
+    if (c == SIZE_MAX) return NULL;
+
+    slot_chunk_t *chunk = &region->chunks[c];
+    bool was_idle = chunk->live == 0 && chunk->fresh > 0;
+    uint32_t slot;
+    if (chunk->free_head != SLOT_REGION_NONE) {
+        slot = chunk->free_head;
+        chunk->free_head = region->next_free[slot];
+    } else {
+        if (!chunk->committed) {
+            if (vm_commit(region->base + c * slot_region_chunk_bytes(region),
+                          slot_region_chunk_bytes(region), region->huge_pages) != 0) {
+                return NULL;
+            }
+            chunk->committed = true;
+            region->committed_chunks++;
+        }
+        if (chunk->fresh == 0) region->resident_chunks++;
+
+        slot = (uint32_t)(c << SLOT_REGION_CHUNK_SHIFT) + chunk->fresh++;
+        if (region->generation_offset != SLOT_REGION_NONE && chunk->generation_floor) {
+            memcpy(region->base + (size_t)slot * region->slot_size + region->generation_offset,
+                   &chunk->generation_floor, sizeof(uint32_t));
+        }
+    }
+
+    /* 块在等待归还时又被用上 */
+    if (was_idle) region->idle_chunks--;
+    chunk->live++;
+    if (chunk->free_head == SLOT_REGION_NONE && chunk->fresh == slot_chunk_limit(region, c)) {
+        region->available[c / 64] &= ~(1ULL << (c % 64));
+    }
+
+    *index = slot;
+    return region->base + (size_t)slot * region->slot_size;
+}
+
+void slot_region_free(slot_region_t *region, uint32_t index) {
+    size_t c = index >> SLOT_REGION_CHUNK_SHIFT;
+    slot_chunk_t *chunk = &region->chunks[c];
+
+    region->next_free[index] = chunk->free_head;
+    chunk->free_head = index;
+    region->available[c / 64] |= 1ULL << (c % 64);
+
+    if (--chunk->live == 0) {
+        chunk->idle_since = coarse_clock_sec();
+        region->idle_chunks++;
+    }
+}
+
+/* 记录块内的最大代数，然后归还槽位和空闲链表的物理页 */
+static void slot_chunk_release(slot_region_t *region, size_t c) {
+    slot_chunk_t *chunk = &region->chunks[c];
+    size_t first = c << SLOT_REGION_CHUNK_SHIFT;
+    unsigned char *start = region->base + first * region->slot_size;
+
+    if (region->generation_offset != SLOT_REGION_NONE) {
+        uint32_t floor = chunk->generation_floor;
+        for (uint32_t i = 0; i < chunk->fresh; i++) {
+            uint32_t generation;
+            memcpy(&generation, start + (size_t)i * region->slot_size + region->generation_offset,
+                   sizeof(generation));
+            if (generation > floor) floor = generation;
+        }
+        chunk->generation_floor = floor;
+    }
+
+    vm_decommit(start, slot_region_chunk_bytes(region));
+    vm_decommit(&region->next_free[first], SLOT_REGION_CHUNK_SLOTS * sizeof(uint32_t));
+
+    chunk->free_head = SLOT_REGION_NONE;
+    chunk->fresh = 0;
+    region->resident_chunks--;
+    region->idle_chunks--;
+    region->chunks_released++;
+}
+
+size_t slot_region_trim(slot_region_t *region, uint32_t now, uint32_t idle_sec) {
+    size_t released = 0;
+
+    for (size_t c = region->chunk_count; c-- > 0 && region->idle_chunks > 0; ) {
+        slot_chunk_t *chunk = &region->chunks[c];
+        if (chunk->live == 0 && chunk->fresh > 0 && now - chunk->idle_since >= idle_sec) {
+            slot_chunk_release(region, c);
+            released++;
+        }
+    }
+    return released;
+}
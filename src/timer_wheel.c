@@ -0,0 +1,153 @@
+/**
+ * @file timer_wheel.c
+ * @brief 以秒为刻度的分层时间轮，用于客户端超时：按到期时间挂载，推进时只触及到期的节点。
+ */
+
+#include <string.h>
+
+#include "../include/timer_wheel.h"
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+
+void timer_wheel_init(timer_wheel_t *wheel, uint32_t now) {
+    memset(wheel->slots, 0, sizeof(wheel->slots));
+    wheel->pending = NULL;
+    wheel->now = now;
+    wheel->count = 0;
+}
+
+/* 把节点链入槽位头部 */
+static void timer_slot_link(timer_node_t **slot, timer_node_t *node) {
+    node->next = *slot;
+    if (node->next) node->next->pprev = &node->next;
+    node->pprev = slot;
+    *slot = node;
+}
+
+static void timer_node_unlink(timer_node_t *node) {
+    *node->pprev = node->next;
+    if (node->next) node->next->pprev = node->pprev;
+    node->next = NULL;
+    node->pprev = NULL;
+}
+
+/*
+ * 按到期时间与当前时刻的距离选择层级：
+ * 64 秒内放第 0 层，逐秒检查；同一 4096 秒段内放第 1 层，段首迁移到第 0 层；
+ * 同一 2^18 秒段内放第 2 层。更远的到期时间先挂在本段末尾，到时重新挂载。
+ * earliest 为最早可放入的时刻：迁移发生在处理第 0 层当前槽位之前，可以是当前时刻，
+ * 其他情况下当前时刻已处理过，只能从下一秒开始。
+ */
+static void timer_wheel_place(timer_wheel_t *wheel, timer_node_t *node, uint32_t earliest) {
+    uint32_t now = wheel->now;
+    uint32_t at = node->expires;
+
+    if ((int32_t)(at - earliest) < 0) {
+        at = earliest;
+    } else if ((at ^ now) >= TIMER_WHEEL_RANGE) {
+        at = now | (TIMER_WHEEL_RANGE - 1);
+        if (at == now) at = now + 1;
+    }
+
+    timer_node_t **slot;
+    if (at - now < TIMER_WHEEL_SLOTS) {
+        slot = &wheel->slots[0][at & TIMER_WHEEL_MASK];
+    } else if ((at ^ now) < (1u << (TIMER_WHEEL_BITS * 2))) {
+        slot = &wheel->slots[1][(at >> TIMER_WHEEL_BITS) & TIMER_WHEEL_MASK];
+    } else {
+        slot = &wheel->slots[2][(at >> (TIMER_WHEEL_BITS * 2)) & TIMER_WHEEL_MASK];
+    }
+
+    timer_slot_link(slot, node);
+}
+
+void timer_wheel_add(timer_wheel_t *wheel, timer_node_t *node, uint32_t expires) {
+    timer_wheel_remove(wheel, node);
+    node->expires = expires;
+    timer_wheel_place(wheel, node, wheel->now + 1);
+    wheel->count++;
+}
+
+void timer_wheel_remove(timer_wheel_t *wheel, timer_node_t *node) {
+    if (!node->pprev) return;
+
+    timer_node_unlink(node);
+    wheel->count--;
+}
+
+/* 把槽位上的链表整体移到时间轮的临时链表，回调中摘除其中的节点仍然安全 */
+static void timer_slot_take(timer_wheel_t *wheel, timer_node_t **slot) {
+    wheel->pending = *slot;
+    *slot = NULL;
+    if (wheel->pending) wheel->pending->pprev = &wheel->pending;
+}
+
+/* 把一个高层槽位的节点按当前时刻重新分配到低层 */
+static void timer_wheel_cascade(timer_wheel_t *wheel, timer_node_t **slot) {
+    timer_slot_take(wheel, slot);
+
+    while (wheel->pending) {
+        timer_node_t *node = wheel->pending;
+        timer_node_unlink(node);
+        timer_wheel_place(wheel, node, wheel->now);
+    }
+}
+
+/* 处理临时链表：已到期的交给回调，其余 (提前挂载的远期节点) 重新挂载 */
+static size_t timer_wheel_fire(timer_wheel_t *wheel, timer_expire_fn expire, void *arg) {
+    size_t fired = 0;
+
+    while (wheel->pending) {
+        timer_node_t *node = wheel->pending;
+        timer_node_unlink(node);
+
+        if ((int32_t)(node->expires - wheel->now) > 0) {
+            timer_wheel_place(wheel, node, wheel->now + 1);
+        } else {
+            wheel->count--;
+            fired++;
+            expire(node, arg);
+        }
+    }
+    return fired;
+}
+
+size_t timer_wheel_advance(timer_wheel_t *wheel, uint32_t now, timer_expire_fn expire, void *arg) {
+    if ((int32_t)(now - wheel->now) <= 0) return 0;
+
+    if (wheel->count == 0) {
+        wheel->now = now;
+        return 0;
+    }
+
+    /* 时钟跳跃超过整个时间轮范围：一次性收集全部节点统一处理 */
+    if (now - wheel->now >= TIMER_WHEEL_RANGE) {
+        for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+            for (unsigned i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+                while (wheel->slots[level][i]) {
+                    timer_node_t *node = wheel->slots[level][i];
+                    timer_node_unlink(node);
+                    timer_slot_link(&wheel->pending, node);
+                }
+            }
+        }
+        wheel->now = now;
+        return timer_wheel_fire(wheel, expire, arg);
+    }
+
+    size_t fired = 0;
+    while (wheel->now != now) {
+        uint32_t t = ++wheel->now;
+
+        if ((t & ((1u << (TIMER_WHEEL_BITS * 2)) - 1)) == 0) {
+            timer_wheel_cascade(wheel, &wheel->slots[2][(t >> (TIMER_WHEEL_BITS * 2)) & TIMER_WHEEL_MASK]);
+        }
+        if ((t & TIMER_WHEEL_MASK) == 0) {
+            timer_wheel_cascade(wheel, &wheel->slots[1][(t >> TIMER_WHEEL_BITS) & TIMER_WHEEL_MASK]);
+        }
+
+        timer_slot_take(wheel, &wheel->slots[0][t & TIMER_WHEEL_MASK]);
+        fired += timer_wheel_fire(wheel, expire, arg);
+    }
+    return fired;
+}
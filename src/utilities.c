@@ -1,35 +1,232 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/random.h>
 
 #include "../include/utilities.h"
 
-/**
- * @brief 生成一个唯一的 UUID (通用唯一标识符)
- * @param buffer 存储 UUID 的缓冲区
- * @param size 缓冲区的大小
+/*
+ * ID 生成器：每个线程一个 ChaCha20 密钥流 (20 轮，64 位块计数器 + 64 位 nonce)，
+ * 密钥和 nonce 在线程第一次生成 ID 时取自 getrandom()。每个 64 字节的块产生 4 个 ID，
+ * 不加锁、不进内核。不同线程、不同连接的 ID 只取决于各自的随机密钥，
+ * 同一微秒内的连接不会再得到相同的 ID。fork 之后子进程的所有线程重新取种子，
+ * 避免与父进程输出相同的序列。
  */
-void generate_uuid(char *buffer, size_t size) {
-    if (size < 37) return;
+#define ID_RNG_ROUNDS 20
+#define ID_RNG_WORDS 16
+
+typedef struct id_rng_s {
+    uint32_t state[ID_RNG_WORDS];  /* 常量、密钥、块计数器、nonce */
+    uint32_t block[ID_RNG_WORDS];  /* 当前块的密钥流 */
+    unsigned used;                 /* 已取用的字数 */
+    unsigned epoch;                /* 取种子时的 fork 代数 */
+    bool seeded;
+} id_rng_t;
+
+static _Thread_local id_rng_t id_rng;
+static atomic_uint id_rng_epoch = 0;
+static atomic_uint_fast64_t id_rng_fallback = 0;
+static pthread_once_t id_rng_once = PTHREAD_ONCE_INIT;
+
+static void id_rng_after_fork(void) {
+    atomic_fetch_add_explicit(&id_rng_epoch, 1, memory_order_relaxed);
+}
+
+static void id_rng_register_fork(void) {
+    pthread_atfork(NULL, NULL, id_rng_after_fork);
+}
+
+/* 填满 buf：getrandom()，不可用时读 /dev/urandom；都失败返回 -1 */
+static int id_rng_entropy(void *buf, size_t len) {
+    unsigned char *p = buf;
+    size_t got = 0;
     
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
+    while (got < len) {
+        ssize_t n = getrandom(p + got, len - got, 0);
+        if (n > 0) {
+            got += (size_t)n;
+        } else if (n < 0 && errno != EINTR) {
+            break;
+        }
+    }
+    if (got == len) return 0;
+    
+    FILE *urandom = fopen("/dev/urandom", "rb");
+    if (!urandom) return -1;
+    got = fread(p, 1, len, urandom);
+    fclose(urandom);
+    return got == len ? 0 : -1;
+}
+
+static void id_rng_seed(id_rng_t *rng) {
+    pthread_once(&id_rng_once, id_rng_register_fork);
+    
+    /* "expand 32-byte k" */
+    rng->state[0] = 0x61707865;
+    rng->state[1] = 0x3320646e;
+    rng->state[2] = 0x79622d32;
+    rng->state[3] = 0x6b206574;
+    
+    uint32_t seed[10];
+    if (id_rng_entropy(seed, sizeof(seed)) != 0) {
+        /* 没有熵源 (极少见)：退化为时间、进程、线程和全局序号，仍保证进程内不重复 */
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint64_t mix[5] = {
+            (uint64_t)ts.tv_sec, (uint64_t)ts.tv_nsec, (uint64_t)getpid(),
+            (uint64_t)(uintptr_t)rng,
+            atomic_fetch_add_explicit(&id_rng_fallback, 1, memory_order_relaxed)
+        };
+        memcpy(seed, mix, sizeof(seed));
+    }
+    memcpy(&rng->state[4], seed, 8 * sizeof(uint32_t));
+    rng->state[12] = 0;
+    rng->state[13] = 0;
+    rng->state[14] = seed[8];
+    rng->state[15] = seed[9];
+    
+    rng->used = ID_RNG_WORDS;
+    rng->epoch = atomic_load_explicit(&id_rng_epoch, memory_order_relaxed);
+    rng->seeded = true;
+}
+
+#define ID_RNG_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define ID_RNG_QUARTER(a, b, c, d) do {                                     \
+    a += b; d ^= a; d = ID_RNG_ROTL(d, 16);                                 \
+    c += d; b ^= c; b = ID_RNG_ROTL(b, 12);                                 \
+    a += b; d ^= a; d = ID_RNG_ROTL(d, 8);                                  \
+    c += d; b ^= c; b = ID_RNG_ROTL(b, 7);                                  \
+} while (0)
+
+/* 生成下一个 ChaCha20 块 */
+static void id_rng_refill(id_rng_t *rng) {
+    uint32_t x[ID_RNG_WORDS];
+    memcpy(x, rng->state, sizeof(x));
+    
+    for (int i = 0; i < ID_RNG_ROUNDS; i += 2) {
+        ID_RNG_QUARTER(x[0], x[4], x[8], x[12]);
+        ID_RNG_QUARTER(x[1], x[5], x[9], x[13]);
+        ID_RNG_QUARTER(x[2], x[6], x[10], x[14]);
+        ID_RNG_QUARTER(x[3], x[7], x[11], x[15]);
+        ID_RNG_QUARTER(x[0], x[5], x[10], x[15]);
+        ID_RNG_QUARTER(x[1], x[6], x[11], x[12]);
+        ID_RNG_QUARTER(x[2], x[7], x[8], x[13]);
+        ID_RNG_QUARTER(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < ID_RNG_WORDS; i++) {
+        rng->block[i] = x[i] + rng->state[i];
+    }
     
-    unsigned int seed = (unsigned int)(tv.tv_sec ^ tv.tv_usec ^ getpid());
+    if (++rng->state[12] == 0) rng->state[13]++;
+    rng->used = 0;
+}
+
+/**
+ * @brief 生成一个 128 位二进制 ID (UUID v4 布局)
+ * @param id 输出 ID
+ */
+void id128_generate(id128_t *id) {
+    id_rng_t *rng = &id_rng;
+    if (!rng->seeded || rng->epoch != atomic_load_explicit(&id_rng_epoch, memory_order_relaxed)) {
+        id_rng_seed(rng);
+    }
+    if (rng->used > ID_RNG_WORDS - 4) {
+        id_rng_refill(rng);
+    }
+    
+    const uint32_t *w = &rng->block[rng->used];
+    rng->used += 4;
+    id->hi = ((uint64_t)w[0] << 32) | w[1];
+    id->lo = ((uint64_t)w[2] << 32) | w[3];
     
-    snprintf(buffer, size,
-            "%08x-%04x-4%03x-%04x-%08x%04x",
-            rand_r(&seed) & 0xffffffff,
-            rand_r(&seed) & 0xffff,
-            rand_r(&seed) & 0x0fff,
-            (rand_r(&seed) & 0x3fff) | 0x8000,
-            rand_r(&seed) & 0xffffffff,
-            rand_r(&seed) & 0xffff);
+    /* 版本 4 与 RFC 4122 变体位 */
+    id->hi = (id->hi & ~0xf000ULL) | 0x4000ULL;
+    id->lo = (id->lo & 0x3fffffffffffffffULL) | 0x8000000000000000ULL;
+}
+
+/* 每个字节对应的两个十六进制字符 */
+static const char id128_hex_pairs[513] =
+    "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
 
+/* 十六进制字符的值加一，0 表示不是十六进制字符 */
+static const uint8_t id128_hex_values[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+/**
+ * @brief 将 128 位 ID 格式化为 UUID 文本
+ *
+ * 每个字节查一次两字符表，只在 ID 需要发送或打印时调用。
+ * @param id 要格式化的 ID
+ * @param buffer 输出缓冲区，至少 ID128_STR_LEN 字节
+ */
+void id128_format(const id128_t *id, char *buffer) {
+    char *p = buffer;
     
+    for (int i = 0; i < 16; i++) {
+        uint64_t word = i < 8 ? id->hi : id->lo;
+        unsigned byte = (unsigned)(word >> ((7 - (i & 7)) * 8)) & 0xff;
+        
+        memcpy(p, &id128_hex_pairs[byte * 2], 2);
+        p += 2;
+        if (i == 3 || i == 5 || i == 7 || i == 9) *p++ = '-';
+    }
+    *p = '\0';
 }
 
+/**
+ * @brief 解析 UUID 文本为 128 位 ID
+ * @param str UUID 文本 (8-4-4-4-12，不区分大小写)
+ * @param id 输出 ID
+ * @return 0 成功，-1 格式无效
+ */
+int id128_parse(const char *str, id128_t *id) {
+    if (!str) return -1;
+    return id128_parse_n(str, strnlen(str, ID128_STR_LEN), id);
+}
+
+/**
+ * @brief 解析定长 UUID 文本 (无需空终止符)
+ * @param str UUID 文本
+ * @param len 文本长度，必须为 36
+ * @param id 输出 ID
+ * @return 0 成功，-1 格式无效
+ */
+int id128_parse_n(const char *str, size_t len, id128_t *id) {
+    if (!str || !id || len != ID128_STR_LEN - 1) return -1;
+    if (str[8] != '-' || str[13] != '-' || str[18] != '-' || str[23] != '-') return -1;
+    
+    uint64_t words[2] = { 0, 0 };
+    int digits = 0;
+    
+    for (int i = 0; i < ID128_STR_LEN - 1; i++) {
+        if (i == 8 || i == 13 || i == 18 || i == 23) continue;
+        
+        unsigned v = id128_hex_values[(unsigned char)str[i]];
+        if (v == 0) return -1;
+        
+        words[digits >> 4] = (words[digits >> 4] << 4) | (uint64_t)(v - 1);
+        digits++;
+    }
+    
+    id->hi = words[0];
+    id->lo = words[1];
+    return 0;
+}
 
 /**
  * @brief 获取当前时间戳，单位为毫秒
@@ -49,6 +246,178 @@ uint32_t get_timestamp_sec(void) {
     return (uint32_t)time(NULL);
 }
 
+atomic_uint_least32_t coarse_clock_now = 0;
+
+/**
+ * @brief 刷新粗粒度时钟
+ *
+ * 每个服务线程在每轮循环和每秒的定时器中调用，值未变化时不写入，避免无谓的缓存行争用。
+ * @return 刷新后的时间戳，单位为秒
+ */
+uint32_t coarse_clock_update(void) {
+    uint32_t now = get_timestamp_sec();
+    if (atomic_load_explicit(&coarse_clock_now, memory_order_relaxed) != now) {
+        atomic_store_explicit(&coarse_clock_now, now, memory_order_relaxed);
+    }
+    return now;
+}
+
+/**
+ * @brief 分配按缓存行对齐并清零的数组
+ *
+ * 首个字段按缓存行对齐的结构体 (如 client_t) 需要数组本身也对齐，
+ * 否则热字段会跨越两个缓存行。
+ * @param count 元素数量
+ * @param size 元素大小
+ * @return 数组指针，溢出或内存不足时返回 NULL，用 free() 释放
+ */
+void *cache_aligned_calloc(size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) return NULL;
+    
+    /* aligned_alloc 要求长度是对齐值的整数倍 */
+    size_t bytes = (count * size + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+    void *ptr = aligned_alloc(CACHE_LINE_SIZE, bytes ? bytes : CACHE_LINE_SIZE);
+    if (ptr) {
+        memset(ptr, 0, bytes);
+    }
+    return ptr;
+}
+
+/**
+ * @brief 系统页大小
+ * @return 页大小，单位为字节
+ */
+size_t vm_page_size(void) {
+    static size_t page_size;
+    if (!page_size) {
+        long size = sysconf(_SC_PAGESIZE);
+        page_size = size > 0 ? (size_t)size : 4096;
+    }
+    return page_size;
+}
+
+/**
+ * @brief 保留一段地址空间，不可访问也不计入提交内存
+ *
+ * 不小于一个大页的区域按大页边界对齐，使提交后的连续块可以由透明大页承载。
+ * @param bytes 区域长度，按页取整
+ * @return 区域起始地址，失败返回 NULL，用 vm_unreserve() 释放
+ */
+void *vm_reserve(size_t bytes) {
+    size_t page = vm_page_size();
+    bytes = (bytes + page - 1) & ~(page - 1);
+    if (bytes == 0) return NULL;
+    
+    size_t align = bytes >= VM_HUGE_PAGE_SIZE ? VM_HUGE_PAGE_SIZE : page;
+    size_t span = bytes + align - page;
+    if (span < bytes) return NULL;
+    
+    unsigned char *base = mmap(NULL, span, PROT_NONE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) return NULL;
+    
+    /* 裁掉对齐前后多余的部分 */
+    unsigned char *aligned = (unsigned char *)(((uintptr_t)base + align - 1) & ~(uintptr_t)(align - 1));
+    if (aligned > base) {
+        munmap(base, (size_t)(aligned - base));
+    }
+    size_t tail = (size_t)((base + span) - (aligned + bytes));
+    if (tail > 0) {
+        munmap(aligned + bytes, tail);
+    }
+    return aligned;
+}
+
+/**
+ * @brief 把保留区中的一段设为可读写
+ * @param addr 起始地址，按页对齐
+ * @param bytes 长度
+ * @param huge_pages 建议内核用透明大页承载
+ * @return 成功返回 0，失败返回 -1 (提交内存不足)
+ */
+int vm_commit(void *addr, size_t bytes, bool huge_pages) {
+    if (mprotect(addr, bytes, PROT_READ | PROT_WRITE) != 0) return -1;
+#ifdef MADV_HUGEPAGE
+    if (huge_pages) {
+        madvise(addr, bytes, MADV_HUGEPAGE);
+    }
+#else
+    (void)huge_pages;
+#endif
+    return 0;
+}
+
+/**
+ * @brief 把已提交区域的物理页还给系统，区域保持可读写，再次访问时为零
+ *
+ * 只归还完全落在区域内的页。
+ * @param addr 起始地址
+ * @param bytes 长度
+ */
+void vm_decommit(void *addr, size_t bytes) {
+    size_t page = vm_page_size();
+    uintptr_t start = ((uintptr_t)addr + page - 1) & ~(uintptr_t)(page - 1);
+    uintptr_t end = ((uintptr_t)addr + bytes) & ~(uintptr_t)(page - 1);
+    if (end > start) {
+        madvise((void *)start, end - start, MADV_DONTNEED);
+    }
+}
+
+/**
+ * @brief 释放 vm_reserve() 保留的区域
+ * @param addr 区域起始地址 (可以为 NULL)
+ * @param bytes 保留时的长度
+ */
+void vm_unreserve(void *addr, size_t bytes) {
+    if (!addr) return;
+    size_t page = vm_page_size();
+    munmap(addr, (bytes + page - 1) & ~(page - 1));
+}
+
+/**
+ * @brief 设置令牌桶速率
+ * @param rate 输出速率参数
+ * @param per_sec 每秒的单位数，0 表示不限速 (不超过 1e9)
+ * @param burst 可以一次透支的单位数，至少为 1
+ */
+void token_rate_init(token_rate_t *rate, uint64_t per_sec, uint64_t burst) {
+    if (per_sec == 0) {
+        rate->interval_ns = 0;
+        rate->tolerance_ns = 0;
+        return;
+    }
+    if (per_sec > 1000000000ULL) per_sec = 1000000000ULL;
+    if (burst == 0) burst = 1;
+    
+    rate->interval_ns = 1000000000ULL / per_sec;
+    rate->tolerance_ns = burst * rate->interval_ns;
+}
+
+/**
+ * @brief 从多个线程共享的令牌桶中取出 cost 个单位 (CAS 循环)
+ * @param tat_ns 共享的理论到达时间
+ * @param rate 速率参数
+ * @param cost 单位数
+ * @param now_ns 当前单调时钟 (纳秒)
+ * @return 取出成功返回 true，不足时返回 false 且不扣除
+ */
+bool token_bucket_take_shared(_Atomic uint64_t *tat_ns, const token_rate_t *rate,
+                              uint64_t cost, uint64_t now_ns) {
+    if (rate->interval_ns == 0) return true;
+    
+    uint64_t cur = atomic_load_explicit(tat_ns, memory_order_relaxed);
+    for (;;) {
+        uint64_t tat = cur > now_ns ? cur : now_ns;
+        uint64_t next = tat + cost * rate->interval_ns;
+        if (next - now_ns > rate->tolerance_ns) return false;
+        
+        if (atomic_compare_exchange_weak_explicit(tat_ns, &cur, next, memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+            return true;
+        }
+    }
+}
+
 /**
  * @brief 安全地复制字符串，防止缓冲区溢出
  * @param dest 目标缓冲区
@@ -84,66 +453,282 @@ int safe_strncat(char *dest, const char *src, size_t dest_size) {
     return safe_strncpy(dest + dest_len, src, dest_size - dest_len);
 }
 
+/* 块头：记录所属池和大小级别，释放时无需调用者提供池 */
+typedef union memory_pool_header_u {
+    struct {
+        memory_pool_t *pool;
+        uint32_t size_class;
+    } h;
+    max_align_t align;
+} memory_pool_header_t;
+
+/* 超出最大级别或池已满时直接使用 malloc 的块 */
+#define MEMORY_POOL_LARGE UINT32_MAX
+
+/* 空闲块的链接保存在块头之后的用户区 */
+#define MEMORY_POOL_NEXT(hdr) (*(void **)((memory_pool_header_t *)(hdr) + 1))
+
+/* 当前线程拥有的内存池和临时分配区 */
+static _Thread_local memory_pool_t *thread_pool = NULL;
+static _Thread_local memory_arena_t *thread_arena = NULL;
+
 /**
  * @brief 初始化内存池
  * @param pool 内存池结构体指针
- * @param max_size 内存池中可存储的最大指针数量
+ * @param max_size 最多申请的 slab 字节数，超出后的分配退回 malloc
+ * @return 成功返回 0
  */
-void memory_pool_init(memory_pool_t *pool, size_t max_size) {
-    pool->free_list = calloc(max_size, sizeof(void *));
-    pool->free_count = 0;
+int memory_pool_init(memory_pool_t *pool, size_t max_size) {
+    for (unsigned i = 0; i < MEMORY_POOL_CLASSES; i++) {
+        pool->classes[i].free_list = NULL;
+        atomic_init(&pool->classes[i].remote_free, NULL);
+        pool->classes[i].block_size = (size_t)MEMORY_POOL_MIN_BLOCK << i;
+    }
+    pool->slabs = NULL;
     pool->total_allocated = 0;
     pool->max_size = max_size;
+    return 0;
+}
+
+/* 为一个大小级别申请新的 slab 并切分成空闲块 */
+static bool memory_pool_refill(memory_pool_t *pool, uint32_t size_class) {
+    memory_pool_class_t *cls = &pool->classes[size_class];
+    
+    if (pool->total_allocated + MEMORY_POOL_SLAB_SIZE > pool->max_size) return false;
+    
+    char *slab = malloc(MEMORY_POOL_SLAB_SIZE);
+    if (!slab) return false;
+    
+    /* slab 开头一个块头大小的空间用于链接 slab 链表 */
+    *(void **)slab = pool->slabs;
+    pool->slabs = slab;
+    pool->total_allocated += MEMORY_POOL_SLAB_SIZE;
+    
+    for (char *p = slab + sizeof(memory_pool_header_t);
+         p + cls->block_size <= slab + MEMORY_POOL_SLAB_SIZE; p += cls->block_size) {
+        memory_pool_header_t *hdr = (memory_pool_header_t *)p;
+        hdr->h.pool = pool;
+        hdr->h.size_class = size_class;
+        MEMORY_POOL_NEXT(hdr) = cls->free_list;
+        cls->free_list = hdr;
+    }
+    return true;
 }
 
 /**
  * @brief 从内存池中分配内存
- * @param pool 内存池结构体指针
+ *
+ * 只能由池所属的线程调用。内存不会被清零。pool 为 NULL、请求超过最大级别
+ * 或池已达上限时退回 malloc，释放方式不变。
+ * @param pool 内存池结构体指针，可为 NULL
  * @param size 需要分配的内存大小
  * @return 分配的内存指针，或 NULL (如果分配失败)
  */
 void *memory_pool_alloc(memory_pool_t *pool, size_t size) {
-    if (pool->free_count > 0) {
-        void *ptr = pool->free_list[--pool->free_count];
-        memset(ptr, 0, size);
-        return ptr;
-    }
+    size_t total = size + sizeof(memory_pool_header_t);
     
-    if (pool->total_allocated < pool->max_size) {
-        void *ptr = calloc(1, size);
-        if (ptr) pool->total_allocated++; 
-        return ptr;
+    if (pool && total <= MEMORY_POOL_MAX_BLOCK) {
+        uint32_t size_class = 0;
+        while (((size_t)MEMORY_POOL_MIN_BLOCK << size_class) < total) size_class++;
+        memory_pool_class_t *cls = &pool->classes[size_class];
+        
+        /* 本地空闲块用完时先取回其他线程释放的块，再申请新 slab */
+        if (!cls->free_list) {
+            cls->free_list = atomic_exchange_explicit(&cls->remote_free, NULL, memory_order_acquire);
+        }
+        if (cls->free_list || memory_pool_refill(pool, size_class)) {
+            memory_pool_header_t *hdr = cls->free_list;
+            cls->free_list = MEMORY_POOL_NEXT(hdr);
+            return hdr + 1;
+        }
     }
     
-    return NULL;
+    memory_pool_header_t *hdr = malloc(total);
+    if (!hdr) return NULL;
+    hdr->h.pool = NULL;
+    hdr->h.size_class = MEMORY_POOL_LARGE;
+    return hdr + 1;
 }
 
 /**
- * @brief 释放内存到内存池
- * @param pool 内存池结构体指针
+ * @brief 释放 memory_pool_alloc 分配的内存，可在任意线程调用
  * @param ptr 需要释放的内存指针
  */
-void memory_pool_free(memory_pool_t *pool, void *ptr) {
-    if (ptr && pool->free_count < pool->max_size) {
-        pool->free_list[pool->free_count++] = ptr;
-    } else if (ptr) {
-        free(ptr);
-        pool->total_allocated--;
+void memory_pool_free(void *ptr) {
+    if (!ptr) return;
+    
+    memory_pool_header_t *hdr = (memory_pool_header_t *)ptr - 1;
+    if (hdr->h.size_class == MEMORY_POOL_LARGE) {
+        free(hdr);
+        return;
+    }
+    
+    memory_pool_t *pool = hdr->h.pool;
+    memory_pool_class_t *cls = &pool->classes[hdr->h.size_class];
+    
+    if (pool == thread_pool) {
+        MEMORY_POOL_NEXT(hdr) = cls->free_list;
+        cls->free_list = hdr;
+        return;
     }
+    
+    /* 其他线程的块：压入所属池的回收栈，所属线程一次性取走整个栈，因此没有 ABA 问题 */
+    void *head = atomic_load_explicit(&cls->remote_free, memory_order_relaxed);
+    do {
+        MEMORY_POOL_NEXT(hdr) = head;
+    } while (!atomic_compare_exchange_weak_explicit(&cls->remote_free, &head, hdr,
+                                                    memory_order_release, memory_order_relaxed));
 }
 
 /**
- * @brief 清理内存池，释放所有已分配的内存
+ * @brief 清理内存池，释放所有 slab
+ *
+ * 调用前所有从该池分配的块都必须已经释放。
  * @param pool 内存池结构体指针
  */
 void memory_pool_cleanup(memory_pool_t *pool) {
-    for (size_t i = 0; i < pool->free_count; i++) {
-        free(pool->free_list[i]);
+    while (pool->slabs) {
+        void *next = *(void **)pool->slabs;
+        free(pool->slabs);
+        pool->slabs = next;
+    }
+    
+    for (unsigned i = 0; i < MEMORY_POOL_CLASSES; i++) {
+        pool->classes[i].free_list = NULL;
+        atomic_store_explicit(&pool->classes[i].remote_free, NULL, memory_order_relaxed);
     }
+    pool->total_allocated = 0;
+    
+    if (thread_pool == pool) thread_pool = NULL;
+}
 
-    free(pool->free_list);
+/**
+ * @brief 设置当前线程使用的内存池
+ * @param pool 内存池结构体指针，NULL 表示直接使用 malloc
+ */
+void memory_pool_bind_thread(memory_pool_t *pool) {
+    thread_pool = pool;
+}
 
-    pool->free_count = 0;
-    pool->total_allocated = 0;
+/**
+ * @brief 获取当前线程使用的内存池
+ * @return 内存池结构体指针，未绑定时返回 NULL
+ */
+memory_pool_t *memory_pool_thread(void) {
+    return thread_pool;
+}
+
+/* 临时分配区的分配对齐 */
+#define MEMORY_ARENA_ALIGN (sizeof(max_align_t))
+
+/**
+ * @brief 初始化临时分配区
+ * @param arena 分配区结构体指针
+ * @param size 初始容量
+ * @return 成功返回 0，内存分配失败返回 -1
+ */
+int memory_arena_init(memory_arena_t *arena, size_t size) {
+    arena->base = malloc(size);
+    if (!arena->base) return -1;
+    
+    arena->size = size;
+    arena->used = 0;
+    arena->overflow = NULL;
+    arena->overflow_bytes = 0;
+    return 0;
+}
+
+/**
+ * @brief 从临时分配区分配内存，下一次复位之前有效
+ *
+ * 容量不足时临时追加一块内存，复位时释放并据此扩大分配区，
+ * 使之后的每轮循环不再溢出。
+ * @param arena 分配区结构体指针
+ * @param size 需要分配的内存大小
+ * @return 分配的内存指针，或 NULL (如果分配失败)
+ */
+void *memory_arena_alloc(memory_arena_t *arena, size_t size) {
+    size = (size + MEMORY_ARENA_ALIGN - 1) & ~(MEMORY_ARENA_ALIGN - 1);
+    
+    if (size <= arena->size - arena->used) {
+        void *ptr = arena->base + arena->used;
+        arena->used += size;
+        return ptr;
+    }
+    
+    memory_pool_header_t *chunk = malloc(sizeof(memory_pool_header_t) + size);
+    if (!chunk) return NULL;
+    
+    /* 追加块开头一个块头大小的空间用于链接 */
+    *(void **)chunk = arena->overflow;
+    arena->overflow = chunk;
+    arena->overflow_bytes += size;
+    return chunk + 1;
+}
+
+/* 释放本轮追加的块 */
+static void memory_arena_free_overflow(memory_arena_t *arena) {
+    while (arena->overflow) {
+        void *next = *(void **)arena->overflow;
+        free(arena->overflow);
+        arena->overflow = next;
+    }
+}
+
+/**
+ * @brief 复位临时分配区，之前分配的内存全部失效
+ * @param arena 分配区结构体指针
+ */
+void memory_arena_reset(memory_arena_t *arena) {
+    arena->used = 0;
+    if (!arena->overflow) return;
+    
+    memory_arena_free_overflow(arena);
+    
+    /* 按本轮的峰值扩大分配区 */
+    size_t size = arena->size + arena->overflow_bytes;
+    if (size < arena->size * 2) size = arena->size * 2;
+    if (size > MEMORY_ARENA_MAX_SIZE) size = MEMORY_ARENA_MAX_SIZE;
+    arena->overflow_bytes = 0;
+    
+    if (size > arena->size) {
+        char *base = malloc(size);
+        if (base) {
+            free(arena->base);
+            arena->base = base;
+            arena->size = size;
+        }
+    }
+}
+
+/**
+ * @brief 释放临时分配区
+ * @param arena 分配区结构体指针
+ */
+void memory_arena_cleanup(memory_arena_t *arena) {
+    memory_arena_free_overflow(arena);
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+    arena->overflow_bytes = 0;
+    
+    if (thread_arena == arena) thread_arena = NULL;
+}
+
+/**
+ * @brief 设置当前线程使用的临时分配区
+ * @param arena 分配区结构体指针，NULL 表示临时内存直接使用 malloc
+ */
+void memory_arena_bind_thread(memory_arena_t *arena) {
+    thread_arena = arena;
+}
+
+/**
+ * @brief 获取当前线程使用的临时分配区
+ * @return 分配区结构体指针，未绑定时返回 NULL
+ */
+memory_arena_t *memory_arena_thread(void) {
+    return thread_arena;
 }
 